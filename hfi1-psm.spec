@@ -136,6 +136,8 @@ rm -rf $RPM_BUILD_ROOT
 /usr/include/psm2.h
 /usr/include/psm2_mq.h
 /usr/include/psm2_am.h
+/usr/include/psm2_rma.h
+/usr/include/psm2_coll.h
 # The following files were part of the devel-noship and moved to devel:
 /usr/include/hfi1diag/ptl_ips/ipserror.h
 /usr/include/hfi1diag/linux-x86_64/bit_ops.h
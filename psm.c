@@ -266,8 +266,6 @@ psm2_error_t __psm2_finalize(void)
 		ep = psmi_opened_endpoint;
 	}
 
-	psmi_epid_fini();
-
 	psmi_faultinj_fini();
 
 	/* De-allocate memory for any allocated space to store hostnames */
@@ -276,6 +274,8 @@ psm2_error_t __psm2_finalize(void)
 		psmi_free(hostname);
 	psmi_epid_itor_fini(&itor);
 
+	psmi_epid_fini();
+
 	char buf[128];
 	psmi_sysbuf_getinfo(buf, sizeof(buf));
 	_HFI_VDBG("%s", buf);
@@ -286,6 +286,55 @@ psm2_am_request_short(psm2_epaddr_t epaddr, psm2_handler_t handler,
 		     psm2_am_completion_fn_t completion_fn,
 		     void *completion_ctxt);
 
+/** @brief Generate a long AM request.
+ *
+ * This function transfers a payload of up to max_request_long bytes from
+ * local memory to an address in the PSM2 process associated with the
+ * specified end-point address, and then calls an AM handler function in that
+ * process.  The handler is passed the arguments and, as its payload, the
+ * destination buffer holding the transferred data.  The number of arguments
+ * is limited to max_nargs.
+ *
+ * Unlike psm2_am_request_short(), the payload is not fragmented into short
+ * messages.  It is moved in bulk, by the kernel assisted copy between
+ * processes on the same node and by the rendezvous protocol, using expected
+ * receives where available, across the fabric.  Since the transfer is
+ * driven by the target, the handler of a long request may run after the
+ * handlers of short requests issued to the same target after it.
+ *
+ * The destination buffer must be valid in the target process and must not be
+ * touched there until the handler runs.  The source buffer must not be
+ * modified or freed until the completion function is called, which happens
+ * locally once the payload has been delivered.  If no completion function is
+ * given, the caller must learn of completion by other means, for instance
+ * through a reply generated by the handler.
+ *
+ * The allowed flags are PSM2_AM_FLAG_NONE and PSM2_AM_FLAG_NOREPLY, with the
+ * same meaning as for psm2_am_request_short().
+ *
+ * @param[in] epaddr End-point address to run handler on
+ * @param[in] handler Index of handler to run
+ * @param[in] args Array of arguments to be provided to the handler
+ * @param[in] nargs Number of arguments to be provided to the handler
+ * @param[in] src Pointer to the payload to be transferred
+ * @param[in] len Length of the payload in bytes
+ * @param[in] dest Address of the payload in the target process
+ * @param[in] flags These are PSM2 AM flags and may be combined together with
+ *                  bitwise-or
+ * @param[in] completion_fn The completion function to called locally when
+ *                          the payload has been delivered
+ * @param[in] completion_ctxt User-provided context pointer to be passed to the
+ *                            completion handler
+ *
+ * @returns PSM2_OK indicates success.
+ */
+psm2_error_t
+psm2_am_request_long(psm2_epaddr_t epaddr, psm2_handler_t handler,
+		     psm2_amarg_t *args, int nargs, void *src,
+		     size_t len, void *dest, int flags,
+		     psm2_am_completion_fn_t completion_fn,
+		     void *completion_ctxt);
+
 /** @brief Generate an AM reply.
  *
  * This function may only be called from an AM handler called due to an AM
@@ -345,6 +394,41 @@ psm2_am_reply_short(psm2_am_token_t token, psm2_handler_t handler,
 		   psm2_am_completion_fn_t completion_fn,
 		   void *completion_ctxt);
 
+/** @brief Generate a long AM reply.
+ *
+ * This function is to psm2_am_reply_short() what psm2_am_request_long() is to
+ * psm2_am_request_short().  It may only be called from the handler of an AM
+ * request, at most once and in place of psm2_am_reply_short(), and transfers
+ * a payload of up to max_request_long bytes to dest in the process that
+ * issued the request before running the reply handler there.
+ *
+ * The source buffer must not be modified or freed until the completion
+ * function is called.  The allowed flags are PSM2_AM_FLAG_NONE.
+ *
+ * @param[in] token Token value provided to the AM handler that is generating
+ *                  the reply.
+ * @param[in] handler Index of handler to run
+ * @param[in] args Array of arguments to be provided to the handler
+ * @param[in] nargs Number of arguments to be provided to the handler
+ * @param[in] src Pointer to the payload to be transferred
+ * @param[in] len Length of the payload in bytes
+ * @param[in] dest Address of the payload in the requesting process
+ * @param[in] flags These are PSM2 AM flags and may be combined together with
+ *                  bitwise-or
+ * @param[in] completion_fn The completion function to called locally when
+ *                          the payload has been delivered
+ * @param[in] completion_ctxt User-provided context pointer to be passed to the
+ *                            completion handler
+ *
+ * @returns PSM2_OK indicates success.
+ */
+psm2_error_t
+psm2_am_reply_long(psm2_am_token_t token, psm2_handler_t handler,
+		   psm2_amarg_t *args, int nargs, void *src,
+		   size_t len, void *dest, int flags,
+		   psm2_am_completion_fn_t completion_fn,
+		   void *completion_ctxt);
+
 /** @brief Return the source end-point address for a token.
  *
  * This function is used to obtain the epaddr object representing the message
@@ -380,6 +464,8 @@ struct psm2_am_parameters {
 	uint32_t max_request_short;
 	/** Maximum number of bytes in a reply payload. */
 	uint32_t max_reply_short;
+	/** Maximum number of bytes in a long request payload. */
+	uint32_t max_request_long;
 };
 
 /** @brief Get the AM parameter values
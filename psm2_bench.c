@@ -0,0 +1,828 @@
+/*
+
+  This file is provided under a dual BSD/GPLv2 license.  When using or
+  redistributing this file, you may do so under either license.
+
+  GPL LICENSE SUMMARY
+
+  Copyright(c) 2015 Intel Corporation.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of version 2 of the GNU General Public License as
+  published by the Free Software Foundation.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  Contact Information:
+  Intel Corporation, www.intel.com
+
+  BSD LICENSE
+
+  Copyright(c) 2015 Intel Corporation.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the
+      distribution.
+    * Neither the name of Intel Corporation nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+
+/*
+ * psm2_bench: microbenchmarks over the public PSM2 API.  Each test runs in
+ * freshly forked processes that pick their transport through PSM2_DEVICES:
+ * "self" runs one process that sends to itself, "shm" and "hfi" run pairs of
+ * processes on this node.  Results go out as one JSON document so runs of
+ * different library builds can be compared by a script.
+ *
+ *   psm2_bench [-d self,shm,hfi] [-t latency,bw,msgrate,unexpected,am]
+ *              [-m max_size] [-n iterations] [-w window] [-p pairs]
+ *              [-q max_depth] [-T timeout] [-o out.json]
+ *
+ * latency	MQ ping-pong, one way latency per message size
+ * bw		MQ streaming, window messages in flight per round trip
+ * msgrate	8 byte MQ streaming from several pairs at once, summed
+ * unexpected	cost per receive posted against a queue of that many
+ *		unexpected messages, matched in reverse order
+ * am		AM short request/reply ping-pong, one way latency
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "psm2.h"
+#include "psm2_mq.h"
+#include "psm2_am.h"
+
+#define TEST_LATENCY	0
+#define TEST_BW		1
+#define TEST_MSGRATE	2
+#define TEST_UNEXPECTED	3
+#define TEST_AM		4
+#define NUM_TESTS	5
+
+#define DEV_SELF	0
+#define DEV_SHM		1
+#define DEV_HFI		2
+#define NUM_DEVS	3
+
+#define TAG_DATA	1
+#define TAG_ACK		2
+#define TAG_UNEXP	(1ULL << 32)
+
+#define MIN_ITERS	10
+#define POLLS_BEFORE_YIELD 250	/* as PSM's own blocking calls do */
+#define MSGRATE_SIZE	8
+#define UNEXP_SIZE	8
+
+static const char *test_name[NUM_TESTS] = {
+	"latency", "bw", "msgrate", "unexpected", "am"
+};
+static const char *dev_name[NUM_DEVS] = { "self", "shm", "hfi" };
+static const char *dev_env[NUM_DEVS] = { "self", "self,shm", "self,hfi" };
+
+static struct {
+	size_t max_size;
+	int iters;
+	int window;
+	int pairs;
+	int max_depth;
+	int timeout;
+} opt = {
+	.max_size = 1 << 22,
+	.iters = 1000,
+	.window = 64,
+	.pairs = 4,
+	.max_depth = 4096,
+	.timeout = 60,
+};
+
+/* One benchmark process */
+struct bench {
+	int rank;		/* 0 sends first, 1 answers */
+	int loopback;		/* self: one process plays both ranks */
+	int sync_out;		/* pipes to and from the partner */
+	int sync_in;
+	int res_fd;		/* result lines for the parent */
+	psm2_ep_t ep;
+	psm2_mq_t mq;
+	psm2_epaddr_t peer;
+	int am_idx[2];
+	char *sbuf;
+	char *rbuf;
+};
+
+static volatile int am_replies;
+static volatile int am_requests;
+
+static double now_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/* Fewer rounds for larger messages so every size takes similar time */
+static int iters_for(size_t size)
+{
+	int n = (int)((uint64_t) opt.iters * 8192 /
+		      (size > 8192 ? size : 8192));
+
+	return n < MIN_ITERS ? MIN_ITERS : n;
+}
+
+static void report(struct bench *b, uint64_t size, int iters, double value)
+{
+	dprintf(b->res_fd, "%" PRIu64 " %d %.6f\n", size, iters, value);
+}
+
+static void fail(struct bench *b, const char *what, psm2_error_t err)
+{
+	dprintf(b->res_fd, "error %s: %s\n", what, psm2_error_get_string(err));
+	_exit(1);
+}
+
+/* Give the CPU away after a run of idle polls, so that a partner sharing it
+ * gets to answer */
+static void poll_idle(struct bench *b, int *spins)
+{
+	if (psm2_poll(b->ep) == PSM2_OK_NO_PROGRESS &&
+	    ++*spins == POLLS_BEFORE_YIELD) {
+		sched_yield();
+		*spins = 0;
+	}
+}
+
+/* Wait for the partner while keeping this endpoint progressing, the
+ * partner may need it to finish what it is doing */
+static void sync_partner(struct bench *b)
+{
+	int spins = 0;
+	char c = 0;
+	ssize_t n;
+
+	if (b->loopback)
+		return;
+	if (write(b->sync_out, &c, 1) != 1)
+		_exit(1);
+	while ((n = read(b->sync_in, &c, 1)) != 1) {
+		if (n == 0 || errno != EAGAIN)
+			_exit(1);
+		poll_idle(b, &spins);
+	}
+}
+
+static void mq_wait(struct bench *b, psm2_mq_req_t *req)
+{
+	psm2_error_t err = psm2_mq_wait(req, NULL);
+
+	if (err != PSM2_OK)
+		fail(b, "psm2_mq_wait", err);
+}
+
+static void mq_send(struct bench *b, uint64_t tag, size_t len,
+		    psm2_mq_req_t *req)
+{
+	psm2_error_t err = psm2_mq_isend(b->mq, b->peer, 0, tag, b->sbuf, len,
+					 NULL, req);
+
+	if (err != PSM2_OK)
+		fail(b, "psm2_mq_isend", err);
+}
+
+static void mq_recv(struct bench *b, uint64_t tag, size_t len,
+		    psm2_mq_req_t *req)
+{
+	psm2_error_t err = psm2_mq_irecv(b->mq, tag, ~0ULL, 0, b->rbuf, len,
+					 NULL, req);
+
+	if (err != PSM2_OK)
+		fail(b, "psm2_mq_irecv", err);
+}
+
+static void run_latency(struct bench *b)
+{
+	psm2_mq_req_t sreq, rreq;
+	size_t size;
+	int i, iters, warm;
+	double t0 = 0;
+
+	for (size = 0; size <= opt.max_size; size = size ? size << 1 : 1) {
+		iters = iters_for(size);
+		warm = iters / 10 + 1;
+		for (i = 0; i < warm + iters; i++) {
+			if (i == warm)
+				t0 = now_usec();
+			if (b->loopback) {
+				mq_recv(b, TAG_DATA, size, &rreq);
+				mq_send(b, TAG_DATA, size, &sreq);
+				mq_wait(b, &sreq);
+				mq_wait(b, &rreq);
+			} else if (b->rank == 0) {
+				mq_send(b, TAG_DATA, size, &sreq);
+				mq_wait(b, &sreq);
+				mq_recv(b, TAG_DATA, size, &rreq);
+				mq_wait(b, &rreq);
+			} else {
+				mq_recv(b, TAG_DATA, size, &rreq);
+				mq_wait(b, &rreq);
+				mq_send(b, TAG_DATA, size, &sreq);
+				mq_wait(b, &sreq);
+			}
+		}
+		if (b->rank == 0)
+			report(b, size, iters, (now_usec() - t0) / iters /
+			       (b->loopback ? 1 : 2));
+	}
+}
+
+/* iters rounds of window messages, each round closed by an ack from the
+ * receiver; returns the time the measured rounds took */
+static double stream(struct bench *b, size_t size, int iters)
+{
+	psm2_mq_req_t *reqs, ack;
+	int i, j, warm = iters / 10 + 1;
+	double t0 = 0;
+
+	reqs = calloc(opt.window, sizeof(*reqs));
+	if (reqs == NULL)
+		fail(b, "calloc", PSM2_NO_MEMORY);
+
+	for (i = 0; i < warm + iters; i++) {
+		if (i == warm)
+			t0 = now_usec();
+		if (b->loopback) {
+			for (j = 0; j < opt.window; j++)
+				mq_recv(b, TAG_DATA, size, &reqs[j]);
+			for (j = 0; j < opt.window; j++) {
+				mq_send(b, TAG_DATA, size, &ack);
+				mq_wait(b, &ack);
+			}
+			for (j = 0; j < opt.window; j++)
+				mq_wait(b, &reqs[j]);
+		} else if (b->rank == 0) {
+			for (j = 0; j < opt.window; j++)
+				mq_send(b, TAG_DATA, size, &reqs[j]);
+			for (j = 0; j < opt.window; j++)
+				mq_wait(b, &reqs[j]);
+			mq_recv(b, TAG_ACK, 0, &ack);
+			mq_wait(b, &ack);
+		} else {
+			for (j = 0; j < opt.window; j++)
+				mq_recv(b, TAG_DATA, size, &reqs[j]);
+			for (j = 0; j < opt.window; j++)
+				mq_wait(b, &reqs[j]);
+			mq_send(b, TAG_ACK, 0, &ack);
+			mq_wait(b, &ack);
+		}
+	}
+	free(reqs);
+	return now_usec() - t0;
+}
+
+static void run_bw(struct bench *b)
+{
+	size_t size;
+	int iters;
+	double usec;
+
+	for (size = 1; size <= opt.max_size; size <<= 1) {
+		iters = iters_for(size);
+		usec = stream(b, size, iters);
+		if (b->rank == 0)
+			report(b, size, iters, (double)size * opt.window *
+			       iters / usec);
+	}
+}
+
+static void run_msgrate(struct bench *b)
+{
+	int iters = iters_for(MSGRATE_SIZE);
+	double usec = stream(b, MSGRATE_SIZE, iters);
+
+	if (b->rank == 0)
+		report(b, MSGRATE_SIZE, iters, (double)opt.window * iters *
+		       1e6 / usec);
+}
+
+/*
+ * The sender queues depth messages before the receiver posts anything, the
+ * receiver waits until the last one has arrived and then times receives
+ * posted newest tag first, so every match walks the whole queue unless the
+ * MQ indexes it.
+ */
+static void run_unexpected(struct bench *b)
+{
+	psm2_mq_req_t *reqs;
+	psm2_mq_status_t status;
+	psm2_error_t err;
+	int depth, rep, reps, i, spins;
+	double usec;
+
+	reqs = calloc(opt.max_depth, sizeof(*reqs));
+	if (reqs == NULL)
+		fail(b, "calloc", PSM2_NO_MEMORY);
+
+	for (depth = 1; depth <= opt.max_depth; depth <<= 2) {
+		reps = 16384 / depth;
+		if (reps < MIN_ITERS)
+			reps = MIN_ITERS;
+		usec = 0;
+		for (rep = 0; rep < reps; rep++) {
+			if (b->loopback || b->rank == 0) {
+				for (i = 0; i < depth; i++) {
+					mq_send(b, TAG_UNEXP | i, UNEXP_SIZE,
+						&reqs[i]);
+					mq_wait(b, &reqs[i]);
+				}
+			}
+			sync_partner(b);
+			if (b->loopback || b->rank == 1) {
+				spins = 0;
+				while ((err = psm2_mq_iprobe(b->mq,
+						TAG_UNEXP | (depth - 1), ~0ULL,
+						&status)) != PSM2_OK) {
+					if (err != PSM2_MQ_NO_COMPLETIONS)
+						fail(b, "psm2_mq_iprobe", err);
+					if (++spins == POLLS_BEFORE_YIELD) {
+						sched_yield();
+						spins = 0;
+					}
+				}
+				usec -= now_usec();
+				for (i = depth - 1; i >= 0; i--) {
+					mq_recv(b, TAG_UNEXP | i, UNEXP_SIZE,
+						&reqs[i]);
+					mq_wait(b, &reqs[i]);
+				}
+				usec += now_usec();
+			}
+			sync_partner(b);
+		}
+		if (b->loopback || b->rank == 1)
+			report(b, depth, reps, usec * 1e3 / reps / depth);
+	}
+	free(reqs);
+}
+
+static int am_request_handler(psm2_am_token_t token, psm2_amarg_t *args,
+			      int nargs, void *src, uint32_t len)
+{
+	am_requests++;
+	psm2_am_reply_short(token, args[0].u32w0, NULL, 0, src, len, 0,
+			    NULL, NULL);
+	return 0;
+}
+
+static int am_reply_handler(psm2_am_token_t token, psm2_amarg_t *args,
+			    int nargs, void *src, uint32_t len)
+{
+	am_replies++;
+	return 0;
+}
+
+static void run_am(struct bench *b)
+{
+	struct psm2_am_parameters params;
+	psm2_amarg_t arg;
+	psm2_error_t err;
+	size_t size, max, out;
+	int i, iters, warm, spins = 0;
+	double t0 = 0;
+
+	err = psm2_am_get_parameters(b->ep, &params, sizeof(params), &out);
+	if (err != PSM2_OK)
+		fail(b, "psm2_am_get_parameters", err);
+	max = params.max_request_short < params.max_reply_short ?
+	    params.max_request_short : params.max_reply_short;
+	if (max > opt.max_size)
+		max = opt.max_size;
+
+	arg.u64 = 0;
+	arg.u32w0 = b->am_idx[1];
+	for (size = 0; size <= max; size = size ? size << 1 : 1) {
+		iters = iters_for(size);
+		warm = iters / 10 + 1;
+		if (b->rank == 1) {
+			/* Answer from the handler until the sender is done */
+			while (am_requests < warm + iters)
+				poll_idle(b, &spins);
+			am_requests = 0;
+			continue;
+		}
+		for (i = 0; i < warm + iters; i++) {
+			if (i == warm)
+				t0 = now_usec();
+			am_replies = 0;
+			err = psm2_am_request_short(b->peer, b->am_idx[0],
+						    &arg, 1, b->sbuf, size, 0,
+						    NULL, NULL);
+			if (err != PSM2_OK)
+				fail(b, "psm2_am_request_short", err);
+			while (am_replies == 0)
+				poll_idle(b, &spins);
+		}
+		report(b, size, iters, (now_usec() - t0) / iters / 2);
+		if (b->loopback)
+			am_requests = 0;
+	}
+}
+
+static void bench_setup(struct bench *b, int dev)
+{
+	struct psm2_ep_open_opts opts;
+	psm2_am_handler_fn_t handlers[2] = {
+		am_request_handler, am_reply_handler
+	};
+	psm2_uuid_t uuid;
+	psm2_epid_t epid, peer_epid;
+	psm2_error_t err, conn_err;
+	int ver_major = PSM2_VERNO_MAJOR, ver_minor = PSM2_VERNO_MINOR;
+	size_t buflen = opt.max_size > 64 ? opt.max_size : 64;
+
+	setenv("PSM2_DEVICES", dev_env[dev], 1);
+	if ((err = psm2_init(&ver_major, &ver_minor)))
+		fail(b, "psm2_init", err);
+
+	/* Both ranks of a pair must present the same job key, rank 0 made
+	 * it and sent it ahead */
+	if (b->loopback)
+		psm2_uuid_generate(uuid);
+	else if (b->rank == 0) {
+		psm2_uuid_generate(uuid);
+		if (write(b->sync_out, uuid, sizeof(uuid)) != sizeof(uuid))
+			_exit(1);
+	} else if (read(b->sync_in, uuid, sizeof(uuid)) != sizeof(uuid))
+		_exit(1);
+
+	psm2_ep_open_opts_get_defaults(&opts);
+	if ((err = psm2_ep_open(uuid, &opts, &b->ep, &epid)))
+		fail(b, "psm2_ep_open", err);
+
+	peer_epid = epid;
+	if (!b->loopback) {
+		if (write(b->sync_out, &epid, sizeof(epid)) != sizeof(epid) ||
+		    read(b->sync_in, &peer_epid, sizeof(peer_epid)) !=
+		    sizeof(peer_epid))
+			_exit(1);
+		fcntl(b->sync_in, F_SETFL, O_NONBLOCK);
+	}
+	if ((err = psm2_ep_connect(b->ep, 1, &peer_epid, NULL, &conn_err,
+				   &b->peer, (int64_t) opt.timeout * 1000000000LL)))
+		fail(b, "psm2_ep_connect", err);
+	if ((err = psm2_mq_init(b->ep, PSM2_MQ_ORDERMASK_ALL, NULL, 0, &b->mq)))
+		fail(b, "psm2_mq_init", err);
+	if ((err = psm2_am_register_handlers(b->ep, handlers, 2, b->am_idx)))
+		fail(b, "psm2_am_register_handlers", err);
+
+	b->sbuf = malloc(buflen);
+	b->rbuf = malloc(buflen);
+	if (b->sbuf == NULL || b->rbuf == NULL)
+		fail(b, "malloc", PSM2_NO_MEMORY);
+	memset(b->sbuf, 'a', buflen);
+}
+
+static void bench_teardown(struct bench *b)
+{
+	sync_partner(b);
+	psm2_mq_finalize(b->mq);
+	psm2_ep_close(b->ep, PSM2_EP_CLOSE_GRACEFUL,
+		      (int64_t) opt.timeout * 1000000000LL);
+	psm2_finalize();
+}
+
+static void child_main(struct bench *b, int dev, int test, int ready_fd,
+		       int go_fd)
+{
+	char c = 0;
+
+	alarm(opt.timeout);
+	bench_setup(b, dev);
+
+	/* Start all pairs of a test together */
+	sync_partner(b);
+	if (write(ready_fd, &c, 1) != 1 || read(go_fd, &c, 1) != 1)
+		_exit(1);
+
+	switch (test) {
+	case TEST_LATENCY:
+		run_latency(b);
+		break;
+	case TEST_BW:
+		run_bw(b);
+		break;
+	case TEST_MSGRATE:
+		run_msgrate(b);
+		break;
+	case TEST_UNEXPECTED:
+		run_unexpected(b);
+		break;
+	case TEST_AM:
+		run_am(b);
+		break;
+	}
+
+	bench_teardown(b);
+	_exit(0);
+}
+
+static FILE *out;
+static int num_records;
+
+static void record_begin(int dev, int test)
+{
+	fprintf(out, "%s\n    { \"test\": \"%s\", \"devices\": \"%s\"",
+		num_records++ ? "," : "", test_name[test], dev_name[dev]);
+}
+
+static void record_error(int dev, int test, char *msg)
+{
+	char *p;
+
+	for (p = msg; *p; p++)
+		if (*p == '"' || *p == '\\' || (unsigned char)*p < ' ')
+			*p = '\'';
+	record_begin(dev, test);
+	fprintf(out, ", \"error\": \"%s\" }", msg);
+}
+
+static void record_result(int dev, int test, uint64_t size, int iters,
+			  double value)
+{
+	record_begin(dev, test);
+	switch (test) {
+	case TEST_LATENCY:
+	case TEST_AM:
+		fprintf(out, ", \"size\": %" PRIu64 ", \"iterations\": %d"
+			", \"usec\": %.3f }", size, iters, value);
+		break;
+	case TEST_BW:
+		fprintf(out, ", \"size\": %" PRIu64 ", \"iterations\": %d"
+			", \"mb_per_sec\": %.2f }", size, iters, value);
+		break;
+	case TEST_MSGRATE:
+		fprintf(out, ", \"size\": %" PRIu64 ", \"pairs\": %d"
+			", \"msgs_per_sec\": %.0f }", size, iters, value);
+		break;
+	case TEST_UNEXPECTED:
+		fprintf(out, ", \"depth\": %" PRIu64 ", \"iterations\": %d"
+			", \"nsec_per_match\": %.1f }", size, iters, value);
+		break;
+	}
+	fflush(out);
+}
+
+/* Fork the processes of one test and turn what they report into records */
+static void run_test(int dev, int test)
+{
+	int pairs = test == TEST_MSGRATE ? opt.pairs : 1;
+	int nprocs = dev == DEV_SELF ? pairs : 2 * pairs;
+	int res[2], ready[2], go[2], a[2], b[2];
+	int p, r, status, failed = 0, nlines = 0;
+	double rate = 0;
+	char line[512], c = 0;
+	uint64_t size;
+	int iters;
+	double value;
+	FILE *res_in;
+	pid_t pid;
+
+	if (pipe(res) || pipe(ready) || pipe(go)) {
+		perror("pipe");
+		exit(EXIT_FAILURE);
+	}
+
+	for (p = 0; p < pairs; p++) {
+		if (pipe(a) || pipe(b)) {
+			perror("pipe");
+			exit(EXIT_FAILURE);
+		}
+		for (r = 0; r < (dev == DEV_SELF ? 1 : 2); r++) {
+			pid = fork();
+			if (pid < 0) {
+				perror("fork");
+				exit(EXIT_FAILURE);
+			}
+			if (pid == 0) {
+				struct bench bench = {
+					.rank = r,
+					.loopback = dev == DEV_SELF,
+					.sync_out = r ? b[1] : a[1],
+					.sync_in = r ? a[0] : b[0],
+					.res_fd = res[1],
+				};
+				close(res[0]);
+				close(ready[0]);
+				close(go[1]);
+				close(r ? a[1] : a[0]);
+				close(r ? b[0] : b[1]);
+				child_main(&bench, dev, test, ready[1], go[0]);
+			}
+		}
+		close(a[0]);
+		close(a[1]);
+		close(b[0]);
+		close(b[1]);
+	}
+	close(res[1]);
+	close(ready[1]);
+	close(go[0]);
+
+	/* Release everyone once every process is connected, a process that
+	 * failed to set up closes its end early */
+	for (p = 0; p < nprocs; p++)
+		if (read(ready[0], line, 1) != 1)
+			break;
+	for (p = 0; p < nprocs; p++)
+		if (write(go[1], &c, 1) != 1)
+			break;
+	close(ready[0]);
+	close(go[1]);
+
+	res_in = fdopen(res[0], "r");
+	while (fgets(line, sizeof(line), res_in) != NULL) {
+		line[strcspn(line, "\n")] = '\0';
+		if (strncmp(line, "error ", 6) == 0) {
+			record_error(dev, test, line + 6);
+			failed = 1;
+		} else if (sscanf(line, "%" SCNu64 " %d %lf", &size, &iters,
+				  &value) == 3) {
+			nlines++;
+			if (test == TEST_MSGRATE)
+				rate += value;
+			else
+				record_result(dev, test, size, iters, value);
+		}
+	}
+	fclose(res_in);
+
+	while ((pid = wait(&status)) > 0) {
+		if (!failed && !(WIFEXITED(status) &&
+				 WEXITSTATUS(status) == 0)) {
+			snprintf(line, sizeof(line), WIFSIGNALED(status) &&
+				 WTERMSIG(status) == SIGALRM ?
+				 "timed out after %d seconds" :
+				 "benchmark process failed", opt.timeout);
+			record_error(dev, test, line);
+			failed = 1;
+		}
+	}
+
+	if (test == TEST_MSGRATE && !failed && nlines == pairs)
+		record_result(dev, test, MSGRATE_SIZE, pairs, rate);
+}
+
+/* Turn a comma separated list of names into a mask */
+static unsigned parse_list(const char *arg, const char **names, int num,
+			   const char *what)
+{
+	char *copy = strdup(arg), *tok, *save = NULL;
+	unsigned mask = 0;
+	int i;
+
+	for (tok = strtok_r(copy, ",", &save); tok != NULL;
+	     tok = strtok_r(NULL, ",", &save)) {
+		for (i = 0; i < num; i++)
+			if (strcmp(tok, names[i]) == 0)
+				break;
+		if (i == num) {
+			fprintf(stderr, "unknown %s '%s'\n", what, tok);
+			exit(EXIT_FAILURE);
+		}
+		mask |= 1U << i;
+	}
+	free(copy);
+	return mask;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-d devices] [-t tests] [-m max_size] [-n iterations]\n"
+		"          [-w window] [-p pairs] [-q max_depth] [-T timeout]"
+		" [-o out.json]\n"
+		"  -d  any of self,shm,hfi (default self,shm)\n"
+		"  -t  any of latency,bw,msgrate,unexpected,am (default all)\n"
+		"  -m  largest message size (default %zu)\n"
+		"  -n  iterations for messages up to 8KB (default %d)\n"
+		"  -w  messages in flight for bw and msgrate (default %d)\n"
+		"  -p  pairs of processes for msgrate (default %d)\n"
+		"  -q  deepest unexpected queue (default %d)\n"
+		"  -T  seconds before a test is abandoned (default %d)\n",
+		prog, opt.max_size, opt.iters, opt.window, opt.pairs,
+		opt.max_depth, opt.timeout);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned devs = (1U << DEV_SELF) | (1U << DEV_SHM);
+	unsigned tests = (1U << NUM_TESTS) - 1;
+	const char *out_path = NULL;
+	char host[256];
+	int dev, test, c;
+
+	while ((c = getopt(argc, argv, "d:t:m:n:w:p:q:T:o:")) != -1) {
+		switch (c) {
+		case 'd':
+			devs = parse_list(optarg, dev_name, NUM_DEVS, "device");
+			break;
+		case 't':
+			tests = parse_list(optarg, test_name, NUM_TESTS, "test");
+			break;
+		case 'm':
+			opt.max_size = strtoull(optarg, NULL, 0);
+			break;
+		case 'n':
+			opt.iters = atoi(optarg);
+			break;
+		case 'w':
+			opt.window = atoi(optarg);
+			break;
+		case 'p':
+			opt.pairs = atoi(optarg);
+			break;
+		case 'q':
+			opt.max_depth = atoi(optarg);
+			break;
+		case 'T':
+			opt.timeout = atoi(optarg);
+			break;
+		case 'o':
+			out_path = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc || opt.iters <= 0 || opt.window <= 0 ||
+	    opt.pairs <= 0 || opt.max_depth <= 0 || opt.timeout <= 0)
+		usage(argv[0]);
+
+	out = stdout;
+	if (out_path != NULL && (out = fopen(out_path, "w")) == NULL) {
+		perror(out_path);
+		return EXIT_FAILURE;
+	}
+	/* Children inherit the stream, don't let them flush its buffer */
+	fflush(out);
+	/* Processes that failed to start close their pipes, that is reported
+	 * from their exit status */
+	signal(SIGPIPE, SIG_IGN);
+
+	if (gethostname(host, sizeof(host)) != 0)
+		strcpy(host, "unknown");
+	host[sizeof(host) - 1] = '\0';
+
+	fprintf(out, "{\n  \"benchmark\": \"psm2_bench\",\n"
+		"  \"api_version\": \"%d.%d\",\n  \"host\": \"%s\",\n"
+		"  \"time\": %ld,\n  \"max_size\": %zu,\n"
+		"  \"iterations\": %d,\n  \"window\": %d,\n"
+		"  \"results\": [", PSM2_VERNO_MAJOR, PSM2_VERNO_MINOR, host,
+		(long)time(NULL), opt.max_size, opt.iters, opt.window);
+	fflush(out);
+
+	for (dev = 0; dev < NUM_DEVS; dev++)
+		for (test = 0; test < NUM_TESTS; test++)
+			if ((devs & (1U << dev)) && (tests & (1U << test)))
+				run_test(dev, test);
+
+	fprintf(out, "\n  ]\n}\n");
+	if (out != stdout)
+		fclose(out);
+	return 0;
+}
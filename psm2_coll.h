@@ -0,0 +1,245 @@
+/*
+
+  This file is provided under a dual BSD/GPLv2 license.  When using or
+  redistributing this file, you may do so under either license.
+
+  GPL LICENSE SUMMARY
+
+  Copyright(c) 2015 Intel Corporation.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of version 2 of the GNU General Public License as
+  published by the Free Software Foundation.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  Contact Information:
+  Intel Corporation, www.intel.com
+
+  BSD LICENSE
+
+  Copyright(c) 2015 Intel Corporation.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the
+      distribution.
+    * Neither the name of Intel Corporation nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef PSM2_COLL_H
+#define PSM2_COLL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <psm2.h>
+#include <psm2_mq.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*!
+ * @file psm2_coll.h
+ * @brief PSM2 node-local collectives.
+ *
+ * @page psm2_coll Node-local Collective Interface
+ *
+ * A collective group is a set of processes on the same node, each with its
+ * own end-point, that take part in barriers, broadcasts and reductions
+ * together.  Members share a dedicated memory region, mapped when the group
+ * is created, and synchronize through flags in it without going through
+ * point-to-point messaging.
+ *
+ * Barriers use a dissemination schedule.  Broadcasts are pipelined through
+ * the root's slot of the region, which every member copies from.  Reductions
+ * are split: each member posts its contribution, reduces an equal share of
+ * the elements across all contributions with vector instructions, and then
+ * collects every share of the result.
+ *
+ * Groups spanning several nodes are hierarchical: the members on each node
+ * form a node-local group as above, and the member of rank 0 on each node,
+ * its leader, talks to the other nodes' leaders through an MQ.  A
+ * collective first runs within every node, then between the leaders with
+ * binomial trees or a dissemination barrier, and then within every node
+ * again, so its latency grows with the log of the number of nodes rather
+ * than with the number of processes.  When a leader's exchange with the
+ * other nodes fails, every member of its node returns the leader's error.
+ *
+ * Collectives are blocking, and every member must call the same collectives
+ * on a group in the same order with matching arguments.  Members keep making
+ * progress on their end-point while they wait, so point-to-point traffic is
+ * not held up by a collective.  A group must only be used by one thread at a
+ * time.
+ */
+
+/*! @defgroup coll PSM2 Node-local Collectives
+ *
+ * @{
+ */
+
+/** @brief Opaque handle to a collective group */
+typedef struct psm2_coll *psm2_coll_t;
+
+/** @brief Third word of the tags of the MQ messages leaders exchange.
+ *
+ * The low 16 bits hold the group id.  Applications sharing the MQ with a
+ * hierarchical group must not post receives that can match such tags.
+ */
+#define PSM2_COLL_MQ_TAG2	0xc0110000U
+
+/** @brief Element types of reductions */
+typedef enum psm2_coll_type {
+	PSM2_COLL_TYPE_INT32 = 0,	/**< int32_t */
+	PSM2_COLL_TYPE_INT64 = 1,	/**< int64_t */
+	PSM2_COLL_TYPE_DOUBLE = 2	/**< double */
+} psm2_coll_type_t;
+
+/** @brief Reduction operations */
+typedef enum psm2_coll_op {
+	PSM2_COLL_OP_SUM = 0,	/**< Sum of the elements */
+	PSM2_COLL_OP_MIN = 1,	/**< Minimum of the elements */
+	PSM2_COLL_OP_MAX = 2	/**< Maximum of the elements */
+} psm2_coll_op_t;
+
+/** @brief Join a node-local collective group.
+ *
+ * Blocks until all @c nranks members have joined, or until the time-out
+ * set with PSM2_COLL_TIMEOUT (60 seconds by default) expires.  Members name
+ * the group with @c group_id, which must be unique among the groups that
+ * exist at the same time in the job (the job being all end-points opened
+ * with the same uuid).  A member that gives up joining, on a time-out or a
+ * mismatched group size, makes the members already waiting give up too.
+ *
+ * @param[in] ep End-point of the calling process
+ * @param[in] group_id Name of the group, identical on all members
+ * @param[in] nranks Number of members
+ * @param[in] rank Rank of the caller in the group, 0 to nranks - 1
+ * @param[out] coll_o Handle to the group
+ *
+ * @returns PSM2_OK indicates success.
+ * @returns PSM2_PARAM_ERR if @c rank or @c nranks is invalid.
+ * @returns PSM2_SHMEM_SEGMENT_ERR if the shared region cannot be created.
+ * @returns PSM2_TIMEOUT if not all members joined in time.
+ */
+psm2_error_t
+psm2_coll_init(psm2_ep_t ep, uint32_t group_id, int nranks, int rank,
+	       psm2_coll_t *coll_o);
+
+/** @brief Join a collective group spanning several nodes.
+ *
+ * Every member calls this with the size of its node's part of the group
+ * and its rank within that part, as for @ref psm2_coll_init.  The member of
+ * local rank 0 leads its node: it must also pass the MQ and the connected
+ * addresses of the leaders of all nodes, indexed by node rank, which must
+ * stay valid until the group is finalized.  Other members may pass NULL for
+ * both.  Members are grouped by node rank, not by host, so a host may also
+ * be split into several nodes, one per socket for instance.
+ *
+ * @param[in] ep End-point of the calling process
+ * @param[in] mq MQ the leaders communicate through (leaders only)
+ * @param[in] group_id Name of the group, identical on all members
+ * @param[in] nranks Number of members on the caller's node
+ * @param[in] rank Rank of the caller on its node, 0 to nranks - 1
+ * @param[in] leaders Addresses of the leaders by node rank (leaders only)
+ * @param[in] nnodes Number of nodes, identical on all members
+ * @param[in] node_rank Rank of the caller's node, 0 to nnodes - 1
+ * @param[out] coll_o Handle to the group
+ *
+ * @returns PSM2_OK indicates success.
+ * @returns PSM2_PARAM_ERR if a rank or size is invalid, or if a leader
+ *          does not provide the MQ and leader addresses.
+ * @returns PSM2_SHMEM_SEGMENT_ERR if the shared region cannot be created.
+ * @returns PSM2_TIMEOUT if not all members of the node joined in time.
+ */
+psm2_error_t
+psm2_coll_init_hier(psm2_ep_t ep, psm2_mq_t mq, uint32_t group_id,
+		    int nranks, int rank, const psm2_epaddr_t *leaders,
+		    int nnodes, int node_rank, psm2_coll_t *coll_o);
+
+/** @brief Leave a collective group.
+ *
+ * Collective: blocks until all members have called it.
+ *
+ * @param[in] coll Handle to the group
+ *
+ * @returns PSM2_OK indicates success.
+ */
+psm2_error_t
+psm2_coll_fini(psm2_coll_t coll);
+
+/** @brief Barrier across the members of a group.
+ *
+ * @param[in] coll Handle to the group
+ *
+ * @returns PSM2_OK indicates success.
+ */
+psm2_error_t
+psm2_coll_barrier(psm2_coll_t coll);
+
+/** @brief Broadcast a buffer from one member to all others.
+ *
+ * @param[in] coll Handle to the group
+ * @param[inout] buf Data on @c root, destination on the other members
+ * @param[in] len Length of @c buf, identical on all members
+ * @param[in] root Rank of the member that holds the data.  In a group
+ *                 created with @ref psm2_coll_init_hier, rank of the node
+ *                 whose leader holds the data.
+ *
+ * @returns PSM2_OK indicates success.
+ * @returns PSM2_PARAM_ERR if @c root is not a rank of the group.
+ */
+psm2_error_t
+psm2_coll_bcast(psm2_coll_t coll, void *buf, size_t len, int root);
+
+/** @brief Reduce arrays element-wise across all members.
+ *
+ * On return, element i of @c rbuf on every member holds @c op applied to
+ * element i of @c sbuf of all members.  Sums of doubles are not reordered
+ * between members, all members get bit-identical results.  @c sbuf and
+ * @c rbuf may be the same buffer.
+ *
+ * @param[in] coll Handle to the group
+ * @param[in] sbuf Local contribution
+ * @param[out] rbuf Result
+ * @param[in] count Number of elements, identical on all members
+ * @param[in] type Element type
+ * @param[in] op Reduction
+ *
+ * @returns PSM2_OK indicates success.
+ * @returns PSM2_PARAM_ERR if the type or op is unknown.
+ */
+psm2_error_t
+psm2_coll_allreduce(psm2_coll_t coll, const void *sbuf, void *rbuf,
+		    size_t count, psm2_coll_type_t type, psm2_coll_op_t op);
+
+/*! @} */
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+#endif
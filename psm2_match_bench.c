@@ -0,0 +1,502 @@
+/*
+
+  This file is provided under a dual BSD/GPLv2 license.  When using or
+  redistributing this file, you may do so under either license.
+
+  GPL LICENSE SUMMARY
+
+  Copyright(c) 2015 Intel Corporation.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of version 2 of the GNU General Public License as
+  published by the Free Software Foundation.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  Contact Information:
+  Intel Corporation, www.intel.com
+
+  BSD LICENSE
+
+  Copyright(c) 2015 Intel Corporation.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the
+      distribution.
+    * Neither the name of Intel Corporation nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+
+/*
+ * psm2_match_bench: tag matching in isolation.  Links the library objects
+ * directly and feeds MQ envelopes from a stub PTL, so the cost of matching
+ * can be measured without a fabric, a peer process or any packet handling.
+ *
+ *   psm2_match_bench [-s expected|unexpected|mixed] [-n msgs] [-r rounds]
+ *                    [-p peers] [-w pct] [-t pct] [-d depth]
+ *                    [-o fifo|lifo|random] [-m]
+ *
+ * Every round posts n receives and delivers n tiny messages that match them
+ * one to one.  With -s expected the receives are posted first and the
+ * deliveries are timed, with -s unexpected the messages arrive first and the
+ * posts are timed, mixed alternates.  -o orders the timed side relative to
+ * the other.  -w and -t make that percentage of receives source or tag
+ * wildcards, -d keeps that many receives (or unexpected messages) posted
+ * that never match, which is what long queue scans are made of.  Without -s
+ * a standard matrix is run.  -m adds hardware cache miss counts where the
+ * kernel allows them.
+ *
+ * Output is JSON, one record per configuration.
+ */
+
+#include "psm_user.h"
+#include "psm_mq_internal.h"
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+#define SCEN_EXPECTED	0
+#define SCEN_UNEXPECTED	1
+#define SCEN_MIXED	2
+
+#define ORDER_FIFO	0
+#define ORDER_LIFO	1
+#define ORDER_RANDOM	2
+
+#define NOISE_TAG	0xffffffffU	/* tag[2] of receives that never match */
+
+static const char *scen_name[] = { "expected", "unexpected", "mixed" };
+static const char *order_name[] = { "fifo", "lifo", "random" };
+
+struct config {
+	int scenario;
+	int order;
+	int msgs;
+	int rounds;
+	int peers;
+	int wild_src;		/* percent of receives from any source */
+	int wild_tag;		/* percent of receives ignoring tag[0] */
+	int depth;
+};
+
+/* The stub PTL: epaddrs that only exist to be the source of envelopes */
+static struct ptl_ctl stub_ctl;
+static struct psm2_epaddr *stub_peers;
+static struct psm2_epaddr stub_noise_peer;
+
+static psm2_ep_t ep;
+static psm2_mq_t mq;
+static psm2_mq_req_t *reqs, *noise_reqs;
+static int *order;
+static uint32_t payload[2];
+static char rbuf[8];
+
+static int perf_fd = -1;
+
+static double now_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void perf_open(void)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = PERF_COUNT_HW_CACHE_MISSES;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	perf_fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+	if (perf_fd < 0)
+		fprintf(stderr, "cache misses not available: %s\n",
+			strerror(errno));
+}
+
+static void perf_start(void)
+{
+	if (perf_fd >= 0)
+		ioctl(perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+}
+
+static void perf_stop(uint64_t *misses)
+{
+	uint64_t val;
+
+	if (perf_fd < 0)
+		return;
+	ioctl(perf_fd, PERF_EVENT_IOC_DISABLE, 0);
+	if (read(perf_fd, &val, sizeof(val)) == sizeof(val))
+		*misses += val;
+	ioctl(perf_fd, PERF_EVENT_IOC_RESET, 0);
+}
+
+/* Message i carries its index in tag[0] and tag[1], so a receive ignoring
+ * either still matches exactly one message */
+static void msg_tag(psm2_mq_tag_t *tag, int i, int round)
+{
+	tag->tag[0] = i;
+	tag->tag[1] = i;
+	tag->tag[2] = round;
+}
+
+static psm2_epaddr_t msg_src(const struct config *cfg, int i)
+{
+	return &stub_peers[i % cfg->peers];
+}
+
+static void post_recv(const struct config *cfg, int i, int round)
+{
+	psm2_mq_tag_t tag, tagsel;
+	psm2_epaddr_t src = msg_src(cfg, i);
+	psm2_error_t err;
+
+	msg_tag(&tag, i, round);
+	tagsel.tag[0] = tagsel.tag[1] = tagsel.tag[2] = 0xffffffff;
+	/* Spread wildcards evenly instead of drawing them, so every run
+	 * posts the same mix */
+	if ((i * 37) % 100 < cfg->wild_src)
+		src = PSM2_MQ_ANY_ADDR;
+	if ((i * 37 + 50) % 100 < cfg->wild_tag)
+		tagsel.tag[0] = 0;
+
+	err = psm2_mq_irecv2(mq, src, &tag, &tagsel, 0, rbuf, sizeof(rbuf),
+			     NULL, &reqs[i]);
+	if (err != PSM2_OK) {
+		fprintf(stderr, "psm2_mq_irecv2: %s\n",
+			psm2_error_get_string(err));
+		exit(EXIT_FAILURE);
+	}
+}
+
+/* What a PTL does for a tiny eager message, under the progress lock like
+ * any receive path */
+static void deliver(psm2_epaddr_t src, psm2_mq_tag_t *tag)
+{
+	psm2_mq_req_t req;
+
+	psmi_mq_handle_envelope(mq, src, tag, sizeof(payload), 0, payload,
+				sizeof(payload), 1, MQ_MSG_TINY, &req, NULL);
+}
+
+static void deliver_msg(const struct config *cfg, int i, int round)
+{
+	psm2_mq_tag_t tag;
+
+	msg_tag(&tag, i, round);
+	deliver(msg_src(cfg, i), &tag);
+}
+
+static void make_order(const struct config *cfg)
+{
+	int i, j, tmp;
+
+	for (i = 0; i < cfg->msgs; i++)
+		order[i] = cfg->order == ORDER_LIFO ? cfg->msgs - 1 - i : i;
+	if (cfg->order == ORDER_RANDOM)
+		for (i = cfg->msgs - 1; i > 0; i--) {
+			j = random() % (i + 1);
+			tmp = order[i];
+			order[i] = order[j];
+			order[j] = tmp;
+		}
+}
+
+static void retire_all(const struct config *cfg)
+{
+	psm2_error_t err;
+	int i;
+
+	for (i = 0; i < cfg->msgs; i++) {
+		err = psm2_mq_test(&reqs[i], NULL);
+		if (err != PSM2_OK) {
+			fprintf(stderr, "receive %d of %d did not match: %s\n",
+				i, cfg->msgs, psm2_error_get_string(err));
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+/* Entries that sit in the queue the timed side searches and never match */
+static void noise_add(const struct config *cfg, int scenario)
+{
+	psm2_mq_tag_t tag, tagsel;
+	int i;
+
+	for (i = 0; i < cfg->depth; i++) {
+		tag.tag[0] = tag.tag[1] = i;
+		tag.tag[2] = NOISE_TAG;
+		if (scenario == SCEN_EXPECTED) {
+			/* Wildcards, so that they land on the list every
+			 * incoming message is checked against */
+			tagsel.tag[0] = tagsel.tag[1] = 0;
+			tagsel.tag[2] = 0xffffffff;
+			psm2_mq_irecv2(mq, PSM2_MQ_ANY_ADDR, &tag, &tagsel, 0,
+				       rbuf, sizeof(rbuf), NULL,
+				       &noise_reqs[i]);
+		} else {
+			PSMI_PLOCK();
+			deliver(&stub_noise_peer, &tag);
+			PSMI_PUNLOCK();
+		}
+	}
+}
+
+static void noise_remove(const struct config *cfg, int scenario)
+{
+	psm2_mq_tag_t tag, tagsel;
+	psm2_mq_req_t req;
+	int i;
+
+	for (i = 0; i < cfg->depth; i++) {
+		if (scenario == SCEN_EXPECTED) {
+			psm2_mq_cancel(&noise_reqs[i]);
+			psm2_mq_test(&noise_reqs[i], NULL);
+		} else {
+			tag.tag[0] = tag.tag[1] = i;
+			tag.tag[2] = NOISE_TAG;
+			tagsel.tag[0] = tagsel.tag[1] = tagsel.tag[2] =
+			    0xffffffff;
+			psm2_mq_irecv2(mq, &stub_noise_peer, &tag, &tagsel, 0,
+				       rbuf, sizeof(rbuf), NULL, &req);
+			psm2_mq_test(&req, NULL);
+		}
+	}
+}
+
+static void run_config(const struct config *cfg, int first)
+{
+	double usec = 0;
+	uint64_t misses = 0;
+	int round, i, scenario;
+
+	make_order(cfg);
+	for (round = 0; round < cfg->rounds; round++) {
+		scenario = cfg->scenario == SCEN_MIXED ?
+		    round & 1 : cfg->scenario;
+		noise_add(cfg, scenario);
+
+		if (scenario == SCEN_EXPECTED) {
+			for (i = 0; i < cfg->msgs; i++)
+				post_recv(cfg, i, round);
+			perf_start();
+			usec -= now_usec();
+			PSMI_PLOCK();
+			for (i = 0; i < cfg->msgs; i++)
+				deliver_msg(cfg, order[i], round);
+			PSMI_PUNLOCK();
+			usec += now_usec();
+			perf_stop(&misses);
+		} else {
+			PSMI_PLOCK();
+			for (i = 0; i < cfg->msgs; i++)
+				deliver_msg(cfg, i, round);
+			PSMI_PUNLOCK();
+			perf_start();
+			usec -= now_usec();
+			for (i = 0; i < cfg->msgs; i++)
+				post_recv(cfg, order[i], round);
+			usec += now_usec();
+			perf_stop(&misses);
+		}
+
+		retire_all(cfg);
+		noise_remove(cfg, scenario);
+	}
+
+	printf("%s\n    { \"scenario\": \"%s\", \"order\": \"%s\", "
+	       "\"msgs\": %d, \"rounds\": %d, \"peers\": %d, "
+	       "\"wild_src_pct\": %d, \"wild_tag_pct\": %d, \"depth\": %d, "
+	       "\"matches_per_sec\": %.0f, \"nsec_per_match\": %.1f, "
+	       "\"cache_misses_per_match\": ",
+	       first ? "" : ",", scen_name[cfg->scenario],
+	       order_name[cfg->order], cfg->msgs, cfg->rounds, cfg->peers,
+	       cfg->wild_src, cfg->wild_tag, cfg->depth,
+	       (double)cfg->msgs * cfg->rounds * 1e6 / usec,
+	       usec * 1e3 / ((double)cfg->msgs * cfg->rounds));
+	if (perf_fd >= 0)
+		printf("%.2f }", (double)misses / cfg->msgs / cfg->rounds);
+	else
+		printf("null }");
+	fflush(stdout);
+}
+
+static int parse_name(const char *arg, const char **names, int num)
+{
+	int i;
+
+	for (i = 0; i < num; i++)
+		if (strcmp(arg, names[i]) == 0)
+			return i;
+	fprintf(stderr, "unknown value '%s'\n", arg);
+	exit(EXIT_FAILURE);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-s expected|unexpected|mixed] [-n msgs] [-r rounds]\n"
+		"          [-p peers] [-w pct] [-t pct] [-d depth]"
+		" [-o fifo|lifo|random] [-m]\n", prog);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	struct config cfg = {
+		.scenario = -1,
+		.order = ORDER_FIFO,
+		.msgs = 1024,
+		.rounds = 100,
+		.peers = 16,
+	};
+	/* The standard matrix: scenario, order, source and tag wildcard
+	 * percentages, depth */
+	static const int matrix[][5] = {
+		{ SCEN_EXPECTED, ORDER_FIFO, 0, 0, 0 },
+		{ SCEN_EXPECTED, ORDER_LIFO, 0, 0, 0 },
+		{ SCEN_EXPECTED, ORDER_RANDOM, 0, 0, 0 },
+		{ SCEN_EXPECTED, ORDER_RANDOM, 100, 0, 0 },
+		{ SCEN_EXPECTED, ORDER_RANDOM, 0, 100, 0 },
+		{ SCEN_EXPECTED, ORDER_RANDOM, 50, 50, 0 },
+		{ SCEN_EXPECTED, ORDER_RANDOM, 0, 0, 1024 },
+		{ SCEN_UNEXPECTED, ORDER_FIFO, 0, 0, 0 },
+		{ SCEN_UNEXPECTED, ORDER_LIFO, 0, 0, 0 },
+		{ SCEN_UNEXPECTED, ORDER_RANDOM, 0, 0, 0 },
+		{ SCEN_UNEXPECTED, ORDER_RANDOM, 100, 0, 0 },
+		{ SCEN_UNEXPECTED, ORDER_RANDOM, 0, 100, 0 },
+		{ SCEN_UNEXPECTED, ORDER_RANDOM, 0, 0, 1024 },
+		{ SCEN_MIXED, ORDER_RANDOM, 10, 10, 64 },
+	};
+	int ver_major = PSM2_VERNO_MAJOR, ver_minor = PSM2_VERNO_MINOR;
+	struct psm2_ep_open_opts opts;
+	psm2_uuid_t uuid;
+	psm2_epid_t epid;
+	psm2_error_t err;
+	int c, i, cache_misses = 0;
+
+	while ((c = getopt(argc, argv, "s:n:r:p:w:t:d:o:m")) != -1) {
+		switch (c) {
+		case 's':
+			cfg.scenario = parse_name(optarg, scen_name, 3);
+			break;
+		case 'n':
+			cfg.msgs = atoi(optarg);
+			break;
+		case 'r':
+			cfg.rounds = atoi(optarg);
+			break;
+		case 'p':
+			cfg.peers = atoi(optarg);
+			break;
+		case 'w':
+			cfg.wild_src = atoi(optarg);
+			break;
+		case 't':
+			cfg.wild_tag = atoi(optarg);
+			break;
+		case 'd':
+			cfg.depth = atoi(optarg);
+			break;
+		case 'o':
+			cfg.order = parse_name(optarg, order_name, 3);
+			break;
+		case 'm':
+			cache_misses = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc || cfg.msgs <= 0 || cfg.rounds <= 0 ||
+	    cfg.peers <= 0 || cfg.depth < 0)
+		usage(argv[0]);
+
+	/* A real endpoint and MQ, on the self device so no hardware is
+	 * needed; the messages never go near it */
+	setenv("PSM2_DEVICES", "self", 1);
+	if ((err = psm2_init(&ver_major, &ver_minor)) ||
+	    (psm2_uuid_generate(uuid), psm2_ep_open_opts_get_defaults(&opts),
+	     err = psm2_ep_open(uuid, &opts, &ep, &epid)) ||
+	    (err = psm2_mq_init(ep, PSM2_MQ_ORDERMASK_ALL, NULL, 0, &mq))) {
+		fprintf(stderr, "setup failed: %s\n",
+			psm2_error_get_string(err));
+		return EXIT_FAILURE;
+	}
+
+	stub_ctl.ep = ep;
+	stub_peers = psmi_calloc(PSMI_EP_NONE, UNDEFINED, cfg.peers,
+				 sizeof(*stub_peers));
+	reqs = psmi_calloc(PSMI_EP_NONE, UNDEFINED, cfg.msgs, sizeof(*reqs));
+	order = psmi_calloc(PSMI_EP_NONE, UNDEFINED, cfg.msgs, sizeof(*order));
+	/* Room for the deepest queue of the standard matrix too */
+	noise_reqs = psmi_calloc(PSMI_EP_NONE, UNDEFINED,
+				 cfg.depth > 1024 ? cfg.depth : 1024,
+				 sizeof(*noise_reqs));
+	if (stub_peers == NULL || reqs == NULL || order == NULL ||
+	    noise_reqs == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return EXIT_FAILURE;
+	}
+	for (i = 0; i < cfg.peers; i++) {
+		stub_peers[i].epid = epid + i + 1;
+		stub_peers[i].ptlctl = &stub_ctl;
+	}
+	stub_noise_peer.epid = epid + cfg.peers + 1;
+	stub_noise_peer.ptlctl = &stub_ctl;
+
+	if (cache_misses)
+		perf_open();
+	srandom(1);
+
+	printf("{\n  \"benchmark\": \"psm2_match_bench\",\n  \"results\": [");
+	if (cfg.scenario >= 0)
+		run_config(&cfg, 1);
+	else
+		for (i = 0; i < (int)(sizeof(matrix) / sizeof(matrix[0]));
+		     i++) {
+			cfg.scenario = matrix[i][0];
+			cfg.order = matrix[i][1];
+			cfg.wild_src = matrix[i][2];
+			cfg.wild_tag = matrix[i][3];
+			cfg.depth = matrix[i][4];
+			run_config(&cfg, i == 0);
+		}
+	printf("\n  ]\n}\n");
+
+	psm2_mq_finalize(mq);
+	psm2_ep_close(ep, PSM2_EP_CLOSE_FORCE, 0);
+	psm2_finalize();
+	return 0;
+}
@@ -415,6 +415,24 @@ struct psm2_mq_status2 {
 /** @brief PSM2 Communication handle (opaque) */
 typedef struct psm2_mq_req *psm2_mq_req_t;
 
+/** @brief Strided buffer layout
+ *
+ * Describes a non-contiguous buffer made of @c count blocks of @c blocklen
+ * bytes each, the start of block i being @c i * @c stride bytes past the
+ * buffer pointer.  On the wire the blocks are packed back to back, so a
+ * strided send matches any receive of @c count * @c blocklen bytes and
+ * vice versa.
+ */
+typedef
+struct psm2_mq_stride {
+	/** Number of blocks */
+	uint32_t count;
+	/** Bytes in each block */
+	uint32_t blocklen;
+	/** Distance in bytes between the start of two consecutive blocks */
+	uint64_t stride;
+} psm2_mq_stride_t;
+
 /*! @} */
 /*! @ingroup mq
  * @defgroup mq_options PSM Matched Queue Options
@@ -588,6 +606,36 @@ psm2_error_t
 psm2_mq_imrecv(psm2_mq_t mq, uint32_t flags, void *buf, uint32_t len,
 	      void *context, psm2_mq_req_t *reqo);
 
+/** @brief Post a strided receive to a Matched Queue
+ *
+ * Same as @ref psm2_mq_irecv2, except that the message is delivered into
+ * @c layout->count blocks of @c layout->blocklen bytes, @c layout->stride
+ * bytes apart, starting at @c buf.  The receive buffer length is the packed
+ * length @c count * @c blocklen, and message bytes land in the blocks in
+ * order as they arrive, without an intermediate contiguous copy where the
+ * transport allows it.
+ *
+ * @param[in] mq Matched Queue Handle
+ * @param[in] src Source (sender's) epaddr (may be PSM2_MQ_ANY_ADDR)
+ * @param[in] rtag Receive tag
+ * @param[in] rtagsel Receive tag selector
+ * @param[in] flags Receive flags (None currently supported)
+ * @param[in] buf Address of the first block
+ * @param[in] layout Block layout, blocks must not overlap
+ * @param[in] context User context pointer, available in @ref psm2_mq_status2_t
+ *                    upon completion
+ * @param[out] req PSM MQ Request handle created by the preposted receive.
+ *
+ * @retval PSM2_OK The receive buffer has successfully been posted to the MQ.
+ * @retval PSM2_PARAM_ERR The layout has overlapping blocks or its packed
+ *                        length does not fit in 32 bits.
+ */
+psm2_error_t
+psm2_mq_irecv_strided(psm2_mq_t mq, psm2_epaddr_t src, psm2_mq_tag_t *rtag,
+		      psm2_mq_tag_t *rtagsel, uint32_t flags, void *buf,
+		      const psm2_mq_stride_t *layout, void *context,
+		      psm2_mq_req_t *req);
+
 /** @brief Send a blocking MQ message
  *
  * Function to send a blocking MQ message, whereby the message is locally
@@ -772,6 +820,33 @@ psm2_mq_isend2(psm2_mq_t mq, psm2_epaddr_t dest, uint32_t flags,
 	      psm2_mq_tag_t *stag, const void *buf, uint32_t len, void *context,
 	      psm2_mq_req_t *req);
 
+/** @brief Send a non-blocking strided MQ message
+ *
+ * Same as @ref psm2_mq_isend2, except that the message is made of
+ * @c layout->count blocks of @c layout->blocklen bytes, @c layout->stride
+ * bytes apart, starting at @c buf.  The blocks are sent packed, the message
+ * length is @c count * @c blocklen.  As for @ref psm2_mq_isend2, the blocks
+ * must remain unmodified until the send is locally completed.
+ *
+ * @param[in] mq Matched Queue Handle
+ * @param[in] dest Destination EP address
+ * @param[in] flags Message flags, as for @ref psm2_mq_isend2
+ * @param[in] stag Message Send Tag, array of three 32-bit values.
+ * @param[in] buf Address of the first block
+ * @param[in] layout Block layout
+ * @param[in] context Optional user-provided pointer available in @ref
+ *                    psm2_mq_status2_t when the send is locally completed.
+ * @param[out] req PSM MQ Request handle created by the non-blocking send.
+ *
+ * @retval PSM2_OK The message has been successfully initiated.
+ * @retval PSM2_PARAM_ERR The packed length does not fit in 32 bits.
+ */
+psm2_error_t
+psm2_mq_isend_strided(psm2_mq_t mq, psm2_epaddr_t dest, uint32_t flags,
+		      psm2_mq_tag_t *stag, const void *buf,
+		      const psm2_mq_stride_t *layout, void *context,
+		      psm2_mq_req_t *req);
+
 /** @brief Try to Probe if a message is received matching tag selection
  * criteria
  *
@@ -1319,6 +1394,98 @@ struct psm2_mq_stats {
 	void
 	 psm2_mq_get_stats(psm2_mq_t mq, psm2_mq_stats_t *stats);
 
+#define PSM2_MQ_HIST_BUCKETS 32	/**< Buckets in each @ref psm2_mq_stats_hist histogram */
+
+/*! @brief Transports distinguished by @ref psm2_mq_stats_hist */
+enum psm2_mq_hist_transport {
+	PSM2_MQ_HIST_SELF = 0,	/**< Messages to and from the local endpoint */
+	PSM2_MQ_HIST_SHM,	/**< Messages through intra-node shared memory */
+	PSM2_MQ_HIST_HFI,	/**< Messages through the HFI */
+	PSM2_MQ_HIST_NUM_TRANSPORTS
+};
+
+/*! @brief MQ message size and latency histograms
+ *
+ * Each histogram is log2 bucketed: bucket 0 counts values of 0, bucket @c i
+ * counts values in [2^(i-1), 2^i) and the last bucket also counts everything
+ * larger.  Sizes are in bytes, latencies are the nanoseconds between posting
+ * a request and its completion.  A request is accounted once it is returned
+ * through @ref psm2_mq_test or @ref psm2_mq_wait, cancelled receives are not
+ * accounted.
+ */
+struct psm2_mq_stats_hist {
+	/** Sizes of sent messages, per transport */
+	uint64_t tx_size[PSM2_MQ_HIST_NUM_TRANSPORTS][PSM2_MQ_HIST_BUCKETS];
+	/** Sizes of received messages, per transport */
+	uint64_t rx_size[PSM2_MQ_HIST_NUM_TRANSPORTS][PSM2_MQ_HIST_BUCKETS];
+	/** Post to completion latency of sends, per transport */
+	uint64_t tx_lat_ns[PSM2_MQ_HIST_NUM_TRANSPORTS][PSM2_MQ_HIST_BUCKETS];
+	/** Post to completion latency of receives, per transport */
+	uint64_t rx_lat_ns[PSM2_MQ_HIST_NUM_TRANSPORTS][PSM2_MQ_HIST_BUCKETS];
+};
+
+/*! @see psm2_mq_stats_hist */
+	typedef struct psm2_mq_stats_hist psm2_mq_stats_hist_t;
+
+/** @brief Retrieve message size and latency histograms from an instantied MQ
+ *
+ * @param[in] mq Matched Queue handle
+ * @param[out] hist Histograms, see @ref psm2_mq_stats_hist
+ */
+	void
+	 psm2_mq_get_stats_hist(psm2_mq_t mq, psm2_mq_stats_hist_t *hist);
+
+/** @brief Get an eventfd signaled when MQ requests complete
+ *
+ * Returns an eventfd (see eventfd(2)) that becomes readable whenever the
+ * MQ's completion queue goes from empty to non-empty, so that a thread can
+ * sleep in poll or epoll until communication completes instead of spinning
+ * on @ref psm2_mq_ipeek2.  The descriptor is created on the first call and
+ * the same one is returned afterwards, it belongs to the MQ and is closed
+ * with its endpoint.
+ *
+ * Since only the transition is signaled, a consumer must read the eventfd
+ * and then retire completions until @ref psm2_mq_ipeek2 returns @ref
+ * PSM2_MQ_NO_COMPLETIONS before sleeping again.
+ *
+ * Completions are only discovered while PSM makes progress.  A consumer
+ * that does not otherwise call into PSM should enable the progress thread
+ * (PSM2_PROGRESS_THREAD=1), or rely on the receive thread for hfi traffic.
+ *
+ * @param[in] mq Matched Queue handle
+ * @param[out] fd Readable when completions are pending
+ *
+ * @retval PSM2_OK @c fd is valid
+ * @retval PSM2_INTERNAL_ERR The eventfd could not be created
+ */
+	psm2_error_t
+	 psm2_mq_get_eventfd(psm2_mq_t mq, int *fd);
+
+/*! @brief Completion callback, see @ref psm2_mq_req_set_callback
+ *
+ * @param[in] req The request that completed, still valid
+ * @param[in] context The context the request was posted with
+ */
+	typedef void (*psm2_mq_req_callback_fn_t) (psm2_mq_req_t req,
+						   void *context);
+
+/** @brief Have a request call back when it completes
+ *
+ * The callback is invoked from whichever thread is making progress when @c
+ * req completes: an application thread inside a PSM call, the receive thread
+ * or the progress thread.  If @c req has already completed it is invoked
+ * before this function returns.  It is called with the PSM lock held and so
+ * must not call back into PSM.  A typical callback records @c req for the
+ * application to retire later with @ref psm2_mq_test2, the request is not
+ * freed until then.
+ *
+ * @param[in] req Posted, not yet retired, send or receive request
+ * @param[in] fn Callback, NULL to clear a previously set one
+ */
+	void
+	 psm2_mq_req_set_callback(psm2_mq_req_t req,
+				  psm2_mq_req_callback_fn_t fn);
+
 /*! @} */
 #ifdef __cplusplus
 }				/* extern "C" */
@@ -0,0 +1,308 @@
+/*
+
+  This file is provided under a dual BSD/GPLv2 license.  When using or
+  redistributing this file, you may do so under either license.
+
+  GPL LICENSE SUMMARY
+
+  Copyright(c) 2015 Intel Corporation.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of version 2 of the GNU General Public License as
+  published by the Free Software Foundation.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  Contact Information:
+  Intel Corporation, www.intel.com
+
+  BSD LICENSE
+
+  Copyright(c) 2015 Intel Corporation.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the
+      distribution.
+    * Neither the name of Intel Corporation nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef PSM2_RMA_H
+#define PSM2_RMA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <psm2.h>
+#include <psm2_am.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*!
+ * @file psm2_rma.h
+ * @brief PSM2 one-sided Remote Memory Access.
+ *
+ * @page psm2_rma Remote Memory Access Interface
+ *
+ * A PSM2 process registers regions of its memory with its end-point and
+ * hands the resulting keys to its peers by some other means, typically an MQ
+ * message or an AM request.  Peers holding a key may then write into the
+ * region with psm2_rma_put() and read from it with psm2_rma_get(), without
+ * the owner posting a matching receive.
+ *
+ * Transfers ride on long AM requests and replies (see psm2_am_request_long()):
+ * kernel assisted copies between processes on the same node, and the
+ * rendezvous protocol with expected receives across the fabric.  The owner of
+ * a region must still make progress, as for any other PSM2 communication,
+ * but does not take part in the data movement itself wherever the transport
+ * allows it.
+ *
+ * Each region keeps a count of the puts that have landed in it, which the
+ * owner can read with psm2_rma_mr_count() to learn that data has arrived.
+ *
+ * The owner checks every access against its regions before touching them.
+ * An access outside any region, or through the key of a deregistered one,
+ * is dropped there and still completes at its origin, the error is kept
+ * for psm2_rma_status().
+ *
+ * Registered regions are also the targets of remote atomics on 64-bit words:
+ * fetch-and-add, compare-and-swap and element-wise accumulate.  Atomics are
+ * run by the owner as it makes progress, with the processor's atomic
+ * instructions, so they are atomic with respect to each other and to the
+ * owner's own atomic accesses to the same words.
+ */
+
+/*! @defgroup rma PSM2 Remote Memory Access
+ *
+ * @{
+ */
+
+/** @brief Opaque handle to a registered memory region */
+typedef struct psm2_rma_mr *psm2_rma_mr_t;
+
+/** @brief Key naming a registered region to the peers of its owner.
+ *
+ * Keys are plain data and may be copied and sent to peers as is.  A key
+ * becomes invalid when its region is deregistered.
+ */
+typedef
+struct psm2_rma_key {
+	uint64_t addr;		/**< Start of the region in its owner */
+	uint64_t len;		/**< Length of the region in bytes */
+	uint64_t id;		/**< Region handle in its owner */
+} psm2_rma_key_t;
+
+/** @brief Register a memory region for remote access.
+ *
+ * @param[in] ep End-point that peers will access the region through
+ * @param[in] addr Start of the region
+ * @param[in] len Length of the region in bytes
+ * @param[out] mr_o Handle to the region
+ * @param[out] key_o Key to give to peers
+ *
+ * @returns PSM2_OK indicates success.
+ * @returns PSM2_NO_MEMORY if no more regions can be registered.
+ */
+psm2_error_t
+psm2_rma_register(psm2_ep_t ep, void *addr, size_t len,
+		  psm2_rma_mr_t *mr_o, psm2_rma_key_t *key_o);
+
+/** @brief Deregister a memory region.
+ *
+ * Puts and gets against the region must be complete before it is
+ * deregistered.
+ *
+ * @param[in] mr Region to deregister
+ *
+ * @returns PSM2_OK indicates success.
+ */
+psm2_error_t psm2_rma_deregister(psm2_rma_mr_t mr);
+
+/** @brief Read the number of puts that have landed in a region.
+ *
+ * @param[in] mr Region
+ * @param[out] count_o Number of puts completed since registration
+ *
+ * @returns PSM2_OK indicates success.
+ */
+psm2_error_t psm2_rma_mr_count(psm2_rma_mr_t mr, uint64_t *count_o);
+
+/** @brief Read and clear the error status of remote accesses.
+ *
+ * Puts, gets and atomics that the owner of the region rejects still call
+ * their completion function, without moving any data or writing the
+ * result.  The first such error since the previous call is
+ * kept per end-point and returned here.
+ *
+ * @param[in] ep End-point the accesses were issued through
+ * @param[out] status_o First error reported by an owner, or PSM2_OK
+ *
+ * @returns PSM2_OK indicates success.
+ */
+psm2_error_t psm2_rma_status(psm2_ep_t ep, psm2_error_t *status_o);
+
+/** @brief Write to a remote region.
+ *
+ * Copies len bytes from src to offset bytes into the region named by key,
+ * owned by the process at epaddr.  The completion function is called
+ * locally once the data is in the region, and the region's put count
+ * has been incremented; src may not be modified until then.
+ *
+ * @param[in] epaddr End-point address of the owner of the region
+ * @param[in] src Local source buffer
+ * @param[in] len Length of the transfer in bytes
+ * @param[in] key Key of the remote region
+ * @param[in] offset Offset of the transfer in the remote region
+ * @param[in] completion_fn Completion function, may be NULL
+ * @param[in] completion_ctxt Context passed to the completion function
+ *
+ * @returns PSM2_OK indicates success.
+ * @returns PSM2_PARAM_ERR if the transfer falls outside the region.
+ */
+psm2_error_t
+psm2_rma_put(psm2_epaddr_t epaddr, const void *src, size_t len,
+	     const psm2_rma_key_t *key, uint64_t offset,
+	     psm2_am_completion_fn_t completion_fn, void *completion_ctxt);
+
+/** @brief Read from a remote region.
+ *
+ * Copies len bytes from offset bytes into the region named by key, owned by
+ * the process at epaddr, to dest.  The completion function is called once
+ * the data is in dest.
+ *
+ * @param[in] epaddr End-point address of the owner of the region
+ * @param[in] dest Local destination buffer
+ * @param[in] len Length of the transfer in bytes
+ * @param[in] key Key of the remote region
+ * @param[in] offset Offset of the transfer in the remote region
+ * @param[in] completion_fn Completion function, may be NULL
+ * @param[in] completion_ctxt Context passed to the completion function
+ *
+ * @returns PSM2_OK indicates success.
+ * @returns PSM2_PARAM_ERR if the transfer falls outside the region.
+ */
+psm2_error_t
+psm2_rma_get(psm2_epaddr_t epaddr, void *dest, size_t len,
+	     const psm2_rma_key_t *key, uint64_t offset,
+	     psm2_am_completion_fn_t completion_fn, void *completion_ctxt);
+
+/** @brief Reduction applied by psm2_atomic_accumulate() */
+typedef enum psm2_atomic_op {
+	PSM2_ATOMIC_SUM = 0,
+	PSM2_ATOMIC_MIN = 1,
+	PSM2_ATOMIC_MAX = 2,
+} psm2_atomic_op_t;
+
+/** @brief Element type of psm2_atomic_accumulate() */
+typedef enum psm2_atomic_type {
+	PSM2_ATOMIC_INT64 = 0,
+	PSM2_ATOMIC_UINT64 = 1,
+	PSM2_ATOMIC_DOUBLE = 2,
+} psm2_atomic_type_t;
+
+/** @brief Remote 64-bit fetch-and-add.
+ *
+ * Adds value to the 64-bit word at offset in the region named by key and
+ * stores the previous value of the word in result.  The completion function
+ * is called once result is written.  The offset must be 8-byte aligned.
+ *
+ * @param[in] epaddr End-point address of the owner of the region
+ * @param[in] key Key of the remote region
+ * @param[in] offset Offset of the word in the remote region
+ * @param[in] value Value to add
+ * @param[out] result Previous value of the word
+ * @param[in] completion_fn Completion function, may be NULL
+ * @param[in] completion_ctxt Context passed to the completion function
+ *
+ * @returns PSM2_OK indicates success.
+ * @returns PSM2_PARAM_ERR if the word falls outside the region.
+ */
+psm2_error_t
+psm2_atomic_fadd(psm2_epaddr_t epaddr, const psm2_rma_key_t *key,
+		 uint64_t offset, uint64_t value, uint64_t *result,
+		 psm2_am_completion_fn_t completion_fn, void *completion_ctxt);
+
+/** @brief Remote 64-bit compare-and-swap.
+ *
+ * Replaces the 64-bit word at offset in the region named by key with swap if
+ * it equals compare, and stores the previous value of the word in result.
+ * The swap took place if and only if the result equals compare.
+ *
+ * @param[in] epaddr End-point address of the owner of the region
+ * @param[in] key Key of the remote region
+ * @param[in] offset Offset of the word in the remote region
+ * @param[in] compare Value the word is expected to hold
+ * @param[in] swap New value of the word
+ * @param[out] result Previous value of the word
+ * @param[in] completion_fn Completion function, may be NULL
+ * @param[in] completion_ctxt Context passed to the completion function
+ *
+ * @returns PSM2_OK indicates success.
+ * @returns PSM2_PARAM_ERR if the word falls outside the region.
+ */
+psm2_error_t
+psm2_atomic_cswap(psm2_epaddr_t epaddr, const psm2_rma_key_t *key,
+		  uint64_t offset, uint64_t compare, uint64_t swap,
+		  uint64_t *result, psm2_am_completion_fn_t completion_fn,
+		  void *completion_ctxt);
+
+/** @brief Remote element-wise accumulate.
+ *
+ * Combines count 64-bit elements from src into the array at offset in the
+ * region named by key, with op applied to each element atomically.  The
+ * accumulate as a whole is not atomic.  The completion function is called
+ * once the owner has applied or rejected every element, src may be reused
+ * from then on.
+ *
+ * @param[in] epaddr End-point address of the owner of the region
+ * @param[in] key Key of the remote region
+ * @param[in] offset Offset of the array in the remote region
+ * @param[in] src Local elements
+ * @param[in] count Number of elements
+ * @param[in] type Element type
+ * @param[in] op Reduction to apply
+ * @param[in] completion_fn Completion function, may be NULL
+ * @param[in] completion_ctxt Context passed to the completion function
+ *
+ * @returns PSM2_OK indicates success.
+ * @returns PSM2_PARAM_ERR if the array falls outside the region, or if the
+ *          type or op is unknown.
+ */
+psm2_error_t
+psm2_atomic_accumulate(psm2_epaddr_t epaddr, const psm2_rma_key_t *key,
+		       uint64_t offset, const void *src, size_t count,
+		       psm2_atomic_type_t type, psm2_atomic_op_t op,
+		       psm2_am_completion_fn_t completion_fn,
+		       void *completion_ctxt);
+
+/*! @} */
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+#endif
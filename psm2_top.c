@@ -0,0 +1,402 @@
+/*
+
+  This file is provided under a dual BSD/GPLv2 license.  When using or
+  redistributing this file, you may do so under either license.
+
+  GPL LICENSE SUMMARY
+
+  Copyright(c) 2015 Intel Corporation.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of version 2 of the GNU General Public License as
+  published by the Free Software Foundation.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  Contact Information:
+  Intel Corporation, www.intel.com
+
+  BSD LICENSE
+
+  Copyright(c) 2015 Intel Corporation.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the
+      distribution.
+    * Neither the name of Intel Corporation nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+
+/*
+ * psm2-top: watch the stats pages PSM2_TELEMETRY publishes.  Every interval
+ * it lists each endpoint found in the directory with its traffic rates and
+ * error counters, summed over its peers, and optionally the busiest peers of
+ * each endpoint below it.
+ *
+ *   psm2-top [-d dir] [-i seconds] [-n count] [-p peers] [-b]
+ *
+ * Counts are read without stopping the job: every peer slot is copied under
+ * its sequence word and the copy retried if the job updated it meanwhile.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "psm_telemetry_format.h"
+
+#define DEFAULT_DIR	"/dev/shm"
+#define PAGE_PATTERN	"psm2-stats.*"
+
+struct peer_sample {
+	uint64_t epid;
+	uint32_t transport;
+	uint64_t count[PSMI_TELEMETRY_NUM_COUNTERS];
+	uint64_t delta[PSMI_TELEMETRY_NUM_COUNTERS];
+};
+
+struct endpoint {
+	char *path;
+	void *map;
+	size_t map_len;
+	struct psmi_telemetry_hdr *hdr;
+	struct psmi_telemetry_peer *slots;
+	struct peer_sample *peers;	/* max_peers entries */
+	uint32_t num_peers;
+	uint64_t total[PSMI_TELEMETRY_NUM_COUNTERS];
+	uint64_t delta[PSMI_TELEMETRY_NUM_COUNTERS];
+	int seen;			/* still present in this round */
+	struct endpoint *next;
+};
+
+static const char *transport_name[] = { "self", "shm", "hfi" };
+
+static struct endpoint *endpoint_open(const char *path)
+{
+	struct endpoint *ep;
+	struct stat st;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		if (fd >= 0)
+			close(fd);
+		return NULL;
+	}
+	if (st.st_size < PSMI_TELEMETRY_HDR_SIZE) {
+		close(fd);
+		return NULL;
+	}
+
+	ep = calloc(1, sizeof(*ep));
+	if (ep == NULL) {
+		close(fd);
+		return NULL;
+	}
+	ep->map_len = st.st_size;
+	ep->map = mmap(NULL, ep->map_len, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (ep->map == MAP_FAILED)
+		goto fail;
+
+	ep->hdr = (struct psmi_telemetry_hdr *)ep->map;
+	if (ep->hdr->magic != PSMI_TELEMETRY_MAGIC ||
+	    ep->hdr->version != PSMI_TELEMETRY_VERSION ||
+	    ep->hdr->slot_size != sizeof(struct psmi_telemetry_peer) ||
+	    ep->map_len < PSMI_TELEMETRY_HDR_SIZE + (size_t)
+	    ep->hdr->max_peers * sizeof(struct psmi_telemetry_peer)) {
+		munmap(ep->map, ep->map_len);
+		goto fail;
+	}
+	ep->slots = (struct psmi_telemetry_peer *)
+	    ((uintptr_t) ep->map + PSMI_TELEMETRY_HDR_SIZE);
+	ep->peers = calloc(ep->hdr->max_peers, sizeof(*ep->peers));
+	ep->path = strdup(path);
+	if (ep->peers == NULL || ep->path == NULL) {
+		munmap(ep->map, ep->map_len);
+		free(ep->peers);
+		free(ep->path);
+		goto fail;
+	}
+	return ep;
+
+fail:
+	free(ep);
+	return NULL;
+}
+
+static void endpoint_close(struct endpoint *ep)
+{
+	munmap(ep->map, ep->map_len);
+	free(ep->peers);
+	free(ep->path);
+	free(ep);
+}
+
+/* Copy one slot, retrying while the job is in the middle of updating it */
+static void slot_read(const struct psmi_telemetry_peer *slot,
+		      uint64_t *count)
+{
+	uint32_t seq;
+	int i;
+
+	do {
+		while ((seq = slot->seq) & 1)
+			;
+		__sync_synchronize();
+		for (i = 0; i < PSMI_TELEMETRY_NUM_COUNTERS; i++)
+			count[i] = slot->count[i];
+		__sync_synchronize();
+	} while (slot->seq != seq);
+}
+
+static void endpoint_sample(struct endpoint *ep)
+{
+	uint64_t count[PSMI_TELEMETRY_NUM_COUNTERS];
+	struct peer_sample *ps;
+	uint32_t n, p;
+	int i;
+
+	n = ep->hdr->num_peers;
+	if (n > ep->hdr->max_peers)
+		n = ep->hdr->max_peers;
+	__sync_synchronize();	/* slot identity is written before num_peers */
+
+	memset(ep->total, 0, sizeof(ep->total));
+	memset(ep->delta, 0, sizeof(ep->delta));
+	for (p = 0; p < n; p++) {
+		ps = &ep->peers[p];
+		slot_read(&ep->slots[p], count);
+		ps->epid = ep->slots[p].epid;
+		ps->transport = ep->slots[p].transport;
+		for (i = 0; i < PSMI_TELEMETRY_NUM_COUNTERS; i++) {
+			/* New slots count from zero */
+			ps->delta[i] = p < ep->num_peers ?
+			    count[i] - ps->count[i] : count[i];
+			ps->count[i] = count[i];
+			ep->total[i] += count[i];
+			ep->delta[i] += ps->delta[i];
+		}
+	}
+	ep->num_peers = n;
+}
+
+static int peer_busier(const void *a, const void *b)
+{
+	const struct peer_sample *pa = a, *pb = b;
+	uint64_t ba = pa->delta[PSMI_TELEMETRY_TX_BYTES] +
+	    pa->delta[PSMI_TELEMETRY_RX_BYTES];
+	uint64_t bb = pb->delta[PSMI_TELEMETRY_TX_BYTES] +
+	    pb->delta[PSMI_TELEMETRY_RX_BYTES];
+
+	return ba < bb ? 1 : ba > bb ? -1 : 0;
+}
+
+static void print_rates(const uint64_t *delta, const uint64_t *count,
+			double secs)
+{
+	printf(" %9.2f %9.2f %9.0f %9.0f %8" PRIu64 " %8" PRIu64
+	       " %8" PRIu64 " %8" PRIu64 " %6" PRIu64 "\n",
+	       delta[PSMI_TELEMETRY_TX_BYTES] / secs / 1e6,
+	       delta[PSMI_TELEMETRY_RX_BYTES] / secs / 1e6,
+	       delta[PSMI_TELEMETRY_TX_MSGS] / secs,
+	       delta[PSMI_TELEMETRY_RX_MSGS] / secs,
+	       count[PSMI_TELEMETRY_REXMIT],
+	       count[PSMI_TELEMETRY_NAK_SENT] + count[PSMI_TELEMETRY_NAK_RECV],
+	       count[PSMI_TELEMETRY_SEND_STALLS],
+	       count[PSMI_TELEMETRY_CCA_CHANGES], delta[PSMI_TELEMETRY_REXMIT]);
+}
+
+static void print_round(struct endpoint *list, double secs, int top_peers,
+			int clear)
+{
+	struct peer_sample *sorted;
+	struct endpoint *ep;
+	uint32_t p;
+
+	if (clear)
+		printf("\033[H\033[2J");
+	printf("%-34s %9s %9s %9s %9s %8s %8s %8s %6s %6s\n",
+	       "host pid epid", "tx MB/s", "rx MB/s", "tx msg/s", "rx msg/s",
+	       "rexmit", "naks", "stalls", "cca", "rex/i");
+
+	for (ep = list; ep != NULL; ep = ep->next) {
+		printf("%-16.16s %7u %9" PRIx64, ep->hdr->hostname,
+		       ep->hdr->pid, ep->hdr->epid);
+		print_rates(ep->delta, ep->total, secs);
+		if (ep->hdr->dropped)
+			printf("  (%u more peers not tracked)\n",
+			       ep->hdr->dropped);
+		if (top_peers == 0 || ep->num_peers == 0)
+			continue;
+
+		/* Sort a copy, the samples stay in slot order for the next
+		 * round's deltas */
+		sorted = malloc(ep->num_peers * sizeof(*sorted));
+		if (sorted == NULL)
+			continue;
+		memcpy(sorted, ep->peers, ep->num_peers * sizeof(*sorted));
+		qsort(sorted, ep->num_peers, sizeof(*sorted), peer_busier);
+		for (p = 0; p < ep->num_peers && p < (uint32_t)top_peers; p++) {
+			printf("  %-4s %-19" PRIx64 " %7s",
+			       transport_name[sorted[p].transport <=
+					      PSMI_TELEMETRY_HFI ?
+					      sorted[p].transport : 0],
+			       sorted[p].epid, "");
+			print_rates(sorted[p].delta, sorted[p].count, secs);
+		}
+		free(sorted);
+	}
+	fflush(stdout);
+}
+
+/* Pick up endpoints that appeared since the last round, drop those whose
+ * page went away */
+static struct endpoint *rescan(struct endpoint *list, const char *dir)
+{
+	struct endpoint *ep, **pep;
+	char pattern[4096];
+	glob_t g;
+	size_t i;
+
+	for (ep = list; ep != NULL; ep = ep->next)
+		ep->seen = 0;
+
+	snprintf(pattern, sizeof(pattern), "%s/" PAGE_PATTERN, dir);
+	if (glob(pattern, 0, NULL, &g) == 0) {
+		for (i = 0; i < g.gl_pathc; i++) {
+			for (ep = list; ep != NULL; ep = ep->next)
+				if (strcmp(ep->path, g.gl_pathv[i]) == 0)
+					break;
+			if (ep == NULL) {
+				ep = endpoint_open(g.gl_pathv[i]);
+				if (ep == NULL)
+					continue;
+				ep->next = list;
+				list = ep;
+			}
+			ep->seen = 1;
+		}
+		globfree(&g);
+	}
+
+	for (pep = &list; *pep != NULL;) {
+		ep = *pep;
+		if (!ep->seen) {
+			*pep = ep->next;
+			endpoint_close(ep);
+		} else
+			pep = &ep->next;
+	}
+	return list;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-d dir] [-i seconds] [-n count] [-p peers] [-b]\n"
+		"  -d  directory holding the stats pages (default %s)\n"
+		"  -i  refresh interval (default 1)\n"
+		"  -n  stop after count refreshes\n"
+		"  -p  also list the busiest peers of each endpoint\n"
+		"  -b  batch mode, don't clear the screen between refreshes\n",
+		prog, DEFAULT_DIR);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	const char *dir = DEFAULT_DIR;
+	struct endpoint *list = NULL, *ep;
+	struct timespec then, now;
+	double interval = 1.0, secs;
+	int count = -1, top_peers = 0, batch = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "d:i:n:p:b")) != -1) {
+		switch (opt) {
+		case 'd':
+			dir = optarg;
+			break;
+		case 'i':
+			interval = atof(optarg);
+			break;
+		case 'n':
+			count = atoi(optarg);
+			break;
+		case 'p':
+			top_peers = atoi(optarg);
+			break;
+		case 'b':
+			batch = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc || interval <= 0)
+		usage(argv[0]);
+	if (!isatty(STDOUT_FILENO))
+		batch = 1;
+
+	/* A first sample so the first round shows rates, not totals */
+	list = rescan(list, dir);
+	for (ep = list; ep != NULL; ep = ep->next)
+		endpoint_sample(ep);
+	clock_gettime(CLOCK_MONOTONIC, &then);
+
+	while (count != 0) {
+		usleep((useconds_t) (interval * 1e6));
+		list = rescan(list, dir);
+		for (ep = list; ep != NULL; ep = ep->next)
+			endpoint_sample(ep);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		secs = (now.tv_sec - then.tv_sec) +
+		    (now.tv_nsec - then.tv_nsec) / 1e9;
+		then = now;
+
+		print_round(list, secs, top_peers, !batch);
+		if (count > 0)
+			count--;
+	}
+
+	while (list != NULL) {
+		ep = list->next;
+		endpoint_close(list);
+		list = ep;
+	}
+	return 0;
+}
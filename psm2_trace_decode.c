@@ -0,0 +1,310 @@
+/*
+
+  This file is provided under a dual BSD/GPLv2 license.  When using or
+  redistributing this file, you may do so under either license.
+
+  GPL LICENSE SUMMARY
+
+  Copyright(c) 2015 Intel Corporation.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of version 2 of the GNU General Public License as
+  published by the Free Software Foundation.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  Contact Information:
+  Intel Corporation, www.intel.com
+
+  BSD LICENSE
+
+  Copyright(c) 2015 Intel Corporation.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the
+      distribution.
+    * Neither the name of Intel Corporation nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+
+/*
+ * psm2_trace_decode: turn the trace files PSM2_TRACE leaves behind into a
+ * Chrome trace (JSON) that chrome://tracing and Perfetto display as a
+ * timeline.  Every endpoint becomes a process lane with one track for MQ
+ * requests and one each for HFI and shared memory packets.  Requests show as
+ * spans from their post to their completion, packets as instants.
+ *
+ *   psm2_trace_decode [-o out.json] file...	decode
+ *   psm2_trace_decode -e|-d file...		resume/pause a running job
+ *
+ * Timestamps are TSC based: files from one node line up, files from several
+ * nodes are each relative to their own clock.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "psm_trace_format.h"
+
+#define TRACK_MQ	0
+#define TRACK_IPS	1
+#define TRACK_SHM	2
+#define NUM_TRACKS	3
+
+struct trace_file {
+	const char *path;
+	void *map;
+	size_t map_len;
+	struct psmi_trace_hdr *hdr;
+	struct psmi_trace_rec *ring;
+	uint64_t first;		/* oldest record still in the ring */
+	uint64_t last;		/* one past the newest */
+};
+
+static const char *track_name[NUM_TRACKS] = { "mq", "hfi", "shm" };
+
+static int trace_open(struct trace_file *tf, const char *path, int writable)
+{
+	struct stat st;
+	int fd;
+
+	tf->path = path;
+	fd = open(path, writable ? O_RDWR : O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+	tf->map_len = st.st_size;
+	if (tf->map_len < PSMI_TRACE_HDR_SIZE) {
+		fprintf(stderr, "%s: not a PSM trace file\n", path);
+		close(fd);
+		return -1;
+	}
+	tf->map = mmap(NULL, tf->map_len,
+		       PROT_READ | (writable ? PROT_WRITE : 0), MAP_SHARED,
+		       fd, 0);
+	close(fd);
+	if (tf->map == MAP_FAILED) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	tf->hdr = (struct psmi_trace_hdr *)tf->map;
+	if (tf->hdr->magic != PSMI_TRACE_MAGIC ||
+	    tf->hdr->version != PSMI_TRACE_VERSION ||
+	    tf->hdr->rec_size != sizeof(struct psmi_trace_rec) ||
+	    tf->map_len < PSMI_TRACE_HDR_SIZE +
+	    tf->hdr->num_recs * sizeof(struct psmi_trace_rec)) {
+		fprintf(stderr, "%s: not a PSM trace file or wrong version\n",
+			path);
+		munmap(tf->map, tf->map_len);
+		return -1;
+	}
+	tf->ring = (struct psmi_trace_rec *)
+	    ((uintptr_t) tf->map + PSMI_TRACE_HDR_SIZE);
+
+	tf->last = tf->hdr->head;
+	tf->first = tf->last > tf->hdr->num_recs ?
+	    tf->last - tf->hdr->num_recs : 0;
+	return 0;
+}
+
+static const struct psmi_trace_rec *
+trace_rec(const struct trace_file *tf, uint64_t i)
+{
+	return &tf->ring[i & (tf->hdr->num_recs - 1)];
+}
+
+static void
+print_event(FILE *out, int *nevents, const struct trace_file *tf, int fidx,
+	    const struct psmi_trace_rec *rec, uint64_t base)
+{
+	double ts = (double)(rec->cycles - base) *
+	    tf->hdr->pico_per_cycle / 1e6;
+	int pid = fidx + 1;
+	const char *sep = (*nevents)++ ? ",\n" : "";
+
+	switch (rec->event) {
+	case PSMI_TRACE_MQ_SEND_POST:
+	case PSMI_TRACE_MQ_RECV_POST:
+		fprintf(out, "%s{\"name\":\"%s\",\"cat\":\"mq\",\"ph\":\"b\","
+			"\"id\":\"%d.%" PRIu32 "\",\"pid\":%d,\"tid\":%d,"
+			"\"ts\":%.3f,\"args\":{\"peer\":\"0x%" PRIx64 "\","
+			"\"len\":%" PRIu32 ",\"tag0\":\"0x%" PRIx32 "\"}}",
+			sep, rec->event == PSMI_TRACE_MQ_SEND_POST ?
+			"send" : "recv", fidx, rec->id, pid, TRACK_MQ, ts,
+			rec->peer, rec->len, rec->seq);
+		break;
+	case PSMI_TRACE_MQ_SEND_DONE:
+	case PSMI_TRACE_MQ_RECV_DONE:
+		fprintf(out, "%s{\"name\":\"%s\",\"cat\":\"mq\",\"ph\":\"e\","
+			"\"id\":\"%d.%" PRIu32 "\",\"pid\":%d,\"tid\":%d,"
+			"\"ts\":%.3f,\"args\":{\"len\":%" PRIu32 "}}",
+			sep, rec->event == PSMI_TRACE_MQ_SEND_DONE ?
+			"send" : "recv", fidx, rec->id, pid, TRACK_MQ, ts,
+			rec->len);
+		break;
+	case PSMI_TRACE_IPS_TX:
+	case PSMI_TRACE_IPS_RX:
+		fprintf(out, "%s{\"name\":\"%s 0x%x\",\"cat\":\"hfi\","
+			"\"ph\":\"i\",\"s\":\"t\",\"pid\":%d,\"tid\":%d,"
+			"\"ts\":%.3f,\"args\":{\"peer\":\"0x%" PRIx64 "\","
+			"\"len\":%" PRIu32 ",\"psn\":%" PRIu32 ","
+			"\"flow\":%" PRIu32 "}}",
+			sep, rec->event == PSMI_TRACE_IPS_TX ? "tx" : "rx",
+			rec->opcode, pid, TRACK_IPS, ts, rec->peer, rec->len,
+			rec->seq, rec->id);
+		break;
+	case PSMI_TRACE_SHM_TX:
+	case PSMI_TRACE_SHM_RX:
+		fprintf(out, "%s{\"name\":\"%s am %u\",\"cat\":\"shm\","
+			"\"ph\":\"i\",\"s\":\"t\",\"pid\":%d,\"tid\":%d,"
+			"\"ts\":%.3f,\"args\":{\"peer\":\"0x%" PRIx64 "\","
+			"\"len\":%" PRIu32 ",\"type\":%" PRIu32 "}}",
+			sep, rec->event == PSMI_TRACE_SHM_TX ? "tx" : "rx",
+			rec->opcode, pid, TRACK_SHM, ts, rec->peer, rec->len,
+			rec->seq);
+		break;
+	default:
+		/* Slot overwritten while we read a live file */
+		(*nevents)--;
+		break;
+	}
+}
+
+static void print_metadata(FILE *out, int *nevents,
+			   const struct trace_file *tf, int fidx)
+{
+	int t;
+
+	fprintf(out, "%s{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+		"\"args\":{\"name\":\"%.64s pid %" PRIu32 " ep 0x%" PRIx64
+		"\"}}", (*nevents)++ ? ",\n" : "", fidx + 1,
+		tf->hdr->hostname, tf->hdr->pid, tf->hdr->epid);
+	for (t = 0; t < NUM_TRACKS; t++)
+		fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\","
+			"\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+			fidx + 1, t, track_name[t]);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-o out.json] file...\n"
+		"       %s -e|-d file...\n"
+		"  -o  write the Chrome trace to a file instead of stdout\n"
+		"  -e  resume recording into the given (live) trace files\n"
+		"  -d  pause recording into the given (live) trace files\n",
+		prog, prog);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	struct trace_file *tf;
+	FILE *out = stdout;
+	int toggle = -1, nfiles = 0, nevents = 0;
+	uint64_t base = UINT64_MAX, i;
+	int c, f;
+
+	while ((c = getopt(argc, argv, "edo:h")) != -1) {
+		switch (c) {
+		case 'e':
+			toggle = 1;
+			break;
+		case 'd':
+			toggle = 0;
+			break;
+		case 'o':
+			out = fopen(optarg, "w");
+			if (out == NULL) {
+				fprintf(stderr, "%s: %s\n", optarg,
+					strerror(errno));
+				return 1;
+			}
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind == argc)
+		usage(argv[0]);
+
+	tf = calloc(argc - optind, sizeof(*tf));
+	if (tf == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	for (f = optind; f < argc; f++) {
+		if (trace_open(&tf[nfiles], argv[f], toggle != -1))
+			continue;
+		if (toggle != -1) {
+			tf[nfiles].hdr->enabled = toggle;
+			munmap(tf[nfiles].map, tf[nfiles].map_len);
+			continue;
+		}
+		/* Post records are written after the fact, the oldest record
+		 * isn't necessarily the earliest */
+		for (i = tf[nfiles].first; i < tf[nfiles].last; i++)
+			if (trace_rec(&tf[nfiles], i)->cycles < base)
+				base = trace_rec(&tf[nfiles], i)->cycles;
+		nfiles++;
+	}
+	if (toggle != -1)
+		return 0;
+	if (base == UINT64_MAX)
+		base = 0;
+
+	fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+	for (f = 0; f < nfiles; f++) {
+		print_metadata(out, &nevents, &tf[f], f);
+		for (i = tf[f].first; i < tf[f].last; i++)
+			print_event(out, &nevents, &tf[f], f,
+				    trace_rec(&tf[f], i), base);
+		if (tf[f].first > 0)
+			fprintf(stderr, "%s: ring wrapped, %" PRIu64
+				" oldest records lost\n", tf[f].path,
+				tf[f].first);
+		munmap(tf[f].map, tf[f].map_len);
+	}
+	fprintf(out, "\n]}\n");
+
+	if (out != stdout)
+		fclose(out);
+	free(tf);
+	return 0;
+}
@@ -84,6 +84,8 @@ static void psmi_am_min_parameters(struct psm2_am_parameters *dest,
 	    min(dest->max_request_short, src->max_request_short);
 	dest->max_reply_short =
 	    min(dest->max_reply_short, src->max_reply_short);
+	dest->max_request_long =
+	    min(dest->max_request_long, src->max_request_long);
 }
 
 psm2_error_t psmi_am_init_internal(psm2_ep_t ep)
@@ -96,6 +98,7 @@ psm2_error_t psmi_am_init_internal(psm2_ep_t ep)
 	psmi_am_parameters.max_nargs = INT_MAX;
 	psmi_am_parameters.max_request_short = INT_MAX;
 	psmi_am_parameters.max_reply_short = INT_MAX;
+	psmi_am_parameters.max_request_long = INT_MAX;
 
 	if (psmi_ep_device_is_enabled(ep, PTL_DEVID_SELF)) {
 		ep->ptl_self.am_get_parameters(ep, &params);
@@ -122,6 +125,16 @@ psm2_error_t psmi_am_init_internal(psm2_ep_t ep)
 	for (i = 0; i < PSMI_AM_NUM_HANDLERS; i++)
 		am_htable[i] = _ignore_handler;
 
+	/* Registration skips these since they're not _ignore_handler */
+	am_htable[PSMI_AM_RMA_PUT_HIDX] = psmi_rma_put_handler;
+	am_htable[PSMI_AM_RMA_GET_HIDX] = psmi_rma_get_handler;
+	am_htable[PSMI_AM_RMA_DONE_HIDX] = psmi_rma_done_handler;
+	am_htable[PSMI_AM_ATOMIC_HIDX] = psmi_atomic_handler;
+	am_htable[PSMI_AM_ATOMIC_DONE_HIDX] = psmi_atomic_done_handler;
+	psmi_am_parameters.max_handlers =
+	    min(psmi_am_parameters.max_handlers,
+		PSMI_AM_NUM_HANDLERS - PSMI_AM_NUM_INTERNAL);
+
 	return PSM2_OK;
 }
 
@@ -190,6 +203,37 @@ __psm2_am_request_short(psm2_epaddr_t epaddr, psm2_handler_t handler,
 }
 PSMI_API_DECL(psm2_am_request_short)
 
+psm2_error_t
+__psm2_am_request_long(psm2_epaddr_t epaddr, psm2_handler_t handler,
+		      psm2_amarg_t *args, int nargs, void *src, size_t len,
+		      void *dest, int flags,
+		      psm2_am_completion_fn_t completion_fn,
+		      void *completion_ctxt)
+{
+	psm2_error_t err;
+	ptl_ctl_t *ptlc = epaddr->ptlctl;
+
+	PSM2_LOG_MSG("entering");
+	PSMI_ASSERT_INITIALIZED();
+	psmi_assert(epaddr != NULL);
+	psmi_assert(handler >= 0 && handler < psmi_am_parameters.max_handlers);
+	psmi_assert(nargs >= 0 && nargs <= psmi_am_parameters.max_nargs);
+	psmi_assert(nargs > 0 ? args != NULL : 1);
+	psmi_assert(len >= 0 && len <= psmi_am_parameters.max_request_long);
+	psmi_assert(len > 0 ? (src != NULL && dest != NULL) : 1);
+
+	PSMI_PLOCK();
+
+	err = ptlc->am_long_request(epaddr, handler, args,
+				    nargs, src, len, dest, flags,
+				    completion_fn, completion_ctxt);
+	PSMI_PUNLOCK();
+	PSM2_LOG_MSG("leaving");
+
+	return err;
+}
+PSMI_API_DECL(psm2_am_request_long)
+
 psm2_error_t
 __psm2_am_reply_short(psm2_am_token_t token, psm2_handler_t handler,
 		     psm2_amarg_t *args, int nargs, void *src, size_t len,
@@ -226,6 +270,43 @@ __psm2_am_reply_short(psm2_am_token_t token, psm2_handler_t handler,
 }
 PSMI_API_DECL(psm2_am_reply_short)
 
+psm2_error_t
+__psm2_am_reply_long(psm2_am_token_t token, psm2_handler_t handler,
+		    psm2_amarg_t *args, int nargs, void *src, size_t len,
+		    void *dest, int flags,
+		    psm2_am_completion_fn_t completion_fn,
+		    void *completion_ctxt)
+{
+	psm2_error_t err;
+	struct psmi_am_token *tok;
+	psm2_epaddr_t epaddr;
+	ptl_ctl_t *ptlc;
+
+	PSM2_LOG_MSG("entering");
+	PSMI_ASSERT_INITIALIZED();
+	psmi_assert_always(token != NULL);
+	psmi_assert(handler >= 0 && handler < psmi_am_parameters.max_handlers);
+	psmi_assert(nargs >= 0 && nargs <= psmi_am_parameters.max_nargs);
+	psmi_assert(nargs > 0 ? args != NULL : 1);
+	psmi_assert(len >= 0 && len <= psmi_am_parameters.max_request_long);
+	psmi_assert(len > 0 ? (src != NULL && dest != NULL) : 1);
+
+	tok = (struct psmi_am_token *)token;
+	epaddr = tok->epaddr_from;
+	ptlc = epaddr->ptlctl;
+
+	/* No locking here since we are already within handler context and already
+	 * locked */
+
+	err = ptlc->am_long_reply(token, handler, args,
+				  nargs, src, len, dest, flags, completion_fn,
+				  completion_ctxt);
+	PSM2_LOG_MSG("leaving");
+
+	return err;
+}
+PSMI_API_DECL(psm2_am_reply_long)
+
 psm2_error_t __psm2_am_get_source(psm2_am_token_t token, psm2_epaddr_t *epaddr_out)
 {
 	struct psmi_am_token *tok;
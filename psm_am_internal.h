@@ -87,7 +87,50 @@ PSMI_ALWAYS_INLINE(psm2_am_handler_fn_t
 	return fn;
 }
 
+/* The top of the handler table is kept for PSM's own use of AM, users
+ * register handlers below it. */
+#define PSMI_AM_RMA_PUT_HIDX		(PSMI_AM_NUM_HANDLERS - 1)
+#define PSMI_AM_RMA_GET_HIDX		(PSMI_AM_NUM_HANDLERS - 2)
+#define PSMI_AM_RMA_DONE_HIDX		(PSMI_AM_NUM_HANDLERS - 3)
+#define PSMI_AM_ATOMIC_HIDX		(PSMI_AM_NUM_HANDLERS - 4)
+#define PSMI_AM_ATOMIC_DONE_HIDX	(PSMI_AM_NUM_HANDLERS - 5)
+#define PSMI_AM_NUM_INTERNAL		5
+
 /* PSM internal initialization */
 psm2_error_t psmi_am_init_internal(psm2_ep_t ep);
 
+/* One-sided RMA over long AM, psm_rma.c */
+int psmi_rma_put_handler(PSMI_AM_ARGS_DEFAULT);
+int psmi_rma_get_handler(PSMI_AM_ARGS_DEFAULT);
+int psmi_rma_done_handler(PSMI_AM_ARGS_DEFAULT);
+int psmi_atomic_handler(PSMI_AM_ARGS_DEFAULT);
+int psmi_atomic_done_handler(PSMI_AM_ARGS_DEFAULT);
+int psmi_rma_put_dest_ok(psm2_ep_t ep, psm2_amarg_t *args, int nargs,
+			 const void *dest, size_t len);
+void psmi_rma_fini(psm2_ep_t ep);
+
+/*
+ * The origin of a long request names the destination of its payload.  The
+ * RMA put handler only accepts registered regions, so the target checks
+ * such requests before any of the payload lands.  Transports must not let
+ * the origin write straight into the target for them.
+ */
+PSMI_ALWAYS_INLINE(
+int
+psmi_am_long_dest_checked(psm2_handler_t handler))
+{
+	return (handler & (PSMI_AM_NUM_HANDLERS - 1)) == PSMI_AM_RMA_PUT_HIDX;
+}
+
+PSMI_ALWAYS_INLINE(
+int
+psmi_am_long_dest_ok(psm2_ep_t ep, psm2_handler_t handler,
+		     psm2_amarg_t *args, int nargs, const void *dest,
+		     size_t len))
+{
+	if_pf(psmi_am_long_dest_checked(handler))
+		return psmi_rma_put_dest_ok(ep, args, nargs, dest, len);
+	return 1;
+}
+
 #endif
@@ -0,0 +1,825 @@
+/*
+
+  This file is provided under a dual BSD/GPLv2 license.  When using or
+  redistributing this file, you may do so under either license.
+
+  GPL LICENSE SUMMARY
+
+  Copyright(c) 2015 Intel Corporation.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of version 2 of the GNU General Public License as
+  published by the Free Software Foundation.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  Contact Information:
+  Intel Corporation, www.intel.com
+
+  BSD LICENSE
+
+  Copyright(c) 2015 Intel Corporation.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the
+      distribution.
+    * Neither the name of Intel Corporation nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <immintrin.h>
+
+#include "psm_user.h"
+#include "psm2_coll.h"
+
+/*
+ * Node-local collectives.
+ *
+ * Members of a group map one shared region made of a header and one slot
+ * per member.  A slot holds the barrier flags its owner is signalled
+ * through, the broadcast counters its owner publishes, and a data area:
+ * the first half carries the owner's contributions to a reduction or its
+ * broadcast chunks, the second half the share of a reduction's result the
+ * owner computed.
+ *
+ * Every flag is a counter that only ever grows, members keep their own
+ * copy of the expected values, so nothing needs resetting between
+ * collectives.  Slots are reused across collectives without extra
+ * synchronization: a reduction overwrites posted data only after the
+ * barrier that follows everyone's reduce step, and results only after the
+ * barrier that opens the next reduction, which members enter once they
+ * gathered the previous one.  Broadcast chunks are flow controlled by the
+ * readers' acknowledgements, and carry the root's status so that a root
+ * that failed to get the data stops everybody with the same error.
+ *
+ * Hierarchical groups wrap the node-local collectives around an exchange
+ * between the leaders of all nodes (local rank 0), over MQ messages tagged
+ * with the group, an operation sequence number and the step of the
+ * schedule.  Leaders run a dissemination barrier, and reduce up and
+ * broadcast down binomial trees.
+ */
+
+#define PSMI_COLL_SLOTSZ	65536	/* data bytes per member */
+#define PSMI_COLL_ROUNDS	16	/* barrier rounds, 2^16 members */
+#define PSMI_COLL_SPINS		64	/* flag reads between progress polls */
+#define PSMI_COLL_NET_MAX	(1UL << 30)	/* bytes per leader message */
+#define PSMI_COLL_JOIN_TIMEOUT	60	/* seconds, see PSM2_COLL_TIMEOUT */
+
+struct coll_hdr {
+	volatile uint32_t nattached;
+	volatile uint32_t nranks;
+	volatile uint32_t aborted;	/* a member gave up joining */
+} __attribute__ ((aligned(64)));
+
+struct coll_slot {
+	/* Set by the peer that signals the owner in each barrier round */
+	volatile uint64_t barrier[PSMI_COLL_ROUNDS];
+
+	/* Set by the owner only */
+	volatile uint64_t bcast_seq;	/* chunks published as root */
+	volatile uint64_t bcast_ack;	/* chunks consumed */
+	volatile uint32_t bcast_status[2];	/* root's status per chunk */
+
+	uint8_t data[PSMI_COLL_SLOTSZ] __attribute__ ((aligned(64)));
+} __attribute__ ((aligned(64)));
+
+struct psm2_coll {
+	psm2_ep_t ep;
+	int nranks;
+	int rank;
+	struct coll_hdr *hdr;
+	struct coll_slot *slots;
+	size_t segsz;
+
+	uint64_t barrier_seq;	/* barriers entered */
+	uint64_t bcast_seq;	/* broadcast chunks, identical on all members */
+
+	/* Hierarchical groups */
+	int hier;
+	int nnodes;
+	int node_rank;
+	psm2_mq_t mq;		/* leaders only */
+	psm2_epaddr_t *leaders;	/* leaders only, by node rank */
+	uint32_t tag2;
+	uint32_t net_seq;	/* leader operations, identical on all leaders */
+};
+
+/*
+ * Wait for a counter to reach val.  Flags are read a few times between
+ * polls of the end-point, so that a member that waits does not hold up
+ * point-to-point traffic that the others may depend on.
+ */
+static void
+coll_wait(struct psm2_coll *coll, volatile uint64_t *flag, uint64_t val)
+{
+	psm2_ep_t ep = coll->ep;
+	int spins = 0, noprog = 0;
+
+	while (*flag < val) {
+		if (++spins < PSMI_COLL_SPINS)
+			continue;
+		spins = 0;
+
+		PSMI_PLOCK();
+		if (psmi_poll_internal(ep, 1) == PSM2_OK_NO_PROGRESS) {
+			if (++noprog == ep->yield_spin_cnt) {
+				noprog = 0;
+				PSMI_PYIELD();
+			}
+		} else
+			noprog = 0;
+		PSMI_PUNLOCK();
+	}
+	ips_sync_reads();
+}
+
+/* Dissemination barrier, ceil(log2(nranks)) rounds */
+static void coll_barrier(struct psm2_coll *coll)
+{
+	uint64_t seq = ++coll->barrier_seq;
+	int round, dist;
+
+	ips_wmb();
+	for (round = 0, dist = 1; dist < coll->nranks; round++, dist <<= 1) {
+		int peer = (coll->rank + dist) % coll->nranks;
+
+		coll->slots[peer].barrier[round] = seq;
+		coll_wait(coll, &coll->slots[coll->rank].barrier[round], seq);
+	}
+}
+
+/*
+ * Reduction kernels, dst[i] = dst[i] op src[i]
+ */
+#ifdef __AVX2__
+typedef __m256d coll_vpd_t;
+typedef __m256i coll_vsi_t;
+#define coll_ld_pd(p)		_mm256_loadu_pd((const double *)(p))
+#define coll_st_pd(p, v)	_mm256_storeu_pd((double *)(p), v)
+#define coll_ld_si(p)		_mm256_loadu_si256((const __m256i *)(p))
+#define coll_st_si(p, v)	_mm256_storeu_si256((__m256i *)(p), v)
+#define coll_add_pd		_mm256_add_pd
+#define coll_min_pd		_mm256_min_pd
+#define coll_max_pd		_mm256_max_pd
+#define coll_add_epi32		_mm256_add_epi32
+#define coll_min_epi32		_mm256_min_epi32
+#define coll_max_epi32		_mm256_max_epi32
+#define coll_add_epi64		_mm256_add_epi64
+#else
+typedef __m128d coll_vpd_t;
+typedef __m128i coll_vsi_t;
+#define coll_ld_pd(p)		_mm_loadu_pd((const double *)(p))
+#define coll_st_pd(p, v)	_mm_storeu_pd((double *)(p), v)
+#define coll_ld_si(p)		_mm_loadu_si128((const __m128i *)(p))
+#define coll_st_si(p, v)	_mm_storeu_si128((__m128i *)(p), v)
+#define coll_add_pd		_mm_add_pd
+#define coll_min_pd		_mm_min_pd
+#define coll_max_pd		_mm_max_pd
+#define coll_add_epi32		_mm_add_epi32
+#define coll_min_epi32		_mm_min_epi32
+#define coll_max_epi32		_mm_max_epi32
+#define coll_add_epi64		_mm_add_epi64
+#endif
+
+#define COLL_SUM(a, b)	((a) + (b))
+#define COLL_MIN(a, b)	((a) < (b) ? (a) : (b))
+#define COLL_MAX(a, b)	((a) > (b) ? (a) : (b))
+
+#define COLL_KERNEL(name, type, vtype, ld, st, vop, sop)		\
+static void								\
+coll_reduce_##name(void *vdst, const void *vsrc, size_t n)		\
+{									\
+	type *dst = (type *) vdst;					\
+	const type *src = (const type *) vsrc;				\
+	const size_t w = sizeof(vtype) / sizeof(type);			\
+	size_t i = 0;							\
+									\
+	for (; i + w <= n; i += w)					\
+		st(dst + i, vop(ld(dst + i), ld(src + i)));		\
+	for (; i < n; i++)						\
+		dst[i] = sop(dst[i], src[i]);				\
+}
+
+/* No 64-bit integer min/max below AVX-512, leave those to the compiler */
+#define COLL_SCALAR_KERNEL(name, type, sop)				\
+static void								\
+coll_reduce_##name(void *vdst, const void *vsrc, size_t n)		\
+{									\
+	type *dst = (type *) vdst;					\
+	const type *src = (const type *) vsrc;				\
+	size_t i;							\
+									\
+	for (i = 0; i < n; i++)						\
+		dst[i] = sop(dst[i], src[i]);				\
+}
+
+COLL_KERNEL(sum_int32, int32_t, coll_vsi_t, coll_ld_si, coll_st_si,
+	    coll_add_epi32, COLL_SUM)
+COLL_KERNEL(min_int32, int32_t, coll_vsi_t, coll_ld_si, coll_st_si,
+	    coll_min_epi32, COLL_MIN)
+COLL_KERNEL(max_int32, int32_t, coll_vsi_t, coll_ld_si, coll_st_si,
+	    coll_max_epi32, COLL_MAX)
+COLL_KERNEL(sum_int64, int64_t, coll_vsi_t, coll_ld_si, coll_st_si,
+	    coll_add_epi64, COLL_SUM)
+COLL_SCALAR_KERNEL(min_int64, int64_t, COLL_MIN)
+COLL_SCALAR_KERNEL(max_int64, int64_t, COLL_MAX)
+COLL_KERNEL(sum_double, double, coll_vpd_t, coll_ld_pd, coll_st_pd,
+	    coll_add_pd, COLL_SUM)
+COLL_KERNEL(min_double, double, coll_vpd_t, coll_ld_pd, coll_st_pd,
+	    coll_min_pd, COLL_MIN)
+COLL_KERNEL(max_double, double, coll_vpd_t, coll_ld_pd, coll_st_pd,
+	    coll_max_pd, COLL_MAX)
+
+typedef void (*coll_kernel_fn_t) (void *dst, const void *src, size_t n);
+
+static const coll_kernel_fn_t
+coll_kernels[3][3] = {
+	[PSM2_COLL_TYPE_INT32] = {
+		[PSM2_COLL_OP_SUM] = coll_reduce_sum_int32,
+		[PSM2_COLL_OP_MIN] = coll_reduce_min_int32,
+		[PSM2_COLL_OP_MAX] = coll_reduce_max_int32,
+	},
+	[PSM2_COLL_TYPE_INT64] = {
+		[PSM2_COLL_OP_SUM] = coll_reduce_sum_int64,
+		[PSM2_COLL_OP_MIN] = coll_reduce_min_int64,
+		[PSM2_COLL_OP_MAX] = coll_reduce_max_int64,
+	},
+	[PSM2_COLL_TYPE_DOUBLE] = {
+		[PSM2_COLL_OP_SUM] = coll_reduce_sum_double,
+		[PSM2_COLL_OP_MIN] = coll_reduce_min_double,
+		[PSM2_COLL_OP_MAX] = coll_reduce_max_double,
+	},
+};
+
+static const size_t coll_type_size[3] = {
+	[PSM2_COLL_TYPE_INT32] = sizeof(int32_t),
+	[PSM2_COLL_TYPE_INT64] = sizeof(int64_t),
+	[PSM2_COLL_TYPE_DOUBLE] = sizeof(double),
+};
+
+static psm2_error_t
+coll_init(psm2_ep_t ep, uint32_t group_id, int node_rank, int nranks,
+	  int rank, struct psm2_coll **coll_o)
+{
+	struct psm2_coll *coll;
+	char uuid_str[64], shmname[256];
+	union psmi_envvar_val env_timeout;
+	uint64_t t_start, timeout;
+	struct stat st;
+	size_t segsz;
+	void *mapptr;
+	uint32_t old;
+	int shmfd;
+	psm2_error_t err = PSM2_OK;
+
+	if (coll_o == NULL || nranks < 1 || rank < 0 || rank >= nranks ||
+	    nranks > (1 << PSMI_COLL_ROUNDS)) {
+		err = psmi_handle_error(ep, PSM2_PARAM_ERR,
+					"Invalid collective group parameters");
+		goto fail;
+	}
+
+	coll = psmi_calloc(ep, UNDEFINED, 1, sizeof(struct psm2_coll));
+	if (coll == NULL) {
+		err = PSM2_NO_MEMORY;
+		goto fail;
+	}
+
+	psmi_uuid_unparse(ep->uuid, uuid_str);
+	snprintf(shmname, sizeof(shmname), "/psm2_coll.%ld.%s.%u.%d",
+		 (long int) getuid(), uuid_str, group_id, node_rank);
+	segsz = sizeof(struct coll_hdr) + nranks * sizeof(struct coll_slot);
+
+	shmfd = shm_open(shmname, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+	if (shmfd < 0) {
+		err = psmi_handle_error(ep, PSM2_SHMEM_SEGMENT_ERR,
+					"Error creating collective shared "
+					"memory object %s: %s", shmname,
+					strerror(errno));
+		goto fail_free;
+	}
+	/* Only ever grow the region, a member joining with the wrong size
+	 * must not pull it from under the others */
+	if (fstat(shmfd, &st) != 0 ||
+	    ((size_t) st.st_size < segsz && ftruncate(shmfd, segsz) != 0)) {
+		err = psmi_handle_error(ep, PSM2_SHMEM_SEGMENT_ERR,
+					"Error setting size of collective "
+					"shared memory object to %lu bytes: %s",
+					(unsigned long) segsz, strerror(errno));
+		close(shmfd);
+		goto fail_free;
+	}
+	mapptr = mmap(NULL, segsz, PROT_READ | PROT_WRITE, MAP_SHARED,
+		      shmfd, 0);
+	close(shmfd);
+	if (mapptr == MAP_FAILED) {
+		err = psmi_handle_error(ep, PSM2_SHMEM_SEGMENT_ERR,
+					"Error mmapping collective shared "
+					"memory: %s", strerror(errno));
+		goto fail_free;
+	}
+
+	coll->ep = ep;
+	coll->nranks = nranks;
+	coll->rank = rank;
+	coll->hdr = (struct coll_hdr *) mapptr;
+	coll->slots = (struct coll_slot *) (coll->hdr + 1);
+	coll->segsz = segsz;
+	coll->nnodes = 1;
+	coll->tag2 = PSM2_COLL_MQ_TAG2 | (group_id & 0xffff);
+
+	/* The first member to get here fixes the group size */
+	old = __sync_val_compare_and_swap(&coll->hdr->nranks, 0, nranks);
+	if (old != 0 && old != nranks) {
+		err = psmi_handle_error(ep, PSM2_PARAM_ERR,
+					"Collective group %u joined with %d "
+					"members, expected %u", group_id,
+					nranks, old);
+		goto fail_abort;
+	}
+
+	psmi_getenv("PSM2_COLL_TIMEOUT",
+		    "Seconds to wait for all members of a collective group "
+		    "to join, 0 for no time-out",
+		    PSMI_ENVVAR_LEVEL_USER, PSMI_ENVVAR_TYPE_UINT,
+		    (union psmi_envvar_val)PSMI_COLL_JOIN_TIMEOUT,
+		    &env_timeout);
+	timeout = (uint64_t) env_timeout.e_uint * SEC_ULL;
+
+	/* Everybody has the region mapped once all are counted in, the name
+	 * is no longer needed and the region goes away with its mappings */
+	__sync_fetch_and_add(&coll->hdr->nattached, 1);
+	t_start = get_cycles();
+	while (coll->hdr->nattached < nranks) {
+		if (coll->hdr->aborted) {
+			err = psmi_handle_error(ep, PSM2_TIMEOUT,
+						"Collective group %u abandoned "
+						"by a member while joining",
+						group_id);
+			goto fail_detach;
+		}
+		if (!psmi_cycles_left(t_start, timeout)) {
+			err = psmi_handle_error(ep, PSM2_TIMEOUT,
+						"Collective group %u: %u of %d "
+						"members joined after %u "
+						"seconds", group_id,
+						coll->hdr->nattached, nranks,
+						env_timeout.e_uint);
+			goto fail_detach;
+		}
+		PSMI_PLOCK();
+		psmi_poll_internal(ep, 1);
+		PSMI_PUNLOCK();
+	}
+	if (rank == 0)
+		shm_unlink(shmname);
+
+	*coll_o = coll;
+	return PSM2_OK;
+
+	/* Members still waiting give up too, and the name goes so that the
+	 * group can be created afresh */
+fail_detach:
+	__sync_fetch_and_sub(&coll->hdr->nattached, 1);
+fail_abort:
+	coll->hdr->aborted = 1;
+	shm_unlink(shmname);
+	munmap(mapptr, segsz);
+fail_free:
+	psmi_free(coll);
+fail:
+	return err;
+}
+
+psm2_error_t
+__psm2_coll_init(psm2_ep_t ep, uint32_t group_id, int nranks, int rank,
+		 psm2_coll_t *coll_o)
+{
+	psm2_error_t err;
+
+	PSM2_LOG_MSG("entering");
+	PSMI_ERR_UNLESS_INITIALIZED(ep);
+	err = coll_init(ep, group_id, 0, nranks, rank, coll_o);
+	PSM2_LOG_MSG("leaving");
+	return err;
+}
+PSMI_API_DECL(psm2_coll_init)
+
+psm2_error_t
+__psm2_coll_init_hier(psm2_ep_t ep, psm2_mq_t mq, uint32_t group_id,
+		      int nranks, int rank, const psm2_epaddr_t *leaders,
+		      int nnodes, int node_rank, psm2_coll_t *coll_o)
+{
+	struct psm2_coll *coll;
+	psm2_error_t err;
+
+	PSM2_LOG_MSG("entering");
+	PSMI_ERR_UNLESS_INITIALIZED(ep);
+
+	if (nnodes < 1 || node_rank < 0 || node_rank >= nnodes ||
+	    (rank == 0 && nnodes > 1 && (mq == NULL || leaders == NULL))) {
+		err = psmi_handle_error(ep, PSM2_PARAM_ERR,
+					"Invalid %s parameters", __FUNCTION__);
+		goto fail;
+	}
+
+	err = coll_init(ep, group_id, node_rank, nranks, rank, &coll);
+	if (err != PSM2_OK)
+		goto fail;
+
+	coll->hier = nnodes > 1;
+	coll->nnodes = nnodes;
+	coll->node_rank = node_rank;
+	if (coll->hier && rank == 0) {
+		coll->leaders = psmi_malloc(ep, UNDEFINED,
+					    nnodes * sizeof(psm2_epaddr_t));
+		if (coll->leaders == NULL) {
+			munmap(coll->hdr, coll->segsz);
+			psmi_free(coll);
+			err = PSM2_NO_MEMORY;
+			goto fail;
+		}
+		memcpy(coll->leaders, leaders, nnodes * sizeof(psm2_epaddr_t));
+		coll->mq = mq;
+	}
+	*coll_o = coll;
+
+fail:
+	PSM2_LOG_MSG("leaving");
+	return err;
+}
+PSMI_API_DECL(psm2_coll_init_hier)
+
+/*
+ * Leader messages.  Every leader operation takes a new sequence number,
+ * the step of its schedule tells apart messages within an operation.
+ */
+static psm2_error_t
+coll_net_post(struct psm2_coll *coll, int node, uint32_t step, void *buf,
+	      size_t len, int is_send, psm2_mq_req_t *req)
+{
+	psm2_mq_tag_t tag, tagsel;
+
+	psmi_assert(len <= PSMI_COLL_NET_MAX);
+	tag.tag[0] = coll->net_seq;
+	tag.tag[1] = step;
+	tag.tag[2] = coll->tag2;
+	if (is_send)
+		return psm2_mq_isend2(coll->mq, coll->leaders[node], 0, &tag,
+				      buf, len, NULL, req);
+
+	memset(&tagsel, 0xff, sizeof(tagsel));
+	return psm2_mq_irecv2(coll->mq, coll->leaders[node], &tag, &tagsel, 0,
+			      buf, len, NULL, req);
+}
+
+static psm2_error_t
+coll_net_xfer(struct psm2_coll *coll, int node, uint32_t step, void *buf,
+	      size_t len, int is_send)
+{
+	psm2_mq_req_t req;
+	psm2_error_t err;
+
+	err = coll_net_post(coll, node, step, buf, len, is_send, &req);
+	if (err == PSM2_OK)
+		err = psm2_mq_wait2(&req, NULL);
+	return err;
+}
+
+static psm2_error_t coll_net_barrier(struct psm2_coll *coll)
+{
+	int n = coll->nnodes, r = coll->node_rank;
+	psm2_mq_req_t sreq, rreq;
+	psm2_error_t err = PSM2_OK;
+	uint32_t step;
+	int dist;
+
+	coll->net_seq++;
+	for (step = 0, dist = 1; dist < n; step++, dist <<= 1) {
+		err = coll_net_post(coll, (r + n - dist) % n, step, NULL, 0, 0,
+				    &rreq);
+		if (err != PSM2_OK)
+			break;
+		err = coll_net_post(coll, (r + dist) % n, step, NULL, 0, 1,
+				    &sreq);
+		if (err == PSM2_OK)
+			err = psm2_mq_wait2(&sreq, NULL);
+		if (err == PSM2_OK)
+			err = psm2_mq_wait2(&rreq, NULL);
+		if (err != PSM2_OK)
+			break;
+	}
+	return err;
+}
+
+/* Binomial tree broadcast among leaders, rooted at node root */
+static psm2_error_t
+coll_net_bcast(struct psm2_coll *coll, void *buf, size_t len, int root)
+{
+	int n = coll->nnodes;
+	int vr = (coll->node_rank - root + n) % n;
+	psm2_error_t err = PSM2_OK;
+	int mask;
+
+	coll->net_seq++;
+	for (mask = 1; mask < n; mask <<= 1) {
+		if (vr & mask) {
+			err = coll_net_xfer(coll, (vr - mask + root) % n, mask,
+					    buf, len, 0);
+			if (err != PSM2_OK)
+				return err;
+			break;
+		}
+	}
+	for (mask >>= 1; mask > 0; mask >>= 1) {
+		if (vr + mask < n) {
+			err = coll_net_xfer(coll, (vr + mask + root) % n, mask,
+					    buf, len, 1);
+			if (err != PSM2_OK)
+				break;
+		}
+	}
+	return err;
+}
+
+/* Binomial tree reduction to node 0 followed by a broadcast from it, every
+ * node ends up with the same result whatever the op */
+static psm2_error_t
+coll_net_allreduce(struct psm2_coll *coll, void *buf, size_t count,
+		   size_t esz, coll_kernel_fn_t kernel)
+{
+	int n = coll->nnodes, r = coll->node_rank;
+	psm2_error_t err = PSM2_OK;
+	void *tmp;
+	int mask;
+
+	tmp = psmi_malloc(coll->ep, UNDEFINED, count * esz);
+	if (tmp == NULL)
+		return PSM2_NO_MEMORY;
+
+	coll->net_seq++;
+	for (mask = 1; mask < n; mask <<= 1) {
+		if (r & mask) {
+			err = coll_net_xfer(coll, r - mask, mask, buf,
+					    count * esz, 1);
+			break;
+		}
+		if (r + mask < n) {
+			err = coll_net_xfer(coll, r + mask, mask, tmp,
+					    count * esz, 0);
+			if (err != PSM2_OK)
+				break;
+			kernel(buf, tmp, count);
+		}
+	}
+	psmi_free(tmp);
+
+	if (err == PSM2_OK)
+		err = coll_net_bcast(coll, buf, count * esz, 0);
+	return err;
+}
+
+psm2_error_t __psm2_coll_fini(psm2_coll_t coll)
+{
+	PSM2_LOG_MSG("entering");
+
+	/* Nobody may still be reading our slot */
+	coll_barrier(coll);
+	munmap(coll->hdr, coll->segsz);
+	if (coll->leaders != NULL)
+		psmi_free(coll->leaders);
+	psmi_free(coll);
+
+	PSM2_LOG_MSG("leaving");
+	return PSM2_OK;
+}
+PSMI_API_DECL(psm2_coll_fini)
+
+
+/*
+ * Broadcast chunks alternate between two buffers in the first half of the
+ * root's data area.  The root refills a buffer once every member has
+ * acknowledged the chunk it last held.  A root passing an error publishes
+ * it in place of the first chunk and everybody returns it, a broadcast of
+ * no data still publishes one empty chunk.
+ */
+#define PSMI_COLL_BCAST_CHUNK	(PSMI_COLL_SLOTSZ / 4)
+
+static psm2_error_t
+coll_bcast(struct psm2_coll *coll, void *buf, size_t len, int root,
+	   psm2_error_t status)
+{
+	struct coll_slot *rslot = &coll->slots[root];
+	struct coll_slot *myslot = &coll->slots[coll->rank];
+	size_t off = 0, n;
+	int i;
+
+	do {
+		uint64_t seq = coll->bcast_seq++;
+		uint8_t *chunk = rslot->data +
+		    (seq & 1) * PSMI_COLL_BCAST_CHUNK;
+
+		n = min(len - off, PSMI_COLL_BCAST_CHUNK);
+		if (coll->rank == root) {
+			if (seq >= 2) {
+				for (i = 0; i < coll->nranks; i++)
+					coll_wait(coll,
+						  &coll->slots[i].bcast_ack,
+						  seq - 1);
+			}
+			rslot->bcast_status[seq & 1] = status;
+			if (status == PSM2_OK && n > 0)
+				memcpy(chunk, (uint8_t *) buf + off, n);
+			ips_wmb();
+			rslot->bcast_seq = seq + 1;
+		} else {
+			coll_wait(coll, &rslot->bcast_seq, seq + 1);
+			status = (psm2_error_t) rslot->bcast_status[seq & 1];
+			if (status == PSM2_OK && n > 0)
+				memcpy((uint8_t *) buf + off, chunk, n);
+			ips_barrier();
+		}
+		myslot->bcast_ack = seq + 1;
+		off += n;
+	} while (off < len && status == PSM2_OK);
+
+	return status;
+}
+
+psm2_error_t __psm2_coll_barrier(psm2_coll_t coll)
+{
+	psm2_error_t err = PSM2_OK;
+
+	PSM2_LOG_MSG("entering");
+	coll_barrier(coll);
+	if (coll->hier) {
+		/* Everybody on the node has arrived, leaders wait for the
+		 * other nodes while the rest waits for its leader to tell
+		 * how that went */
+		if (coll->rank == 0)
+			err = coll_net_barrier(coll);
+		err = coll_bcast(coll, NULL, 0, 0, err);
+	}
+	PSM2_LOG_MSG("leaving");
+	return err;
+}
+PSMI_API_DECL(psm2_coll_barrier)
+
+psm2_error_t
+__psm2_coll_bcast(psm2_coll_t coll, void *buf, size_t len, int root)
+{
+	psm2_error_t err = PSM2_OK;
+	size_t off, n;
+
+	PSM2_LOG_MSG("entering");
+
+	if (root < 0 || root >= (coll->hier ? coll->nnodes : coll->nranks)) {
+		err = psmi_handle_error(coll->ep, PSM2_PARAM_ERR,
+					"Invalid broadcast root %d", root);
+		goto ret;
+	}
+
+	if (!coll->hier) {
+		err = coll_bcast(coll, buf, len, root, PSM2_OK);
+		goto ret;
+	}
+
+	/* Members always follow their leader, which hands down its status
+	 * with the data */
+	for (off = 0; off < len && err == PSM2_OK; off += n) {
+		n = min(len - off, PSMI_COLL_NET_MAX);
+		if (coll->rank == 0)
+			err = coll_net_bcast(coll, (uint8_t *) buf + off, n,
+					     root);
+		err = coll_bcast(coll, (uint8_t *) buf + off, n, 0, err);
+	}
+
+ret:
+	PSM2_LOG_MSG("leaving");
+	return err;
+}
+PSMI_API_DECL(psm2_coll_bcast)
+
+/*
+ * Reduce-scatter then gather, a chunk of the arrays at a time: members post
+ * their chunk, member r reduces the r-th share of it across all posts in
+ * rank order and publishes it, then everybody gathers all shares.
+ */
+static void
+coll_allreduce(struct psm2_coll *coll, const void *sbuf, void *rbuf,
+	       size_t count, size_t esz, coll_kernel_fn_t kernel)
+{
+	const size_t half = PSMI_COLL_SLOTSZ / 2;
+	const size_t maxelems = half / esz;
+	struct coll_slot *myslot = &coll->slots[coll->rank];
+	size_t off, n;
+	int i;
+
+	/* Our first half may still hold a broadcast chunk being read */
+	for (i = 0; i < coll->nranks; i++)
+		coll_wait(coll, &coll->slots[i].bcast_ack, coll->bcast_seq);
+
+	for (off = 0; off < count; off += n) {
+		size_t share, lo, hi;
+
+		n = min(count - off, maxelems);
+		share = (n + coll->nranks - 1) / coll->nranks;
+
+		memcpy(myslot->data, (const uint8_t *) sbuf + off * esz,
+		       n * esz);
+		coll_barrier(coll);
+
+		lo = min(n, coll->rank * share);
+		hi = min(n, lo + share);
+		if (lo < hi) {
+			uint8_t *res = myslot->data + half;
+
+			memcpy(res, coll->slots[0].data + lo * esz,
+			       (hi - lo) * esz);
+			for (i = 1; i < coll->nranks; i++)
+				kernel(res, coll->slots[i].data + lo * esz,
+				       hi - lo);
+		}
+		coll_barrier(coll);
+
+		for (i = 0; i < coll->nranks; i++) {
+			lo = min(n, i * share);
+			hi = min(n, lo + share);
+			if (lo < hi)
+				memcpy((uint8_t *) rbuf + (off + lo) * esz,
+				       coll->slots[i].data + half,
+				       (hi - lo) * esz);
+		}
+	}
+}
+
+psm2_error_t
+__psm2_coll_allreduce(psm2_coll_t coll, const void *sbuf, void *rbuf,
+		      size_t count, psm2_coll_type_t type, psm2_coll_op_t op)
+{
+	psm2_error_t err = PSM2_OK;
+	coll_kernel_fn_t kernel;
+	size_t esz, off, n;
+
+	PSM2_LOG_MSG("entering");
+
+	if ((unsigned) type > PSM2_COLL_TYPE_DOUBLE ||
+	    (unsigned) op > PSM2_COLL_OP_MAX) {
+		err = psmi_handle_error(coll->ep, PSM2_PARAM_ERR,
+					"Invalid reduction type %d or op %d",
+					type, op);
+		goto ret;
+	}
+	kernel = coll_kernels[type][op];
+	esz = coll_type_size[type];
+
+	if (!coll->hier) {
+		coll_allreduce(coll, sbuf, rbuf, count, esz, kernel);
+		goto ret;
+	}
+
+	/* Node result, combined across leaders, handed back down with the
+	 * leader's status */
+	for (off = 0; off < count && err == PSM2_OK; off += n) {
+		uint8_t *rb = (uint8_t *) rbuf + off * esz;
+
+		n = min(count - off, PSMI_COLL_NET_MAX / esz);
+		coll_allreduce(coll, (const uint8_t *) sbuf + off * esz, rb,
+			       n, esz, kernel);
+		if (coll->rank == 0)
+			err = coll_net_allreduce(coll, rb, n, esz, kernel);
+		err = coll_bcast(coll, rb, n * esz, 0, err);
+	}
+
+ret:
+	PSM2_LOG_MSG("leaving");
+	return err;
+}
+PSMI_API_DECL(psm2_coll_allreduce)
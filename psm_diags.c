@@ -99,7 +99,7 @@ static int psmi_test_epid_table(int numelems)
 	ptl_ctl_t ctl;
 	psm2_epaddr_t *ep_array, epaddr, ep_alloc;
 	psm2_epid_t *epid_array, epid_tmp;
-	psm2_ep_t ep = (psm2_ep_t) (uintptr_t) 0xabcdef00;
+	psm2_ep_t ep;
 	struct psmi_epid_table *tab;
 	int i, j;
 
@@ -112,14 +112,17 @@ static int psmi_test_epid_table(int numelems)
 	epid_array =
 	    (psm2_epid_t *) psmi_calloc(PSMI_EP_NONE, UNDEFINED, numelems,
 				       sizeof(psm2_epid_t));
+	ep = (psm2_ep_t) psmi_calloc(PSMI_EP_NONE, UNDEFINED, 1,
+				     sizeof(struct psm2_ep));
+	diags_assert(ep != NULL);
 	diags_assert(ep_alloc != NULL);
 	diags_assert(ep_array != NULL);
 	diags_assert(epid_array != NULL);
 
 	srand(12345678);
 
-	psmi_epid_init();
-	tab = &psmi_epid_table;
+	tab = &ep->epid_table;
+	psmi_epid_table_init(tab);
 	ctl.ep = ep;
 
 	for (i = 0; i < numelems; i++) {
@@ -176,18 +179,14 @@ static int psmi_test_epid_table(int numelems)
 		epaddr = psmi_epid_lookup(ep, epid_array[i]);
 		diags_assert(epaddr == NULL);
 	}
-	for (i = 0; i < tab->tabsize; i++) {
-		diags_assert(tab->table[i].entry == NULL ||
-			     tab->table[i].entry == EPADDR_DELETED);
-	}
-
-	/* Make sure we're not leaking memory somewhere... */
-	diags_assert(tab->tabsize > tab->tabsize_used &&
-		     tab->tabsize * PSMI_EPID_TABLOAD_FACTOR >
-		     tab->tabsize_used);
+	/* Removal leaves no tombstones behind */
+	diags_assert(tab->tabsize_used == 0);
+	for (i = 0; i < (int)(tab->tabsize + PSMI_EPID_GROUP - 1); i++)
+		diags_assert(tab->ctrl[i] == PSMI_EPID_CTRL_EMPTY);
 
 	/* Only free on success */
-	psmi_epid_fini();
+	psmi_epid_table_fini(tab);
+	psmi_free(ep);
 	psmi_free(epid_array);
 	psmi_free(ep_array);
 	psmi_free(ep_alloc);
@@ -195,7 +194,10 @@ static int psmi_test_epid_table(int numelems)
 
 fail:
 	/* Klocwork scan report memory leak. */
-	psmi_epid_fini();
+	if (ep) {
+		psmi_epid_table_fini(&ep->epid_table);
+		psmi_free(ep);
+	}
 	if (epid_array)
 		psmi_free(epid_array);
 	if (ep_array)
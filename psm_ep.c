@@ -782,6 +782,8 @@ __psm2_ep_open_internal(psm2_uuid_t const unique_job_key, int *devid_enabled,
 	for (i = 0; i < PTL_MAX_INIT; i++)
 		ep->devid_enabled[i] = devid_enabled[i];
 
+	psmi_epid_table_init(&ep->epid_table);
+
 	/* Matched Queue initialization.  We do this early because we have to
 	 * make sure ep->mq exists and is valid before calling ips_do_work.
 	 */
@@ -879,6 +881,12 @@ __psm2_ep_open_internal(psm2_uuid_t const unique_job_key, int *devid_enabled,
 
 	_HFI_VDBG("finish ptl device init...\n");
 
+	if ((err = psmi_trace_init(ep)))
+		goto fail;
+
+	if ((err = psmi_telemetry_init(ep)))
+		goto fail;
+
 	/*
 	 * Keep only IPS since only IPS support multi-rail, other devices
 	 * are only setup once. IPS device can come to this function again.
@@ -1018,6 +1026,10 @@ __psm2_ep_open(psm2_uuid_t const unique_job_key,
 	if (err == PSM2_OK)
 		err = psmi_mq_initialize_defaults(mq);
 
+	/* Start asynchronous progress only once every rail can be polled */
+	if (err == PSM2_OK)
+		err = psmi_progress_init(ep);
+
 	_HFI_VDBG("psm2_ep_open() OK....\n");
 
 fail:
@@ -1073,6 +1085,9 @@ psm2_error_t __psm2_ep_close(psm2_ep_t ep, int mode, int64_t timeout_in)
 		timeout_in = max(timeout_in, (ep->connections * SEC_ULL) / 100);
 	}
 
+	/* Stop the progress thread before the PTLs it polls go away */
+	psmi_progress_fini(ep);
+
 	if (timeout_in > 0 && timeout_in < PSMI_MIN_EP_CLOSE_TIMEOUT)
 		timeout_in = PSMI_MIN_EP_CLOSE_TIMEOUT;
 
@@ -1135,9 +1150,13 @@ psm2_error_t __psm2_ep_close(psm2_ep_t ep, int mode, int64_t timeout_in)
 				tmp->user_ep_next = ep->user_ep_next;
 			}
 			psmi_opened_endpoint_count--;
+			psmi_rma_fini(ep);
 			if (mq)
 			        err = psmi_mq_free(mq);
 		}
+		psmi_trace_fini(ep);
+		psmi_telemetry_fini(ep);
+		psmi_epid_table_fini(&ep->epid_table);
 		psmi_free(ep);
 
 	} while ((err == PSM2_OK || err == PSM2_TIMEOUT) && tmp != ep);
@@ -159,6 +159,23 @@ struct psm2_ep {
 	/* Active Message handler table */
 	void **am_htable;
 
+	/* Regions registered for RMA, see psm_rma.c */
+	mpool_t rma_mr_pool;
+	psm2_error_t rma_status;	/* first error reported by a target */
+
+	/* Binary event trace ring, NULL unless PSM2_TRACE is set */
+	struct psmi_trace *trace;
+
+	/* Live per-peer stats page, NULL unless PSM2_TELEMETRY is set */
+	struct psmi_telemetry *telemetry;
+
+	/* Asynchronous progress thread, master ep only and NULL unless
+	 * PSM2_PROGRESS_THREAD is set */
+	struct psmi_progress *progress;
+
+	/* Remote endpoints this ep knows about, see psmi_epid_lookup */
+	struct psmi_epid_table epid_table;
+
 	uint64_t gid_hi;
 	uint64_t gid_lo;
 
@@ -195,6 +212,7 @@ struct psm2_epaddr {
 	ptl_ctl_t *ptlctl;	/* The control structure for the ptl */
 	struct ips_proto *proto;	/* only for ips protocol */
 	void *usr_ep_ctxt;	/* User context associated with endpoint */
+	struct psmi_telemetry_peer *telemetry;	/* stats slot, may be NULL */
 };
 
 #ifndef PSMI_BLOCKUNTIL_POLLS_BEFORE_YIELD
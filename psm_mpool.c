@@ -99,10 +99,208 @@ struct mpool {
 	non_empty_callback_fn_t mp_non_empty_cb;
 	void *mp_non_empty_cb_context;
 
+	/* Huge page backing (PSMI_MPOOL_HUGEPAGE), chunks are carved back to
+	 * back out of mappings so they share TLB entries */
+	struct mpool_hugemap *mp_hugemaps;	/* most recent mapping first */
+	size_t mp_hugemap_avail;	/* bytes left in the most recent one */
+
+	/* Per-thread magazines (PSMI_MPOOL_TLSCACHE), mp_lock protects the
+	 * shared free list once threads refill and drain magazines */
+	psmi_spinlock_t mp_lock;
+	uint32_t mp_mag_size;
+	uint64_t mp_id;
+	SLIST_ENTRY(mpool) mp_live_next;
+};
+
+/* Kept off the mapping so that chunks can fill it whole */
+struct mpool_hugemap {
+	struct mpool_hugemap *next;
+	void *base;
+	size_t size;
 };
 
 static int psmi_mpool_allocate_chunk(mpool_t);
 
+/*
+ * Per-thread magazines (PSMI_MPOOL_TLSCACHE).  Each thread keeps a few free
+ * elements of a pool in a private list, so that get and put don't touch the
+ * shared free list or its cacheline.  A magazine is refilled from the shared
+ * list, and drained back to it, half a magazine at a time under mp_lock.
+ * Elements parked in a magazine count as in use for the shared pool, so a
+ * pool can report exhaustion while other threads still hold some; at most
+ * mp_mag_size per thread.  Magazines of exiting threads are drained back.
+ *
+ * A slot names its pool by address and id, the id telling a live pool from
+ * a destroyed one whose address has been reused.  Slots of destroyed pools
+ * are only recycled against the list of live pools.
+ */
+#define PSMI_MPOOL_MAG_SLOTS	8
+#define PSMI_MPOOL_MAG_DEFAULT	64
+
+struct mpool_magazine {
+	mpool_t mp;
+	uint64_t mp_id;
+	uint32_t count;
+	SLIST_HEAD(, mpool_element) head;
+};
+
+static __thread struct mpool_magazine psmi_mpool_mags[PSMI_MPOOL_MAG_SLOTS];
+
+static pthread_mutex_t psmi_mpool_live_lock = PTHREAD_MUTEX_INITIALIZER;
+static SLIST_HEAD(, mpool) psmi_mpool_live =
+	SLIST_HEAD_INITIALIZER(psmi_mpool_live);
+static uint64_t psmi_mpool_next_id;
+static pthread_once_t psmi_mpool_mag_once = PTHREAD_ONCE_INIT;
+static pthread_key_t psmi_mpool_mag_key;
+
+static uint32_t psmi_mpool_mag_size(void)
+{
+	static int mag_size = -1;
+
+	if (mag_size < 0) {
+		union psmi_envvar_val env_mag;
+
+		psmi_getenv("PSM2_MPOOL_MAGAZINE",
+			    "Per-thread cache of free request descriptors (0 disables)",
+			    PSMI_ENVVAR_LEVEL_HIDDEN, PSMI_ENVVAR_TYPE_UINT,
+			    (union psmi_envvar_val)PSMI_MPOOL_MAG_DEFAULT,
+			    &env_mag);
+		mag_size = env_mag.e_uint;
+	}
+	return mag_size;
+}
+
+/* Move up to n elements from the shared free list into a magazine */
+static uint32_t
+psmi_mpool_mag_refill(mpool_t mp, struct mpool_magazine *mag, uint32_t n)
+{
+	struct mpool_element *me;
+	uint32_t i;
+
+	psmi_spin_lock(&mp->mp_lock);
+	for (i = 0; i < n; i++) {
+		if (SLIST_EMPTY(&mp->mp_head) &&
+		    psmi_mpool_allocate_chunk(mp) != PSM2_OK)
+			break;
+		me = SLIST_FIRST(&mp->mp_head);
+		SLIST_REMOVE_HEAD(&mp->mp_head, me_next);
+		SLIST_INSERT_HEAD(&mag->head, me, me_next);
+	}
+	mp->mp_num_obj_inuse += i;
+	psmi_assert(mp->mp_num_obj_inuse <= mp->mp_num_obj);
+	psmi_spin_unlock(&mp->mp_lock);
+
+	mag->count += i;
+	return i;
+}
+
+/* Return n elements from a magazine to the shared free list */
+static void
+psmi_mpool_mag_drain(mpool_t mp, struct mpool_magazine *mag, uint32_t n)
+{
+	struct mpool_element *me;
+	uint32_t i;
+
+	psmi_assert(n <= mag->count);
+	psmi_spin_lock(&mp->mp_lock);
+	for (i = 0; i < n; i++) {
+		me = SLIST_FIRST(&mag->head);
+		SLIST_REMOVE_HEAD(&mag->head, me_next);
+		SLIST_INSERT_HEAD(&mp->mp_head, me, me_next);
+	}
+	mp->mp_num_obj_inuse -= n;
+	psmi_spin_unlock(&mp->mp_lock);
+
+	mag->count -= n;
+}
+
+static void psmi_mpool_mag_slot_reset(struct mpool_magazine *mag)
+{
+	mag->mp = NULL;
+	mag->mp_id = 0;
+	mag->count = 0;
+	SLIST_INIT(&mag->head);
+}
+
+/* Called with psmi_mpool_live_lock held */
+static mpool_t psmi_mpool_live_find(mpool_t mp, uint64_t mp_id)
+{
+	mpool_t live;
+
+	SLIST_FOREACH(live, &psmi_mpool_live, mp_live_next)
+	    if (live == mp && live->mp_id == mp_id)
+		return live;
+	return NULL;
+}
+
+/* Thread exit, hand whatever the magazines hold back to live pools */
+static void psmi_mpool_mag_thread_exit(void *arg)
+{
+	struct mpool_magazine *mags = (struct mpool_magazine *)arg;
+	int i;
+
+	pthread_mutex_lock(&psmi_mpool_live_lock);
+	for (i = 0; i < PSMI_MPOOL_MAG_SLOTS; i++) {
+		if (mags[i].mp != NULL &&
+		    psmi_mpool_live_find(mags[i].mp, mags[i].mp_id))
+			psmi_mpool_mag_drain(mags[i].mp, &mags[i],
+					     mags[i].count);
+		psmi_mpool_mag_slot_reset(&mags[i]);
+	}
+	pthread_mutex_unlock(&psmi_mpool_live_lock);
+}
+
+static void psmi_mpool_mag_key_init(void)
+{
+	pthread_key_create(&psmi_mpool_mag_key, psmi_mpool_mag_thread_exit);
+}
+
+/*
+ * Claim a slot for mp in this thread's magazines.  Returns NULL when all of
+ * them are taken by live pools, the caller then uses the shared list.
+ */
+static struct mpool_magazine *psmi_mpool_mag_claim(mpool_t mp)
+{
+	struct mpool_magazine *mag = NULL;
+	int i;
+
+	pthread_once(&psmi_mpool_mag_once, psmi_mpool_mag_key_init);
+
+	pthread_mutex_lock(&psmi_mpool_live_lock);
+	for (i = 0; i < PSMI_MPOOL_MAG_SLOTS; i++) {
+		if (psmi_mpool_mags[i].mp != NULL &&
+		    psmi_mpool_live_find(psmi_mpool_mags[i].mp,
+					 psmi_mpool_mags[i].mp_id))
+			continue;
+		/* free, or left over from a destroyed pool */
+		psmi_mpool_mag_slot_reset(&psmi_mpool_mags[i]);
+		if (mag == NULL)
+			mag = &psmi_mpool_mags[i];
+	}
+	pthread_mutex_unlock(&psmi_mpool_live_lock);
+
+	if (mag != NULL) {
+		mag->mp = mp;
+		mag->mp_id = mp->mp_id;
+		pthread_setspecific(psmi_mpool_mag_key, psmi_mpool_mags);
+	}
+	return mag;
+}
+
+PSMI_ALWAYS_INLINE(
+struct mpool_magazine *
+psmi_mpool_mag_get(mpool_t mp))
+{
+	int i;
+
+	for (i = 0; i < PSMI_MPOOL_MAG_SLOTS; i++)
+		if (psmi_mpool_mags[i].mp == mp &&
+		    psmi_mpool_mags[i].mp_id == mp->mp_id)
+			return &psmi_mpool_mags[i];
+
+	return psmi_mpool_mag_claim(mp);
+}
+
 /**
  * psmi_mpool_create()
  *
@@ -157,11 +355,7 @@ psmi_mpool_create(size_t obj_size, uint32_t num_obj_per_chunk,
 		return NULL;
 	}
 
-	for (s = 1; s < num_obj_per_chunk; s <<= 1)
-		mp->mp_vector_shift++;
-
 	mp->mp_flags = flags;
-	mp->mp_num_obj_per_chunk = num_obj_per_chunk;
 	mp->mp_num_obj_max_total = num_obj_max_total;
 	mp->mp_non_empty_cb = cb;
 	mp->mp_non_empty_cb_context = context;
@@ -169,19 +363,6 @@ psmi_mpool_create(size_t obj_size, uint32_t num_obj_per_chunk,
 	mp->mp_memtype = statstype;
 
 	SLIST_INIT(&mp->mp_head);
-	mp->mp_elm_vector_size = num_obj_max_total / num_obj_per_chunk;
-	mp->mp_elm_vector =
-	    psmi_calloc(PSMI_EP_NONE, statstype, mp->mp_elm_vector_size,
-			sizeof(struct mpool_element *));
-	if (mp->mp_elm_vector == NULL) {
-		fprintf(stderr,
-			"Failed to allocate memory for memory pool vector: "
-			"%s\n", strerror(errno));
-		psmi_free(mp);
-		return NULL;
-	}
-
-	mp->mp_elm_vector_free = mp->mp_elm_vector;
 
 	if (flags & PSMI_MPOOL_ALIGN) {
 		/* User wants its block to start on a PSMI_MPOOL_ALIGNMENT
@@ -199,11 +380,71 @@ psmi_mpool_create(size_t obj_size, uint32_t num_obj_per_chunk,
 		mp->mp_elm_offset = 0;
 	}
 
+	/*
+	 * Pools that can grow past a huge page are backed by huge pages when
+	 * enabled.  Chunks then grow by powers of two, so the pool needs fewer
+	 * of them, as long as they still pack a huge page with no more than
+	 * 1/32 of it left over.
+	 */
+	mp->mp_flags &= ~PSMI_MPOOL_HUGEPAGE;
+	if (psmi_hugepages_enabled() &&
+	    (uint64_t) num_obj_max_total * mp->mp_elm_size >=
+	    PSMI_HUGEPAGE_SIZE) {
+		uint64_t chunk_sz;
+
+		mp->mp_flags |= PSMI_MPOOL_HUGEPAGE;
+		while (num_obj_per_chunk < num_obj_max_total) {
+			chunk_sz = PSMI_ALIGNUP((uint64_t) num_obj_per_chunk *
+						2 * mp->mp_elm_size,
+						PSMI_MPOOL_ALIGNMENT);
+			if (chunk_sz > PSMI_HUGEPAGE_SIZE ||
+			    PSMI_HUGEPAGE_SIZE % chunk_sz >
+			    PSMI_HUGEPAGE_SIZE / 32)
+				break;
+			num_obj_per_chunk <<= 1;
+		}
+	}
+
+	for (s = 1; s < num_obj_per_chunk; s <<= 1)
+		mp->mp_vector_shift++;
+	mp->mp_num_obj_per_chunk = num_obj_per_chunk;
+
+	mp->mp_elm_vector_size = num_obj_max_total / num_obj_per_chunk;
+	mp->mp_elm_vector =
+	    psmi_calloc(PSMI_EP_NONE, statstype, mp->mp_elm_vector_size,
+			sizeof(struct mpool_element *));
+	if (mp->mp_elm_vector == NULL) {
+		fprintf(stderr,
+			"Failed to allocate memory for memory pool vector: "
+			"%s\n", strerror(errno));
+		psmi_free(mp);
+		return NULL;
+	}
+
+	mp->mp_elm_vector_free = mp->mp_elm_vector;
+
+	/*
+	 * Magazines hide free elements from the shared pool, which doesn't
+	 * mix with a non-empty callback and wastes too much of small pools.
+	 */
+	mp->mp_mag_size = psmi_mpool_mag_size();
+	if (cb != NULL || mp->mp_mag_size == 0 ||
+	    num_obj_max_total / 4 < mp->mp_mag_size)
+		mp->mp_flags &= ~PSMI_MPOOL_TLSCACHE;
+	psmi_spin_init(&mp->mp_lock);
+
 	if (psmi_mpool_allocate_chunk(mp) != PSM2_OK) {
 		psmi_mpool_destroy(mp);
 		return NULL;
 	}
 
+	if (mp->mp_flags & PSMI_MPOOL_TLSCACHE) {
+		pthread_mutex_lock(&psmi_mpool_live_lock);
+		mp->mp_id = ++psmi_mpool_next_id;
+		SLIST_INSERT_HEAD(&psmi_mpool_live, mp, mp_live_next);
+		pthread_mutex_unlock(&psmi_mpool_live_lock);
+	}
+
 	VALGRIND_CREATE_MEMPOOL(mp, 0 /* no redzone */ ,
 				PSM_VALGRIND_MEM_UNDEFINED);
 
@@ -223,23 +464,44 @@ psmi_mpool_create(size_t obj_size, uint32_t num_obj_per_chunk,
 void *psmi_mpool_get(mpool_t mp)
 {
 	struct mpool_element *me;
+	struct mpool_magazine *mag;
 	void *obj;
 
-	if (SLIST_EMPTY(&mp->mp_head)) {
-		if (psmi_mpool_allocate_chunk(mp) != PSM2_OK)
+	if ((mp->mp_flags & PSMI_MPOOL_TLSCACHE) &&
+	    (mag = psmi_mpool_mag_get(mp)) != NULL) {
+		if (SLIST_EMPTY(&mag->head) &&
+		    psmi_mpool_mag_refill(mp, mag,
+					  (mp->mp_mag_size + 1) / 2) == 0)
 			return NULL;
-	}
 
-	me = SLIST_FIRST(&mp->mp_head);
-	SLIST_REMOVE_HEAD(&mp->mp_head, me_next);
+		me = SLIST_FIRST(&mag->head);
+		SLIST_REMOVE_HEAD(&mag->head, me_next);
+		mag->count--;
+	} else {
+		if (mp->mp_flags & PSMI_MPOOL_TLSCACHE)
+			psmi_spin_lock(&mp->mp_lock);
+
+		if (SLIST_EMPTY(&mp->mp_head) &&
+		    psmi_mpool_allocate_chunk(mp) != PSM2_OK)
+			me = NULL;
+		else {
+			me = SLIST_FIRST(&mp->mp_head);
+			SLIST_REMOVE_HEAD(&mp->mp_head, me_next);
+			mp->mp_num_obj_inuse++;
+			psmi_assert(mp->mp_num_obj_inuse <= mp->mp_num_obj);
+		}
+
+		if (mp->mp_flags & PSMI_MPOOL_TLSCACHE)
+			psmi_spin_unlock(&mp->mp_lock);
+		if (me == NULL)
+			return NULL;
+	}
 
 	psmi_assert(!me->me_isused);
 	me_mark_used(me);
 
 	/* store a backpointer to the memory pool */
 	me->me_mpool = mp;
-	mp->mp_num_obj_inuse++;
-	psmi_assert(mp->mp_num_obj_inuse <= mp->mp_num_obj);
 
 	obj = (void *)((uintptr_t) me + sizeof(struct mpool_element));
 	VALGRIND_MEMPOOL_ALLOC(mp, obj, mp->mp_obj_size);
@@ -271,6 +533,23 @@ void psmi_mpool_put(void *obj)
 	psmi_assert(me->me_isused);
 	me_mark_unused(me);
 
+	if (mp->mp_flags & PSMI_MPOOL_TLSCACHE) {
+		struct mpool_magazine *mag = psmi_mpool_mag_get(mp);
+
+		if (mag != NULL) {
+			SLIST_INSERT_HEAD(&mag->head, me, me_next);
+			if (++mag->count >= mp->mp_mag_size)
+				psmi_mpool_mag_drain(mp, mag, mag->count / 2);
+		} else {
+			psmi_spin_lock(&mp->mp_lock);
+			SLIST_INSERT_HEAD(&mp->mp_head, me, me_next);
+			mp->mp_num_obj_inuse--;
+			psmi_spin_unlock(&mp->mp_lock);
+		}
+		VALGRIND_MEMPOOL_FREE(mp, obj);
+		return;
+	}
+
 	was_empty = mp->mp_num_obj_inuse == mp->mp_num_obj_max_total;
 	SLIST_INSERT_HEAD(&mp->mp_head, me, me_next);
 
@@ -379,9 +658,29 @@ void psmi_mpool_destroy(mpool_t mp)
 	int i = 0;
 	size_t nbytes = mp->mp_num_obj * mp->mp_elm_size;
 
-	for (i = 0; i < mp->mp_elm_vector_size; i++) {
-		if (mp->mp_elm_vector[i])
-			psmi_free(mp->mp_elm_vector[i]);
+	struct mpool_hugemap *map;
+
+	if (mp->mp_id != 0) {	/* listed as live, see psmi_mpool_create */
+		pthread_mutex_lock(&psmi_mpool_live_lock);
+		SLIST_REMOVE(&psmi_mpool_live, mp, mpool, mp_live_next);
+		pthread_mutex_unlock(&psmi_mpool_live_lock);
+		for (i = 0; i < PSMI_MPOOL_MAG_SLOTS; i++)
+			if (psmi_mpool_mags[i].mp == mp)
+				psmi_mpool_mag_slot_reset(&psmi_mpool_mags[i]);
+	}
+
+	if (mp->mp_flags & PSMI_MPOOL_HUGEPAGE) {
+		while ((map = mp->mp_hugemaps) != NULL) {
+			mp->mp_hugemaps = map->next;
+			psmi_hugepage_free(mp->mp_memtype, map->base,
+					   map->size);
+			psmi_free(map);
+		}
+	} else {
+		for (i = 0; i < mp->mp_elm_vector_size; i++) {
+			if (mp->mp_elm_vector[i])
+				psmi_free(mp->mp_elm_vector[i]);
+		}
 	}
 	psmi_free(mp->mp_elm_vector);
 	nbytes += mp->mp_elm_vector_size * sizeof(struct mpool_element *);
@@ -407,6 +706,42 @@ psmi_mpool_get_obj_info(mpool_t mp, uint32_t *num_obj_per_chunk,
 	return;
 }
 
+/*
+ * Carve a chunk out of the current huge page mapping, mapping a new one if
+ * what's left is too small.  The unused tail of the previous mapping is
+ * simply left alone.
+ */
+static void *psmi_mpool_hugemap_carve(mpool_t mp, size_t chunk_sz)
+{
+	struct mpool_hugemap *map;
+	int is_huge = 1;
+
+	chunk_sz = PSMI_ALIGNUP(chunk_sz, PSMI_MPOOL_ALIGNMENT);
+	if (mp->mp_hugemap_avail < chunk_sz) {
+		map = psmi_malloc(PSMI_EP_NONE, mp->mp_memtype,
+				  sizeof(struct mpool_hugemap));
+		if (map == NULL)
+			return NULL;
+		map->size = chunk_sz;
+		map->base = psmi_hugepage_alloc(mp->mp_memtype, &map->size,
+						&is_huge);
+		if (map->base == NULL) {
+			psmi_free(map);
+			return NULL;
+		}
+		_HFI_VDBG("mpool %p mapped %lu bytes (huge=%d)\n", mp,
+			  (unsigned long)map->size, is_huge);
+		map->next = mp->mp_hugemaps;
+		mp->mp_hugemaps = map;
+		mp->mp_hugemap_avail = map->size;
+	}
+
+	map = mp->mp_hugemaps;
+	mp->mp_hugemap_avail -= chunk_sz;
+	return (void *)((uintptr_t) map->base + map->size -
+			mp->mp_hugemap_avail - chunk_sz);
+}
+
 static int psmi_mpool_allocate_chunk(mpool_t mp)
 {
 	struct mpool_element *elm;
@@ -423,8 +758,16 @@ static int psmi_mpool_allocate_chunk(mpool_t mp)
 	if (num_to_allocate == 0)
 		return PSM2_NO_MEMORY;
 
-	chunk = psmi_malloc(PSMI_EP_NONE, mp->mp_memtype,
-			    num_to_allocate * mp->mp_elm_size);
+	if (mp->mp_flags & PSMI_MPOOL_HUGEPAGE)
+		chunk = psmi_mpool_hugemap_carve(mp,
+				num_to_allocate * mp->mp_elm_size);
+	else if (mp->mp_flags & PSMI_MPOOL_ALIGN)
+		chunk = psmi_memalign(PSMI_EP_NONE, mp->mp_memtype,
+				      PSMI_MPOOL_ALIGNMENT,
+				      num_to_allocate * mp->mp_elm_size);
+	else
+		chunk = psmi_malloc(PSMI_EP_NONE, mp->mp_memtype,
+				    num_to_allocate * mp->mp_elm_size);
 	if (chunk == NULL) {
 		fprintf(stderr,
 			"Failed to allocate memory for memory pool chunk: %s\n",
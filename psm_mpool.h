@@ -64,6 +64,8 @@
 #define PSMI_MPOOL_ALIGN_CACHE	0x1
 #define PSMI_MPOOL_ALIGN_PAGE   0x2
 #define PSMI_MPOOL_NOGENERATION 0x4
+#define PSMI_MPOOL_HUGEPAGE	0x8	/* set internally, see PSM2_MEM_HUGEPAGES */
+#define PSMI_MPOOL_TLSCACHE	0x10	/* per-thread magazines, no callback */
 
 /* Backwards compatibility */
 #define PSMI_MPOOL_ALIGN	PSMI_MPOOL_ALIGN_CACHE
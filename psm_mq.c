@@ -54,6 +54,7 @@
 /* Copyright (c) 2003-2015 Intel Corporation. All rights reserved. */
 
 #include <sched.h>
+#include <sys/eventfd.h>
 
 #include "psm_user.h"
 #include "psm_mq_internal.h"
@@ -486,8 +487,9 @@ psm2_error_t __psm2_mq_cancel(psm2_mq_req_t *ireq)
 
 			rc = mq_req_remove_single(mq, req);
 			psmi_assert_always(rc);
+			req->type |= MQE_TYPE_CANCELLED;
 			req->state = MQ_STATE_COMPLETE;
-			mq_qq_append(&mq->completed_q, req);
+			psmi_mq_completed_q_append(mq, req);
 			err = PSM2_OK;
 		} else
 			err = PSM2_MQ_NO_COMPLETIONS;
@@ -557,6 +559,7 @@ psmi_mq_wait_inner(psm2_mq_req_t *ireq, void *status,
 	}
 
 	mq_qq_remove(&req->mq->completed_q, req);
+	psmi_mq_stats_hist_account(req);
 
 	if (status != NULL) {
 		status_copy(req, status);
@@ -646,6 +649,7 @@ psmi_mq_test_inner(psm2_mq_req_t *ireq, void *status,
 
 	PSMI_PLOCK();
 	mq_qq_remove(&req->mq->completed_q, req);
+	psmi_mq_stats_hist_account(req);
 	psmi_mq_req_free(req);
 	PSMI_PUNLOCK();
 
@@ -679,12 +683,34 @@ __psm2_mq_test(psm2_mq_req_t *ireq, psm2_mq_status_t *status)
 }
 PSMI_API_DECL(psm2_mq_test)
 
+/*
+ * Post records carry the time the post started but are written once the PTL
+ * returned the request, sends may well have completed by then.
+ */
+PSMI_ALWAYS_INLINE(uint64_t mq_trace_start(psm2_mq_t mq))
+{
+	return psmi_trace_enabled(mq->ep) ? get_cycles() : 0;
+}
+
+PSMI_ALWAYS_INLINE(
+void
+mq_trace_post(psm2_mq_t mq, uint64_t t_post, uint16_t event,
+	      psm2_epaddr_t peer, uint32_t len, psm2_mq_tag_t *tag,
+	      psm2_mq_req_t req))
+{
+	if_pf(t_post != 0)
+		psmi_trace_at(mq->ep, t_post, event, 0,
+			      peer != NULL ? peer->epid : 0, len, tag->tag[0],
+			      psmi_trace_req_id(req));
+}
+
 psm2_error_t
 __psm2_mq_isend2(psm2_mq_t mq, psm2_epaddr_t dest, uint32_t flags,
 		psm2_mq_tag_t *stag, const void *buf, uint32_t len,
 		void *context, psm2_mq_req_t *req)
 {
 	psm2_error_t err;
+	uint64_t t_post;
 
 	PSM2_LOG_MSG("entering");
 
@@ -692,9 +718,13 @@ __psm2_mq_isend2(psm2_mq_t mq, psm2_epaddr_t dest, uint32_t flags,
 	psmi_assert(stag != NULL);
 
 	PSMI_PLOCK();
+	t_post = mq_trace_start(mq);
 	err =
 	    dest->ptlctl->mq_isend(mq, dest, flags, stag, buf, len, context,
 				   req);
+	if (err == PSM2_OK)
+		mq_trace_post(mq, t_post, PSMI_TRACE_MQ_SEND_POST, dest, len,
+			      stag, *req);
 	PSMI_PUNLOCK();
 
 #if 0
@@ -716,12 +746,97 @@ __psm2_mq_isend2(psm2_mq_t mq, psm2_epaddr_t dest, uint32_t flags,
 }
 PSMI_API_DECL(psm2_mq_isend2)
 
+/* Checks a strided layout and returns its packed length */
+static
+psm2_error_t
+mq_stride_check(psm2_mq_t mq, const psm2_mq_stride_t *layout,
+		const char *what, uint64_t *len_o)
+{
+	*len_o = (uint64_t) layout->count * layout->blocklen;
+	if (*len_o > UINT32_MAX ||
+	    (layout->count > 1 && layout->stride < layout->blocklen))
+		return psmi_handle_error(mq->ep, PSM2_PARAM_ERR,
+					 "Invalid %s layout (count=%u, "
+					 "blocklen=%u, stride=%" PRIu64 ")",
+					 what, layout->count,
+					 layout->blocklen, layout->stride);
+	return PSM2_OK;
+}
+
+/* Single, empty or touching blocks are an ordinary contiguous buffer */
+PSMI_ALWAYS_INLINE(
+int
+mq_stride_is_dense(const psm2_mq_stride_t *layout))
+{
+	return layout->count <= 1 || layout->blocklen == 0 ||
+	    layout->stride == layout->blocklen;
+}
+
+psm2_error_t
+__psm2_mq_isend_strided(psm2_mq_t mq, psm2_epaddr_t dest, uint32_t flags,
+		       psm2_mq_tag_t *stag, const void *buf,
+		       const psm2_mq_stride_t *layout, void *context,
+		       psm2_mq_req_t *req)
+{
+	psm2_error_t err;
+	struct psmi_mq_stride *stride;
+	uint64_t len, t_post;
+
+	PSM2_LOG_MSG("entering");
+	PSMI_ASSERT_INITIALIZED();
+	psmi_assert(stag != NULL);
+
+	err = mq_stride_check(mq, layout, "send", &len);
+	if (err != PSM2_OK)
+		goto ret;
+
+	/* A dense layout is an ordinary send */
+	if (mq_stride_is_dense(layout)) {
+		err = __psm2_mq_isend2(mq, dest, flags, stag, buf,
+				       (uint32_t) len, context, req);
+		goto ret;
+	}
+
+	/* Gather once into a buffer owned by the request, every PTL then
+	 * sees a contiguous send and may read it until the request is freed */
+	stride = psmi_malloc(mq->ep, UNDEFINED, sizeof(*stride) + len);
+	if (stride == NULL) {
+		err = PSM2_NO_MEMORY;
+		goto ret;
+	}
+	stride->count = layout->count;
+	stride->blocklen = layout->blocklen;
+	stride->stride = layout->stride;
+	stride->bounce = (uint8_t *) (stride + 1);
+	psmi_mq_stride_gather(stride, stride->bounce, buf);
+
+	PSMI_PLOCK();
+	t_post = mq_trace_start(mq);
+	err = dest->ptlctl->mq_isend(mq, dest, flags, stag, stride->bounce,
+				     (uint32_t) len, context, req);
+	if (err == PSM2_OK) {
+		psmi_assert(*req != NULL);
+		(*req)->peer = dest;
+		(*req)->stride = stride;
+		mq_trace_post(mq, t_post, PSMI_TRACE_MQ_SEND_POST, dest,
+			      (uint32_t) len, stag, *req);
+	} else
+		psmi_free(stride);
+	PSMI_PUNLOCK();
+
+ret:
+	PSM2_LOG_MSG("leaving");
+	return err;
+}
+PSMI_API_DECL(psm2_mq_isend_strided)
+
 psm2_error_t
 __psm2_mq_isend(psm2_mq_t mq, psm2_epaddr_t dest, uint32_t flags, uint64_t stag,
 	       const void *buf, uint32_t len, void *context, psm2_mq_req_t *req)
 {
 	psm2_error_t err;
 	psm2_mq_tag_t tag;
+	uint64_t t_post;
 
 	PSM2_LOG_MSG("entering");
 
@@ -731,9 +846,13 @@ __psm2_mq_isend(psm2_mq_t mq, psm2_epaddr_t dest, uint32_t flags, uint64_t stag,
 	PSMI_ASSERT_INITIALIZED();
 
 	PSMI_PLOCK();
+	t_post = mq_trace_start(mq);
 	err =
 	    dest->ptlctl->mq_isend(mq, dest, flags, &tag, buf, len, context,
 				   req);
+	if (err == PSM2_OK)
+		mq_trace_post(mq, t_post, PSMI_TRACE_MQ_SEND_POST, dest, len,
+			      &tag, *req);
 	PSMI_PUNLOCK();
 
 #if 0
@@ -794,6 +913,18 @@ __psm2_mq_send(psm2_mq_t mq, psm2_epaddr_t dest, uint32_t flags, uint64_t stag,
 }
 PSMI_API_DECL(psm2_mq_send)
 
+/* Copy what an unexpected request buffered to the user's buffer */
+PSMI_ALWAYS_INLINE(
+void
+mq_irecv_copy(void *buf, struct psmi_mq_stride *stride, const void *src,
+	      uint32_t len))
+{
+	if_pt (stride == NULL)
+		psmi_mq_mtucpy(buf, src, len);
+	else
+		psmi_mq_stride_scatter(stride, buf, 0, src, len);
+}
+
 /*
  * Common subroutine to psm2_mq_irecv2 and psm2_mq_imrecv.  This code assumes
  * that the provided request has been matched, and begins copying message data
@@ -801,23 +932,29 @@ PSMI_API_DECL(psm2_mq_send)
  * by PSM polling until the message is complete.
  */
 static psm2_error_t
-psm2_mq_irecv_inner(psm2_mq_t mq, psm2_mq_req_t req, void *buf, uint32_t len)
+psm2_mq_irecv_inner(psm2_mq_t mq, psm2_mq_req_t req, void *buf, uint32_t len,
+		    struct psmi_mq_stride *stride)
 {
 	uint32_t copysz;
 
 	PSM2_LOG_MSG("entering");
 	psmi_assert(MQE_TYPE_IS_RECV(req->type));
+	psmi_assert(req->stride == NULL);
+
+	/* The message may have arrived long ago, the receive is posted now */
+	req->post_cycles = get_cycles();
 
 	switch (req->state) {
 	case MQ_STATE_COMPLETE:
 		if (req->buf != NULL) {	/* 0-byte messages don't alloc a sysbuf */
 			copysz = mq_set_msglen(req, len, req->send_msglen);
-			psmi_mq_mtucpy(buf, (const void *)req->buf, copysz);
-			psmi_sysbuf_free(req->buf);
+			mq_irecv_copy(buf, stride, req->buf, copysz);
+			mq_unexp_buf_free(req);
 		}
 		req->buf = buf;
 		req->buf_len = len;
-		mq_qq_append(&mq->completed_q, req);
+		req->stride = stride;
+		psmi_mq_req_completed(mq, req);
 		break;
 
 	case MQ_STATE_UNEXP:	/* not done yet */
@@ -827,8 +964,8 @@ psm2_mq_irecv_inner(psm2_mq_t mq, psm2_mq_req_t req, void *buf, uint32_t len)
 		 */
 		req->recv_msgoff = min(req->recv_msgoff, copysz);
 		if (req->recv_msgoff) {
-			psmi_mq_mtucpy(buf, (const void *)req->buf,
-				       req->recv_msgoff);
+			mq_irecv_copy(buf, stride, req->buf,
+				      req->recv_msgoff);
 		}
 		/* What's "left" is no access */
 		VALGRIND_MAKE_MEM_NOACCESS((void *)((uintptr_t) buf +
@@ -839,6 +976,7 @@ psm2_mq_irecv_inner(psm2_mq_t mq, psm2_mq_req_t req, void *buf, uint32_t len)
 		req->state = MQ_STATE_MATCHED;
 		req->buf = buf;
 		req->buf_len = len;
+		req->stride = stride;
 		break;
 
 	case MQ_STATE_UNEXP_RV:	/* rendez-vous ... */
@@ -848,8 +986,8 @@ psm2_mq_irecv_inner(psm2_mq_t mq, psm2_mq_req_t req, void *buf, uint32_t len)
 		 */
 		req->recv_msgoff = min(req->recv_msgoff, copysz);
 		if (req->recv_msgoff) {
-			psmi_mq_mtucpy(buf, (const void *)req->buf,
-				       req->recv_msgoff);
+			mq_irecv_copy(buf, stride, req->buf,
+				      req->recv_msgoff);
 		}
 		/* What's "left" is no access */
 		VALGRIND_MAKE_MEM_NOACCESS((void *)((uintptr_t) buf +
@@ -862,6 +1000,7 @@ psm2_mq_irecv_inner(psm2_mq_t mq, psm2_mq_req_t req, void *buf, uint32_t len)
 		req->state = MQ_STATE_MATCHED;
 		req->buf = buf;
 		req->buf_len = len;
+		req->stride = stride;
 		req->rts_callback(req, 0);
 		break;
 
@@ -877,19 +1016,18 @@ psm2_mq_irecv_inner(psm2_mq_t mq, psm2_mq_req_t req, void *buf, uint32_t len)
 	return PSM2_OK;
 }
 
-psm2_error_t
-__psm2_mq_irecv2(psm2_mq_t mq, psm2_epaddr_t src,
-		psm2_mq_tag_t *tag, psm2_mq_tag_t *tagsel,
-		uint32_t flags, void *buf, uint32_t len, void *context,
-		psm2_mq_req_t *reqo)
+static psm2_error_t
+mq_irecv_post(psm2_mq_t mq, psm2_epaddr_t src,
+	      psm2_mq_tag_t *tag, psm2_mq_tag_t *tagsel,
+	      void *buf, uint32_t len, struct psmi_mq_stride *stride,
+	      void *context, psm2_mq_req_t *reqo)
 {
 	psm2_error_t err = PSM2_OK;
 	psm2_mq_req_t req;
-
-	PSM2_LOG_MSG("entering");
-	PSMI_ASSERT_INITIALIZED();
+	uint64_t t_post;
 
 	PSMI_PLOCK();
+	t_post = mq_trace_start(mq);
 
 	/* First check unexpected Queue and remove req if found */
 	req = mq_req_match_with_tagsel(mq, src, tag, tagsel, REMOVE_ENTRY);
@@ -910,6 +1048,7 @@ __psm2_mq_irecv2(psm2_mq_t mq, psm2_epaddr_t src,
 		req->buf_len = len;
 		req->recv_msglen = len;
 		req->recv_msgoff = 0;
+		req->stride = stride;
 
 		/* Nobody should touch the buffer after it's posted */
 		VALGRIND_MAKE_MEM_NOACCESS(buf, len);
@@ -925,20 +1064,83 @@ __psm2_mq_irecv2(psm2_mq_t mq, psm2_epaddr_t src,
 			  tag->tag[0], tag->tag[1], tag->tag[2],
 			  tagsel->tag[0], tagsel->tag[1], tagsel->tag[2], req);
 
-		psm2_mq_irecv_inner(mq, req, buf, len);
+		psm2_mq_irecv_inner(mq, req, buf, len, stride);
 	}
 
 	req->context = context;
+	mq_trace_post(mq, t_post, PSMI_TRACE_MQ_RECV_POST, src, len, tag, req);
 
 ret:
 	PSMI_PUNLOCK();
 	*reqo = req;
+
+	return err;
+}
+
+psm2_error_t
+__psm2_mq_irecv2(psm2_mq_t mq, psm2_epaddr_t src,
+		psm2_mq_tag_t *tag, psm2_mq_tag_t *tagsel,
+		uint32_t flags, void *buf, uint32_t len, void *context,
+		psm2_mq_req_t *reqo)
+{
+	psm2_error_t err;
+
+	PSM2_LOG_MSG("entering");
+	PSMI_ASSERT_INITIALIZED();
+
+	err = mq_irecv_post(mq, src, tag, tagsel, buf, len, NULL, context,
+			    reqo);
 	PSM2_LOG_MSG("leaving");
 
 	return err;
 }
 PSMI_API_DECL(psm2_mq_irecv2)
 
+psm2_error_t
+__psm2_mq_irecv_strided(psm2_mq_t mq, psm2_epaddr_t src,
+		       psm2_mq_tag_t *tag, psm2_mq_tag_t *tagsel,
+		       uint32_t flags, void *buf,
+		       const psm2_mq_stride_t *layout, void *context,
+		       psm2_mq_req_t *reqo)
+{
+	psm2_error_t err;
+	struct psmi_mq_stride *stride;
+	uint64_t len;
+
+	PSM2_LOG_MSG("entering");
+	PSMI_ASSERT_INITIALIZED();
+
+	err = mq_stride_check(mq, layout, "receive", &len);
+	if (err != PSM2_OK)
+		goto ret;
+
+	/* A dense layout is an ordinary receive */
+	if (mq_stride_is_dense(layout)) {
+		err = mq_irecv_post(mq, src, tag, tagsel, buf, (uint32_t) len,
+				    NULL, context, reqo);
+		goto ret;
+	}
+
+	stride = psmi_malloc(mq->ep, UNDEFINED, sizeof(*stride));
+	if (stride == NULL) {
+		err = PSM2_NO_MEMORY;
+		goto ret;
+	}
+	stride->count = layout->count;
+	stride->blocklen = layout->blocklen;
+	stride->stride = layout->stride;
+	stride->bounce = NULL;
+
+	err = mq_irecv_post(mq, src, tag, tagsel, buf, (uint32_t) len, stride,
+			    context, reqo);
+	if (err != PSM2_OK)
+		psmi_free(stride);
+ret:
+	PSM2_LOG_MSG("leaving");
+	return err;
+}
+PSMI_API_DECL(psm2_mq_irecv_strided)
+
 psm2_error_t
 __psm2_mq_irecv(psm2_mq_t mq, uint64_t tag, uint64_t tagsel, uint32_t flags,
 	       void *buf, uint32_t len, void *context, psm2_mq_req_t *reqo)
@@ -982,7 +1184,7 @@ __psm2_mq_imrecv(psm2_mq_t mq, uint32_t flags, void *buf, uint32_t len,
 		req->context = context;
 
 		PSMI_PLOCK();
-		psm2_mq_irecv_inner(mq, req, buf, len);
+		psm2_mq_irecv_inner(mq, req, buf, len, NULL);
 		PSMI_PUNLOCK();
 	}
 
@@ -1144,11 +1346,35 @@ fail:
 }
 PSMI_API_DECL(psm2_mq_init)
 
+/* Only non-empty buckets are printed, as the lower bound of the bucket */
+static
+void
+psmi_mq_print_hist(const char *name,
+		   uint64_t hist[PSM2_MQ_HIST_NUM_TRANSPORTS]
+				[PSM2_MQ_HIST_BUCKETS])
+{
+	static const char *transport[PSM2_MQ_HIST_NUM_TRANSPORTS] = {
+		[PSM2_MQ_HIST_SELF] = "self",
+		[PSM2_MQ_HIST_SHM] = "shm",
+		[PSM2_MQ_HIST_HFI] = "hfi"
+	};
+	int t, i;
+
+	for (t = 0; t < PSM2_MQ_HIST_NUM_TRANSPORTS; t++)
+		for (i = 0; i < PSM2_MQ_HIST_BUCKETS; i++)
+			if (hist[t][i] != 0)
+				_HFI_INFO("%s_%s[%lu] %lu\n", name,
+					  transport[t],
+					  i ? 1UL << (i - 1) : 0UL,
+					  hist[t][i]);
+}
+
 static
 void
 psmi_mq_print_stats(psm2_mq_t mq)
 {
 	psm2_mq_stats_t stats;
+	psm2_mq_stats_hist_t hist;
 
 	psm2_mq_get_stats(mq, &stats);
 	_HFI_INFO("rx_user_bytes %lu\n", stats.rx_user_bytes);
@@ -1167,6 +1393,12 @@ psmi_mq_print_stats(psm2_mq_t mq)
 
 	_HFI_INFO("rx_sysbuf_num %lu\n", stats.rx_sysbuf_num);
 	_HFI_INFO("rx_sysbuf_bytes %lu\n", stats.rx_sysbuf_bytes);
+
+	psm2_mq_get_stats_hist(mq, &hist);
+	psmi_mq_print_hist("tx_size", hist.tx_size);
+	psmi_mq_print_hist("rx_size", hist.rx_size);
+	psmi_mq_print_hist("tx_lat_ns", hist.tx_lat_ns);
+	psmi_mq_print_hist("rx_lat_ns", hist.rx_lat_ns);
 }
 
 psm2_error_t __psm2_mq_finalize(psm2_mq_t mq)
@@ -1193,6 +1425,70 @@ void __psm2_mq_get_stats(psm2_mq_t mq, psm2_mq_stats_t *stats)
 }
 PSMI_API_DECL(psm2_mq_get_stats)
 
+void __psm2_mq_get_stats_hist(psm2_mq_t mq, psm2_mq_stats_hist_t *hist)
+{
+	PSM2_LOG_MSG("entering");
+	memcpy(hist, &mq->hist, sizeof(psm2_mq_stats_hist_t));
+	PSM2_LOG_MSG("leaving");
+}
+PSMI_API_DECL(psm2_mq_get_stats_hist)
+
+void psmi_mq_completion_notify(psm2_mq_t mq)
+{
+	uint64_t one = 1;
+
+	/* EAGAIN means the counter is saturated, the consumer will wake up
+	 * either way */
+	if (write(mq->eventfd, &one, sizeof(one)) != sizeof(one) &&
+	    errno != EAGAIN)
+		_HFI_VDBG("eventfd write failed: %s\n", strerror(errno));
+}
+
+psm2_error_t __psm2_mq_get_eventfd(psm2_mq_t mq, int *fd)
+{
+	psm2_error_t err = PSM2_OK;
+
+	PSM2_LOG_MSG("entering");
+	PSMI_ERR_UNLESS_INITIALIZED(mq->ep);
+
+	PSMI_PLOCK();
+	if (mq->eventfd < 0) {
+		mq->eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (mq->eventfd < 0) {
+			err = psmi_handle_error(mq->ep, PSM2_INTERNAL_ERR,
+						"Can't create MQ eventfd: %s",
+						strerror(errno));
+			goto fail;
+		}
+		/* Completions that arrived before anyone asked */
+		if (mq->completed_q.first != NULL)
+			psmi_mq_completion_notify(mq);
+	}
+	*fd = mq->eventfd;
+
+fail:
+	PSMI_PUNLOCK();
+	PSM2_LOG_MSG("leaving");
+	return err;
+}
+PSMI_API_DECL(psm2_mq_get_eventfd)
+
+void __psm2_mq_req_set_callback(psm2_mq_req_t req,
+				psm2_mq_req_callback_fn_t fn)
+{
+	PSM2_LOG_MSG("entering");
+
+	PSMI_PLOCK();
+	req->done_callback = fn;
+	/* Already on the completed queue, nothing will call it later */
+	if (fn != NULL && req->state == MQ_STATE_COMPLETE)
+		fn(req, req->context);
+	PSMI_PUNLOCK();
+
+	PSM2_LOG_MSG("leaving");
+}
+PSMI_API_DECL(psm2_mq_req_set_callback)
+
 psm2_error_t psmi_mq_malloc(psm2_mq_t *mqo)
 {
 	psm2_error_t err = PSM2_OK;
@@ -1231,6 +1527,7 @@ psm2_error_t psmi_mq_malloc(psm2_mq_t *mqo)
 		mq->hfi_window_rv = 131072;
 	}
 	mq->shm_thresh_rv = 16000;
+	mq->eventfd = -1;
 
 	memset(&mq->stats, 0, sizeof(psm2_mq_stats_t));
 	err = psmi_mq_req_init(mq);
@@ -1283,6 +1580,8 @@ psm2_error_t psmi_mq_initialize_defaults(psm2_mq_t mq)
 
 psm2_error_t psmi_mq_free(psm2_mq_t mq)
 {
+	if (mq->eventfd >= 0)
+		close(mq->eventfd);
 	psmi_mq_req_fini(mq);
 	psmi_free(mq);
 	return PSM2_OK;
@@ -109,12 +109,15 @@ struct psm2_mq {
 
 	uint64_t timestamp;
 	psm2_mq_stats_t stats;	/**> MQ stats, accumulated by each PTL */
+	psm2_mq_stats_hist_t hist; /**> Size/latency histograms, see psmi_mq_stats_hist_account */
 	int print_stats;
 	int nohash_fastpath;
 	unsigned unexpected_hash_len;
 	unsigned unexpected_list_len;
 	unsigned expected_hash_len;
 	unsigned expected_list_len;
+
+	int eventfd;		/**> -1 until psm2_mq_get_eventfd */
 };
 
 #define MQ_HFI_THRESH_TINY	8
@@ -132,6 +135,9 @@ struct psm2_mq {
 #define MQE_TYPE_WAITING	0x0001
 #define MQE_TYPE_WAITING_PEER	0x0004
 #define MQE_TYPE_EAGER_QUEUE	0x0008
+#define MQE_TYPE_HELD		0x0010	/* buf is in a PTL receive buffer */
+#define MQE_TYPE_INTERNAL	0x0020	/* completes through complete_callback */
+#define MQE_TYPE_CANCELLED	0x0040	/* cancelled receive, not accounted */
 
 #define MQ_STATE_COMPLETE	0
 #define MQ_STATE_POSTED		1
@@ -177,51 +183,86 @@ struct psm2_mq {
 typedef psm2_error_t(*mq_rts_callback_fn_t) (psm2_mq_req_t req, int was_posted);
 typedef psm2_error_t(*mq_testwait_callback_fn_t) (psm2_mq_req_t *req);
 
-/* receive mq_req, the default */
+/* receive mq_req, the default
+ *
+ * The layout follows the order in which tag matching touches a request.  A
+ * queue scan reads next[], timestamp, peer and tag of every candidate, which
+ * all sit in the first cacheline.  tagsel leads the second line: only
+ * expected receives are matched against their own selector, unexpected
+ * messages are matched against the selector of the receive being posted.
+ * The rest of that line is what is read once a request has matched, the
+ * third holds the back links that are only needed to unlink it from its
+ * queues.  Rendezvous and PTL bookkeeping come last.  Requests are allocated
+ * from cacheline aligned pools (see psmi_mq_req_init).
+ */
 struct psm2_mq_req {
+	/* Tag matching vars */
 	struct {
 		psm2_mq_req_t next[NUM_MQ_SUBLISTS];
+		psm2_epaddr_t peer;
+		uint64_t timestamp;
+		psm2_mq_tag_t tag;
+	} PSMI_CACHEALIGN;
+
+	struct {
+		psm2_mq_tag_t tagsel;	/* used for receives */
+		uint32_t state;
+		uint32_t type;
+		psm2_mq_t mq;
+
+		/* Buffer attached to request.  May be a system buffer for
+		 * unexpected messages or a user buffer when an expected
+		 * message */
+		uint8_t *buf;
+		uint32_t buf_len;
+		uint32_t error_code;
+
+		uint32_t recv_msglen;	/* Message length we are ready to receive */
+		uint32_t send_msglen;	/* Message length from sender */
+		uint32_t recv_msgoff;	/* Message offset into buf */
+		union {
+			uint32_t send_msgoff;	/* Bytes received so far.. can be larger than buf_len */
+			uint32_t recv_msgposted;
+		};
+	} PSMI_CACHEALIGN;
+
+	/* Only needed to unlink the request from its queues */
+	struct {
 		psm2_mq_req_t prev[NUM_MQ_SUBLISTS];
-		STAILQ_ENTRY(psm2_mq_req) nextq; /* used for eager only */
-	};
-	struct mqq *q[NUM_MQ_SUBLISTS];
-	uint64_t timestamp;
-	uint32_t state;
-	uint32_t type;
-	psm2_mq_t mq;
+		struct mqq *q[NUM_MQ_SUBLISTS];
+	} PSMI_CACHEALIGN;
 
-	/* Tag matching vars */
-	psm2_epaddr_t peer;
-	psm2_mq_tag_t tag;
-	psm2_mq_tag_t tagsel;	/* used for receives */
+	/* Used for request to send messages */
+	void *context;		/* user context associated to sends or receives */
+
+	STAILQ_ENTRY(psm2_mq_req) nextq; /* used for eager only */
 
 	/* Some PTLs want to get notified when there's a test/wait event */
 	mq_testwait_callback_fn_t testwait_callback;
 
-	/* Buffer attached to request.  May be a system buffer for unexpected
-	 * messages or a user buffer when an expected message */
-	uint8_t *buf;
-	uint32_t buf_len;
-	uint32_t error_code;
+	/* Requests a PTL issues on its own behalf (MQE_TYPE_INTERNAL) never
+	 * reach the completed queue, they are handed back through this */
+	void (*complete_callback) (psm2_mq_req_t req);
+
+	/* User requests can ask to be told when they complete, see
+	 * psm2_mq_req_set_callback */
+	psm2_mq_req_callback_fn_t done_callback;
 
 	uint16_t msg_seqnum;	/* msg seq num for mctxt */
-	uint32_t recv_msglen;	/* Message length we are ready to receive */
-	uint32_t send_msglen;	/* Message length from sender */
-	uint32_t recv_msgoff;	/* Message offset into buf */
-	union {
-		uint32_t send_msgoff;	/* Bytes received so far.. can be larger than buf_len */
-		uint32_t recv_msgposted;
-	};
 	uint32_t rts_reqidx_peer;
 
-	/* Used for request to send messages */
-	void *context;		/* user context associated to sends or receives */
-
 	/* Used to keep track of unexpected rendezvous */
 	mq_rts_callback_fn_t rts_callback;
 	psm2_epaddr_t rts_peer;
 	uintptr_t rts_sbuf;
 
+	/* Block layout of buf for strided requests, NULL when contiguous */
+	struct psmi_mq_stride *stride;
+
+	/* get_cycles() when posted, turned into the post to completion
+	 * latency by psmi_mq_req_completed() */
+	uint64_t post_cycles;
+
 	/* PTLs get to store their own per-request data.  MQ manages the allocation
 	 * by allocating psm2_mq_req so that ptl_req_data has enough space for all
 	 * possible PTLs.
@@ -247,6 +288,58 @@ hash_32(uint32_t a))
 
 void psmi_mq_mtucpy(void *vdest, const void *vsrc, uint32_t nchars);
 
+/*
+ * Strided requests (psm2_mq_isend_strided/psm2_mq_irecv_strided) carry the
+ * user's block layout.  Everything below MQ deals in packed message offsets,
+ * receive copies go through mq_recv_copy() which scatters packed bytes into
+ * the blocks.  Sends are gathered into 'bounce' when posted; on receives,
+ * 'bounce' is a packed staging buffer a PTL may use when its transport can
+ * only write contiguously (it then scatters it itself).
+ */
+struct psmi_mq_stride {
+	uint32_t count;
+	uint32_t blocklen;
+	uint64_t stride;
+	uint8_t *bounce;
+};
+
+void psmi_mq_stride_scatter(const struct psmi_mq_stride *layout, uint8_t *base,
+			    uint32_t offset, const void *src, uint32_t len);
+void psmi_mq_stride_gather(const struct psmi_mq_stride *layout, void *dest,
+			   const uint8_t *base);
+
+/*
+ * A PTL can leave the payload of an unexpected message in its own receive
+ * buffer instead of having it copied into a sysbuf.  The request is then
+ * flagged MQE_TYPE_HELD, req->buf points into the PTL buffer and
+ * req->ptl_req_ptr at the hold.  Once MQ has copied the payload out, it hands
+ * the buffer back through the release callback.  A PTL that needs the buffer
+ * back earlier moves the payload into a sysbuf with psmi_mq_reclaim_held().
+ */
+struct psmi_mq_hold {
+	void (*release) (struct psmi_mq_hold *hold, psm2_mq_req_t req);
+};
+
+void psmi_mq_reclaim_held(psm2_mq_req_t req);
+
+/*
+ * Free the buffer of a completed unexpected message.
+ */
+PSMI_ALWAYS_INLINE(
+void
+mq_unexp_buf_free(psm2_mq_req_t req))
+{
+	if (req->type & MQE_TYPE_HELD) {
+		struct psmi_mq_hold *hold = (struct psmi_mq_hold *)
+						req->ptl_req_ptr;
+
+		req->type &= ~MQE_TYPE_HELD;
+		req->ptl_req_ptr = NULL;
+		hold->release(hold, req);
+	} else
+		psmi_sysbuf_free(req->buf);
+}
+
 #if defined(__x86_64__)
 void psmi_mq_mtucpy_safe(void *vdest, const void *vsrc, uint32_t nchars);
 #else
@@ -292,6 +385,29 @@ mq_copy_tiny(uint32_t *dest, uint32_t *src, uint8_t len))
 	}
 }
 
+/* Copy len bytes at packed offset 'offset' of the message into req */
+PSMI_ALWAYS_INLINE(
+void
+mq_recv_copy(psm2_mq_req_t req, uint32_t offset, const void *src,
+	     uint32_t len))
+{
+	if_pt (req->stride == NULL)
+		psmi_mq_mtucpy(req->buf + offset, src, len);
+	else
+		psmi_mq_stride_scatter(req->stride, req->buf, offset, src, len);
+}
+
+PSMI_ALWAYS_INLINE(
+void
+mq_recv_copy_tiny(psm2_mq_req_t req, uint32_t offset, uint32_t *src,
+		  uint8_t len))
+{
+	if_pt (req->stride == NULL)
+		mq_copy_tiny((uint32_t *)(req->buf + offset), src, len);
+	else
+		psmi_mq_stride_scatter(req->stride, req->buf, offset, src, len);
+}
+
 /* Typedef describing a function to populate a psm2_mq_status(2)_t given a
  * matched request.  The purpose of this typedef is to avoid duplicating
  * code to handle both PSM v1 and v2 status objects.  Outer routines pass in
@@ -434,7 +550,30 @@ PSMI_ALWAYS_INLINE(void mq_qq_remove_which(psm2_mq_req_t req, int table))
 psm2_error_t psmi_mq_req_init(psm2_mq_t mq);
 psm2_error_t psmi_mq_req_fini(psm2_mq_t mq);
 psm2_mq_req_t psmi_mq_req_alloc(psm2_mq_t mq, uint32_t type);
-#define      psmi_mq_req_free(req)  psmi_mpool_put(req)
+
+PSMI_ALWAYS_INLINE(
+void
+psmi_mq_req_free(psm2_mq_req_t req))
+{
+	if_pf (req->stride != NULL) {
+		psmi_free(req->stride);
+		req->stride = NULL;
+	}
+	psmi_mpool_put(req);
+}
+
+/*
+ * PTLs move bulk data for other layers (long active messages) with the same
+ * rendezvous machinery as MQ messages, using send and receive requests marked
+ * MQE_TYPE_INTERNAL.  Those complete through req->complete_callback, which
+ * owns the request from then on, instead of the completed queue.
+ */
+PSMI_ALWAYS_INLINE(void psmi_mq_req_complete_internal(psm2_mq_req_t req))
+{
+	psmi_assert(req->type & MQE_TYPE_INTERNAL);
+	req->state = MQ_STATE_COMPLETE;
+	req->complete_callback(req);
+}
 
 /*
  * Main receive progress engine, for shmops and hfi, in mq.c
@@ -460,7 +599,8 @@ int psmi_mq_handle_rts(psm2_mq_t mq, psm2_epaddr_t src, psm2_mq_tag_t *tag,
 int psmi_mq_handle_envelope(psm2_mq_t mq, psm2_epaddr_t src, psm2_mq_tag_t *tag,
 			    uint32_t msglen, uint32_t offset,
 			    const void *payload, uint32_t paylen, int msgorder,
-			    uint32_t opcode, psm2_mq_req_t *req_o);
+			    uint32_t opcode, psm2_mq_req_t *req_o,
+			    struct psmi_mq_hold *hold);
 int psmi_mq_handle_outoforder(psm2_mq_t mq, psm2_mq_req_t req);
 
 void psmi_mq_stats_register(psm2_mq_t mq, mpspawn_stats_add_fn add_fn);
@@ -522,4 +662,88 @@ PSMI_ALWAYS_INLINE(void psmi_mq_stats_rts_account(psm2_mq_req_t req))
 	return;
 }
 
+void psmi_mq_completion_notify(psm2_mq_t mq);
+
+/*
+ * Queue a finished user request for test/wait/ipeek.  The eventfd is only
+ * written when the queue stops being empty since consumers drain it before
+ * going back to sleep.
+ */
+PSMI_ALWAYS_INLINE(
+void psmi_mq_completed_q_append(psm2_mq_t mq, psm2_mq_req_t req))
+{
+	int was_empty = (mq->completed_q.first == NULL);
+
+	mq_qq_append(&mq->completed_q, req);
+	if_pf(mq->eventfd >= 0 && was_empty)
+		psmi_mq_completion_notify(mq);
+	if_pf(req->done_callback != NULL)
+		req->done_callback(req, req->context);
+}
+
+/*
+ * Every user request a PTL completes goes through here on its way to the
+ * completed queue.  It turns post_cycles into the post to completion latency,
+ * which is only accounted once the request is retired (see below).
+ */
+PSMI_ALWAYS_INLINE(void psmi_mq_req_completed(psm2_mq_t mq, psm2_mq_req_t req))
+{
+	uint64_t t_done = get_cycles();
+
+	if_pf(psmi_trace_enabled(mq->ep))
+		psmi_trace_at(mq->ep, t_done, MQE_TYPE_IS_SEND(req->type) ?
+			      PSMI_TRACE_MQ_SEND_DONE : PSMI_TRACE_MQ_RECV_DONE,
+			      0, 0, MQE_TYPE_IS_SEND(req->type) ?
+			      req->send_msglen : req->recv_msglen, 0,
+			      psmi_trace_req_id(req));
+	req->post_cycles = t_done - req->post_cycles;
+	psmi_mq_completed_q_append(mq, req);
+}
+
+PSMI_ALWAYS_INLINE(unsigned psmi_mq_hist_bucket(uint64_t val))
+{
+	unsigned b = val ? 64 - __builtin_clzll(val) : 0;
+
+	return b < PSM2_MQ_HIST_BUCKETS ? b : PSM2_MQ_HIST_BUCKETS - 1;
+}
+
+/*
+ * Histograms are accounted when test/wait retires a request rather than when
+ * it completes: sends often complete within the PTL's isend, before the
+ * request has the peer that tells the transport apart.  The peer's telemetry
+ * counters are bumped at the same point for the same reason.
+ */
+PSMI_ALWAYS_INLINE(void psmi_mq_stats_hist_account(psm2_mq_req_t req))
+{
+	psm2_mq_stats_hist_t *hist = &req->mq->hist;
+	psm2_epaddr_t peer = req->peer;
+	ptl_ctl_t *ctl;
+	unsigned lat;
+	int t;
+
+	if_pf(peer == NULL || (req->type & MQE_TYPE_CANCELLED))
+		return;
+
+	ctl = peer->ptlctl;
+	if (ctl == &ctl->ep->ptl_ips)
+		t = PSM2_MQ_HIST_HFI;
+	else if (ctl == &ctl->ep->ptl_amsh)
+		t = PSM2_MQ_HIST_SHM;
+	else
+		t = PSM2_MQ_HIST_SELF;
+
+	lat = psmi_mq_hist_bucket(cycles_to_nanosecs(req->post_cycles));
+	if (MQE_TYPE_IS_SEND(req->type)) {
+		hist->tx_size[t][psmi_mq_hist_bucket(req->send_msglen)]++;
+		hist->tx_lat_ns[t][lat]++;
+		psmi_telemetry_msg(peer, PSMI_TELEMETRY_TX_MSGS,
+				   PSMI_TELEMETRY_TX_BYTES, req->send_msglen);
+	} else {
+		hist->rx_size[t][psmi_mq_hist_bucket(req->recv_msglen)]++;
+		hist->rx_lat_ns[t][lat]++;
+		psmi_telemetry_msg(peer, PSMI_TELEMETRY_RX_MSGS,
+				   PSMI_TELEMETRY_RX_BYTES, req->recv_msglen);
+	}
+}
+
 #endif
@@ -74,11 +74,16 @@ void psmi_mq_handle_rts_complete(psm2_mq_req_t req)
 {
 	psm2_mq_t mq = req->mq;
 
+	if_pf(req->type & MQE_TYPE_INTERNAL) {
+		psmi_mq_req_complete_internal(req);
+		return;
+	}
+
 	/* Stats on rendez-vous messages */
 	psmi_mq_stats_rts_account(req);
 	req->state = MQ_STATE_COMPLETE;
 	ips_barrier();
-	mq_qq_append(&mq->completed_q, req);
+	psmi_mq_req_completed(mq, req);
 #ifdef PSM_VALGRIND
 	if (MQE_TYPE_IS_RECV(req->type))
 		PSM_VALGRIND_DEFINE_MQ_RECV(req->buf, req->buf_len,
@@ -97,7 +102,6 @@ psmi_mq_req_copy(psm2_mq_req_t req,
 {
 	/* recv_msglen may be changed by unexpected receive buf. */
 	uint32_t msglen_this, end;
-	uint8_t *msgptr = (uint8_t *) req->buf + offset;
 
 	/* out of receiving range. */
 	if (offset >= req->recv_msglen) {
@@ -113,8 +117,8 @@ psmi_mq_req_copy(psm2_mq_req_t req,
 		msglen_this = nbytes;
 	}
 
-	VALGRIND_MAKE_MEM_DEFINED(msgptr, msglen_this);
-	psmi_mq_mtucpy(msgptr, buf, msglen_this);
+	VALGRIND_MAKE_MEM_DEFINED(req->buf + offset, msglen_this);
+	mq_recv_copy(req, offset, buf, msglen_this);
 
 	if (req->recv_msgoff < end) {
 		req->recv_msgoff = end;
@@ -149,10 +153,12 @@ psmi_mq_handle_data(psm2_mq_t mq, psm2_mq_req_t req,
 			STAILQ_REMOVE(&mq->eager_q, req, psm2_mq_req, nextq);
 		}
 
-		if (req->state == MQ_STATE_MATCHED) {
+		if_pf(req->type & MQE_TYPE_INTERNAL)
+			psmi_mq_req_complete_internal(req);
+		else if (req->state == MQ_STATE_MATCHED) {
 			req->state = MQ_STATE_COMPLETE;
 			ips_barrier();
-			mq_qq_append(&mq->completed_q, req);
+			psmi_mq_req_completed(mq, req);
 		} else {	/* MQ_STATE_UNEXP */
 			req->state = MQ_STATE_COMPLETE;
 		}
@@ -274,7 +280,7 @@ psmi_mq_handle_rts(psm2_mq_t mq, psm2_epaddr_t src, psm2_mq_tag_t *tag,
 
 		if (paylen > msglen) paylen = msglen;
 		if (paylen) {
-			psmi_mq_mtucpy(req->buf, payload, paylen);
+			mq_recv_copy(req, 0, payload, paylen);
 		}
 		req->recv_msgoff = req->send_msgoff = paylen;
 		*req_o = req;	/* yes match */
@@ -342,7 +348,8 @@ int
 psmi_mq_handle_envelope(psm2_mq_t mq, psm2_epaddr_t src, psm2_mq_tag_t *tag,
 			uint32_t send_msglen, uint32_t offset,
 			const void *payload, uint32_t paylen, int msgorder,
-			uint32_t opcode, psm2_mq_req_t *req_o)
+			uint32_t opcode, psm2_mq_req_t *req_o,
+			struct psmi_mq_hold *hold)
 {
 	psm2_mq_req_t req;
 	uint32_t msglen;
@@ -365,31 +372,30 @@ psmi_mq_handle_envelope(psm2_mq_t mq, psm2_epaddr_t src, psm2_mq_tag_t *tag,
 			PSM_VALGRIND_DEFINE_MQ_RECV(req->buf, req->buf_len,
 						    msglen);
 			/* mq_copy_tiny() can handle zero byte */
-			mq_copy_tiny((uint32_t *) req->buf,
-				     (uint32_t *) payload, msglen);
+			mq_recv_copy_tiny(req, 0, (uint32_t *) payload, msglen);
 			req->state = MQ_STATE_COMPLETE;
 			ips_barrier();
-			mq_qq_append(&mq->completed_q, req);
+			psmi_mq_req_completed(mq, req);
 			break;
 
 		case MQ_MSG_SHORT:	/* message fits in 1 payload */
 			PSM_VALGRIND_DEFINE_MQ_RECV(req->buf, req->buf_len,
 						    msglen);
 			if (msglen <= paylen) {
-				psmi_mq_mtucpy(req->buf, payload, msglen);
+				mq_recv_copy(req, 0, payload, msglen);
 			} else {
 				psmi_assert((msglen & ~0x3) == paylen);
-				psmi_mq_mtucpy(req->buf, payload, paylen);
+				mq_recv_copy(req, 0, payload, paylen);
 				/*
 				 * there are nonDW bytes attached in header,
 				 * copy after the DW payload.
 				 */
-				mq_copy_tiny((uint32_t *)(req->buf+paylen),
+				mq_recv_copy_tiny(req, paylen,
 					(uint32_t *)&offset, msglen & 0x3);
 			}
 			req->state = MQ_STATE_COMPLETE;
 			ips_barrier();
-			mq_qq_append(&mq->completed_q, req);
+			psmi_mq_req_completed(mq, req);
 			break;
 
 		case MQ_MSG_EAGER:
@@ -471,6 +477,15 @@ psmi_mq_handle_envelope(psm2_mq_t mq, psm2_epaddr_t src, psm2_mq_tag_t *tag,
 		break;
 
 	case MQ_MSG_SHORT:
+		if (hold != NULL && msglen > 0 && msglen <= paylen) {
+			/* Leave the payload where the PTL received it, the
+			 * posted receive copies it straight to the user. */
+			req->buf = (uint8_t *) payload;
+			req->ptl_req_ptr = hold;
+			req->type |= MQE_TYPE_HELD;
+			req->state = MQ_STATE_COMPLETE;
+			break;
+		}
 		req->buf = psmi_sysbuf_alloc(msglen);
 		mq->stats.rx_sysbuf_num++;
 		mq->stats.rx_sysbuf_bytes += paylen;
@@ -520,6 +535,26 @@ psmi_mq_handle_envelope(psm2_mq_t mq, psm2_epaddr_t src, psm2_mq_tag_t *tag,
 	return MQ_RET_UNEXP_OK;
 }
 
+/*
+ * Move a payload that a PTL is holding in its receive buffer into a sysbuf,
+ * so the PTL can reuse the buffer before the receive is posted.
+ */
+void psmi_mq_reclaim_held(psm2_mq_req_t req)
+{
+	psm2_mq_t mq = req->mq;
+	void *buf;
+
+	psmi_assert(req->type & MQE_TYPE_HELD);
+	buf = psmi_sysbuf_alloc(req->send_msglen);
+	psmi_mq_mtucpy(buf, (const void *)req->buf, req->send_msglen);
+	mq->stats.rx_sysbuf_num++;
+	mq->stats.rx_sysbuf_bytes += req->send_msglen;
+
+	req->buf = buf;
+	req->type &= ~MQE_TYPE_HELD;
+	req->ptl_req_ptr = NULL;
+}
+
 int psmi_mq_handle_outoforder(psm2_mq_t mq, psm2_mq_req_t ureq)
 {
 	psm2_mq_req_t ereq;
@@ -539,13 +574,12 @@ int psmi_mq_handle_outoforder(psm2_mq_t mq, psm2_mq_req_t ureq)
 	switch (ureq->state) {
 	case MQ_STATE_COMPLETE:
 		if (ureq->buf != NULL) {	/* 0-byte don't alloc a sysbuf */
-			psmi_mq_mtucpy(ereq->buf, (const void *)ureq->buf,
-				       msglen);
-			psmi_sysbuf_free(ureq->buf);
+			mq_recv_copy(ereq, 0, (const void *)ureq->buf, msglen);
+			mq_unexp_buf_free(ureq);
 		}
 		ereq->state = MQ_STATE_COMPLETE;
 		ips_barrier();
-		mq_qq_append(&mq->completed_q, ereq);
+		psmi_mq_req_completed(mq, ereq);
 		break;
 	case MQ_STATE_UNEXP:	/* not done yet */
 		ereq->state = MQ_STATE_MATCHED;
@@ -554,9 +588,8 @@ int psmi_mq_handle_outoforder(psm2_mq_t mq, psm2_mq_req_t ureq)
 		ereq->send_msgoff = ureq->send_msgoff;
 		ereq->recv_msgoff = min(ureq->recv_msgoff, msglen);
 		if (ereq->recv_msgoff) {
-			psmi_mq_mtucpy(ereq->buf,
-				       (const void *)ureq->buf,
-				       ereq->recv_msgoff);
+			mq_recv_copy(ereq, 0, (const void *)ureq->buf,
+				     ereq->recv_msgoff);
 		}
 		psmi_sysbuf_free(ureq->buf);
 		ereq->type = ureq->type;
@@ -570,9 +603,8 @@ int psmi_mq_handle_outoforder(psm2_mq_t mq, psm2_mq_req_t ureq)
 		ereq->send_msgoff = ureq->send_msgoff;
 		ereq->recv_msgoff = min(ureq->recv_msgoff, msglen);
 		if (ereq->recv_msgoff) {
-			psmi_mq_mtucpy(ereq->buf,
-				       (const void *)ureq->buf,
-				       ereq->recv_msgoff);
+			mq_recv_copy(ereq, 0, (const void *)ureq->buf,
+				     ereq->recv_msgoff);
 		}
 		if (ereq->send_msgoff) {
 			psmi_sysbuf_free(ureq->buf);
@@ -87,9 +87,12 @@ psm2_mq_req_t psmi_mq_req_alloc(psm2_mq_t mq, uint32_t type)
 		req->error_code = PSM2_OK;
 		req->mq = mq;
 		req->testwait_callback = NULL;
+		req->done_callback = NULL;
 		req->rts_peer = NULL;
 		req->peer = NULL;
 		req->ptl_req_ptr = NULL;
+		req->stride = NULL;
+		req->post_cycles = get_cycles();
 		return req;
 	} else {	/* we're out of reqs */
 		int issend = (type == MQE_TYPE_SEND);
@@ -107,6 +110,54 @@ psm2_mq_req_t psmi_mq_req_alloc(psm2_mq_t mq, uint32_t type)
 	}
 }
 
+/*
+ * Strided layouts
+ *
+ * Scatter 'len' bytes found at packed offset 'offset' of a message into the
+ * blocks of 'layout' at 'base'.  Offsets need not be block aligned, eager
+ * packets arrive in arbitrary order and sizes.
+ */
+void
+psmi_mq_stride_scatter(const struct psmi_mq_stride *layout, uint8_t *base,
+		       uint32_t offset, const void *src, uint32_t len)
+{
+	const uint8_t *s = (const uint8_t *)src;
+	uint32_t block, boff, n;
+
+	/* Empty blocks are dense, they never get here */
+	psmi_assert(layout->blocklen > 0);
+	if (len == 0)
+		return;
+
+	block = offset / layout->blocklen;
+	boff = offset % layout->blocklen;
+
+	while (len > 0) {
+		psmi_assert(block < layout->count);
+		n = min(len, layout->blocklen - boff);
+		psmi_mq_mtucpy(base + block * layout->stride + boff, s, n);
+		s += n;
+		len -= n;
+		block++;
+		boff = 0;
+	}
+}
+
+/* Pack all blocks of 'layout' at 'base' into 'dest' */
+void
+psmi_mq_stride_gather(const struct psmi_mq_stride *layout, void *dest,
+		      const uint8_t *base)
+{
+	uint8_t *d = (uint8_t *)dest;
+	uint32_t i;
+
+	for (i = 0; i < layout->count; i++) {
+		psmi_mq_mtucpy(d, base, layout->blocklen);
+		d += layout->blocklen;
+		base += layout->stride;
+	}
+}
+
 psm2_error_t psmi_mq_req_init(psm2_mq_t mq)
 {
 	psm2_mq_req_t warmup_req;
@@ -128,7 +179,8 @@ psm2_error_t psmi_mq_req_init(psm2_mq_t mq)
 
 		if ((mq->sreq_pool =
 		     psmi_mpool_create(sizeof(struct psm2_mq_req), chunksz,
-				       maxsz, 0, DESCRIPTORS, NULL,
+				       maxsz, PSMI_MPOOL_ALIGN | PSMI_MPOOL_TLSCACHE,
+				       DESCRIPTORS, NULL,
 				       NULL)) == NULL) {
 			err = PSM2_NO_MEMORY;
 			goto fail;
@@ -148,7 +200,8 @@ psm2_error_t psmi_mq_req_init(psm2_mq_t mq)
 
 		if ((mq->rreq_pool =
 		     psmi_mpool_create(sizeof(struct psm2_mq_req), chunksz,
-				       maxsz, 0, DESCRIPTORS, NULL,
+				       maxsz, PSMI_MPOOL_ALIGN | PSMI_MPOOL_TLSCACHE,
+				       DESCRIPTORS, NULL,
 				       NULL)) == NULL) {
 			err = PSM2_NO_MEMORY;
 			goto fail;
@@ -203,6 +256,87 @@ void psmi_mq_stats_callback(struct mpspawn_stats_req_args *args)
 	entry[7] = mqstats.rx_sys_bytes;
 }
 
+/*
+ * The histograms are summarized as latency percentiles per transport, each
+ * reported as the upper bound of the bucket the percentile falls in.
+ */
+#define MQ_HIST_NUM_ENTRIES	(PSM2_MQ_HIST_NUM_TRANSPORTS * 4)
+
+static
+uint64_t psmi_mq_hist_percentile(const uint64_t *hist, unsigned pct)
+{
+	uint64_t total = 0, sum = 0;
+	int i;
+
+	for (i = 0; i < PSM2_MQ_HIST_BUCKETS; i++)
+		total += hist[i];
+	if (total == 0)
+		return 0;
+
+	for (i = 0; i < PSM2_MQ_HIST_BUCKETS; i++) {
+		sum += hist[i];
+		if (sum * 100 >= total * pct)
+			break;
+	}
+	return i ? 1ULL << i : 0;
+}
+
+static
+void psmi_mq_stats_hist_callback(struct mpspawn_stats_req_args *args)
+{
+	uint64_t *entry = args->stats;
+	psm2_mq_t mq = (psm2_mq_t) args->context;
+	psm2_mq_stats_hist_t hist;
+	int t;
+
+	if (args->num < MQ_HIST_NUM_ENTRIES)
+		return;
+
+	psm2_mq_get_stats_hist(mq, &hist);
+
+	for (t = 0; t < PSM2_MQ_HIST_NUM_TRANSPORTS; t++) {
+		*entry++ = psmi_mq_hist_percentile(hist.tx_lat_ns[t], 50);
+		*entry++ = psmi_mq_hist_percentile(hist.tx_lat_ns[t], 99);
+		*entry++ = psmi_mq_hist_percentile(hist.rx_lat_ns[t], 50);
+		*entry++ = psmi_mq_hist_percentile(hist.rx_lat_ns[t], 99);
+	}
+}
+
+static
+void psmi_mq_stats_hist_register(psm2_mq_t mq, mpspawn_stats_add_fn add_fn)
+{
+	static char *desc[MQ_HIST_NUM_ENTRIES] = {
+		"Self send latency p50 (ns)",
+		"Self send latency p99 (ns)",
+		"Self recv latency p50 (ns)",
+		"Self recv latency p99 (ns)",
+		"Shm send latency p50 (ns)",
+		"Shm send latency p99 (ns)",
+		"Shm recv latency p50 (ns)",
+		"Shm recv latency p99 (ns)",
+		"Hfi send latency p50 (ns)",
+		"Hfi send latency p99 (ns)",
+		"Hfi recv latency p50 (ns)",
+		"Hfi recv latency p99 (ns)"
+	};
+	uint16_t flags[MQ_HIST_NUM_ENTRIES];
+	int i;
+	struct mpspawn_stats_add_args mp_add;
+
+	for (i = 0; i < MQ_HIST_NUM_ENTRIES; i++)
+		flags[i] = MPSPAWN_STATS_REDUCTION_ALL;
+
+	mp_add.version = MPSPAWN_STATS_VERSION;
+	mp_add.num = MQ_HIST_NUM_ENTRIES;
+	mp_add.header = "MPI Latency Summary (max,min @ rank)";
+	mp_add.req_fn = psmi_mq_stats_hist_callback;
+	mp_add.desc = desc;
+	mp_add.flags = flags;
+	mp_add.context = mq;
+
+	add_fn(&mp_add);
+}
+
 void psmi_mq_stats_register(psm2_mq_t mq, mpspawn_stats_add_fn add_fn)
 {
 	char *desc[8];
@@ -234,4 +368,6 @@ void psmi_mq_stats_register(psm2_mq_t mq, mpspawn_stats_add_fn add_fn)
 	mp_add.context = mq;
 
 	add_fn(&mp_add);
+
+	psmi_mq_stats_hist_register(mq, add_fn);
 }
@@ -0,0 +1,192 @@
+/*
+
+  This file is provided under a dual BSD/GPLv2 license.  When using or
+  redistributing this file, you may do so under either license.
+
+  GPL LICENSE SUMMARY
+
+  Copyright(c) 2015 Intel Corporation.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of version 2 of the GNU General Public License as
+  published by the Free Software Foundation.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  Contact Information:
+  Intel Corporation, www.intel.com
+
+  BSD LICENSE
+
+  Copyright(c) 2015 Intel Corporation.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the
+      distribution.
+    * Neither the name of Intel Corporation nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <sched.h>
+
+#include "psm_user.h"
+
+/* Poll for 20us out of every 100us by default */
+#define PSMI_PROGRESS_BUSY_US	20
+#define PSMI_PROGRESS_SLEEP_US	80
+
+static void *psmi_progress_thread(void *arg)
+{
+	struct psmi_progress *prog = (struct psmi_progress *)arg;
+	psm2_ep_t ep = prog->ep;
+	uint64_t t_end;
+	psm2_error_t err;
+	int ret;
+
+	if (prog->cpu >= 0) {
+		cpu_set_t cpuset;
+		CPU_ZERO(&cpuset);
+		CPU_SET(prog->cpu, &cpuset);
+		ret = pthread_setaffinity_np(pthread_self(), sizeof(cpuset),
+					     &cpuset);
+		if (ret)
+			_HFI_INFO("Couldn't pin progress thread to cpu %d: %s\n",
+				  prog->cpu, strerror(ret));
+	}
+
+	while (!prog->stop) {
+		t_end = get_cycles() + prog->busy_cyc;
+		do {
+			if (PSMI_PLOCK_TRY()) {
+				prog->lock_busy++;
+				continue;
+			}
+			err = psmi_poll_internal(ep, PSMI_TRUE);
+			PSMI_PUNLOCK();
+
+			prog->polls++;
+			if (err == PSM2_OK)
+				prog->polls_ok++;
+			else if (err != PSM2_OK_NO_PROGRESS)
+				_HFI_VDBG("progress thread poll returned %s\n",
+					  psm2_error_get_string(err));
+		} while (!prog->stop && get_cycles() < t_end);
+
+		if (prog->sleep_us && !prog->stop)
+			usleep(prog->sleep_us);
+	}
+
+	return NULL;
+}
+
+psm2_error_t psmi_progress_init(psm2_ep_t ep)
+{
+	union psmi_envvar_val env_prog, env_duty, env_cpu;
+	struct psmi_progress *prog;
+	char buf[32];
+	int ret;
+	int tvals[2] = { PSMI_PROGRESS_BUSY_US, PSMI_PROGRESS_SLEEP_US };
+
+	ep->progress = NULL;
+
+	psmi_getenv("PSM2_PROGRESS_THREAD",
+		    "Progress communication from a helper thread (0 off, 1 on)",
+		    PSMI_ENVVAR_LEVEL_USER, PSMI_ENVVAR_TYPE_UINT,
+		    (union psmi_envvar_val)0, &env_prog);
+	if (env_prog.e_uint == 0)
+		return PSM2_OK;
+
+	if (PSMI_PLOCK_DISABLED) {
+		_HFI_INFO("Progress lock is compiled out, "
+			  "not starting progress thread\n");
+		return PSM2_OK;
+	}
+
+	snprintf(buf, sizeof(buf), "%d:%d", PSMI_PROGRESS_BUSY_US,
+		 PSMI_PROGRESS_SLEEP_US);
+	if (!psmi_getenv("PSM2_PROGRESS_DUTY",
+			 "Progress thread duty cycle <busy_usecs[:sleep_usecs]>",
+			 PSMI_ENVVAR_LEVEL_USER, PSMI_ENVVAR_TYPE_STR,
+			 (union psmi_envvar_val)buf, &env_duty)) {
+		if (psmi_parse_str_tuples(env_duty.e_str, 2, tvals) < 1 ||
+		    tvals[0] < 0 || tvals[1] < 0) {
+			_HFI_INFO("Overriding invalid PSM2_PROGRESS_DUTY of %s "
+				  "to be <%d:%d>\n", env_duty.e_str,
+				  PSMI_PROGRESS_BUSY_US, PSMI_PROGRESS_SLEEP_US);
+			tvals[0] = PSMI_PROGRESS_BUSY_US;
+			tvals[1] = PSMI_PROGRESS_SLEEP_US;
+		}
+	}
+
+	psmi_getenv("PSM2_PROGRESS_AFFINITY",
+		    "Pin progress thread to this cpu (-1 inherits affinity)",
+		    PSMI_ENVVAR_LEVEL_USER, PSMI_ENVVAR_TYPE_INT,
+		    (union psmi_envvar_val)-1, &env_cpu);
+
+	prog = psmi_calloc(ep, UNDEFINED, 1, sizeof(struct psmi_progress));
+	if (prog == NULL)
+		return PSM2_NO_MEMORY;
+	prog->ep = ep;
+	prog->busy_cyc = nanosecs_to_cycles((uint64_t) tvals[0] * 1000);
+	prog->sleep_us = tvals[1];
+	prog->cpu = env_cpu.e_int < CPU_SETSIZE ? env_cpu.e_int : -1;
+
+	/* Like tracing, the endpoint still works without its helper */
+	ret = pthread_create(&prog->threadid, NULL, psmi_progress_thread, prog);
+	if (ret) {
+		_HFI_ERROR("Can't start progress thread: %s\n", strerror(ret));
+		psmi_free(prog);
+		return PSM2_OK;
+	}
+
+	_HFI_PRDBG("progress thread polls %dus every %dus, cpu %d\n",
+		   tvals[0], tvals[0] + tvals[1], prog->cpu);
+	ep->progress = prog;
+	return PSM2_OK;
+}
+
+/*
+ * The thread never blocks on the progress lock, so the caller may hold it
+ * while waiting for the thread to exit.
+ */
+void psmi_progress_fini(psm2_ep_t ep)
+{
+	struct psmi_progress *prog = ep->progress;
+
+	if (prog == NULL)
+		return;
+
+	prog->stop = 1;
+	pthread_join(prog->threadid, NULL);
+
+	_HFI_PRDBG("progress thread made progress %lld/%lld polls, "
+		   "lock busy %lld times\n", (long long)prog->polls_ok,
+		   (long long)prog->polls, (long long)prog->lock_busy);
+
+	psmi_free(prog);
+	ep->progress = NULL;
+}
@@ -0,0 +1,90 @@
+/*
+
+  This file is provided under a dual BSD/GPLv2 license.  When using or
+  redistributing this file, you may do so under either license.
+
+  GPL LICENSE SUMMARY
+
+  Copyright(c) 2015 Intel Corporation.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of version 2 of the GNU General Public License as
+  published by the Free Software Foundation.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  Contact Information:
+  Intel Corporation, www.intel.com
+
+  BSD LICENSE
+
+  Copyright(c) 2015 Intel Corporation.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the
+      distribution.
+    * Neither the name of Intel Corporation nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef _PSMI_IN_USER_H
+#error psm_progress.h not meant to be included directly, include psm_user.h instead
+#endif
+
+#ifndef _PSMI_PROGRESS_H
+#define _PSMI_PROGRESS_H
+
+/*
+ * Asynchronous progress thread.
+ *
+ * With PSM2_PROGRESS_THREAD set, the master endpoint starts a thread that
+ * drives psmi_poll_internal() over all PTLs (self, shm and hfi, on every
+ * rail) so that rendezvous transfers keep moving while the application
+ * computes.  The thread only ever try-locks the progress lock, so it backs
+ * off whenever an application thread is inside PSM, and runs on a duty
+ * cycle: it polls for busy_cyc, then sleeps for sleep_us.
+ */
+
+struct psmi_progress {
+	psm2_ep_t ep;
+	pthread_t threadid;
+	volatile int stop;
+
+	uint64_t busy_cyc;	/* polling part of the duty cycle */
+	uint32_t sleep_us;	/* sleeping part of the duty cycle */
+	int cpu;		/* -1 to inherit the caller's affinity */
+
+	/* stats */
+	uint64_t polls;		/* psmi_poll_internal calls */
+	uint64_t polls_ok;	/* ... that made progress */
+	uint64_t lock_busy;	/* times the lock was held by someone else */
+};
+
+psm2_error_t psmi_progress_init(psm2_ep_t ep);
+void psmi_progress_fini(psm2_ep_t ep);
+
+#endif /* _PSMI_PROGRESS_H */
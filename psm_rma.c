@@ -0,0 +1,779 @@
+/*
+
+  This file is provided under a dual BSD/GPLv2 license.  When using or
+  redistributing this file, you may do so under either license.
+
+  GPL LICENSE SUMMARY
+
+  Copyright(c) 2015 Intel Corporation.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of version 2 of the GNU General Public License as
+  published by the Free Software Foundation.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  Contact Information:
+  Intel Corporation, www.intel.com
+
+  BSD LICENSE
+
+  Copyright(c) 2015 Intel Corporation.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the
+      distribution.
+    * Neither the name of Intel Corporation nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+
+#include "psm_user.h"
+#include "psm2_am.h"
+#include "psm2_rma.h"
+#include "psm_am_internal.h"
+
+/*
+ * One-sided RMA.
+ *
+ * Regions live in a per-endpoint mpool, a key names one by its pool index
+ * and generation count so that keys to a deregistered region are caught.
+ * Puts are long AM requests to the region.  The owner's transport checks
+ * them against the region before any of the payload lands (see
+ * psmi_am_long_dest_ok), and the handler bumps the region's put count and
+ * replies.  Gets are short AM requests that the owner answers with a long
+ * AM reply out of the region.  Both use the handlers kept at the top of the
+ * AM handler table, so the owner need not register anything but the region.
+ *
+ * Atomics are short AM requests run by the owner's handler with the
+ * processor's atomics on the region.  Fetching ones reply with the previous
+ * value.  Accumulates are split to fit short requests, each one is answered
+ * and the accumulate completes once all are, whatever rail they took.
+ *
+ * Replies carry the status of the access.  A rejected one still completes,
+ * its error is kept for psm2_rma_status().
+ */
+
+#define PSMI_RMA_MR_PER_CHUNK	64
+#define PSMI_RMA_MR_MAX		(1 << 16)
+
+struct psm2_rma_mr {
+	uint8_t *addr;
+	uint64_t len;
+	uint64_t id;
+	volatile uint64_t count;	/* puts landed */
+};
+
+/* Argument layout of a put request */
+#define RMA_PUT_ARG_ID		0
+#define RMA_PUT_ARG_LEN		1
+#define RMA_PUT_ARG_FN		2
+#define RMA_PUT_ARG_CTXT	3
+#define RMA_PUT_NARGS		4
+
+/* Argument layout of a get request */
+#define RMA_GET_ARG_ID		0
+#define RMA_GET_ARG_ADDR	1
+#define RMA_GET_ARG_LEN		2
+#define RMA_GET_ARG_DEST	3
+#define RMA_GET_ARG_FN		4
+#define RMA_GET_ARG_CTXT	5
+#define RMA_GET_NARGS		6
+
+PSMI_ALWAYS_INLINE(
+psm2_ep_t
+psmi_rma_token_ep(psm2_am_token_t token))
+{
+	struct psmi_am_token *tok = (struct psmi_am_token *)token;
+
+	/* Regions hang off the master of a multi-rail endpoint */
+	return tok->epaddr_from->ptlctl->ep->mctxt_master;
+}
+
+static
+struct psm2_rma_mr *
+psmi_rma_mr_lookup(psm2_ep_t ep, uint64_t id, uint64_t addr, uint64_t len)
+{
+	struct psm2_rma_mr *mr;
+	uint32_t index, gen_count;
+
+	if (ep->rma_mr_pool == NULL)
+		return NULL;
+
+	mr = psmi_mpool_find_obj_by_index(ep->rma_mr_pool,
+					  (int)(id & 0xffffffff));
+	if (mr == NULL)
+		return NULL;
+
+	psmi_mpool_get_obj_index_gen_count(mr, &index, &gen_count);
+	if (gen_count != (uint32_t) (id >> 32) || mr->id != id)
+		return NULL;
+
+	if (addr < (uintptr_t) mr->addr ||
+	    addr + len > (uintptr_t) mr->addr + mr->len)
+		return NULL;
+
+	return mr;
+}
+
+/* Keeps the first error reported by a target until psm2_rma_status() */
+PSMI_ALWAYS_INLINE(
+void
+psmi_rma_status_set(psm2_ep_t ep, psm2_error_t err))
+{
+	if (ep->rma_status == PSM2_OK)
+		ep->rma_status = err;
+}
+
+int
+psmi_rma_put_dest_ok(psm2_ep_t ep, psm2_amarg_t *args, int nargs,
+		     const void *dest, size_t len)
+{
+	psmi_assert(nargs >= 1);
+	return psmi_rma_mr_lookup(ep->mctxt_master, args[RMA_PUT_ARG_ID].u64,
+				  (uintptr_t) dest, len) != NULL;
+}
+
+int psmi_rma_put_handler(PSMI_AM_ARGS_DEFAULT)
+{
+	psm2_ep_t ep = psmi_rma_token_ep(token);
+	struct psmi_am_token *tok = (struct psmi_am_token *)token;
+	uint64_t putlen = args[RMA_PUT_ARG_LEN].u64;
+	struct psm2_rma_mr *mr;
+	psm2_amarg_t rarg[3];
+
+	psmi_assert(nargs == RMA_PUT_NARGS);
+
+	rarg[0].u64 = args[RMA_PUT_ARG_FN].u64;
+	rarg[1].u64 = args[RMA_PUT_ARG_CTXT].u64;
+	rarg[2].u64 = PSM2_OK;
+
+	/* A rejected put arrives with none of its payload */
+	mr = psmi_rma_mr_lookup(ep, args[RMA_PUT_ARG_ID].u64,
+				(uintptr_t) src, putlen);
+	if_pf(mr == NULL || len != putlen) {
+		_HFI_DBG("RMA put to %p len %" PRIu64 " outside any region\n",
+			 src, putlen);
+		rarg[2].u64 = PSM2_PARAM_ERR;
+	} else
+		mr->count++;
+
+	tok->epaddr_from->ptlctl->am_short_reply(token, PSMI_AM_RMA_DONE_HIDX,
+						 rarg, 3, NULL, 0,
+						 PSM2_AM_FLAG_NONE, NULL, NULL);
+	return 0;
+}
+
+int psmi_rma_get_handler(PSMI_AM_ARGS_DEFAULT)
+{
+	psm2_ep_t ep = psmi_rma_token_ep(token);
+	struct psmi_am_token *tok = (struct psmi_am_token *)token;
+	ptl_ctl_t *ptlc = tok->epaddr_from->ptlctl;
+	uint64_t addr = args[RMA_GET_ARG_ADDR].u64;
+	uint64_t getlen = args[RMA_GET_ARG_LEN].u64;
+	psm2_amarg_t rarg[3];
+
+	psmi_assert(nargs == RMA_GET_NARGS);
+
+	rarg[0].u64 = args[RMA_GET_ARG_FN].u64;
+	rarg[1].u64 = args[RMA_GET_ARG_CTXT].u64;
+	rarg[2].u64 = PSM2_OK;
+
+	if_pf(psmi_rma_mr_lookup(ep, args[RMA_GET_ARG_ID].u64,
+				 addr, getlen) == NULL) {
+		rarg[2].u64 = PSM2_PARAM_ERR;
+		getlen = 0;
+	}
+
+	ptlc->am_long_reply(token, PSMI_AM_RMA_DONE_HIDX, rarg, 3,
+			    (void *)(uintptr_t) addr, getlen,
+			    (void *)(uintptr_t) args[RMA_GET_ARG_DEST].u64,
+			    PSM2_AM_FLAG_NONE, NULL, NULL);
+	return 0;
+}
+
+/* Completes a put or get at its origin */
+int psmi_rma_done_handler(PSMI_AM_ARGS_DEFAULT)
+{
+	psm2_am_completion_fn_t completion_fn =
+	    (psm2_am_completion_fn_t) (uintptr_t) args[0].u64;
+	psm2_error_t err = (psm2_error_t) args[2].u64;
+
+	if_pf(err != PSM2_OK) {
+		struct psmi_am_token *tok = (struct psmi_am_token *)token;
+		_HFI_DBG("RMA access at %s outside any region\n",
+			 psmi_epaddr_get_name(tok->epaddr_from->epid));
+		psmi_rma_status_set(psmi_rma_token_ep(token), err);
+	}
+
+	if (completion_fn)
+		completion_fn((void *)(uintptr_t) args[1].u64);
+	return 0;
+}
+
+void psmi_rma_fini(psm2_ep_t ep)
+{
+	if (ep->rma_mr_pool != NULL) {
+		psmi_mpool_destroy(ep->rma_mr_pool);
+		ep->rma_mr_pool = NULL;
+	}
+}
+
+psm2_error_t
+__psm2_rma_register(psm2_ep_t ep, void *addr, size_t len,
+		    psm2_rma_mr_t *mr_o, psm2_rma_key_t *key_o)
+{
+	struct psm2_rma_mr *mr;
+	uint32_t index, gen_count;
+	psm2_error_t err = PSM2_OK;
+
+	PSM2_LOG_MSG("entering");
+	PSMI_ERR_UNLESS_INITIALIZED(ep);
+
+	if (mr_o == NULL || key_o == NULL || (addr == NULL && len > 0)) {
+		err = psmi_handle_error(ep, PSM2_PARAM_ERR,
+					"Invalid %s parameters", __FUNCTION__);
+		goto fail_nolock;
+	}
+
+	PSMI_PLOCK();
+
+	ep = ep->mctxt_master;
+	if (ep->rma_mr_pool == NULL) {
+		ep->rma_mr_pool =
+		    psmi_mpool_create(sizeof(struct psm2_rma_mr),
+				      PSMI_RMA_MR_PER_CHUNK, PSMI_RMA_MR_MAX,
+				      0, UNDEFINED, NULL, NULL);
+		if (ep->rma_mr_pool == NULL) {
+			err = PSM2_NO_MEMORY;
+			goto fail;
+		}
+	}
+
+	mr = psmi_mpool_get(ep->rma_mr_pool);
+	if (mr == NULL) {
+		err = psmi_handle_error(ep, PSM2_NO_MEMORY,
+					"Out of RMA regions (max %d)",
+					PSMI_RMA_MR_MAX);
+		goto fail;
+	}
+
+	psmi_mpool_get_obj_index_gen_count(mr, &index, &gen_count);
+	mr->addr = (uint8_t *) addr;
+	mr->len = len;
+	mr->id = ((uint64_t) gen_count << 32) | index;
+	mr->count = 0;
+
+	key_o->addr = (uintptr_t) addr;
+	key_o->len = len;
+	key_o->id = mr->id;
+	*mr_o = mr;
+
+fail:
+	PSMI_PUNLOCK();
+fail_nolock:
+	PSM2_LOG_MSG("leaving");
+	return err;
+}
+PSMI_API_DECL(psm2_rma_register)
+
+psm2_error_t __psm2_rma_deregister(psm2_rma_mr_t mr)
+{
+	PSM2_LOG_MSG("entering");
+	PSMI_ASSERT_INITIALIZED();
+	psmi_assert_always(mr != NULL);
+
+	PSMI_PLOCK();
+	/* Bumps the generation count, which invalidates the key */
+	psmi_mpool_put(mr);
+	PSMI_PUNLOCK();
+
+	PSM2_LOG_MSG("leaving");
+	return PSM2_OK;
+}
+PSMI_API_DECL(psm2_rma_deregister)
+
+psm2_error_t __psm2_rma_mr_count(psm2_rma_mr_t mr, uint64_t *count_o)
+{
+	PSM2_LOG_MSG("entering");
+	PSMI_ASSERT_INITIALIZED();
+	psmi_assert_always(mr != NULL);
+
+	/* The put handler bumps the count under the lock */
+	PSMI_PLOCK();
+	*count_o = mr->count;
+	PSMI_PUNLOCK();
+
+	PSM2_LOG_MSG("leaving");
+	return PSM2_OK;
+}
+PSMI_API_DECL(psm2_rma_mr_count)
+
+psm2_error_t __psm2_rma_status(psm2_ep_t ep, psm2_error_t *status_o)
+{
+	PSM2_LOG_MSG("entering");
+	PSMI_ERR_UNLESS_INITIALIZED(ep);
+	psmi_assert_always(status_o != NULL);
+
+	PSMI_PLOCK();
+	ep = ep->mctxt_master;
+	*status_o = ep->rma_status;
+	ep->rma_status = PSM2_OK;
+	PSMI_PUNLOCK();
+
+	PSM2_LOG_MSG("leaving");
+	return PSM2_OK;
+}
+PSMI_API_DECL(psm2_rma_status)
+
+PSMI_ALWAYS_INLINE(
+psm2_error_t
+psmi_rma_check_key(psm2_epaddr_t epaddr, const psm2_rma_key_t *key,
+		   uint64_t offset, size_t len))
+{
+	if_pf(key == NULL || offset > key->len || len > key->len - offset)
+		return psmi_handle_error(epaddr->ptlctl->ep, PSM2_PARAM_ERR,
+					 "RMA access of %lu bytes at offset %lu "
+					 "outside region", (unsigned long)len,
+					 (unsigned long)offset);
+	return PSM2_OK;
+}
+
+psm2_error_t
+__psm2_rma_put(psm2_epaddr_t epaddr, const void *src, size_t len,
+	       const psm2_rma_key_t *key, uint64_t offset,
+	       psm2_am_completion_fn_t completion_fn, void *completion_ctxt)
+{
+	ptl_ctl_t *ptlc = epaddr->ptlctl;
+	psm2_amarg_t args[RMA_PUT_NARGS];
+	psm2_error_t err;
+
+	PSM2_LOG_MSG("entering");
+	PSMI_ASSERT_INITIALIZED();
+	psmi_assert(len > 0 ? src != NULL : 1);
+
+	err = psmi_rma_check_key(epaddr, key, offset, len);
+	if (err != PSM2_OK)
+		goto fail;
+
+	args[RMA_PUT_ARG_ID].u64 = key->id;
+	args[RMA_PUT_ARG_LEN].u64 = len;
+	args[RMA_PUT_ARG_FN].u64 = (uintptr_t) completion_fn;
+	args[RMA_PUT_ARG_CTXT].u64 = (uintptr_t) completion_ctxt;
+
+	/* The owner's reply completes the put, once the data has landed */
+	PSMI_PLOCK();
+	err = ptlc->am_long_request(epaddr, PSMI_AM_RMA_PUT_HIDX,
+				    args, RMA_PUT_NARGS, (void *)src, len,
+				    (void *)(uintptr_t) (key->addr + offset),
+				    PSM2_AM_FLAG_NONE, NULL, NULL);
+	PSMI_PUNLOCK();
+
+fail:
+	PSM2_LOG_MSG("leaving");
+	return err;
+}
+PSMI_API_DECL(psm2_rma_put)
+
+psm2_error_t
+__psm2_rma_get(psm2_epaddr_t epaddr, void *dest, size_t len,
+	       const psm2_rma_key_t *key, uint64_t offset,
+	       psm2_am_completion_fn_t completion_fn, void *completion_ctxt)
+{
+	ptl_ctl_t *ptlc = epaddr->ptlctl;
+	psm2_amarg_t args[RMA_GET_NARGS];
+	psm2_error_t err;
+
+	PSM2_LOG_MSG("entering");
+	PSMI_ASSERT_INITIALIZED();
+	psmi_assert(len > 0 ? dest != NULL : 1);
+
+	err = psmi_rma_check_key(epaddr, key, offset, len);
+	if (err != PSM2_OK)
+		goto fail;
+
+	args[RMA_GET_ARG_ID].u64 = key->id;
+	args[RMA_GET_ARG_ADDR].u64 = key->addr + offset;
+	args[RMA_GET_ARG_LEN].u64 = len;
+	args[RMA_GET_ARG_DEST].u64 = (uintptr_t) dest;
+	args[RMA_GET_ARG_FN].u64 = (uintptr_t) completion_fn;
+	args[RMA_GET_ARG_CTXT].u64 = (uintptr_t) completion_ctxt;
+
+	/* The owner answers with a long reply into dest */
+	PSMI_PLOCK();
+	err = ptlc->am_short_request(epaddr, PSMI_AM_RMA_GET_HIDX,
+				     args, RMA_GET_NARGS, NULL, 0,
+				     PSM2_AM_FLAG_NONE, NULL, NULL);
+	PSMI_PUNLOCK();
+
+fail:
+	PSM2_LOG_MSG("leaving");
+	return err;
+}
+PSMI_API_DECL(psm2_rma_get)
+
+/* Argument layout of an atomic request */
+#define ATOMIC_ARG_KIND		0	/* u32w0 kind, u32w1 type << 8 | op */
+#define ATOMIC_ARG_ID		1
+#define ATOMIC_ARG_ADDR		2
+#define ATOMIC_ARG_OPERAND0	3
+#define ATOMIC_ARG_OPERAND1	4
+#define ATOMIC_ARG_RESULT	5
+#define ATOMIC_ARG_FN		6
+#define ATOMIC_ARG_CTXT		7
+#define ATOMIC_NARGS		8
+
+#define ATOMIC_KIND_FADD	0
+#define ATOMIC_KIND_CSWAP	1
+#define ATOMIC_KIND_ACC		2
+
+/* Argument layout of an atomic reply */
+#define ATOMIC_REP_ARG_RESULT	0	/* result, or accumulate tracker */
+#define ATOMIC_REP_ARG_VALUE	1
+#define ATOMIC_REP_ARG_FN	2
+#define ATOMIC_REP_ARG_CTXT	3
+#define ATOMIC_REP_ARG_STATUS	4	/* u32w0 status, u32w1 kind */
+#define ATOMIC_REP_NARGS	5
+
+/* An accumulate split over several requests */
+struct psmi_atomic_acc {
+	uint32_t pending;	/* requests not answered yet */
+	psm2_am_completion_fn_t completion_fn;
+	void *completion_ctxt;
+};
+
+PSMI_ALWAYS_INLINE(
+int
+psmi_atomic_replaces(psm2_atomic_type_t type, psm2_atomic_op_t op,
+		     uint64_t cur, uint64_t val))
+{
+	switch (type) {
+	case PSM2_ATOMIC_INT64:
+		return op == PSM2_ATOMIC_MIN ? (int64_t) val < (int64_t) cur :
+					       (int64_t) val > (int64_t) cur;
+	case PSM2_ATOMIC_UINT64:
+		return op == PSM2_ATOMIC_MIN ? val < cur : val > cur;
+	default:
+		{
+			union { uint64_t u; double d; } c, v;
+			c.u = cur;
+			v.u = val;
+			return op == PSM2_ATOMIC_MIN ? v.d < c.d : v.d > c.d;
+		}
+	}
+}
+
+static
+void
+psmi_atomic_accumulate(volatile uint64_t *dest, const uint64_t *src,
+		       size_t count, psm2_atomic_type_t type,
+		       psm2_atomic_op_t op)
+{
+	union { uint64_t u; double d; } cur, val;
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		if (op == PSM2_ATOMIC_SUM && type != PSM2_ATOMIC_DOUBLE) {
+			__sync_fetch_and_add(&dest[i], src[i]);
+			continue;
+		}
+
+		/* Everything else is a compare-and-swap loop */
+		do {
+			cur.u = dest[i];
+			if (op == PSM2_ATOMIC_SUM) {
+				val.u = src[i];
+				val.d += cur.d;
+			} else if (psmi_atomic_replaces(type, op, cur.u,
+							src[i]))
+				val.u = src[i];
+			else
+				break;
+		} while (!__sync_bool_compare_and_swap(&dest[i], cur.u,
+						       val.u));
+	}
+}
+
+int psmi_atomic_handler(PSMI_AM_ARGS_DEFAULT)
+{
+	psm2_ep_t ep = psmi_rma_token_ep(token);
+	struct psmi_am_token *tok = (struct psmi_am_token *)token;
+	uint32_t kind = args[ATOMIC_ARG_KIND].u32w0;
+	uint64_t addr = args[ATOMIC_ARG_ADDR].u64;
+	volatile uint64_t *word = (volatile uint64_t *)(uintptr_t) addr;
+	psm2_amarg_t rarg[ATOMIC_REP_NARGS];
+	uint64_t bytes;
+
+	psmi_assert(nargs == ATOMIC_NARGS);
+
+	rarg[ATOMIC_REP_ARG_VALUE].u64 = 0;
+	rarg[ATOMIC_REP_ARG_STATUS].u32w0 = PSM2_OK;
+	rarg[ATOMIC_REP_ARG_STATUS].u32w1 = kind;
+
+	bytes = kind == ATOMIC_KIND_ACC ? len : sizeof(uint64_t);
+	if_pf(psmi_rma_mr_lookup(ep, args[ATOMIC_ARG_ID].u64,
+				 addr, bytes) == NULL)
+		rarg[ATOMIC_REP_ARG_STATUS].u32w0 = PSM2_PARAM_ERR;
+	else {
+		switch (kind) {
+		case ATOMIC_KIND_FADD:
+			rarg[ATOMIC_REP_ARG_VALUE].u64 =
+			    __sync_fetch_and_add(word,
+				args[ATOMIC_ARG_OPERAND0].u64);
+			break;
+		case ATOMIC_KIND_CSWAP:
+			rarg[ATOMIC_REP_ARG_VALUE].u64 =
+			    __sync_val_compare_and_swap(word,
+				args[ATOMIC_ARG_OPERAND0].u64,
+				args[ATOMIC_ARG_OPERAND1].u64);
+			break;
+		default:
+			psmi_assert(kind == ATOMIC_KIND_ACC);
+			psmi_atomic_accumulate(word, (const uint64_t *)src,
+				len / sizeof(uint64_t),
+				(psm2_atomic_type_t)
+				(args[ATOMIC_ARG_KIND].u32w1 >> 8),
+				(psm2_atomic_op_t)
+				(args[ATOMIC_ARG_KIND].u32w1 & 0xff));
+			break;
+		}
+	}
+
+	rarg[ATOMIC_REP_ARG_RESULT].u64 = args[ATOMIC_ARG_RESULT].u64;
+	rarg[ATOMIC_REP_ARG_FN].u64 = args[ATOMIC_ARG_FN].u64;
+	rarg[ATOMIC_REP_ARG_CTXT].u64 = args[ATOMIC_ARG_CTXT].u64;
+	tok->epaddr_from->ptlctl->am_short_reply(token,
+						 PSMI_AM_ATOMIC_DONE_HIDX,
+						 rarg, ATOMIC_REP_NARGS,
+						 NULL, 0, PSM2_AM_FLAG_NONE,
+						 NULL, NULL);
+	return 0;
+}
+
+int psmi_atomic_done_handler(PSMI_AM_ARGS_DEFAULT)
+{
+	void *result = (void *)(uintptr_t) args[ATOMIC_REP_ARG_RESULT].u64;
+	psm2_am_completion_fn_t completion_fn =
+	    (psm2_am_completion_fn_t) (uintptr_t) args[ATOMIC_REP_ARG_FN].u64;
+	void *completion_ctxt =
+	    (void *)(uintptr_t) args[ATOMIC_REP_ARG_CTXT].u64;
+	psm2_error_t err = (psm2_error_t) args[ATOMIC_REP_ARG_STATUS].u32w0;
+	uint32_t kind = args[ATOMIC_REP_ARG_STATUS].u32w1;
+
+	psmi_assert(nargs == ATOMIC_REP_NARGS);
+
+	/* A failed atomic leaves result alone but still completes */
+	if_pf(err != PSM2_OK) {
+		struct psmi_am_token *tok = (struct psmi_am_token *)token;
+		_HFI_DBG("RMA atomic at %s outside any region\n",
+			 psmi_epaddr_get_name(tok->epaddr_from->epid));
+		psmi_rma_status_set(psmi_rma_token_ep(token), err);
+	} else if (kind != ATOMIC_KIND_ACC)
+		*(uint64_t *)result = args[ATOMIC_REP_ARG_VALUE].u64;
+
+	/* A split accumulate completes with the last answer to arrive */
+	if (kind == ATOMIC_KIND_ACC && result != NULL) {
+		struct psmi_atomic_acc *acc = (struct psmi_atomic_acc *)result;
+
+		if (--acc->pending > 0)
+			return 0;
+		completion_fn = acc->completion_fn;
+		completion_ctxt = acc->completion_ctxt;
+		psmi_free(acc);
+	}
+	if (completion_fn)
+		completion_fn(completion_ctxt);
+	return 0;
+}
+
+static
+psm2_error_t
+psmi_atomic_fetch(psm2_epaddr_t epaddr, const psm2_rma_key_t *key,
+		  uint64_t offset, uint32_t kind, uint64_t operand0,
+		  uint64_t operand1, uint64_t *result,
+		  psm2_am_completion_fn_t completion_fn, void *completion_ctxt)
+{
+	ptl_ctl_t *ptlc = epaddr->ptlctl;
+	psm2_amarg_t args[ATOMIC_NARGS];
+	psm2_error_t err;
+
+	psmi_assert_always(result != NULL);
+
+	err = psmi_rma_check_key(epaddr, key, offset, sizeof(uint64_t));
+	if (err != PSM2_OK)
+		return err;
+	if_pf((key->addr + offset) & (sizeof(uint64_t) - 1))
+		return psmi_handle_error(ptlc->ep, PSM2_PARAM_ERR,
+					 "Unaligned RMA atomic at offset %lu",
+					 (unsigned long)offset);
+
+	args[ATOMIC_ARG_KIND].u32w0 = kind;
+	args[ATOMIC_ARG_KIND].u32w1 = 0;
+	args[ATOMIC_ARG_ID].u64 = key->id;
+	args[ATOMIC_ARG_ADDR].u64 = key->addr + offset;
+	args[ATOMIC_ARG_OPERAND0].u64 = operand0;
+	args[ATOMIC_ARG_OPERAND1].u64 = operand1;
+	args[ATOMIC_ARG_RESULT].u64 = (uintptr_t) result;
+	args[ATOMIC_ARG_FN].u64 = (uintptr_t) completion_fn;
+	args[ATOMIC_ARG_CTXT].u64 = (uintptr_t) completion_ctxt;
+
+	PSMI_PLOCK();
+	err = ptlc->am_short_request(epaddr, PSMI_AM_ATOMIC_HIDX,
+				     args, ATOMIC_NARGS, NULL, 0,
+				     PSM2_AM_FLAG_NONE, NULL, NULL);
+	PSMI_PUNLOCK();
+	return err;
+}
+
+psm2_error_t
+__psm2_atomic_fadd(psm2_epaddr_t epaddr, const psm2_rma_key_t *key,
+		   uint64_t offset, uint64_t value, uint64_t *result,
+		   psm2_am_completion_fn_t completion_fn, void *completion_ctxt)
+{
+	psm2_error_t err;
+
+	PSM2_LOG_MSG("entering");
+	PSMI_ASSERT_INITIALIZED();
+	err = psmi_atomic_fetch(epaddr, key, offset, ATOMIC_KIND_FADD,
+				value, 0, result, completion_fn,
+				completion_ctxt);
+	PSM2_LOG_MSG("leaving");
+	return err;
+}
+PSMI_API_DECL(psm2_atomic_fadd)
+
+psm2_error_t
+__psm2_atomic_cswap(psm2_epaddr_t epaddr, const psm2_rma_key_t *key,
+		    uint64_t offset, uint64_t compare, uint64_t swap,
+		    uint64_t *result, psm2_am_completion_fn_t completion_fn,
+		    void *completion_ctxt)
+{
+	psm2_error_t err;
+
+	PSM2_LOG_MSG("entering");
+	PSMI_ASSERT_INITIALIZED();
+	err = psmi_atomic_fetch(epaddr, key, offset, ATOMIC_KIND_CSWAP,
+				compare, swap, result, completion_fn,
+				completion_ctxt);
+	PSM2_LOG_MSG("leaving");
+	return err;
+}
+PSMI_API_DECL(psm2_atomic_cswap)
+
+psm2_error_t
+__psm2_atomic_accumulate(psm2_epaddr_t epaddr, const psm2_rma_key_t *key,
+			 uint64_t offset, const void *src, size_t count,
+			 psm2_atomic_type_t type, psm2_atomic_op_t op,
+			 psm2_am_completion_fn_t completion_fn,
+			 void *completion_ctxt)
+{
+	ptl_ctl_t *ptlc = epaddr->ptlctl;
+	psm2_amarg_t args[ATOMIC_NARGS];
+	const uint64_t *elems = (const uint64_t *)src;
+	size_t chunk, nreqs, len = count * sizeof(uint64_t);
+	struct psmi_atomic_acc *acc = NULL;
+	psm2_error_t err;
+
+	PSM2_LOG_MSG("entering");
+	PSMI_ASSERT_INITIALIZED();
+	psmi_assert(count > 0 ? src != NULL : 1);
+
+	if (type > PSM2_ATOMIC_DOUBLE || op > PSM2_ATOMIC_MAX) {
+		err = psmi_handle_error(ptlc->ep, PSM2_PARAM_ERR,
+					"Invalid RMA accumulate type %d op %d",
+					type, op);
+		goto fail;
+	}
+	err = psmi_rma_check_key(epaddr, key, offset, len);
+	if (err != PSM2_OK)
+		goto fail;
+	if_pf((key->addr + offset) & (sizeof(uint64_t) - 1)) {
+		err = psmi_handle_error(ptlc->ep, PSM2_PARAM_ERR,
+					"Unaligned RMA atomic at offset %lu",
+					(unsigned long)offset);
+		goto fail;
+	}
+
+	/* Each request carries as many elements as fit a short payload */
+	chunk = psmi_am_parameters.max_request_short / sizeof(uint64_t);
+	psmi_assert_always(chunk > 0);
+	nreqs = count > chunk ? (count + chunk - 1) / chunk : 1;
+
+	/* Answers to the requests of a split accumulate may come back in any
+	 * order across rails, they are counted down to complete it */
+	if (nreqs > 1) {
+		acc = psmi_malloc(ptlc->ep, UNDEFINED, sizeof(*acc));
+		if (acc == NULL) {
+			err = PSM2_NO_MEMORY;
+			goto fail;
+		}
+		acc->pending = nreqs;
+		acc->completion_fn = completion_fn;
+		acc->completion_ctxt = completion_ctxt;
+	}
+
+	args[ATOMIC_ARG_KIND].u32w0 = ATOMIC_KIND_ACC;
+	args[ATOMIC_ARG_KIND].u32w1 = (type << 8) | op;
+	args[ATOMIC_ARG_ID].u64 = key->id;
+	args[ATOMIC_ARG_OPERAND0].u64 = 0;
+	args[ATOMIC_ARG_OPERAND1].u64 = 0;
+	args[ATOMIC_ARG_RESULT].u64 = (uintptr_t) acc;
+	args[ATOMIC_ARG_FN].u64 = (uintptr_t) completion_fn;
+	args[ATOMIC_ARG_CTXT].u64 = (uintptr_t) completion_ctxt;
+
+	PSMI_PLOCK();
+	do {
+		size_t n = min(count, chunk);
+
+		args[ATOMIC_ARG_ADDR].u64 = key->addr + offset;
+		err = ptlc->am_short_request(epaddr, PSMI_AM_ATOMIC_HIDX,
+				args, ATOMIC_NARGS, (void *)elems,
+				n * sizeof(uint64_t), PSM2_AM_FLAG_NONE,
+				NULL, NULL);
+		if (err != PSM2_OK)
+			break;
+		elems += n;
+		offset += n * sizeof(uint64_t);
+		count -= n;
+		nreqs--;
+	} while (count > 0);
+
+	/* The error is returned, the answers to what went out only release
+	 * the tracker */
+	if (err != PSM2_OK && acc != NULL) {
+		acc->completion_fn = NULL;
+		acc->pending -= nreqs;
+		if (acc->pending == 0)
+			psmi_free(acc);
+	}
+	PSMI_PUNLOCK();
+
+fail:
+	PSM2_LOG_MSG("leaving");
+	return err;
+}
+PSMI_API_DECL(psm2_atomic_accumulate)
@@ -112,6 +112,20 @@ fail:
 	return err;
 }
 
+void psmi_stats_deregister_type(uint32_t statstype, void *context)
+{
+	struct psmi_stats_type *type, *next;
+
+	for (type = STAILQ_FIRST(&psmi_stats); type != NULL; type = next) {
+		next = STAILQ_NEXT(type, next);
+		if (type->statstype != statstype || type->context != context)
+			continue;
+		STAILQ_REMOVE(&psmi_stats, type, psmi_stats_type, next);
+		psmi_free(type->entries);
+		psmi_free(type);
+	}
+}
+
 psm2_error_t psmi_stats_deregister_all(void)
 {
 	struct psmi_stats_type *type;
@@ -156,6 +170,9 @@ static uint32_t typestring_to_type(const char *typestr)
 		 (strncasecmp(typestr, "alloc", 6) == 0) ||
 		 (strncasecmp(typestr, "malloc", 7) == 0))
 		return PSMI_STATSTYPE_MEMORY;
+	else if ((strncasecmp(typestr, "sysbuf", 7) == 0) ||
+		 (strncasecmp(typestr, "unexp", 6) == 0))
+		return PSMI_STATSTYPE_SYSBUF;
 	else
 		return 0;
 }
@@ -67,6 +67,7 @@
 #define PSMI_STATSTYPE_IPSPROTO	    0x00200	/* acks,naks,err_chks */
 #define PSMI_STATSTYPE_TIDS	    0x00400
 #define PSMI_STATSTYPE_MEMORY	    0x01000
+#define PSMI_STATSTYPE_SYSBUF	    0x02000	/* unexpected buffer slabs */
 #define PSMI_STATSTYPE_HFI	    (PSMI_STATSTYPE_RCVTHREAD|	\
 				     PSMI_STATSTYPE_IPSPROTO |  \
 				     PSMI_STATSTYPE_MEMORY |  \
@@ -115,6 +116,11 @@ psmi_stats_register_type(const char *heading,
 			 const struct psmi_stats_entry *entries,
 			 int num_entries, void *context);
 
+/*
+ * Drop the entries registered with that type and context
+ */
+void psmi_stats_deregister_type(uint32_t statstype, void *context);
+
 psm2_error_t psmi_stats_deregister_all(void);
 
 #endif /* PSM_STATS_H */
@@ -59,24 +59,59 @@
  *
  * System buffer (unexpected message) allocator
  *
+ * Each size class carves its blocks out of slabs, mmap'd segments that are
+ * optionally backed by huge pages.  A slab whose blocks are all free goes on
+ * the class's empty list, and once a class caches more free memory than its
+ * high watermark, empty slabs are unmapped until it's back under the low
+ * watermark.  Requests larger than the largest class are malloc'd.
+ *
  */
 
 #define MM_FLAG_NONE  0
 #define MM_FLAG_TRANSIENT  0x1
-#define MM_NUM_OF_POOLS 7
+#define MM_MAX_POOLS 16
 
-struct psmi_mem_ctrl {
+#define MM_SLAB_FLAG_HUGE	0x1	/* slab is backed by huge pages */
+
+#define MM_SLAB_SIZE_KB		64
+#define MM_WATERMARK_HIGH_KB	1024	/* per class */
+#define MM_WATERMARK_LOW_KB	256
+
+struct psmi_mem_block_ctrl;
+
+struct psmi_sysbuf_slab {
+	TAILQ_ENTRY(psmi_sysbuf_slab) next;	/* on partial or empty list */
+	struct psmi_mem_ctrl *mem_handler;
 	struct psmi_mem_block_ctrl *free_list;
+	uint32_t current_available;
+	uint32_t num_blocks;
+	size_t size;		/* bytes mapped, including this header */
+	uint32_t flags;
+};
+
+TAILQ_HEAD(psmi_sysbuf_slab_list, psmi_sysbuf_slab);
+
+struct psmi_mem_ctrl {
+	struct psmi_sysbuf_slab_list partial;	/* slabs with some free blocks */
+	struct psmi_sysbuf_slab_list empty;	/* slabs with all blocks free */
 	uint32_t total_alloc;
 	uint32_t current_available;
 	uint32_t block_size;
+	uint32_t block_stride;	/* block size plus control and redzones */
+	uint32_t blocks_per_slab;
 	uint32_t flags;
-	uint32_t replenishing_rate;
+	uint32_t watermark_high;	/* in free blocks */
+	uint32_t watermark_low;
+
+	/* Statistics, registered with psm_stats */
+	uint64_t hits;		/* served from a cached free block */
+	uint64_t misses;	/* had to map a slab or malloc */
+	uint64_t slabs_trimmed;
 };
 
 struct psmi_mem_block_ctrl {
 	union {
-		struct psmi_mem_ctrl *mem_handler;
+		struct psmi_sysbuf_slab *slab;	/* NULL for transient blocks */
 		struct psmi_mem_block_ctrl *next;
 	};
 	char _redzone[PSM_VALGRIND_REDZONE_SZ];
@@ -84,8 +119,13 @@ struct psmi_mem_block_ctrl {
 
 struct psmi_sysbuf_allocator {
 	int is_initialized;
-	struct psmi_mem_ctrl handler_index[MM_NUM_OF_POOLS];
-	uint64_t mem_ctrl_total_bytes;
+	int num_pools;
+	int use_hugepages;
+	size_t slab_size;
+	struct psmi_mem_ctrl handler_index[MM_MAX_POOLS];
+	uint64_t mem_ctrl_total_bytes;	/* currently mapped for slabs */
+	uint64_t hugepage_fallbacks;
+	char stats_desc[MM_MAX_POOLS][3][32];
 };
 
 static struct psmi_sysbuf_allocator psmi_sysbuf;
@@ -105,53 +145,207 @@ void psmi_sysbuf_free(psm2_ep_t ep, void *ptr)
 
 #else
 
+static void psmi_sysbuf_stats_register(void);
+
 int psmi_sysbuf_init(void)
 {
-	int i;
-	uint32_t block_sizes[] = { 256, 512, 1024,
-		2048, 4096, 8192, (uint32_t) -1 };
-	uint32_t replenishing_rate[] = { 128, 64, 32, 16, 8, 4, 0 };
+	int i, nclasses, nfields;
+	const char *p;
+	int block_sizes[MM_MAX_POOLS] = { 256, 512, 1024, 2048, 4096, 8192 };
+	int watermarks[2] = { MM_WATERMARK_HIGH_KB, MM_WATERMARK_LOW_KB };
+	union psmi_envvar_val env_classes, env_slab, env_huge, env_wm;
+	struct psmi_mem_ctrl *mm_handler;
 
 	if (psmi_sysbuf.is_initialized)
 		return PSM2_OK;
 
-	for (i = 0; i < MM_NUM_OF_POOLS; i++) {
-		psmi_sysbuf.handler_index[i].block_size = block_sizes[i];
-		psmi_sysbuf.handler_index[i].current_available = 0;
-		psmi_sysbuf.handler_index[i].free_list = NULL;
-		psmi_sysbuf.handler_index[i].total_alloc = 0;
-		psmi_sysbuf.handler_index[i].replenishing_rate =
-			replenishing_rate[i];
-
-		if (block_sizes[i] == -1) {
-			psmi_assert_always(replenishing_rate[i] == 0);
-			psmi_sysbuf.handler_index[i].flags =
-				MM_FLAG_TRANSIENT;
-		} else {
-			psmi_assert_always(replenishing_rate[i] > 0);
-			psmi_sysbuf.handler_index[i].flags = MM_FLAG_NONE;
+	psmi_getenv("PSM2_SYSBUF_CLASSES",
+		    "Unexpected buffer size classes in bytes, colon separated",
+		    PSMI_ENVVAR_LEVEL_HIDDEN, PSMI_ENVVAR_TYPE_STR,
+		    (union psmi_envvar_val)"256:512:1024:2048:4096:8192",
+		    &env_classes);
+	psmi_getenv("PSM2_SYSBUF_SLAB_KB",
+		    "Size of the slabs unexpected buffers are carved from",
+		    PSMI_ENVVAR_LEVEL_HIDDEN, PSMI_ENVVAR_TYPE_UINT,
+		    (union psmi_envvar_val)MM_SLAB_SIZE_KB, &env_slab);
+	psmi_getenv("PSM2_SYSBUF_HUGEPAGES",
+		    "Back unexpected buffer slabs with huge pages",
+		    PSMI_ENVVAR_LEVEL_HIDDEN, PSMI_ENVVAR_TYPE_YESNO,
+		    (union psmi_envvar_val)0, &env_huge);
+	psmi_getenv("PSM2_SYSBUF_WATERMARKS",
+		    "Free memory per size class in KB above which empty slabs are "
+		    "released, and the level they are released down to (high:low)",
+		    PSMI_ENVVAR_LEVEL_HIDDEN, PSMI_ENVVAR_TYPE_STR,
+		    (union psmi_envvar_val)"1024:256", &env_wm);
+
+	/* Every field must hold a size, an empty or bad one would otherwise
+	 * leave the default class at its position */
+	for (p = env_classes.e_str, nfields = 1; *p; p++)
+		nfields += *p == ':';
+	nclasses = psmi_parse_str_tuples(env_classes.e_str, MM_MAX_POOLS - 1,
+					 block_sizes);
+	if (nclasses != nfields) {
+		_HFI_ERROR("Invalid PSM2_SYSBUF_CLASSES '%s', expected up to "
+			   "%d sizes\n", env_classes.e_str, MM_MAX_POOLS - 1);
+		return PSM2_PARAM_ERR;
+	}
+	for (i = 0; i < nclasses; i++) {
+		if (block_sizes[i] <= 0 ||
+		    (i > 0 && block_sizes[i] <= block_sizes[i - 1])) {
+			_HFI_ERROR("Invalid PSM2_SYSBUF_CLASSES '%s', "
+				   "sizes must be increasing\n",
+				   env_classes.e_str);
+			return PSM2_PARAM_ERR;
 		}
 	}
+	psmi_parse_str_tuples(env_wm.e_str, 2, watermarks);
+	if (watermarks[1] > watermarks[0])
+		watermarks[1] = watermarks[0];
+
+	psmi_sysbuf.use_hugepages = env_huge.e_uint;
+	psmi_sysbuf.slab_size = (size_t) max(env_slab.e_uint, 4) * 1024;
+	if (psmi_sysbuf.use_hugepages)
+		psmi_sysbuf.slab_size = PSMI_ALIGNUP(psmi_sysbuf.slab_size,
+						     PSMI_HUGEPAGE_SIZE);
+	psmi_sysbuf.num_pools = nclasses + 1;
+
+	for (i = 0; i < psmi_sysbuf.num_pools; i++) {
+		mm_handler = &psmi_sysbuf.handler_index[i];
+		memset(mm_handler, 0, sizeof(*mm_handler));
+		TAILQ_INIT(&mm_handler->partial);
+		TAILQ_INIT(&mm_handler->empty);
+
+		if (i == nclasses) {
+			mm_handler->block_size = (uint32_t) -1;
+			mm_handler->flags = MM_FLAG_TRANSIENT;
+			continue;
+		}
+
+		mm_handler->block_size = block_sizes[i];
+		mm_handler->block_stride =
+		    PSMI_ALIGNUP(block_sizes[i] +
+				 sizeof(struct psmi_mem_block_ctrl) +
+				 PSM_VALGRIND_REDZONE_SZ, 64);
+		mm_handler->blocks_per_slab =
+		    max(1, (psmi_sysbuf.slab_size -
+			    PSMI_ALIGNUP(sizeof(struct psmi_sysbuf_slab), 64)) /
+			mm_handler->block_stride);
+		mm_handler->watermark_high =
+		    (uint32_t) (((uint64_t) watermarks[0] * 1024) /
+				block_sizes[i]);
+		mm_handler->watermark_low =
+		    (uint32_t) (((uint64_t) watermarks[1] * 1024) /
+				block_sizes[i]);
+		/* Always keep a slab's worth around, or an alloc/free pair at
+		 * the slab boundary would map and unmap a slab every time */
+		mm_handler->watermark_high = max(mm_handler->watermark_high,
+						 mm_handler->blocks_per_slab);
+		mm_handler->watermark_low = max(mm_handler->watermark_low,
+						mm_handler->blocks_per_slab);
+		mm_handler->flags = MM_FLAG_NONE;
+	}
 
 	VALGRIND_CREATE_MEMPOOL(&psmi_sysbuf, PSM_VALGRIND_REDZONE_SZ,
 				PSM_VALGRIND_MEM_UNDEFINED);
 
+	psmi_sysbuf.is_initialized = 1;
+
 	/* Hit once on each block size so we have a pool that's allocated */
-	for (i = 0; i < MM_NUM_OF_POOLS; i++) {
+	for (i = 0; i < nclasses; i++) {
 		void *ptr;
-		if (block_sizes[i] == -1)
-			continue;
 		ptr = psmi_sysbuf_alloc(block_sizes[i]);
 		psmi_assert(ptr);
 		psmi_sysbuf_free(ptr);
 	}
 
+	psmi_sysbuf_stats_register();
+
 	return PSM2_OK;
 }
 
-void psmi_sysbuf_fini(void)
+/*
+ * Map a slab for mm_handler and thread all its blocks onto the slab's free
+ * list.  Huge pages are tried first when enabled, falling back to regular
+ * pages if none are available.
+ */
+static struct psmi_sysbuf_slab *psmi_sysbuf_slab_alloc(struct psmi_mem_ctrl
+						       *mm_handler)
 {
+	struct psmi_sysbuf_slab *slab;
 	struct psmi_mem_block_ctrl *block;
+	size_t size;
+	uintptr_t base;
+	uint32_t flags = 0, i;
+	int is_huge;
+	void *addr;
+
+	size = PSMI_ALIGNUP(sizeof(struct psmi_sysbuf_slab), 64) +
+	    (size_t) mm_handler->blocks_per_slab * mm_handler->block_stride;
+
+	is_huge = psmi_sysbuf.use_hugepages;
+	addr = psmi_hugepage_alloc(UNEXPECTED_BUFFERS, &size, &is_huge);
+	if (addr == NULL)
+		return NULL;
+	if (is_huge)
+		flags |= MM_SLAB_FLAG_HUGE;
+	else if (psmi_sysbuf.use_hugepages)
+		psmi_sysbuf.hugepage_fallbacks++;
+
+	slab = (struct psmi_sysbuf_slab *)addr;
+	slab->mem_handler = mm_handler;
+	slab->num_blocks = mm_handler->blocks_per_slab;
+	slab->current_available = slab->num_blocks;
+	slab->size = size;
+	slab->flags = flags;
+	slab->free_list = NULL;
+
+	base = (uintptr_t) addr +
+	    PSMI_ALIGNUP(sizeof(struct psmi_sysbuf_slab), 64);
+	for (i = slab->num_blocks; i > 0; i--) {
+		block = (struct psmi_mem_block_ctrl *)
+		    (base + (uintptr_t) (i - 1) * mm_handler->block_stride);
+		block->next = slab->free_list;
+		slab->free_list = block;
+	}
+
+	mm_handler->total_alloc += slab->num_blocks;
+	mm_handler->current_available += slab->num_blocks;
+	psmi_sysbuf.mem_ctrl_total_bytes += size;
+
+	return slab;
+}
+
+static void psmi_sysbuf_slab_free(struct psmi_sysbuf_slab *slab)
+{
+	struct psmi_mem_ctrl *mm_handler = slab->mem_handler;
+	size_t size = slab->size;
+
+	mm_handler->total_alloc -= slab->num_blocks;
+	mm_handler->current_available -= slab->num_blocks;
+	psmi_sysbuf.mem_ctrl_total_bytes -= size;
+
+	psmi_hugepage_free(UNEXPECTED_BUFFERS, slab, size);
+}
+
+/*
+ * Give empty slabs back to the OS until the class is down to its low
+ * watermark.
+ */
+static void psmi_sysbuf_trim(struct psmi_mem_ctrl *mm_handler)
+{
+	struct psmi_sysbuf_slab *slab;
+
+	while (mm_handler->current_available > mm_handler->watermark_low &&
+	       (slab = TAILQ_FIRST(&mm_handler->empty)) != NULL) {
+		TAILQ_REMOVE(&mm_handler->empty, slab, next);
+		psmi_sysbuf_slab_free(slab);
+		mm_handler->slabs_trimmed++;
+	}
+}
+
+void psmi_sysbuf_fini(void)
+{
+	struct psmi_sysbuf_slab *slab;
 	struct psmi_mem_ctrl *handler_index;
 	int i;
 
@@ -160,13 +354,22 @@ void psmi_sysbuf_fini(void)
 
 	VALGRIND_DESTROY_MEMPOOL(&psmi_sysbuf);
 
+	/* Blocks still in use are lost with their slab, as before when they
+	 * simply weren't freed */
 	handler_index = psmi_sysbuf.handler_index;
-	for (i = 0; i < MM_NUM_OF_POOLS; i++) {
-		while ((block = handler_index[i].free_list) != NULL) {
-			handler_index[i].free_list = block->next;
-			psmi_free(block);
+	for (i = 0; i < psmi_sysbuf.num_pools; i++) {
+		while ((slab = TAILQ_FIRST(&handler_index[i].empty)) != NULL) {
+			TAILQ_REMOVE(&handler_index[i].empty, slab, next);
+			psmi_sysbuf_slab_free(slab);
+		}
+		while ((slab = TAILQ_FIRST(&handler_index[i].partial)) != NULL) {
+			TAILQ_REMOVE(&handler_index[i].partial, slab, next);
+			psmi_sysbuf_slab_free(slab);
 		}
 	}
+
+	psmi_stats_deregister_type(PSMI_STATSTYPE_SYSBUF, NULL);
+	psmi_sysbuf.is_initialized = 0;
 }
 
 void psmi_sysbuf_getinfo(char *buf, size_t len)
@@ -181,91 +384,132 @@ void *psmi_sysbuf_alloc(uint32_t alloc_size)
 {
 	struct psmi_mem_ctrl *mm_handler = psmi_sysbuf.handler_index;
 	struct psmi_mem_block_ctrl *new_block;
-	int replenishing;
+	struct psmi_sysbuf_slab *slab;
 
 	while (mm_handler->block_size < alloc_size)
 		mm_handler++;
 
-	replenishing = mm_handler->replenishing_rate;
-
-	if (mm_handler->current_available == 0) { /* allocate more buffers */
-		if (mm_handler->flags & MM_FLAG_TRANSIENT) {
-			uint32_t newsz = alloc_size +
-				sizeof(struct psmi_mem_block_ctrl) +
-				PSM_VALGRIND_REDZONE_SZ;
-			new_block = psmi_malloc(PSMI_EP_NONE,
-					UNEXPECTED_BUFFERS, newsz);
-
-			if (new_block) {
-				new_block->mem_handler = mm_handler;
-				new_block++;
-				mm_handler->total_alloc++;
-				psmi_sysbuf.mem_ctrl_total_bytes += newsz;
-				VALGRIND_MEMPOOL_ALLOC(&psmi_sysbuf, new_block,
-						       alloc_size);
-			}
-			return new_block;
+	if (mm_handler->flags & MM_FLAG_TRANSIENT) {
+		uint32_t newsz = alloc_size +
+			sizeof(struct psmi_mem_block_ctrl) +
+			PSM_VALGRIND_REDZONE_SZ;
+		new_block = psmi_malloc(PSMI_EP_NONE,
+				UNEXPECTED_BUFFERS, newsz);
+
+		if (new_block) {
+			new_block->slab = NULL;
+			new_block++;
+			mm_handler->total_alloc++;
+			mm_handler->misses++;
+			VALGRIND_MEMPOOL_ALLOC(&psmi_sysbuf, new_block,
+					       alloc_size);
 		}
-
-		do {
-			uint32_t newsz =
-			    mm_handler->block_size +
-			    sizeof(struct psmi_mem_block_ctrl) +
-			    PSM_VALGRIND_REDZONE_SZ;
-
-			new_block = psmi_malloc(PSMI_EP_NONE,
-					UNEXPECTED_BUFFERS, newsz);
-			psmi_sysbuf.mem_ctrl_total_bytes += newsz;
-
-			if (new_block) {
-				mm_handler->current_available++;
-				mm_handler->total_alloc++;
-
-				new_block->next = mm_handler->free_list;
-				mm_handler->free_list = new_block;
-			}
-
-		} while (--replenishing && new_block);
+		return new_block;
 	}
 
-	if (mm_handler->current_available) {
-		mm_handler->current_available--;
-
-		new_block = mm_handler->free_list;
-		mm_handler->free_list = new_block->next;
+	/* Prefer partially used slabs so empty ones can be trimmed */
+	if ((slab = TAILQ_FIRST(&mm_handler->partial)) != NULL)
+		mm_handler->hits++;
+	else if ((slab = TAILQ_FIRST(&mm_handler->empty)) != NULL) {
+		TAILQ_REMOVE(&mm_handler->empty, slab, next);
+		TAILQ_INSERT_HEAD(&mm_handler->partial, slab, next);
+		mm_handler->hits++;
+	} else {
+		slab = psmi_sysbuf_slab_alloc(mm_handler);
+		if (slab == NULL)
+			return NULL;
+		TAILQ_INSERT_HEAD(&mm_handler->partial, slab, next);
+		mm_handler->misses++;
+	}
 
-		new_block->mem_handler = mm_handler;
-		new_block++;
+	new_block = slab->free_list;
+	slab->free_list = new_block->next;
+	if (--slab->current_available == 0)
+		TAILQ_REMOVE(&mm_handler->partial, slab, next);
+	mm_handler->current_available--;
 
-		VALGRIND_MEMPOOL_ALLOC(&psmi_sysbuf, new_block,
-				mm_handler->block_size);
-		return new_block;
-	}
+	new_block->slab = slab;
+	new_block++;
 
-	return NULL;
+	VALGRIND_MEMPOOL_ALLOC(&psmi_sysbuf, new_block,
+			mm_handler->block_size);
+	return new_block;
 }
 
 void psmi_sysbuf_free(void *mem_to_free)
 {
 	struct psmi_mem_block_ctrl *block_to_free;
 	struct psmi_mem_ctrl *mm_handler;
+	struct psmi_sysbuf_slab *slab;
 
 	block_to_free = (struct psmi_mem_block_ctrl *) mem_to_free - 1;
-	mm_handler = block_to_free->mem_handler;
+	slab = block_to_free->slab;
 
 	VALGRIND_MEMPOOL_FREE(&psmi_sysbuf, mem_to_free);
 
-	if (mm_handler->flags & MM_FLAG_TRANSIENT) {
+	if (slab == NULL) {
 		psmi_free(block_to_free);
-	} else {
-		block_to_free->next = mm_handler->free_list;
-		mm_handler->free_list = block_to_free;
-
-		mm_handler->current_available++;
+		return;
 	}
 
+	mm_handler = slab->mem_handler;
+	block_to_free->next = slab->free_list;
+	slab->free_list = block_to_free;
+	mm_handler->current_available++;
+
+	if (++slab->current_available == slab->num_blocks) {
+		if (slab->num_blocks > 1)
+			TAILQ_REMOVE(&mm_handler->partial, slab, next);
+		TAILQ_INSERT_TAIL(&mm_handler->empty, slab, next);
+		if (mm_handler->current_available > mm_handler->watermark_high)
+			psmi_sysbuf_trim(mm_handler);
+	} else if (slab->current_available == 1)
+		TAILQ_INSERT_TAIL(&mm_handler->partial, slab, next);
+
 	return;
 }
-#endif
-
 
+static void psmi_sysbuf_stats_register(void)
+{
+	struct psmi_stats_entry entries[MM_MAX_POOLS * 3 + 2];
+	struct psmi_mem_ctrl *mm_handler;
+	int i, n = 0;
+
+	for (i = 0; i < psmi_sysbuf.num_pools; i++) {
+		mm_handler = &psmi_sysbuf.handler_index[i];
+		if (mm_handler->flags & MM_FLAG_TRANSIENT)
+			snprintf(psmi_sysbuf.stats_desc[i][0], 32,
+				 "large misses");
+		else {
+			snprintf(psmi_sysbuf.stats_desc[i][0], 32,
+				 "%uB hits", mm_handler->block_size);
+			snprintf(psmi_sysbuf.stats_desc[i][1], 32,
+				 "%uB misses", mm_handler->block_size);
+			snprintf(psmi_sysbuf.stats_desc[i][2], 32,
+				 "%uB slabs trimmed", mm_handler->block_size);
+			entries[n++] = (struct psmi_stats_entry)
+			    PSMI_STATS_DECLU64(psmi_sysbuf.stats_desc[i][0],
+					       &mm_handler->hits);
+			entries[n++] = (struct psmi_stats_entry)
+			    PSMI_STATS_DECLU64(psmi_sysbuf.stats_desc[i][1],
+					       &mm_handler->misses);
+			entries[n++] = (struct psmi_stats_entry)
+			    PSMI_STATS_DECLU64(psmi_sysbuf.stats_desc[i][2],
+					       &mm_handler->slabs_trimmed);
+			continue;
+		}
+		entries[n++] = (struct psmi_stats_entry)
+		    PSMI_STATS_DECLU64(psmi_sysbuf.stats_desc[i][0],
+				       &mm_handler->misses);
+	}
+	entries[n++] = (struct psmi_stats_entry)
+	    PSMI_STATS_DECLU64("slab bytes (current)",
+			       &psmi_sysbuf.mem_ctrl_total_bytes);
+	entries[n++] = (struct psmi_stats_entry)
+	    PSMI_STATS_DECLU64("huge page fallbacks",
+			       &psmi_sysbuf.hugepage_fallbacks);
+
+	psmi_stats_register_type("PSM unexpected buffer statistics",
+				 PSMI_STATSTYPE_SYSBUF, entries, n, NULL);
+}
+#endif
@@ -0,0 +1,200 @@
+/*
+
+  This file is provided under a dual BSD/GPLv2 license.  When using or
+  redistributing this file, you may do so under either license.
+
+  GPL LICENSE SUMMARY
+
+  Copyright(c) 2015 Intel Corporation.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of version 2 of the GNU General Public License as
+  published by the Free Software Foundation.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  Contact Information:
+  Intel Corporation, www.intel.com
+
+  BSD LICENSE
+
+  Copyright(c) 2015 Intel Corporation.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the
+      distribution.
+    * Neither the name of Intel Corporation nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include "psm_user.h"
+
+/*
+ * Stats pages are named like the trace files, psm2-top globs the directory
+ * for them.  They live in /dev/shm by default so updating them never costs
+ * I/O, and are removed when the endpoint closes so the reader only lists
+ * live endpoints.
+ */
+#define PSMI_TELEMETRY_DEFAULT_DIR	"/dev/shm"
+#define PSMI_TELEMETRY_DEFAULT_PEERS	1024
+
+psm2_error_t psmi_telemetry_init(psm2_ep_t ep)
+{
+	union psmi_envvar_val env_telem, env_peers, env_dir;
+	struct psmi_telemetry *telem;
+	char *path;
+	size_t map_len;
+	void *mapptr;
+	int fd;
+
+	ep->telemetry = NULL;
+
+	psmi_getenv("PSM2_TELEMETRY",
+		    "Publish live per-peer counters for psm2-top (0 off, 1 on)",
+		    PSMI_ENVVAR_LEVEL_USER, PSMI_ENVVAR_TYPE_UINT,
+		    (union psmi_envvar_val)0, &env_telem);
+	if (env_telem.e_uint == 0)
+		return PSM2_OK;
+
+	psmi_getenv("PSM2_TELEMETRY_PEERS",
+		    "Peers tracked per endpoint, later ones are not counted",
+		    PSMI_ENVVAR_LEVEL_USER, PSMI_ENVVAR_TYPE_UINT,
+		    (union psmi_envvar_val)PSMI_TELEMETRY_DEFAULT_PEERS,
+		    &env_peers);
+	psmi_getenv("PSM2_TELEMETRY_DIR",
+		    "Directory the stats pages are created in",
+		    PSMI_ENVVAR_LEVEL_USER, PSMI_ENVVAR_TYPE_STR,
+		    (union psmi_envvar_val)PSMI_TELEMETRY_DEFAULT_DIR,
+		    &env_dir);
+
+	map_len = PSMI_TELEMETRY_HDR_SIZE +
+	    (size_t) env_peers.e_uint * sizeof(struct psmi_telemetry_peer);
+
+	telem = psmi_calloc(ep, UNDEFINED, 1, sizeof(struct psmi_telemetry));
+	if (telem == NULL)
+		return PSM2_NO_MEMORY;
+	path = telem->path;
+	snprintf(path, sizeof(telem->path), "%s/psm2-stats.%s.%d.%" PRIx64,
+		 env_dir.e_str, psmi_gethostname(), (int)getpid(), ep->epid);
+
+	/* Like tracing, a missing stats page doesn't fail the endpoint */
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+	if (fd < 0) {
+		_HFI_ERROR("Can't create stats page %s: %s\n", path,
+			   strerror(errno));
+		goto fail;
+	}
+	if (ftruncate(fd, map_len) != 0) {
+		_HFI_ERROR("Can't size stats page %s to %lu bytes: %s\n", path,
+			   (unsigned long)map_len, strerror(errno));
+		close(fd);
+		unlink(path);
+		goto fail;
+	}
+	mapptr = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mapptr == MAP_FAILED) {
+		_HFI_ERROR("Can't map stats page %s: %s\n", path,
+			   strerror(errno));
+		unlink(path);
+		goto fail;
+	}
+
+	telem->hdr = (struct psmi_telemetry_hdr *)mapptr;
+	telem->peers = (struct psmi_telemetry_peer *)
+	    ((uintptr_t) mapptr + PSMI_TELEMETRY_HDR_SIZE);
+	telem->map_len = map_len;
+
+	telem->hdr->version = PSMI_TELEMETRY_VERSION;
+	telem->hdr->slot_size = sizeof(struct psmi_telemetry_peer);
+	telem->hdr->max_peers = env_peers.e_uint;
+	telem->hdr->num_peers = 0;
+	telem->hdr->dropped = 0;
+	telem->hdr->pid = getpid();
+	telem->hdr->epid = ep->epid;
+	telem->hdr->open_sec = time(NULL);
+	strncpy(telem->hdr->hostname, psmi_gethostname(),
+		sizeof(telem->hdr->hostname) - 1);
+	/* The magic goes last, the reader skips pages without it */
+	ips_wmb();
+	telem->hdr->magic = PSMI_TELEMETRY_MAGIC;
+
+	_HFI_PRDBG("Publishing stats for %u peers to %s\n", env_peers.e_uint,
+		   path);
+	ep->telemetry = telem;
+	return PSM2_OK;
+
+fail:
+	psmi_free(telem);
+	return PSM2_OK;
+}
+
+void psmi_telemetry_fini(psm2_ep_t ep)
+{
+	struct psmi_telemetry *telem = ep->telemetry;
+
+	if (telem == NULL)
+		return;
+
+	ep->telemetry = NULL;
+	unlink(telem->path);
+	munmap(telem->hdr, telem->map_len);
+	psmi_free(telem);
+}
+
+/*
+ * Called by the PTLs as they create an epaddr.  A peer that reconnects gets
+ * a new slot, the old one keeps the counts of the earlier connection.
+ */
+void psmi_telemetry_peer_add(psm2_ep_t ep, psm2_epaddr_t epaddr,
+			     uint32_t transport)
+{
+	struct psmi_telemetry *telem = ep->telemetry;
+	struct psmi_telemetry_peer *slot;
+
+	epaddr->telemetry = NULL;
+	if (telem == NULL)
+		return;
+
+	if (telem->hdr->num_peers == telem->hdr->max_peers) {
+		telem->hdr->dropped++;
+		return;
+	}
+
+	slot = &telem->peers[telem->hdr->num_peers];
+	slot->transport = transport;
+	slot->epid = epaddr->epid;
+	/* Publish the slot once its identity is in place */
+	ips_wmb();
+	telem->hdr->num_peers++;
+	epaddr->telemetry = slot;
+}
@@ -0,0 +1,136 @@
+/*
+
+  This file is provided under a dual BSD/GPLv2 license.  When using or
+  redistributing this file, you may do so under either license.
+
+  GPL LICENSE SUMMARY
+
+  Copyright(c) 2015 Intel Corporation.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of version 2 of the GNU General Public License as
+  published by the Free Software Foundation.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  Contact Information:
+  Intel Corporation, www.intel.com
+
+  BSD LICENSE
+
+  Copyright(c) 2015 Intel Corporation.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the
+      distribution.
+    * Neither the name of Intel Corporation nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+
+#ifndef _PSMI_IN_USER_H
+#error psm_telemetry.h not meant to be included directly, include psm_user.h instead
+#endif
+
+#ifndef _PSMI_TELEMETRY_H
+#define _PSMI_TELEMETRY_H
+
+#include "psm_telemetry_format.h"
+
+/*
+ * Live per-peer counters.
+ *
+ * With PSM2_TELEMETRY set, every endpoint maps a stats page (see
+ * psm_telemetry.c) and each epaddr a PTL creates is given a slot in it.  The
+ * data path bumps the slot counters in place, so a reader such as psm2-top
+ * sees them move while the job runs without the job ever publishing
+ * anything.  Epaddrs without a slot (telemetry off, or the page full) carry
+ * a NULL pointer and cost one predicted branch per event.
+ *
+ * Like the rest of the endpoint state, slots are only written under the PSM
+ * lock, the seq word only has to keep readers in other processes from
+ * seeing half an update.
+ */
+
+struct psmi_telemetry {
+	struct psmi_telemetry_hdr *hdr;
+	struct psmi_telemetry_peer *peers;
+	size_t map_len;
+	char path[PATH_MAX];	/* unlinked at close */
+};
+
+psm2_error_t psmi_telemetry_init(psm2_ep_t ep);
+void psmi_telemetry_fini(psm2_ep_t ep);
+void psmi_telemetry_peer_add(psm2_ep_t ep, psm2_epaddr_t epaddr,
+			     uint32_t transport);
+
+PSMI_ALWAYS_INLINE(
+void
+psmi_telemetry_write_begin(struct psmi_telemetry_peer *slot))
+{
+	slot->seq++;
+	ips_wmb();
+}
+
+PSMI_ALWAYS_INLINE(
+void
+psmi_telemetry_write_end(struct psmi_telemetry_peer *slot))
+{
+	ips_wmb();
+	slot->seq++;
+}
+
+PSMI_ALWAYS_INLINE(
+void
+psmi_telemetry_count(psm2_epaddr_t epaddr, int counter, uint64_t n))
+{
+	struct psmi_telemetry_peer *slot = epaddr->telemetry;
+
+	if_pf(slot != NULL) {
+		psmi_telemetry_write_begin(slot);
+		slot->count[counter] += n;
+		psmi_telemetry_write_end(slot);
+	}
+}
+
+/* A message and its payload, moved together so readers never see one
+ * without the other */
+PSMI_ALWAYS_INLINE(
+void
+psmi_telemetry_msg(psm2_epaddr_t epaddr, int msgs, int bytes, uint64_t len))
+{
+	struct psmi_telemetry_peer *slot = epaddr->telemetry;
+
+	if_pf(slot != NULL) {
+		psmi_telemetry_write_begin(slot);
+		slot->count[msgs]++;
+		slot->count[bytes] += len;
+		psmi_telemetry_write_end(slot);
+	}
+}
+
+#endif /* _PSMI_TELEMETRY_H */
@@ -0,0 +1,114 @@
+/*
+
+  This file is provided under a dual BSD/GPLv2 license.  When using or
+  redistributing this file, you may do so under either license.
+
+  GPL LICENSE SUMMARY
+
+  Copyright(c) 2015 Intel Corporation.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of version 2 of the GNU General Public License as
+  published by the Free Software Foundation.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  Contact Information:
+  Intel Corporation, www.intel.com
+
+  BSD LICENSE
+
+  Copyright(c) 2015 Intel Corporation.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the
+      distribution.
+    * Neither the name of Intel Corporation nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+
+#ifndef _PSM_TELEMETRY_FORMAT_H
+#define _PSM_TELEMETRY_FORMAT_H
+
+/*
+ * Layout of the stats pages published by psm_telemetry.c and read by
+ * psm2-top.  Kept free of any other PSM header so the reader can be built on
+ * its own.
+ *
+ * A page is a header padded to PSMI_TELEMETRY_HDR_SIZE followed by
+ * max_peers peer slots.  Slots are handed out as peers connect and are never
+ * reused while the endpoint is open, num_peers of them are in use.  The
+ * counters of a slot are updated in place under its seq word: seq is odd
+ * while an update is in progress, a reader copies the slot and retries if
+ * seq was odd or changed under it.
+ */
+
+#include <stdint.h>
+
+#define PSMI_TELEMETRY_MAGIC	0x454c4554324d5350ULL	/* "PSM2TELE" */
+#define PSMI_TELEMETRY_VERSION	1
+#define PSMI_TELEMETRY_HDR_SIZE	4096
+
+/* How a peer is reached */
+#define PSMI_TELEMETRY_SELF	0
+#define PSMI_TELEMETRY_SHM	1
+#define PSMI_TELEMETRY_HFI	2
+
+/* Peer counters, the endpoint totals are the sums over its peers */
+#define PSMI_TELEMETRY_TX_BYTES		0	/* MQ payload sent */
+#define PSMI_TELEMETRY_TX_MSGS		1
+#define PSMI_TELEMETRY_RX_BYTES		2	/* MQ payload received */
+#define PSMI_TELEMETRY_RX_MSGS		3
+#define PSMI_TELEMETRY_REXMIT		4	/* packets resent after a NAK */
+#define PSMI_TELEMETRY_NAK_SENT		5
+#define PSMI_TELEMETRY_NAK_RECV		6
+#define PSMI_TELEMETRY_SEND_STALLS	7	/* out of PIO, SDMA or credits */
+#define PSMI_TELEMETRY_CCA_CHANGES	8	/* rate cuts after a BECN */
+#define PSMI_TELEMETRY_NUM_COUNTERS	9
+
+struct psmi_telemetry_hdr {
+	uint64_t magic;
+	uint32_t version;
+	uint32_t slot_size;	/* sizeof(struct psmi_telemetry_peer) */
+	uint32_t max_peers;
+	volatile uint32_t num_peers; /* slots handed out */
+	volatile uint32_t dropped; /* peers that found no free slot */
+	uint32_t pid;
+	uint64_t epid;
+	uint64_t open_sec;	/* wall clock at endpoint open */
+	char hostname[64];
+};
+
+struct psmi_telemetry_peer {
+	volatile uint32_t seq;
+	uint32_t transport;	/* PSMI_TELEMETRY_SELF, SHM or HFI */
+	uint64_t epid;
+	volatile uint64_t count[PSMI_TELEMETRY_NUM_COUNTERS];
+} __attribute__ ((aligned(64)));
+
+#endif /* _PSM_TELEMETRY_FORMAT_H */
@@ -57,22 +57,38 @@
 
 #if PSMI_TIMER_STATS
 #  define PSMI_TIMER_STATS_ADD_INSERTION(ctrl)	((ctrl)->num_insertions++)
-#  define PSMI_TIMER_STATS_ADD_TRAVERSAL(ctrl)	((ctrl)->num_traversals++)
+#  define PSMI_TIMER_STATS_ADD_CASCADE(ctrl)	((ctrl)->num_cascades++)
 #else
 #  define PSMI_TIMER_STATS_ADD_INSERTION(ctrl)
-#  define PSMI_TIMER_STATS_ADD_TRAVERSAL(ctrl)
+#  define PSMI_TIMER_STATS_ADD_CASCADE(ctrl)
 #endif
 
+#define PSMI_TIMER_SLOT_MASK	(PSMI_TIMER_SLOTS - 1)
+#define PSMI_TIMER_FIRE_SLOT	PSMI_TIMER_NUM_PRIO	/* fire_last index */
+
+#define timer_level_shift(level)	((level) * PSMI_TIMER_SLOT_BITS)
+#define timer_slot_queue(level, slot)					\
+	    (PSMI_TIMER_NUM_PRIO + (level) * PSMI_TIMER_SLOTS + (slot))
+
 psm2_error_t psmi_timer_init(struct psmi_timer_ctrl *ctrl)
 {
+	int i;
+
 	ctrl->t_cyc_next_expire = PSMI_TIMER_INFINITE;
+	ctrl->prio_mask = 0;
+	ctrl->tick = get_cycles() >> PSMI_TIMER_TICK_SHIFT;
 
 #if PSMI_TIMER_STATS
 	ctrl->num_insertions = 0;
-	ctrl->num_traversals = 0;
+	ctrl->num_cascades = 0;
 #endif
 
-	TAILQ_INIT(&ctrl->timerq);
+	for (i = 0; i < PSMI_TIMER_NUM_QUEUES; i++)
+		TAILQ_INIT(&ctrl->timerq[i]);
+	for (i = 0; i < PSMI_TIMER_LEVELS; i++)
+		ctrl->slot_mask[i] = 0;
+	for (i = 0; i <= PSMI_TIMER_NUM_PRIO; i++)
+		ctrl->fire_last[i] = NULL;
 	return PSM2_OK;
 }
 
@@ -80,96 +96,229 @@ psm2_error_t psmi_timer_fini(struct psmi_timer_ctrl *ctrl)
 {
 #if PSMI_TIMER_STATS
 	if (ctrl->num_insertions > 0) {
-		_HFI_INFO("avg elem traversals/insertion = %3.2f %%\n",
-			  100.0 * (double)ctrl->num_traversals /
+		_HFI_INFO("timer cascades/insertion = %3.2f %%\n",
+			  100.0 * (double)ctrl->num_cascades /
 			  ctrl->num_insertions);
 	}
 #endif
 	return PSM2_OK;
 }
 
+/*
+ * Place a timer in the lowest level whose slots still tell its tick apart
+ * from the current one, and return the tick at which that slot comes up.
+ */
+static uint64_t
+psmi_timer_wheel_insert(struct psmi_timer_ctrl *ctrl, struct psmi_timer *t)
+{
+	uint64_t tick = t->t_timeout >> PSMI_TIMER_TICK_SHIFT;
+	uint64_t blk, cur;
+	unsigned slot;
+	int level;
+
+	if (tick < ctrl->tick)
+		tick = ctrl->tick;
+
+	for (level = 0; level < PSMI_TIMER_LEVELS - 1; level++) {
+		if ((tick >> timer_level_shift(level)) -
+		    (ctrl->tick >> timer_level_shift(level)) < PSMI_TIMER_SLOTS)
+			break;
+	}
+	blk = tick >> timer_level_shift(level);
+	cur = ctrl->tick >> timer_level_shift(level);
+	if (blk - cur >= PSMI_TIMER_SLOTS)	/* beyond the wheel */
+		blk = cur + PSMI_TIMER_SLOTS - 1;
+
+	slot = blk & PSMI_TIMER_SLOT_MASK;
+	t->q = timer_slot_queue(level, slot);
+	TAILQ_INSERT_TAIL(&ctrl->timerq[t->q], t, timer);
+	ctrl->slot_mask[level] |= 1ULL << slot;
+
+	return blk << timer_level_shift(level);
+}
+
+/*
+ * Next tick at which a slot of the wheel comes up, either to expire its
+ * timers (level 0) or to cascade them to the levels below.
+ */
+static uint64_t psmi_timer_wheel_next(const struct psmi_timer_ctrl *ctrl)
+{
+	uint64_t next = PSMI_TIMER_INFINITE;
+	uint64_t mask, blk, tick;
+	unsigned idx;
+	int level;
+
+	for (level = 0; level < PSMI_TIMER_LEVELS; level++) {
+		mask = ctrl->slot_mask[level];
+		if (mask == 0)
+			continue;
+
+		blk = ctrl->tick >> timer_level_shift(level);
+		idx = blk & PSMI_TIMER_SLOT_MASK;
+		/* rotate so that bit 0 is the current slot */
+		if (idx)
+			mask = (mask >> idx) | (mask << (PSMI_TIMER_SLOTS - idx));
+		tick = (blk + __builtin_ctzll(mask)) <<
+		    timer_level_shift(level);
+		next = min(next, tick);
+	}
+	return next;
+}
+
+PSMI_ALWAYS_INLINE(
+void
+psmi_timer_update_next_expire(struct psmi_timer_ctrl *ctrl))
+{
+	uint64_t tick;
+
+	if (ctrl->prio_mask) {
+		ctrl->t_cyc_next_expire = 0;
+		return;
+	}
+
+	tick = psmi_timer_wheel_next(ctrl);
+	ctrl->t_cyc_next_expire = (tick == PSMI_TIMER_INFINITE) ?
+	    PSMI_TIMER_INFINITE : (tick + 1) << PSMI_TIMER_TICK_SHIFT;
+}
+
+PSMI_ALWAYS_INLINE(
+void
+psmi_timer_remove(struct psmi_timer_ctrl *ctrl, struct psmi_timer *t))
+{
+	struct timerq *head = &ctrl->timerq[t->q];
+	unsigned n;
+
+	t->flags &= ~PSMI_TIMER_FLAG_PENDING;
+	TAILQ_REMOVE(head, t, timer);
+	if (!TAILQ_EMPTY(head))
+		return;
+
+	if (t->q < PSMI_TIMER_NUM_PRIO) {
+		ctrl->prio_mask &= ~(1U << t->q);
+	} else {
+		n = t->q - PSMI_TIMER_NUM_PRIO;
+		ctrl->slot_mask[n / PSMI_TIMER_SLOTS] &=
+		    ~(1ULL << (n % PSMI_TIMER_SLOTS));
+	}
+}
+
 void
 psmi_timer_request_always(struct psmi_timer_ctrl *ctrl,
 			  struct psmi_timer *t_insert, uint64_t t_cyc_expire)
 {
-	struct psmi_timer *t_cursor;
+	uint64_t tick;
 
 	psmi_assert(!(t_insert->flags & PSMI_TIMER_FLAG_PENDING));
 
 	t_insert->t_timeout = t_cyc_expire;
 	t_insert->flags |= PSMI_TIMER_FLAG_PENDING;
 
-	/*
-	 * We keep the list from oldest (head) to newest (tail), with the
-	 * assumption that insert and remove occur much more often than search
-	 * (when the timer expires).  Newly added timers are more likely to expire
-	 * later rather than sooner, which is why the head is older.
-	 */
 	PSMI_TIMER_STATS_ADD_INSERTION(ctrl);
 
-	if (TAILQ_EMPTY(&ctrl->timerq)) {	/* Common case */
-		TAILQ_INSERT_TAIL(&ctrl->timerq, t_insert, timer);
-		ctrl->t_cyc_next_expire = t_cyc_expire;
-		PSMI_TIMER_STATS_ADD_TRAVERSAL(ctrl);
-		return;
-	} else if (t_cyc_expire > PSMI_TIMER_PRIO_LAST) {
-		TAILQ_FOREACH(t_cursor, &ctrl->timerq, timer) {
-			if (t_cursor->t_timeout <= t_cyc_expire) {
-				TAILQ_INSERT_BEFORE(t_cursor, t_insert, timer);
-				return;
-			}
-			PSMI_TIMER_STATS_ADD_TRAVERSAL(ctrl);
-		}
-		/* Got to the end of the list -- We're the next to expire */
-		ctrl->t_cyc_next_expire = t_cyc_expire;
-		TAILQ_INSERT_TAIL(&ctrl->timerq, t_insert, timer);
-		return;
-	} else {
-		TAILQ_FOREACH_REVERSE(t_cursor, &ctrl->timerq, timerq, timer) {
-			if (t_cursor->t_timeout >= t_cyc_expire) {
-				TAILQ_INSERT_AFTER(&ctrl->timerq, t_cursor,
-						   t_insert, timer);
-				ctrl->t_cyc_next_expire =
-				    min(t_cyc_expire, ctrl->t_cyc_next_expire);
-				return;
-			}
-			PSMI_TIMER_STATS_ADD_TRAVERSAL(ctrl);
-		}
-		TAILQ_INSERT_HEAD(&ctrl->timerq, t_insert, timer);
-		/* No need to check if we inserted last, given first branch case */
-		/* if (TAILQ_LAST(&ctrl->timerq, timerq) == t_insert) */
-		/* ctrl->t_cyc_next_expire = t_cyc_expire; */
+	if (t_cyc_expire <= PSMI_TIMER_PRIO_LAST) {
+		/* Delayed operations run in order of priority, and in order
+		 * of insertion within a priority */
+		t_insert->q = (uint16_t) t_cyc_expire;
+		TAILQ_INSERT_TAIL(&ctrl->timerq[t_insert->q], t_insert, timer);
+		ctrl->prio_mask |= 1U << t_insert->q;
+		ctrl->t_cyc_next_expire = 0;
 		return;
 	}
 
+	tick = psmi_timer_wheel_insert(ctrl, t_insert);
+	ctrl->t_cyc_next_expire = min(ctrl->t_cyc_next_expire,
+				      (tick + 1) << PSMI_TIMER_TICK_SHIFT);
 	return;
 }
 
+/*
+ * Expire the timers of a queue up to the one recorded in fire_last[i] when
+ * expiration started.  Callbacks may request timers again, those are left
+ * for the next call so that an operation that keeps delaying itself cannot
+ * hold up the progress engine.
+ */
+static void
+psmi_timer_fire_queue(struct psmi_timer_ctrl *ctrl, unsigned q, int i,
+		      uint64_t t_cyc_expire)
+{
+	struct psmi_timer *t_cursor;
+
+	while (ctrl->fire_last[i] != NULL) {
+		t_cursor = TAILQ_FIRST(&ctrl->timerq[q]);
+		if (t_cursor == ctrl->fire_last[i])
+			ctrl->fire_last[i] = NULL;
+		psmi_assert(t_cursor->flags & PSMI_TIMER_FLAG_PENDING);
+		psmi_timer_remove(ctrl, t_cursor);
+		t_cursor->expire_callback(t_cursor, t_cyc_expire);
+	}
+}
+
 psm2_error_t
 psmi_timer_process_expired(struct psmi_timer_ctrl *ctrl, uint64_t t_cyc_expire)
 {
 	psm2_error_t err = PSM2_OK_NO_PROGRESS;
-	struct psmi_timer *t_cursor = TAILQ_LAST(&ctrl->timerq, timerq);
+	uint64_t target = t_cyc_expire >> PSMI_TIMER_TICK_SHIFT;
+	struct psmi_timer *t_cursor;
+	struct timerq *head;
+	uint64_t tick;
+	unsigned slot;
+	int i, level;
 
 	PSM2_LOG_MSG("entering");
 
-	while (t_cursor) {
-		if (t_cursor->t_timeout > t_cyc_expire)
-			break;
-
+	if (ctrl->prio_mask) {
 		err = PSM2_OK;
-		psmi_assert(t_cursor->flags & PSMI_TIMER_FLAG_PENDING);
-		t_cursor->flags &= ~PSMI_TIMER_FLAG_PENDING;
-		TAILQ_REMOVE(&ctrl->timerq, t_cursor, timer);
-		t_cursor->expire_callback(t_cursor, t_cyc_expire);
-		t_cursor = TAILQ_PREV(t_cursor, timerq, timer);
+		for (i = 0; i < PSMI_TIMER_NUM_PRIO; i++)
+			ctrl->fire_last[i] = TAILQ_LAST(&ctrl->timerq[i],
+							timerq);
+		for (i = 0; i < PSMI_TIMER_NUM_PRIO; i++)
+			psmi_timer_fire_queue(ctrl, i, i, t_cyc_expire);
 	}
 
-	if (TAILQ_EMPTY(&ctrl->timerq))
-		ctrl->t_cyc_next_expire = PSMI_TIMER_INFINITE;
-	else
-		ctrl->t_cyc_next_expire =
-		    TAILQ_LAST(&ctrl->timerq, timerq)->t_timeout;
+	/* Timers expire once their whole tick has passed */
+	while ((tick = psmi_timer_wheel_next(ctrl)) < target) {
+		ctrl->tick = tick;
+
+		/* Entering a new block of upper level slots, spread the
+		 * timers of the slot that comes up over the levels below */
+		for (level = PSMI_TIMER_LEVELS - 1; level > 0; level--) {
+			if (tick & ((1ULL << timer_level_shift(level)) - 1))
+				continue;
+			slot = (tick >> timer_level_shift(level)) &
+			    PSMI_TIMER_SLOT_MASK;
+			if (!(ctrl->slot_mask[level] & (1ULL << slot)))
+				continue;
+
+			head = &ctrl->timerq[timer_slot_queue(level, slot)];
+			while ((t_cursor = TAILQ_FIRST(head)) != NULL) {
+				TAILQ_REMOVE(head, t_cursor, timer);
+				psmi_timer_wheel_insert(ctrl, t_cursor);
+				PSMI_TIMER_STATS_ADD_CASCADE(ctrl);
+			}
+			ctrl->slot_mask[level] &= ~(1ULL << slot);
+		}
+
+		slot = tick & PSMI_TIMER_SLOT_MASK;
+		if (ctrl->slot_mask[0] & (1ULL << slot)) {
+			err = PSM2_OK;
+			head = &ctrl->timerq[timer_slot_queue(0, slot)];
+			ctrl->fire_last[PSMI_TIMER_FIRE_SLOT] =
+			    TAILQ_LAST(head, timerq);
+			psmi_timer_fire_queue(ctrl, timer_slot_queue(0, slot),
+					      PSMI_TIMER_FIRE_SLOT,
+					      t_cyc_expire);
+			/* Requested again for a past time */
+			if (ctrl->slot_mask[0] & (1ULL << slot))
+				break;
+		}
+		ctrl->tick = tick + 1;
+	}
+
+	/* Nothing comes up before target, skip the idle ticks */
+	if (tick >= target && ctrl->tick < target)
+		ctrl->tick = target;
+
+	psmi_timer_update_next_expire(ctrl);
 
 	PSM2_LOG_MSG("leaving");
 	return err;
@@ -179,20 +328,18 @@ void
 psmi_timer_cancel_inner(struct psmi_timer_ctrl *ctrl,
 			struct psmi_timer *t_remove)
 {
+	int i;
 
 	psmi_assert(t_remove->flags & PSMI_TIMER_FLAG_PENDING);
 
-	t_remove->flags &= ~PSMI_TIMER_FLAG_PENDING;
-	TAILQ_REMOVE(&ctrl->timerq, t_remove, timer);
-
-	/*
-	 * If we're removing the last entry, we need to reset the
-	 * expiration cycle time.
-	 */
-	if (TAILQ_EMPTY(&ctrl->timerq))
-		ctrl->t_cyc_next_expire = PSMI_TIMER_INFINITE;
-	else
-		ctrl->t_cyc_next_expire =
-		    TAILQ_LAST(&ctrl->timerq, timerq)->t_timeout;
+	/* Keep an ongoing expiration from running into timers requested
+	 * after it started */
+	i = t_remove->q < PSMI_TIMER_NUM_PRIO ?
+	    t_remove->q : PSMI_TIMER_FIRE_SLOT;
+	if (ctrl->fire_last[i] == t_remove)
+		ctrl->fire_last[i] = TAILQ_PREV(t_remove, timerq, timer);
+
+	psmi_timer_remove(ctrl, t_remove);
+	psmi_timer_update_next_expire(ctrl);
 	return;
 }
@@ -72,22 +72,13 @@ typedef psm2_error_t(*psmi_timer_expire_callback_t) (struct psmi_timer *,
 struct psmi_timer {
 	TAILQ_ENTRY(psmi_timer) timer;	/* opaque */
 	uint64_t t_timeout;	/* opaque */
+	uint16_t q;		/* opaque */
 	uint8_t flags;		/* opaque */
 
 	psmi_timer_expire_callback_t expire_callback; /* user -- callback fn */
 	void *context;		/* user -- callback param */
 };
 
-struct psmi_timer_ctrl {
-	uint64_t t_cyc_next_expire;
-	 TAILQ_HEAD(timerq, psmi_timer) timerq;
-
-#if PSMI_TIMER_STATS
-	uint64_t num_insertions;
-	uint64_t num_traversals;
-#endif
-};
-
 /*
  * Some events need to be unconditionally enqueued at the beginning of the
  * timerq -- they are not timers meant to expire but merely operations that
@@ -104,6 +95,43 @@ struct psmi_timer_ctrl {
 #define PSMI_TIMER_INFINITE	 0xFFFFFFFFFFFFFFFFULL
 #define PSMI_TIMER_FLAG_PENDING  0x01
 
+/*
+ * Timers proper live in a hierarchical timing wheel.  Time is counted in
+ * ticks of 2^PSMI_TIMER_TICK_SHIFT cycles, and each level has 64 slots
+ * that each cover 64 slots of the level below, so that 6 levels reach
+ * 2^46 cycles ahead (hours); later timers park in the farthest slot and
+ * are placed again when it comes up.  Insertion and cancelation are
+ * O(1), and expired slots are found through the occupancy bitmaps.
+ * Timers fire at most one tick late.
+ */
+#define PSMI_TIMER_TICK_SHIFT	10
+#define PSMI_TIMER_SLOT_BITS	6
+#define PSMI_TIMER_SLOTS	(1 << PSMI_TIMER_SLOT_BITS)
+#define PSMI_TIMER_LEVELS	6
+#define PSMI_TIMER_NUM_PRIO	(PSMI_TIMER_PRIO_LAST + 1)
+#define PSMI_TIMER_NUM_QUEUES	(PSMI_TIMER_NUM_PRIO +			\
+				 PSMI_TIMER_LEVELS * PSMI_TIMER_SLOTS)
+
+struct psmi_timer_ctrl {
+	uint64_t t_cyc_next_expire;
+
+	/* Queues 0 to PSMI_TIMER_PRIO_LAST hold delayed operations, the
+	 * others the slots of the wheel, level by level */
+	TAILQ_HEAD(timerq, psmi_timer) timerq[PSMI_TIMER_NUM_QUEUES];
+	uint32_t prio_mask;	/* non-empty priority queues */
+	uint64_t slot_mask[PSMI_TIMER_LEVELS];	/* non-empty slots */
+	uint64_t tick;		/* next tick to expire */
+
+	/* Last timer of each priority queue, and of the slot, that the
+	 * ongoing psmi_timer_process_expired must expire */
+	struct psmi_timer *fire_last[PSMI_TIMER_NUM_PRIO + 1];
+
+#if PSMI_TIMER_STATS
+	uint64_t num_insertions;
+	uint64_t num_cascades;
+#endif
+};
+
 /*
  * Timer control initialization and finalization
  */
@@ -147,6 +175,23 @@ void psmi_timer_request_always(struct psmi_timer_ctrl *ctrl,
 void psmi_timer_cancel_inner(struct psmi_timer_ctrl *ctrl,
 			     struct psmi_timer *t_remove);
 
+/*
+ * Timer request for a timer shared by several users: the timer expires no
+ * later than t_cyc, a pending timer is moved up if needed.
+ */
+PSMI_ALWAYS_INLINE(
+void
+psmi_timer_request_before(struct psmi_timer_ctrl *ctrl,
+			  struct psmi_timer *t_insert, uint64_t t_cyc))
+{
+	if (t_insert->flags & PSMI_TIMER_FLAG_PENDING) {
+		if (t_insert->t_timeout <= t_cyc)
+			return;
+		psmi_timer_cancel_inner(ctrl, t_insert);
+	}
+	psmi_timer_request_always(ctrl, t_insert, t_cyc);
+}
+
 /*
  * Timer processing, conditional or unconditional.
  */
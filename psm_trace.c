@@ -0,0 +1,172 @@
+/*
+
+  This file is provided under a dual BSD/GPLv2 license.  When using or
+  redistributing this file, you may do so under either license.
+
+  GPL LICENSE SUMMARY
+
+  Copyright(c) 2015 Intel Corporation.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of version 2 of the GNU General Public License as
+  published by the Free Software Foundation.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  Contact Information:
+  Intel Corporation, www.intel.com
+
+  BSD LICENSE
+
+  Copyright(c) 2015 Intel Corporation.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the
+      distribution.
+    * Neither the name of Intel Corporation nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include "psm_user.h"
+
+/*
+ * Trace files are named after the host, process and endpoint so the files of
+ * a whole job can be collected into one directory and decoded together.
+ * They default to /dev/shm, where the mapping costs no I/O while the job
+ * runs, and are left behind when the endpoint closes.
+ */
+#define PSMI_TRACE_DEFAULT_DIR		"/dev/shm"
+#define PSMI_TRACE_DEFAULT_RECORDS	(1 << 20)
+
+psm2_error_t psmi_trace_init(psm2_ep_t ep)
+{
+	union psmi_envvar_val env_trace, env_recs, env_dir;
+	struct psmi_trace *trace;
+	char path[PATH_MAX];
+	uint64_t num_recs;
+	size_t map_len;
+	void *mapptr;
+	int fd;
+
+	ep->trace = NULL;
+
+	psmi_getenv("PSM2_TRACE",
+		    "Binary event tracing (0 off, 1 on, 2 mapped but paused)",
+		    PSMI_ENVVAR_LEVEL_USER, PSMI_ENVVAR_TYPE_UINT,
+		    (union psmi_envvar_val)0, &env_trace);
+	if (env_trace.e_uint == 0)
+		return PSM2_OK;
+
+	psmi_getenv("PSM2_TRACE_RECORDS",
+		    "Records kept per endpoint, rounded up to a power of two",
+		    PSMI_ENVVAR_LEVEL_USER, PSMI_ENVVAR_TYPE_ULONG,
+		    (union psmi_envvar_val)PSMI_TRACE_DEFAULT_RECORDS,
+		    &env_recs);
+	psmi_getenv("PSM2_TRACE_DIR",
+		    "Directory the trace files are written to",
+		    PSMI_ENVVAR_LEVEL_USER, PSMI_ENVVAR_TYPE_STR,
+		    (union psmi_envvar_val)PSMI_TRACE_DEFAULT_DIR, &env_dir);
+
+	num_recs = 1;
+	while (num_recs < env_recs.e_ulong)
+		num_recs <<= 1;
+	map_len = PSMI_TRACE_HDR_SIZE + num_recs * sizeof(struct psmi_trace_rec);
+
+	snprintf(path, sizeof(path), "%s/psm2-trace.%s.%d.%" PRIx64,
+		 env_dir.e_str, psmi_gethostname(), (int)getpid(), ep->epid);
+
+	trace = psmi_calloc(ep, UNDEFINED, 1, sizeof(struct psmi_trace));
+	if (trace == NULL)
+		return PSM2_NO_MEMORY;
+
+	/* Tracing is a diagnostic, failing to set it up doesn't fail the
+	 * endpoint */
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+	if (fd < 0) {
+		_HFI_ERROR("Can't create trace file %s: %s\n", path,
+			   strerror(errno));
+		goto fail;
+	}
+	if (ftruncate(fd, map_len) != 0) {
+		_HFI_ERROR("Can't size trace file %s to %lu bytes: %s\n", path,
+			   (unsigned long)map_len, strerror(errno));
+		close(fd);
+		goto fail;
+	}
+	mapptr = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mapptr == MAP_FAILED) {
+		_HFI_ERROR("Can't map trace file %s: %s\n", path,
+			   strerror(errno));
+		goto fail;
+	}
+
+	trace->hdr = (struct psmi_trace_hdr *)mapptr;
+	trace->ring = (struct psmi_trace_rec *)
+	    ((uintptr_t) mapptr + PSMI_TRACE_HDR_SIZE);
+	trace->mask = num_recs - 1;
+	trace->map_len = map_len;
+
+	trace->hdr->version = PSMI_TRACE_VERSION;
+	trace->hdr->rec_size = sizeof(struct psmi_trace_rec);
+	trace->hdr->num_recs = num_recs;
+	trace->hdr->head = 0;
+	trace->hdr->pid = getpid();
+	trace->hdr->epid = ep->epid;
+	trace->hdr->pico_per_cycle = __hfi_pico_per_cycle;
+	strncpy(trace->hdr->hostname, psmi_gethostname(),
+		sizeof(trace->hdr->hostname) - 1);
+	trace->hdr->enabled = (env_trace.e_uint == 1);
+	/* The magic goes last, the decoder skips files without it */
+	ips_wmb();
+	trace->hdr->magic = PSMI_TRACE_MAGIC;
+
+	_HFI_PRDBG("Tracing %" PRIu64 " records to %s\n", num_recs, path);
+	ep->trace = trace;
+	return PSM2_OK;
+
+fail:
+	psmi_free(trace);
+	return PSM2_OK;
+}
+
+void psmi_trace_fini(psm2_ep_t ep)
+{
+	struct psmi_trace *trace = ep->trace;
+
+	if (trace == NULL)
+		return;
+
+	ep->trace = NULL;
+	munmap(trace->hdr, trace->map_len);
+	psmi_free(trace);
+}
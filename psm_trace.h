@@ -0,0 +1,132 @@
+/*
+
+  This file is provided under a dual BSD/GPLv2 license.  When using or
+  redistributing this file, you may do so under either license.
+
+  GPL LICENSE SUMMARY
+
+  Copyright(c) 2015 Intel Corporation.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of version 2 of the GNU General Public License as
+  published by the Free Software Foundation.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  Contact Information:
+  Intel Corporation, www.intel.com
+
+  BSD LICENSE
+
+  Copyright(c) 2015 Intel Corporation.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the
+      distribution.
+    * Neither the name of Intel Corporation nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+
+#ifndef _PSMI_IN_USER_H
+#error psm_trace.h not meant to be included directly, include psm_user.h instead
+#endif
+
+#ifndef _PSMI_TRACE_H
+#define _PSMI_TRACE_H
+
+#include "psm_trace_format.h"
+
+/*
+ * Binary event tracing.
+ *
+ * With PSM2_TRACE set, every endpoint maps a file (see psm_trace.c) holding
+ * a ring of fixed-size records, and the data path appends one record per
+ * event.  Nothing is formatted or flushed while the job runs, the file is
+ * decoded afterwards (or while it runs) by psm2_trace_decode.  Recording can
+ * be switched on and off at runtime through the enabled word of the mapped
+ * header.  The fields of each record are:
+ *
+ *   event		opcode		peer	len		seq	id
+ *   MQ_SEND_POST	-		dest	msglen		tag[0]	request
+ *   MQ_RECV_POST	-		src	buflen		tag[0]	request
+ *   MQ_*_DONE		-		-	msglen		-	request
+ *   IPS_TX/RX		hfi opcode	peer	paylen		psn	flow
+ *   SHM_TX/RX		AM handler	peer	paylen		AM type	-
+ *
+ * Records are written under the PSM lock, like the rest of the endpoint
+ * state.
+ */
+
+struct psmi_trace {
+	struct psmi_trace_hdr *hdr;
+	struct psmi_trace_rec *ring;
+	uint64_t mask;
+	size_t map_len;
+};
+
+psm2_error_t psmi_trace_init(psm2_ep_t ep);
+void psmi_trace_fini(psm2_ep_t ep);
+
+PSMI_ALWAYS_INLINE(int psmi_trace_enabled(psm2_ep_t ep))
+{
+	return ep->trace != NULL && ep->trace->hdr->enabled;
+}
+
+/* Requests come from cacheline aligned pools, the low bits carry nothing */
+#define psmi_trace_req_id(req)	((uint32_t) ((uintptr_t) (req) >> 6))
+
+PSMI_ALWAYS_INLINE(
+void
+psmi_trace_at(psm2_ep_t ep, uint64_t cycles, uint16_t event, uint16_t opcode,
+	      uint64_t peer, uint32_t len, uint32_t seq, uint32_t id))
+{
+	struct psmi_trace *trace = ep->trace;
+	struct psmi_trace_rec *rec =
+	    &trace->ring[trace->hdr->head & trace->mask];
+
+	rec->cycles = cycles;
+	rec->peer = peer;
+	rec->len = len;
+	rec->seq = seq;
+	rec->event = event;
+	rec->opcode = opcode;
+	rec->id = id;
+	trace->hdr->head++;
+}
+
+PSMI_ALWAYS_INLINE(
+void
+psmi_trace(psm2_ep_t ep, uint16_t event, uint16_t opcode, uint64_t peer,
+	   uint32_t len, uint32_t seq, uint32_t id))
+{
+	if_pf(psmi_trace_enabled(ep))
+		psmi_trace_at(ep, get_cycles(), event, opcode, peer, len, seq,
+			      id);
+}
+
+#endif /* _PSMI_TRACE_H */
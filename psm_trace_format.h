@@ -0,0 +1,110 @@
+/*
+
+  This file is provided under a dual BSD/GPLv2 license.  When using or
+  redistributing this file, you may do so under either license.
+
+  GPL LICENSE SUMMARY
+
+  Copyright(c) 2015 Intel Corporation.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of version 2 of the GNU General Public License as
+  published by the Free Software Foundation.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  Contact Information:
+  Intel Corporation, www.intel.com
+
+  BSD LICENSE
+
+  Copyright(c) 2015 Intel Corporation.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the
+      distribution.
+    * Neither the name of Intel Corporation nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+
+#ifndef _PSM_TRACE_FORMAT_H
+#define _PSM_TRACE_FORMAT_H
+
+/*
+ * Layout of the trace files written by psm_trace.c and read by
+ * psm2_trace_decode.  Kept free of any other PSM header so the decoder can
+ * be built on its own.
+ *
+ * A file is a header padded to PSMI_TRACE_HDR_SIZE followed by a ring of
+ * num_recs fixed-size records.  head counts every record ever written,
+ * record i lives in slot i % num_recs, so the ring holds records
+ * [max(head - num_recs, 0), head).
+ */
+
+#include <stdint.h>
+
+#define PSMI_TRACE_MAGIC	0x45435254324d5350ULL	/* "PSM2TRCE" */
+#define PSMI_TRACE_VERSION	1
+#define PSMI_TRACE_HDR_SIZE	4096
+
+/* Events, see psm_trace.h for what each records in its fields */
+#define PSMI_TRACE_MQ_SEND_POST	1
+#define PSMI_TRACE_MQ_RECV_POST	2
+#define PSMI_TRACE_MQ_SEND_DONE	3
+#define PSMI_TRACE_MQ_RECV_DONE	4
+#define PSMI_TRACE_IPS_TX	5
+#define PSMI_TRACE_IPS_RX	6
+#define PSMI_TRACE_SHM_TX	7
+#define PSMI_TRACE_SHM_RX	8
+#define PSMI_TRACE_NUM_EVENTS	9
+
+struct psmi_trace_hdr {
+	uint64_t magic;
+	uint32_t version;
+	uint32_t rec_size;	/* sizeof(struct psmi_trace_rec) */
+	uint64_t num_recs;	/* power of two */
+	volatile uint64_t head;	/* records written so far */
+	volatile uint32_t enabled; /* may be flipped while the job runs */
+	uint32_t pid;
+	uint64_t epid;
+	uint32_t pico_per_cycle; /* to convert record timestamps */
+	uint32_t unused;
+	char hostname[64];
+};
+
+struct psmi_trace_rec {
+	uint64_t cycles;	/* get_cycles() */
+	uint64_t peer;		/* peer epid, 0 if unknown */
+	uint32_t len;		/* message or payload length */
+	uint32_t seq;		/* psn, tag or AM type */
+	uint16_t event;		/* PSMI_TRACE_* */
+	uint16_t opcode;	/* packet opcode or AM handler */
+	uint32_t id;		/* request id or flow */
+};
+
+#endif /* _PSM_TRACE_FORMAT_H */
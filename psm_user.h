@@ -100,6 +100,9 @@
 #include "psm_timer.h"
 #include "psm_mpool.h"
 #include "psm_ep.h"
+#include "psm_trace.h"
+#include "psm_telemetry.h"
+#include "psm_progress.h"
 #include "psm_lock.h"
 #include "psm_stats.h"
 #undef _PSMI_IN_USER_H
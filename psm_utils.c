@@ -54,48 +54,91 @@
 /* Copyright (c) 2003-2015 Intel Corporation. All rights reserved. */
 
 #include <netdb.h>		/* gethostbyname */
+#include <sys/mman.h>		/* mmap */
+#include <emmintrin.h>		/* SSE2 epid table probing */
 #include "psm_user.h"
 #include "psm_mq_internal.h"
 #include "psm_am_internal.h"
 
 int psmi_ep_device_is_enabled(const psm2_ep_t ep, int devid);
 
-struct psmi_epid_table psmi_epid_table;
+/* Tables for the special PSMI_EP_HOSTNAME and PSMI_EP_CROSSTALK handles,
+ * real endpoints carry their own */
+static struct psmi_epid_table psmi_epid_hostnames;
+static struct psmi_epid_table psmi_epid_crosstalk;
 
-/* Iterator to access the epid table.
- * 'ep' can be NULL if remote endpoints from all endpoint handles are requested
- */
+PSMI_ALWAYS_INLINE(
+struct psmi_epid_table *
+psmi_epid_table_of(psm2_ep_t ep))
+{
+	if (ep == PSMI_EP_HOSTNAME)
+		return &psmi_epid_hostnames;
+	else if (ep == PSMI_EP_CROSSTALK)
+		return &psmi_epid_crosstalk;
+	else
+		return &ep->epid_table;
+}
+
+/* Iterator to access the epid table of 'ep'. */
 void psmi_epid_itor_init(struct psmi_eptab_iterator *itor, psm2_ep_t ep)
 {
+	struct psmi_epid_table *tab = psmi_epid_table_of(ep);
+	uint32_t i;
+
+	pthread_mutex_lock(&tab->tablock);
+	itor->tab = tab;
 	itor->i = 0;
-	itor->ep = ep;
-	pthread_mutex_lock(&psmi_epid_table.tablock);
+	itor->start = 0;
+	itor->last = NULL;
+	/* Below the load factor there's always an empty slot */
+	for (i = 0; tab->table && i < tab->tabsize; i++) {
+		if (tab->ctrl[i] == PSMI_EPID_CTRL_EMPTY) {
+			itor->start = i;
+			break;
+		}
+	}
 }
 
 void *psmi_epid_itor_next(struct psmi_eptab_iterator *itor)
 {
-	int i;
-	struct psmi_epid_tabentry *e;
+	struct psmi_epid_table *tab = itor->tab;
+	uint32_t mask = tab->tabsize - 1;
+	uint32_t i, idx;
 
-	if (itor->i >= psmi_epid_table.tabsize)
+	if (tab->table == NULL)
 		return NULL;
-	for (i = itor->i; i < psmi_epid_table.tabsize; i++) {
-		e = &psmi_epid_table.table[i];
-		if (!e->entry || e->entry == EPADDR_DELETED)
-			continue;
-		if (itor->ep && e->ep != itor->ep)
+
+	/* If the last entry was removed, the rest of its probe run moved back
+	 * one slot and whatever now sits in its slot hasn't been seen yet.
+	 * Runs never wrap past the start slot, so nothing seen moves ahead.
+	 */
+	if (itor->last) {
+		idx = (itor->start + itor->i) & mask;
+		if (tab->ctrl[idx] != PSMI_EPID_CTRL_EMPTY &&
+		    tab->table[idx].entry != itor->last) {
+			itor->last = tab->table[idx].entry;
+			return itor->last;
+		}
+	}
+
+	for (i = itor->i + 1; i < tab->tabsize; i++) {
+		idx = (itor->start + i) & mask;
+		if (tab->ctrl[idx] == PSMI_EPID_CTRL_EMPTY)
 			continue;
-		itor->i = i + 1;
-		return e->entry;
+		itor->i = i;
+		itor->last = tab->table[idx].entry;
+		return itor->last;
 	}
-	itor->i = psmi_epid_table.tabsize;	/* put at end of table */
+	itor->i = tab->tabsize;	/* put at end of table */
+	itor->last = NULL;
 	return NULL;
 }
 
 void psmi_epid_itor_fini(struct psmi_eptab_iterator *itor)
 {
-	pthread_mutex_unlock(&psmi_epid_table.tablock);
+	pthread_mutex_unlock(&itor->tab->tablock);
 	itor->i = 0;
+	itor->last = NULL;
 }
 
 #define mix64(a, b, c) \
@@ -114,69 +157,216 @@ void psmi_epid_itor_fini(struct psmi_eptab_iterator *itor)
 	c -= a; c -= b; c ^= (b>>22); \
 }
 
-psm2_error_t psmi_epid_init()
+void psmi_epid_table_init(struct psmi_epid_table *tab)
 {
 	pthread_mutexattr_t attr;
-	psmi_epid_table.table = NULL, psmi_epid_table.tabsize = 0;
-	psmi_epid_table.tabsize_used = 0;
+
+	tab->ctrl = NULL;
+	tab->table = NULL;
+	tab->tabsize = 0;
+	tab->tabsize_used = 0;
 	pthread_mutexattr_init(&attr);
 	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
-	pthread_mutex_init(&psmi_epid_table.tablock, &attr);
+	pthread_mutex_init(&tab->tablock, &attr);
 	pthread_mutexattr_destroy(&attr);
+}
+
+void psmi_epid_table_fini(struct psmi_epid_table *tab)
+{
+	if (tab->table != NULL) {
+		psmi_free(tab->table);
+		psmi_free(tab->ctrl);
+		tab->table = NULL;
+		tab->ctrl = NULL;
+	}
+	tab->tabsize = 0;
+	tab->tabsize_used = 0;
+}
+
+psm2_error_t psmi_epid_init()
+{
+	psmi_epid_table_init(&psmi_epid_hostnames);
+	psmi_epid_table_init(&psmi_epid_crosstalk);
 	return PSM2_OK;
 };
 
 psm2_error_t psmi_epid_fini()
 {
-	if (psmi_epid_table.table != NULL) {
-		psmi_free(psmi_epid_table.table);
-		psmi_epid_table.table = NULL;
-	}
-	psmi_epid_table.tabsize = 0;
-	psmi_epid_table.tabsize_used = 0;
+	psmi_epid_table_fini(&psmi_epid_hostnames);
+	psmi_epid_table_fini(&psmi_epid_crosstalk);
 	return PSM2_OK;
 }
 
 PSMI_ALWAYS_INLINE(
 uint64_t
-hash_this(const psm2_ep_t ep, const psm2_epid_t epid))
+hash_this(const psm2_epid_t epid))
 {
-	uint64_t ep_i = (uint64_t) (uintptr_t) ep;
+	uint64_t salt = 0xc2b2ae3d27d4eb4fULL;
 	uint64_t epid_i = (uint64_t) epid;
 	uint64_t hash = 0x9e3779b97f4a7c13LL;
-	mix64(ep_i, epid_i, hash);
+	mix64(salt, epid_i, hash);
 	return hash;
 }
 
+/* The low 7 bits of the hash go in the control byte, the rest pick the
+ * home slot */
+#define PSMI_EPID_H1(hash)	((uint32_t) ((hash) >> 7))
+#define PSMI_EPID_H2(hash)	((uint8_t) ((hash) & 0x7f))
+
+PSMI_ALWAYS_INLINE(
+void
+psmi_epid_ctrl_set(struct psmi_epid_table *tab, uint32_t idx, uint8_t c))
+{
+	tab->ctrl[idx] = c;
+	if (idx < PSMI_EPID_GROUP - 1)
+		tab->ctrl[tab->tabsize + idx] = c;
+}
+
+/* Bitmaps of the slots from idx on holding h2, and of the empty ones */
+PSMI_ALWAYS_INLINE(
+void
+psmi_epid_group_match(const struct psmi_epid_table *tab, uint32_t idx,
+		      uint8_t h2, uint32_t *match, uint32_t *empty))
+{
+	__m128i group = _mm_loadu_si128((const __m128i *)&tab->ctrl[idx]);
+
+	*match = _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(h2)));
+	*empty = _mm_movemask_epi8(_mm_cmpeq_epi8(group,
+				   _mm_set1_epi8((char)PSMI_EPID_CTRL_EMPTY)));
+}
+
+/* Returns the slot holding epid, or -1 */
+static
+int64_t
+psmi_epid_find(const struct psmi_epid_table *tab, psm2_epid_t epid)
+{
+	uint64_t hash = hash_this(epid);
+	uint32_t mask = tab->tabsize - 1;
+	uint32_t idx = PSMI_EPID_H1(hash) & mask;
+	uint8_t h2 = PSMI_EPID_H2(hash);
+	uint32_t match, empty, probed;
+
+	for (probed = 0; probed < tab->tabsize; probed += PSMI_EPID_GROUP) {
+		psmi_epid_group_match(tab, idx, h2, &match, &empty);
+		/* The probe run ends at the first empty slot */
+		if (empty)
+			match &= (empty & -empty) - 1;
+		while (match) {
+			uint32_t slot = (idx + __builtin_ctz(match)) & mask;
+			if (tab->table[slot].epid == epid)
+				return slot;
+			match &= match - 1;
+		}
+		if (empty)
+			break;
+		idx = (idx + PSMI_EPID_GROUP) & mask;
+	}
+	return -1;
+}
+
+/* Place an entry, the table must have a free slot */
+static
+void
+psmi_epid_insert(struct psmi_epid_table *tab, psm2_epid_t epid, void *entry)
+{
+	uint64_t hash = hash_this(epid);
+	uint32_t mask = tab->tabsize - 1;
+	uint32_t idx = PSMI_EPID_H1(hash) & mask;
+	uint32_t match, empty;
+
+	while (1) {
+		psmi_epid_group_match(tab, idx, 0, &match, &empty);
+		if (empty)
+			break;
+		idx = (idx + PSMI_EPID_GROUP) & mask;
+	}
+	idx = (idx + __builtin_ctz(empty)) & mask;
+	psmi_epid_ctrl_set(tab, idx, PSMI_EPID_H2(hash));
+	tab->table[idx].epid = epid;
+	tab->table[idx].entry = entry;
+}
+
+/*
+ * Empty a slot and close the gap: every later entry of the probe run whose
+ * home slot isn't between the gap and itself moves back into the gap.
+ */
+static
+void
+psmi_epid_erase(struct psmi_epid_table *tab, uint32_t gap)
+{
+	uint32_t mask = tab->tabsize - 1;
+	uint32_t idx = gap, home;
+
+	while (1) {
+		idx = (idx + 1) & mask;
+		if (tab->ctrl[idx] == PSMI_EPID_CTRL_EMPTY)
+			break;
+		home = PSMI_EPID_H1(hash_this(tab->table[idx].epid)) & mask;
+		/* Stays if its home is cyclically in (gap, idx] */
+		if (((idx - home) & mask) < ((idx - gap) & mask))
+			continue;
+		psmi_epid_ctrl_set(tab, gap, tab->ctrl[idx]);
+		tab->table[gap] = tab->table[idx];
+		gap = idx;
+	}
+	psmi_epid_ctrl_set(tab, gap, PSMI_EPID_CTRL_EMPTY);
+	tab->tabsize_used--;
+}
+
+static
+psm2_error_t
+psmi_epid_grow(psm2_ep_t ep, struct psmi_epid_table *tab)
+{
+	struct psmi_epid_table old = *tab;
+	uint32_t newsz, i;
+
+	newsz = tab->tabsize ? tab->tabsize * 2 : PSMI_EPID_TABSIZE_MIN;
+	tab->table = (struct psmi_epid_tabentry *)
+	    psmi_calloc(ep, PER_PEER_ENDPOINT, newsz,
+			sizeof(struct psmi_epid_tabentry));
+	tab->ctrl = (uint8_t *)
+	    psmi_malloc(ep, PER_PEER_ENDPOINT, newsz + PSMI_EPID_GROUP - 1);
+	if (tab->table == NULL || tab->ctrl == NULL) {
+		if (tab->table)
+			psmi_free(tab->table);
+		if (tab->ctrl)
+			psmi_free(tab->ctrl);
+		*tab = old;
+		return PSM2_NO_MEMORY;
+	}
+	memset(tab->ctrl, PSMI_EPID_CTRL_EMPTY, newsz + PSMI_EPID_GROUP - 1);
+	tab->tabsize = newsz;
+
+	for (i = 0; i < old.tabsize; i++)
+		if (old.ctrl[i] != PSMI_EPID_CTRL_EMPTY)
+			psmi_epid_insert(tab, old.table[i].epid,
+					 old.table[i].entry);
+	if (old.table) {
+		psmi_free(old.table);
+		psmi_free(old.ctrl);
+	}
+	return PSM2_OK;
+}
+
 PSMI_ALWAYS_INLINE(
 void *
 psmi_epid_lookup_inner(psm2_ep_t ep, psm2_epid_t epid, int remove))
 {
-	uint64_t key = hash_this(ep, epid);
-	struct psmi_epid_tabentry *e;
+	struct psmi_epid_table *tab = psmi_epid_table_of(ep);
 	void *entry = NULL;
-	int idx;
+	int64_t idx;
 
-	pthread_mutex_lock(&psmi_epid_table.tablock);
-	if (!psmi_epid_table.table)
+	pthread_mutex_lock(&tab->tablock);
+	if (!tab->table)
 		goto ret;
-	idx = (int)(key % psmi_epid_table.tabsize);
-	while (psmi_epid_table.table[idx].entry != NULL) {
-		/* An epid can be added twice if there's more than one opened endpoint,
-		 * but really we match on epid *and* on endpoint */
-		e = &psmi_epid_table.table[idx];
-		if (e->entry != EPADDR_DELETED && e->key == key) {
-			entry = e->entry;
-			if (remove)
-				psmi_epid_table.table[idx].entry =
-				    EPADDR_DELETED;
-			goto ret;
-		}
-		if (++idx == psmi_epid_table.tabsize)
-			idx = 0;
+	idx = psmi_epid_find(tab, epid);
+	if (idx >= 0) {
+		entry = tab->table[idx].entry;
+		if (remove)
+			psmi_epid_erase(tab, (uint32_t) idx);
 	}
 ret:
-	pthread_mutex_unlock(&psmi_epid_table.tablock);
+	pthread_mutex_unlock(&tab->tablock);
 	return entry;
 }
 
@@ -198,67 +388,25 @@ void *psmi_epid_remove(psm2_ep_t ep, psm2_epid_t epid)
 
 psm2_error_t psmi_epid_add(psm2_ep_t ep, psm2_epid_t epid, void *entry)
 {
-	uint64_t key;
-	int idx, i, newsz;
-	struct psmi_epid_tabentry *e;
+	struct psmi_epid_table *tab = psmi_epid_table_of(ep);
 	psm2_error_t err = PSM2_OK;
 
 	if (PSMI_EP_HOSTNAME != ep)
 		_HFI_VDBG("add of (%p,%" PRIx64 ") with entry %p\n", ep, epid,
 			  entry);
-	pthread_mutex_lock(&psmi_epid_table.tablock);
-	/* Leave this here, mostly for sanity and for the fact that the epid
-	 * table is currently not used in the critical path */
-	if (++psmi_epid_table.tabsize_used >
-	    (int)(psmi_epid_table.tabsize * PSMI_EPID_TABLOAD_FACTOR)) {
-		struct psmi_epid_tabentry *newtab;
-		newsz = psmi_epid_table.tabsize + PSMI_EPID_TABSIZE_CHUNK;
-		newtab = (struct psmi_epid_tabentry *)
-		    psmi_calloc(ep, PER_PEER_ENDPOINT,
-				newsz, sizeof(struct psmi_epid_tabentry));
-		if (newtab == NULL) {
-			err = PSM2_NO_MEMORY;
+	pthread_mutex_lock(&tab->tablock);
+	/* Doubling keeps adding n peers linear, the old fixed size steps
+	 * rehashed the whole table every 128 peers */
+	if ((uint64_t) (tab->tabsize_used + 1) * PSMI_EPID_TABLOAD_DEN >
+	    (uint64_t) tab->tabsize * PSMI_EPID_TABLOAD_NUM) {
+		if ((err = psmi_epid_grow(ep, tab)))
 			goto fail;
-		}
-		if (psmi_epid_table.table) {	/* rehash the table */
-			for (i = 0; i < psmi_epid_table.tabsize; i++) {
-				e = &psmi_epid_table.table[i];
-				if (e->entry == NULL)
-					continue;
-				/* When rehashing, mark deleted as free again */
-				if (e->entry == EPADDR_DELETED) {
-					psmi_epid_table.tabsize_used--;
-					continue;
-				}
-				idx = (int)(e->key % newsz);
-				while (newtab[idx].entry != NULL)
-					if (++idx == newsz)
-						idx = 0;
-				newtab[idx].entry = e->entry;
-				newtab[idx].key = e->key;
-				newtab[idx].ep = e->ep;
-				newtab[idx].epid = e->epid;
-			}
-			psmi_free(psmi_epid_table.table);
-		}
-		psmi_epid_table.table = newtab;
-		psmi_epid_table.tabsize = newsz;
-	}
-	key = hash_this(ep, epid);
-	idx = (int)(key % psmi_epid_table.tabsize);
-	e = &psmi_epid_table.table[idx];
-	while (e->entry && e->entry != EPADDR_DELETED) {
-		if (++idx == psmi_epid_table.tabsize)
-			idx = 0;
-		e = &psmi_epid_table.table[idx];
-	}
-	e->entry = entry;
-	e->key = key;
-	e->epid = epid;
-	e->ep = ep;
+	}
+	psmi_epid_insert(tab, epid, entry);
+	tab->tabsize_used++;
 
 fail:
-	pthread_mutex_unlock(&psmi_epid_table.tablock);
+	pthread_mutex_unlock(&tab->tablock);
 	return err;
 }
 
@@ -1487,6 +1635,61 @@ void psmi_free_internal(void *ptr,const char *curloc)
 	my_free(ptr,curloc);
 }
 
+/*
+ * Whether large pools should be backed by huge pages (PSM2_MEM_HUGEPAGES).
+ */
+int psmi_hugepages_enabled(void)
+{
+	static int enabled = -1;
+
+	if (enabled < 0) {
+		union psmi_envvar_val env_huge;
+
+		psmi_getenv("PSM2_MEM_HUGEPAGES",
+			    "Back large request pools and send buffers with huge pages",
+			    PSMI_ENVVAR_LEVEL_USER, PSMI_ENVVAR_TYPE_YESNO,
+			    (union psmi_envvar_val)0, &env_huge);
+		enabled = env_huge.e_uint;
+	}
+	return enabled;
+}
+
+/*
+ * Map zeroed memory, from huge pages if *is_huge is set on input and some are
+ * available, and from regular pages otherwise.  On return *is_huge tells
+ * which one it was and *sz is rounded up to the size actually mapped, which
+ * must be passed back to psmi_hugepage_free().
+ */
+void *psmi_hugepage_alloc(psmi_memtype_t type, size_t *sz, int *is_huge)
+{
+	size_t newsz = PSMI_ALIGNUP(*sz, PSMI_HUGEPAGE_SIZE);
+	void *addr = MAP_FAILED;
+
+	if (*is_huge)
+		addr = mmap(NULL, newsz, PROT_READ | PROT_WRITE,
+			    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (addr == MAP_FAILED) {
+		*is_huge = 0;
+		newsz = PSMI_ALIGNUP(*sz, PSMI_PAGESIZE);
+		addr = mmap(NULL, newsz, PROT_READ | PROT_WRITE,
+			    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (addr == MAP_FAILED)
+			return NULL;
+	}
+
+	if_pf(psmi_stats_mask & PSMI_STATSTYPE_MEMORY)
+	    psmi_log_memstats(type, newsz);
+	*sz = newsz;
+	return addr;
+}
+
+void psmi_hugepage_free(psmi_memtype_t type, void *ptr, size_t sz)
+{
+	if_pf(psmi_stats_mask & PSMI_STATSTYPE_MEMORY)
+	    psmi_log_memstats(type, -(int64_t) sz);
+	munmap(ptr, sz);
+}
+
 PSMI_ALWAYS_INLINE(
 psm2_error_t
 psmi_coreopt_ctl(const void *core_obj, int optname,
@@ -65,27 +65,37 @@
 
 /*
  * Endpoint 'id' hash table, with iterator interface
+ *
+ * Every endpoint has its own table (ep->epid_table), the special handles
+ * below have global ones.  Tables are open addressed with linear probing
+ * and a control byte per slot, either PSMI_EPID_CTRL_EMPTY or 7 bits of the
+ * key's hash, so a probe compares 16 slots at once with SSE2 before looking
+ * at any key.  Removal shifts the rest of the probe run back instead of
+ * leaving tombstones, so lookups never slow down with churn.
  */
+#define PSMI_EPID_GROUP		16	/* control bytes compared at once */
+#define PSMI_EPID_CTRL_EMPTY	0x80
+#define PSMI_EPID_TABSIZE_MIN	64	/* slots, a power of 2 */
+#define PSMI_EPID_TABLOAD_NUM	3	/* grow past 3/4 full */
+#define PSMI_EPID_TABLOAD_DEN	4
+
+struct psmi_epid_tabentry {
+	psm2_epid_t epid;
+	void *entry;
+};
+
 struct psmi_epid_table {
+	/* tabsize + PSMI_EPID_GROUP - 1 bytes, the tail mirrors the first
+	 * bytes so a group can be loaded at any slot without wrapping */
+	uint8_t *ctrl;
 	struct psmi_epid_tabentry *table;
-	int tabsize;
-	int tabsize_used;
+	uint32_t tabsize;
+	uint32_t tabsize_used;
 	pthread_mutex_t tablock;
 };
-/*
- * Endpoint address hash table
- */
-struct psmi_epid_tabentry {
-	void *entry;
-	uint64_t key;
-	psm2_ep_t ep;
-	psm2_epid_t epid;
-};
 
-extern struct psmi_epid_table psmi_epid_table;
-#define EPADDR_DELETED	((void *)-1)	/* tag used to mark deleted entries */
-#define PSMI_EPID_TABSIZE_CHUNK	 128
-#define PSMI_EPID_TABLOAD_FACTOR ((float)0.7)
+void psmi_epid_table_init(struct psmi_epid_table *tab);
+void psmi_epid_table_fini(struct psmi_epid_table *tab);
 
 psm2_error_t psmi_epid_init();
 psm2_error_t psmi_epid_fini();
@@ -97,9 +107,16 @@ psm2_error_t psmi_epid_add(psm2_ep_t ep, psm2_epid_t epid, void *entry);
 #define PSMI_EP_CROSSTALK   ((psm2_ep_t) -2)	/* Second special endpoint handle
 						 * to log which nodes we've seen
 						 * crosstalk from */
+/*
+ * The table stays locked between init and fini.  The entry last returned by
+ * next may be removed while iterating, nothing may be added and no other
+ * entry removed.
+ */
 struct psmi_eptab_iterator {
-	int i;			/* last index looked up */
-	psm2_ep_t ep;
+	struct psmi_epid_table *tab;
+	uint32_t i;		/* slots visited */
+	uint32_t start;		/* an empty slot, no probe run wraps past it */
+	void *last;		/* entry last returned */
 };
 void psmi_epid_itor_init(struct psmi_eptab_iterator *itor, psm2_ep_t ep);
 void *psmi_epid_itor_next(struct psmi_eptab_iterator *itor);
@@ -207,6 +224,15 @@ void _HD_validate_heap_allocations(const char *curloc);
 
 void psmi_log_memstats(psmi_memtype_t type, int64_t nbytes);
 
+/*
+ * Huge page backed memory for large, frequently walked pools.  Falls back to
+ * regular pages when no huge pages are available.
+ */
+#define PSMI_HUGEPAGE_SIZE	(2UL*1024*1024)
+int psmi_hugepages_enabled(void);
+void *psmi_hugepage_alloc(psmi_memtype_t type, size_t *sz, int *is_huge);
+void psmi_hugepage_free(psmi_memtype_t type, void *ptr, size_t sz);
+
 /*
  * Parsing int parameters set in string tuples.
  */
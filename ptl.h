@@ -195,17 +195,19 @@ struct ptl_ctl {
 				       size_t len, int flags,
 				       psm2_am_completion_fn_t completion_fn,
 				       void *completion_ctxt);
-	/* Long messages currently unsupported */
-#if 0
 	 psm2_error_t(*am_long_request) (psm2_epaddr_t epaddr,
 					psm2_handler_t handler,
 					psm2_amarg_t *args, int nargs,
 					void *src, size_t len, void *dest,
-					int flags);
+					int flags,
+					psm2_am_completion_fn_t completion_fn,
+					void *completion_ctxt);
 	 psm2_error_t(*am_long_reply) (psm2_am_token_t token,
-				      psm2_handler_t handler, psm2_amarg_t *args,
-				      int nargs, void *src, size_t len,
-				      void *dest, int flags);
-#endif
+				      psm2_handler_t handler,
+				      psm2_amarg_t *args, int nargs,
+				      void *src, size_t len, void *dest,
+				      int flags,
+				      psm2_am_completion_fn_t completion_fn,
+				      void *completion_ctxt);
 };
 #endif
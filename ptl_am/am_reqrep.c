@@ -57,6 +57,7 @@
 #include "psm2_am.h"
 #include "psm_mq_internal.h"
 #include "psm_am_internal.h"
+#include "cmarw.h"
 
 psm2_error_t
 psmi_amsh_am_short_request(psm2_epaddr_t epaddr,
@@ -91,6 +92,64 @@ psmi_amsh_am_short_request(psm2_epaddr_t epaddr,
 	return PSM2_OK;
 }
 
+psm2_error_t
+psmi_amsh_am_long_request(psm2_epaddr_t epaddr,
+			  psm2_handler_t handler, psm2_amarg_t *args, int nargs,
+			  void *src, size_t len, void *dest, int flags,
+			  psm2_am_completion_fn_t completion_fn,
+			  void *completion_ctxt)
+{
+	psm2_amarg_t req_args[NSHORT_ARGS + NBULK_ARGS];
+	struct amsh_am_long_desc desc;
+	ptl_t *ptl = epaddr->ptlctl->ptl;
+	int pid = psmi_epaddr_pid(epaddr);
+
+	psmi_assert(nargs <= (NSHORT_ARGS + NBULK_ARGS - 1));
+	psmi_assert(ptl != NULL);
+
+	desc.src = 0;
+	desc.dest = (uint64_t) (uintptr_t) dest;
+	desc.len = len;
+	desc.completion_fn = 0;
+	desc.completion_ctxt = 0;
+
+	/* The first arg carries the handler index, as for short requests, and
+	 * the payload length for the bulk packets below */
+	req_args[0].u32w0 = (uint32_t) handler;
+	req_args[0].u32w1 = (uint32_t) len;
+	psmi_mq_mtucpy((void *)&req_args[1], (const void *)args,
+		       (nargs * sizeof(psm2_amarg_t)));
+
+	if (len == 0) {
+		/* nothing to move */
+	} else if (pid && (ptl->psmi_kassist_mode & PSMI_KASSIST_GET)) {
+		/* The target pulls the payload and tells us when it's done */
+		desc.src = (uint64_t) (uintptr_t) src;
+		desc.completion_fn = (uint64_t) (uintptr_t) completion_fn;
+		desc.completion_ctxt = (uint64_t) (uintptr_t) completion_ctxt;
+	} else if (pid && (ptl->psmi_kassist_mode & PSMI_KASSIST_PUT) &&
+		   !psmi_am_long_dest_checked(handler)) {
+		size_t nbytes = cma_put(src, pid, dest, len);
+		psmi_assert_always(nbytes == len);
+	} else {
+		/* Stream the payload through the long bulk queue.  The target
+		 * drains it before it gets to the request below, each packet
+		 * carries the handler's args so it can be checked before it is
+		 * copied out. */
+		psmi_amsh_long_request(ptl, epaddr, am_long_data_hidx,
+				       req_args, min(nargs + 1, NSHORT_ARGS),
+				       src, len, dest, 0);
+	}
+
+	psmi_amsh_short_request(ptl, epaddr, am_long_handler_hidx,
+				req_args, nargs + 1, &desc, sizeof(desc), 0);
+
+	if (completion_fn && desc.src == 0)
+		completion_fn(completion_ctxt);
+
+	return PSM2_OK;
+}
+
 psm2_error_t
 psmi_amsh_am_short_reply(psm2_am_token_t tok,
 			 psm2_handler_t handler, psm2_amarg_t *args, int nargs,
@@ -116,3 +175,47 @@ psmi_amsh_am_short_reply(psm2_am_token_t tok,
 
 	return PSM2_OK;
 }
+
+psm2_error_t
+psmi_amsh_am_long_reply(psm2_am_token_t tok,
+			psm2_handler_t handler, psm2_amarg_t *args, int nargs,
+			void *src, size_t len, void *dest, int flags,
+			psm2_am_completion_fn_t completion_fn,
+			void *completion_ctxt)
+{
+	psm2_amarg_t rep_args[NSHORT_ARGS + NBULK_ARGS];
+	amsh_am_token_t *token = (amsh_am_token_t *) tok;
+	struct amsh_am_long_desc desc;
+	int pid = psmi_epaddr_pid(token->tok.epaddr_from);
+
+	psmi_assert(nargs <= (NSHORT_ARGS + NBULK_ARGS - 1));
+
+	/* The requester can't reply to a reply, so it never pulls.  Push the
+	 * payload ourselves whichever way kassist prefers. */
+	desc.src = 0;
+	desc.dest = (uint64_t) (uintptr_t) dest;
+	desc.len = len;
+	desc.completion_fn = 0;
+	desc.completion_ctxt = 0;
+
+	if (len == 0) {
+		/* nothing to move */
+	} else if (pid && token->ptl->psmi_kassist_mode != PSMI_KASSIST_OFF) {
+		size_t nbytes = cma_put(src, pid, dest, len);
+		psmi_assert_always(nbytes == len);
+	} else {
+		psmi_amsh_long_reply(token, am_long_data_hidx, NULL, 0,
+				     src, len, dest, 0);
+	}
+
+	rep_args[0].u32w0 = (uint32_t) handler;
+	psmi_mq_mtucpy((void *)&rep_args[1], (const void *)args,
+		       (nargs * sizeof(psm2_amarg_t)));
+	psmi_amsh_short_reply(token, am_long_handler_hidx,
+			      rep_args, nargs + 1, &desc, sizeof(desc), 0);
+
+	if (completion_fn)
+		completion_fn(completion_ctxt);
+
+	return PSM2_OK;
+}
@@ -723,6 +723,7 @@ amsh_epaddr_add(ptl_t *ptl, psm2_epid_t epid, uint16_t shmidx, psm2_epaddr_t *ep
 	/* Finally, add to table */
 	if ((err = psmi_epid_add(ptl->ep, epid, epaddr)))
 		goto fail;
+	psmi_telemetry_peer_add(ptl->ep, epaddr, PSMI_TELEMETRY_SHM);
 	_HFI_VDBG("epaddr=%s added to ptl=%p\n",
 		  psmi_epaddr_get_name(epid), ptl);
 	*epaddr_o = epaddr;
@@ -1356,6 +1357,12 @@ psmi_handlertab_t psmi_allhandlers[] = {
 	{psmi_am_mq_handler_rtsdone}
 	,
 	{psmi_am_handler}
+	,
+	{psmi_am_long_handler}
+	,
+	{psmi_am_long_handler_data}
+	,
+	{psmi_am_long_handler_done}
 };
 
 PSMI_ALWAYS_INLINE(void advance_head(volatile am_ctl_qshort_cache_t *hdr))
@@ -1524,6 +1531,8 @@ psmi_amsh_generic_inner(uint32_t amtype, ptl_t *ptl, psm2_epaddr_t epaddr,
 		  psmi_epaddr_get_name(epaddr->epid),
 		  ((am_epaddr_t *) epaddr)->_shmidx, amtype);
 	psmi_assert(epaddr != ptl->epaddr);
+	psmi_trace(ptl->ep, PSMI_TRACE_SHM_TX, hidx, epaddr->epid, len, amtype,
+		   0);
 
 	switch (amtype) {
 	case AMREQUEST_SHORT:
@@ -1766,6 +1775,9 @@ void process_packet(ptl_t *ptl, am_pkt_short_t *pkt, int isreq)
 		    ("%s inline flag=%d nargs=%d from_idx=%d pkt=%p hidx=%d\n",
 		     isreq ? "request" : "reply", pkt->flag, nargs, shmidx, pkt,
 		     hidx);
+		psmi_trace(ptl->ep, PSMI_TRACE_SHM_RX, hidx,
+			   tok.tok.epaddr_from ? tok.tok.epaddr_from->epid : 0,
+			   pkt->length, pkt->type, 0);
 
 		fn(&tok, args, nargs, pkt->length > 0 ?
 		   (void *)&args[nargs] : NULL, pkt->length);
@@ -1802,6 +1814,9 @@ void process_packet(ptl_t *ptl, am_pkt_short_t *pkt, int isreq)
 			  ptl->ep, ptl->ep->mq, pkt->type, bulkidx, pkt->flag,
 			  bulkpkt->flag, nargs, shmidx, pkt, bulkpkt, hidx);
 		psmi_assert(bulkpkt->flag == QREADY);
+		psmi_trace(ptl->ep, PSMI_TRACE_SHM_RX, hidx,
+			   tok.tok.epaddr_from ? tok.tok.epaddr_from->epid : 0,
+			   bulkpkt->len, pkt->type, 0);
 
 		if (nargs > NSHORT_ARGS || isend == 1) {
 			/* Either there are more args in the bulkpkt, or this is the last
@@ -1825,9 +1840,18 @@ void process_packet(ptl_t *ptl, am_pkt_short_t *pkt, int isreq)
 			   (void *)bulkpkt->payload, bulkpkt->len);
 			QMARKFREE(bulkpkt);
 		} else {
-			amsh_shm_copy_long((void *)(bulkpkt->dest +
-						    bulkpkt->dest_off),
-					   bulkpkt->payload, bulkpkt->len);
+			/* The payload of a long AM request is checked against
+			 * its handler before any of it lands, args[0] holds
+			 * the handler index and the whole length */
+			if (!isreq || hidx != am_long_data_hidx ||
+			    psmi_am_long_dest_ok(ptl->ep, args[0].u32w0,
+						 args + 1, nargs - 1,
+						 (void *)bulkpkt->dest,
+						 args[0].u32w1))
+				amsh_shm_copy_long((void *)(bulkpkt->dest +
+							    bulkpkt->dest_off),
+						   bulkpkt->payload,
+						   bulkpkt->len);
 
 			/* If this is the last packet, copy args before running the
 			 * handler */
@@ -1948,7 +1972,7 @@ do_rendezvous:
 	/* All eager async sends are always "all done" */
 	if (req != NULL) {
 		req->state = MQ_STATE_COMPLETE;
-		mq_qq_append(&mq->completed_q, req);
+		psmi_mq_req_completed(mq, req);
 	}
 
 	mq->stats.tx_num++;
@@ -2220,6 +2244,7 @@ psmi_amsh_am_get_parameters(psm2_ep_t ep, struct psm2_am_parameters *parameters)
 	parameters->max_nargs = PSMI_AM_MAX_ARGS;
 	parameters->max_request_short = AMLONG_MTU;
 	parameters->max_reply_short = AMLONG_MTU;
+	parameters->max_request_long = UINT32_MAX;
 
 	return PSM2_OK;
 }
@@ -2310,6 +2335,8 @@ amsh_init(psm2_ep_t ep, ptl_t *ptl, ptl_ctl_t *ctl)
 	ctl->am_get_parameters = psmi_amsh_am_get_parameters;
 	ctl->am_short_request = psmi_amsh_am_short_request;
 	ctl->am_short_reply = psmi_amsh_am_short_reply;
+	ctl->am_long_request = psmi_amsh_am_long_request;
+	ctl->am_long_reply = psmi_amsh_am_long_reply;
 
 	/* No stats in shm (for now...) */
 	ctl->epaddr_stats_num = NULL;
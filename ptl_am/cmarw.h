@@ -61,6 +61,14 @@
  */
 int64_t cma_get(pid_t pid, const void *src, void *dst, int64_t n);
 
+/*
+ * read n contiguous bytes from remote process pid into cnt local segments,
+ * the segments are used as scratch and modified
+ */
+struct iovec;
+int64_t cma_getv(pid_t pid, const void *src, struct iovec *dst, int cnt,
+		 int64_t n);
+
 /*
  * write to remote process pid
  */
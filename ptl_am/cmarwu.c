@@ -160,6 +160,35 @@ int64_t cma_get(pid_t pid, const void *src, void *dst, int64_t n)
 	return (nr != -1) ? sum : nr;
 }
 
+int64_t cma_getv(pid_t pid, const void *src, struct iovec *dst, int cnt,
+		 int64_t n)
+{
+	int64_t nr, sum, done;
+	struct iovec remote = {
+		.iov_base = (void *)src,
+		.iov_len = n
+	};
+
+	nr = sum = 0;
+	while ((sum != n) && (nr != -1)) {
+		nr = process_vm_readv(pid, dst, cnt, &remote, 1, 0);
+		if (nr == -1)
+			break;
+		sum += nr;
+		remote.iov_base += nr;
+		remote.iov_len -= nr;
+		/* Move past the local segments that were filled */
+		for (done = nr; cnt > 0 && (size_t) done >= dst->iov_len;
+		     cnt--, dst++)
+			done -= dst->iov_len;
+		if (cnt > 0) {
+			dst->iov_base += done;
+			dst->iov_len -= done;
+		}
+	}
+	return (nr != -1) ? sum : nr;
+}
+
 int64_t cma_put(const void *src, pid_t pid, void *dst, int64_t n)
 {
 	int64_t nr, sum;
@@ -121,6 +121,21 @@ typedef struct psmi_handlertab {
 
 int psmi_epaddr_pid(psm2_epaddr_t epaddr);
 
+/*
+ * Payload of the short request that runs the handler of a long AM request.
+ * The payload itself reaches dest ahead of it, either copied by the origin
+ * (kassist put, or the long bulk queue without kassist) or pulled by the
+ * target from src (kassist get), who then replies so that the origin can
+ * run the completion.
+ */
+struct amsh_am_long_desc {
+	uint64_t src;		/* origin buffer to pull, 0 if already copied */
+	uint64_t dest;
+	uint64_t len;
+	uint64_t completion_fn;	/* when pulled, run on the origin */
+	uint64_t completion_ctxt;
+};
+
 /*
  * Eventually, we will allow users to register handlers as "don't reply", which
  * may save on some of the buffering requirements
@@ -166,6 +181,12 @@ void psmi_am_mq_handler_rtsdone(void *toki, psm2_amarg_t *args, int narg,
 				void *buf, size_t len);
 void psmi_am_handler(void *toki, psm2_amarg_t *args, int narg, void *buf,
 		     size_t len);
+void psmi_am_long_handler(void *toki, psm2_amarg_t *args, int narg, void *buf,
+			  size_t len);
+void psmi_am_long_handler_data(void *toki, psm2_amarg_t *args, int narg,
+			       void *buf, size_t len);
+void psmi_am_long_handler_done(void *toki, psm2_amarg_t *args, int narg,
+			       void *buf, size_t len);
 
 /* AM over shared memory (forward decls) */
 psm2_error_t
@@ -185,12 +206,29 @@ psmi_amsh_am_short_reply(psm2_am_token_t tok,
 			 psm2_am_completion_fn_t completion_fn,
 			 void *completion_ctxt);
 
+psm2_error_t
+psmi_amsh_am_long_request(psm2_epaddr_t epaddr,
+			  psm2_handler_t handler, psm2_amarg_t *args, int nargs,
+			  void *src, size_t len, void *dest, int flags,
+			  psm2_am_completion_fn_t completion_fn,
+			  void *completion_ctxt);
+
+psm2_error_t
+psmi_amsh_am_long_reply(psm2_am_token_t tok,
+			psm2_handler_t handler, psm2_amarg_t *args, int nargs,
+			void *src, size_t len, void *dest, int flags,
+			psm2_am_completion_fn_t completion_fn,
+			void *completion_ctxt);
+
 #define amsh_conn_handler_hidx	 1
 #define mq_handler_hidx          2
 #define mq_handler_data_hidx     3
 #define mq_handler_rtsmatch_hidx 4
 #define mq_handler_rtsdone_hidx  5
 #define am_handler_hidx          6
+#define am_long_handler_hidx     7
+#define am_long_data_hidx        8
+#define am_long_done_hidx        9
 
 #define AMREQUEST_SHORT 0
 #define AMREQUEST_LONG  1
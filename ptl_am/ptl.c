@@ -58,6 +58,45 @@
 #include "psm_am_internal.h"
 #include "cmarw.h"
 
+#include <sys/uio.h>
+
+#define PTL_CMA_IOV_BATCH	64
+
+/* Read the sender's packed buffer straight into the blocks of a strided
+ * receive, a batch of blocks per system call */
+static
+size_t
+ptl_cma_get_strided(int pid, psm2_mq_req_t req)
+{
+	const struct psmi_mq_stride *layout = req->stride;
+	struct iovec iov[PTL_CMA_IOV_BATCH];
+	uintptr_t src = req->rts_sbuf;
+	uint32_t left = req->recv_msglen;
+	uint32_t block = 0;
+	size_t total = 0;
+
+	while (left > 0) {
+		int64_t batch = 0, nbytes;
+		int cnt;
+
+		for (cnt = 0; cnt < PTL_CMA_IOV_BATCH && left > 0; cnt++) {
+			uint32_t len = min(left, layout->blocklen);
+			iov[cnt].iov_base = req->buf + block * layout->stride;
+			iov[cnt].iov_len = len;
+			left -= len;
+			batch += len;
+			block++;
+		}
+
+		nbytes = cma_getv(pid, (void *)src, iov, cnt, batch);
+		if (nbytes != batch)
+			break;
+		src += batch;
+		total += batch;
+	}
+	return total;
+}
+
 static
 psm2_error_t
 ptl_handle_rtsmatch_request(psm2_mq_req_t req, int was_posted,
@@ -66,6 +105,7 @@ ptl_handle_rtsmatch_request(psm2_mq_req_t req, int was_posted,
 	psm2_amarg_t args[5];
 	psm2_epaddr_t epaddr = req->rts_peer;
 	ptl_t *ptl = epaddr->ptlctl->ptl;
+	psm2_error_t err = PSM2_OK;
 	int pid = 0;
 
 	PSM2_LOG_MSG("entering.");
@@ -79,17 +119,37 @@ ptl_handle_rtsmatch_request(psm2_mq_req_t req, int was_posted,
 	    && req->recv_msglen > 0
 	    && (pid = psmi_epaddr_pid(epaddr))) {
 		/* cma can be done in handler context or not. */
-		size_t nbytes = cma_get(pid, (void *)req->rts_sbuf,
-					req->buf, req->recv_msglen);
+		size_t nbytes;
+
+		if_pt (req->stride == NULL)
+			nbytes = cma_get(pid, (void *)req->rts_sbuf,
+					 req->buf, req->recv_msglen);
+		else
+			nbytes = ptl_cma_get_strided(pid, req);
 		psmi_assert_always(nbytes == req->recv_msglen);
+	} else if (req->stride != NULL && req->recv_msglen > 0) {
+		/* The sender writes contiguously, have it fill a staging
+		 * buffer that rtsdone scatters */
+		req->stride->bounce = psmi_sysbuf_alloc(req->recv_msglen);
+		if_pf (req->stride->bounce == NULL) {
+			/* Nothing can land, both sides complete empty with
+			 * the error */
+			_HFI_DBG("[shm][rndv][recv] req=%p no staging buffer "
+				 "for %u bytes\n", req, req->recv_msglen);
+			err = PSM2_NO_MEMORY;
+			req->recv_msglen = 0;
+			req->error_code = err;
+		}
 	}
 
 	args[0].u64w0 = (uint64_t) (uintptr_t) req->ptl_req_ptr;
 	args[1].u64w0 = (uint64_t) (uintptr_t) req;
-	args[2].u64w0 = (uint64_t) (uintptr_t) req->buf;
+	args[2].u64w0 = (uint64_t) (uintptr_t)
+	    (req->stride != NULL && req->stride->bounce != NULL ?
+	     req->stride->bounce : req->buf);
 	args[3].u32w0 = req->recv_msglen;
 	args[3].u32w1 = tok != NULL ? 1 : 0;
-	args[4].u64w0 = 0;
+	args[4].u64w0 = err;
 
 	if (tok != NULL) {
 		psmi_am_reqq_add(AMREQUEST_SHORT, tok->ptl,
@@ -140,7 +200,8 @@ psmi_am_mq_handler(void *toki, psm2_amarg_t *args, int narg, void *buf,
 	case MQ_MSG_EAGER:
 		rc = psmi_mq_handle_envelope(tok->mq, tok->tok.epaddr_from,
 					     &tag, msglen, 0, buf,
-					     (uint32_t) len, 1, opcode, &req);
+					     (uint32_t) len, 1, opcode, &req,
+					     NULL);
 
 		/* for eager matching */
 		req->ptl_req_ptr = (void *)tok->tok.epaddr_from;
@@ -202,6 +263,10 @@ psmi_am_mq_handler_rtsmatch(void *toki, psm2_amarg_t *args, int narg, void *buf,
 		  sreq, (void *)(uintptr_t) args[1].u64w0, sreq->buf, dest,
 		  msglen);
 
+	/* The receiver could not take the data */
+	if_pf (args[4].u64w0 != PSM2_OK)
+		sreq->error_code = (psm2_error_t) args[4].u64w0;
+
 	if (msglen > 0) {
 		rarg[0].u64w0 = args[1].u64w0;	/* rreq */
 		int kassist_mode = ptl->psmi_kassist_mode;
@@ -233,6 +298,12 @@ psmi_am_mq_handler_rtsdone(void *toki, psm2_amarg_t *args, int narg, void *buf,
 	psmi_assert(narg == 1);
 	_HFI_VDBG("[rndv][recv] req=%p dest=%p len=%d\n", rreq, rreq->buf,
 		  rreq->recv_msglen);
+	if_pf (rreq->stride != NULL && rreq->stride->bounce != NULL) {
+		psmi_mq_stride_scatter(rreq->stride, rreq->buf, 0,
+				       rreq->stride->bounce, rreq->recv_msglen);
+		psmi_sysbuf_free(rreq->stride->bounce);
+		rreq->stride->bounce = NULL;
+	}
 	psmi_mq_handle_rts_complete(rreq);
 }
 
@@ -252,3 +323,66 @@ psmi_am_handler(void *toki, psm2_amarg_t *args, int narg, void *buf, size_t len)
 
 	return;
 }
+
+void
+psmi_am_long_handler(void *toki, psm2_amarg_t *args, int narg, void *buf,
+		     size_t len)
+{
+	amsh_am_token_t *tok = (amsh_am_token_t *) toki;
+	struct amsh_am_long_desc desc;
+	psm2_am_handler_fn_t hfn;
+
+	psmi_assert(toki != NULL);
+	psmi_assert(len == sizeof(desc));
+
+	/* buf may be a bulk packet we have to give back before replying */
+	memcpy(&desc, buf, sizeof(desc));
+
+	/* A rejected destination gets none of the payload, bulk packets
+	 * were already dropped as they came in */
+	if (!psmi_am_long_dest_ok(tok->mq->ep, (psm2_handler_t) args[0].u32w0,
+				  args + 1, narg - 1,
+				  (void *)(uintptr_t) desc.dest, desc.len))
+		desc.len = 0;
+	else if (desc.src != 0) {
+		int pid = psmi_epaddr_pid(tok->tok.epaddr_from);
+		size_t nbytes = cma_get(pid, (void *)(uintptr_t) desc.src,
+					(void *)(uintptr_t) desc.dest,
+					desc.len);
+		psmi_assert_always(nbytes == desc.len);
+	}
+
+	hfn = psm_am_get_handler_function(tok->mq->ep,
+					  (psm2_handler_t) args[0].u32w0);
+	hfn(toki, args + 1, narg - 1, (void *)(uintptr_t) desc.dest,
+	    desc.len);
+
+	if (desc.completion_fn != 0) {
+		psm2_amarg_t rarg[2];
+
+		rarg[0].u64w0 = desc.completion_fn;
+		rarg[1].u64w0 = desc.completion_ctxt;
+		psmi_amsh_short_reply(tok, am_long_done_hidx, rarg, 2,
+				      NULL, 0, 0);
+	}
+}
+
+void
+psmi_am_long_handler_data(void *toki, psm2_amarg_t *args, int narg,
+			  void *buf, size_t len)
+{
+	/* The payload has already been copied to its destination, the
+	 * request that follows it runs the handler */
+	return;
+}
+
+void
+psmi_am_long_handler_done(void *toki, psm2_amarg_t *args, int narg,
+			  void *buf, size_t len)
+{
+	psm2_am_completion_fn_t completion_fn =
+	    (psm2_am_completion_fn_t) (uintptr_t) args[0].u64w0;
+
+	psmi_assert(narg == 2);
+	completion_fn((void *)(uintptr_t) args[1].u64w0);
+}
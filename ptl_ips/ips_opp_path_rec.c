@@ -75,13 +75,11 @@ ips_opp_get_path_rec(ips_path_type_t type, struct ips_proto *proto,
 #endif
 	ips_path_rec_t *path_rec;
 	int opp_err;
-	ENTRY elid, *epath = NULL;
-	char eplid[128];
+	uint64_t key;
 	uint64_t timeout_ack_ms;
 
 	/* Query path record query cache first */
 	bzero(&query, sizeof(query));
-	bzero(eplid, sizeof(eplid));
 
 	/* Bulk service ID is control service id + 1 */
 	switch (type) {
@@ -98,23 +96,17 @@ ips_opp_get_path_rec(ips_path_type_t type, struct ips_proto *proto,
 	query.slid = slid;
 	query.dlid = dlid;
 
-	snprintf(eplid, sizeof(eplid), "%s_%x_%x",
-		 (type == IPS_PATH_LOW_PRIORITY) ? "LOW" : "HIGH",
-		 query.slid, query.dlid);
-	elid.key = eplid;
-	hsearch_r(elid, FIND, &epath, &proto->ips_path_rec_hash);
+	/* Low priority paths are queried on the bulk data service id */
+	key = IPS_PATH_KEY(query.slid, query.dlid,
+			   type == IPS_PATH_LOW_PRIORITY);
+	path_rec = (ips_path_rec_t *)
+	    ips_path_map_find(&proto->ips_path_rec_hash, key);
 
-	if (!epath) {		/* Unable to find path record in cache */
-		elid.key =
-		    psmi_calloc(proto->ep, UNDEFINED, 1, strlen(eplid) + 1);
+	if (!path_rec) {	/* Unable to find path record in cache */
 		path_rec = (ips_path_rec_t *)
 		    psmi_calloc(proto->ep, UNDEFINED, 1,
 				sizeof(ips_path_rec_t));
-		if (!elid.key || !path_rec) {
-			if (elid.key)
-				psmi_free(elid.key);
-			if (path_rec)
-				psmi_free(path_rec);
+		if (!path_rec) {
 			err = PSM2_NO_MEMORY;
 			goto fail;
 		}
@@ -126,7 +118,6 @@ ips_opp_get_path_rec(ips_path_type_t type, struct ips_proto *proto,
 							  &opp_response);
 		if (opp_err) {
 			psmi_free(path_rec);
-			psmi_free(elid.key);
 			err = PSM2_EPID_PATH_RESOLUTION;
 			goto fail;
 		}
@@ -147,7 +138,6 @@ ips_opp_get_path_rec(ips_path_type_t type, struct ips_proto *proto,
 		/* Setup CCA parameters for path */
 		if (path_rec->pr_sl > PSMI_SL_MAX) {
 			psmi_free(path_rec);
-			psmi_free(elid.key);
 			err = PSM2_INTERNAL_ERR;
 			goto fail;
 		}
@@ -196,11 +186,13 @@ ips_opp_get_path_rec(ips_path_type_t type, struct ips_proto *proto,
 			proto->epinfo.ep_timeout_ack_max = timeout_ack_ms;
 
 		/* Add path record into cache */
-		strcpy(elid.key, eplid);
-		elid.data = (void *)path_rec;
-		hsearch_r(elid, ENTER, &epath, &proto->ips_path_rec_hash);
-	} else			/* Path record found in cache */
-		path_rec = (ips_path_rec_t *) epath->data;
+		err = ips_path_map_insert(proto->ep, &proto->ips_path_rec_hash,
+					  key, path_rec);
+		if (err != PSM2_OK) {
+			psmi_free(path_rec);
+			goto fail;
+		}
+	}
 
 #ifdef _HFI_DEBUGGING
 	/* Dump path record stats */
@@ -238,8 +230,7 @@ ips_opp_path_rec(struct ips_proto *proto,
 	ips_path_rec_t *path;
 	ips_path_grp_t *pathgrp;
 	uint16_t path_slid, path_dlid;
-	ENTRY elid, *epath = NULL;
-	char eplid[128];
+	uint64_t key = IPS_PATH_KEY(slid, dlid, 0);
 
 	/*
 	 * High Priority Path
@@ -307,12 +298,11 @@ ips_opp_path_rec(struct ips_proto *proto,
 	 */
 
 	/* Check if this path grp is already in hash table */
-	snprintf(eplid, sizeof(eplid), "%x_%x", slid, dlid);
-	elid.key = eplid;
-	hsearch_r(elid, FIND, &epath, &proto->ips_path_grp_hash);
+	pathgrp = (ips_path_grp_t *)
+	    ips_path_map_find(&proto->ips_path_grp_hash, key);
 
-	if (epath) {		/* Find path group in cache */
-		*ppathgrp = (ips_path_grp_t *) epath->data;
+	if (pathgrp) {		/* Find path group in cache */
+		*ppathgrp = pathgrp;
 		return err;
 	}
 
@@ -321,16 +311,11 @@ ips_opp_path_rec(struct ips_proto *proto,
 		num_path = 1;
 
 	/* Allocate a new pathgroup */
-	elid.key = psmi_calloc(proto->ep, UNDEFINED, 1, strlen(eplid) + 1);
 	pathgrp = (ips_path_grp_t *)
 	    psmi_calloc(proto->ep, UNDEFINED, 1, sizeof(ips_path_grp_t) +
 			num_path * IPS_PATH_MAX_PRIORITY *
 			sizeof(ips_path_rec_t *));
-	if (!elid.key || !pathgrp) {
-		if (elid.key)
-			psmi_free(elid.key);
-		if (pathgrp)
-			psmi_free(pathgrp);
+	if (!pathgrp) {
 		err = PSM2_NO_MEMORY;
 		goto fail;
 	}
@@ -363,7 +348,6 @@ ips_opp_path_rec(struct ips_proto *proto,
 
 	/* Make sure we have atleast 1 high priority path */
 	if (pathgrp->pg_num_paths[IPS_PATH_HIGH_PRIORITY] == 0) {
-		psmi_free(elid.key);
 		psmi_free(pathgrp);
 		err = psmi_handle_error(NULL, PSM2_EPID_PATH_RESOLUTION,
 					"OFEF Plus path lookup failed. Unable to resolve high priority network path for LID 0x%x <---> 0x%x. Is the SM running or service ID %"
@@ -411,7 +395,6 @@ retry_normal_path_res:
 
 	/* Make sure we have atleast have a single bulk data transfer path */
 	if (pathgrp->pg_num_paths[IPS_PATH_NORMAL_PRIORITY] == 0) {
-		psmi_free(elid.key);
 		psmi_free(pathgrp);
 		err = psmi_handle_error(NULL, PSM2_EPID_PATH_RESOLUTION,
 					"OFED Plus path lookup failed. Unable to resolve normal priority network path for LID 0x%x <---> 0x%x. Is the SM running or service ID %"
@@ -454,7 +437,6 @@ retry_low_path_res:
 
 	/* Make sure we have atleast have a single bulk data transfer path */
 	if (pathgrp->pg_num_paths[IPS_PATH_LOW_PRIORITY] == 0) {
-		psmi_free(elid.key);
 		psmi_free(pathgrp);
 		err = psmi_handle_error(NULL, PSM2_EPID_PATH_RESOLUTION,
 					"OFED Plus path lookup failed. Unable to resolve low priority network path for LID 0x%x <---> 0x%x. Is the SM running or service ID %"
@@ -474,9 +456,12 @@ retry_low_path_res:
 	}
 
 	/* Add path group into cache */
-	strcpy(elid.key, eplid);
-	elid.data = (void *)pathgrp;
-	hsearch_r(elid, ENTER, &epath, &proto->ips_path_grp_hash);
+	err = ips_path_map_insert(proto->ep, &proto->ips_path_grp_hash,
+				  key, pathgrp);
+	if (err != PSM2_OK) {
+		psmi_free(pathgrp);
+		goto fail;
+	}
 
 	*ppathgrp = pathgrp;
 
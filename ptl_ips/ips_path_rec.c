@@ -254,6 +254,98 @@ static opa_rate ips_rate_to_enum(int link_rate)
 	return rate;
 }
 
+#define IPS_PATH_MAP_LOAD_NUM	3
+#define IPS_PATH_MAP_LOAD_DEN	4
+
+PSMI_ALWAYS_INLINE(
+uint32_t
+ips_path_map_home(const struct ips_path_map *map, uint64_t key))
+{
+	/* Fibonacci hashing spreads the dense LID ranges of a fabric */
+	return (uint32_t) ((key * 0x9e3779b97f4a7c15ULL) >> 32) &
+	    (map->size - 1);
+}
+
+void ips_path_map_init(struct ips_path_map *map)
+{
+	map->ent = NULL;
+	map->size = 0;
+	map->used = 0;
+}
+
+void ips_path_map_fini(struct ips_path_map *map)
+{
+	if (map->ent)
+		psmi_free(map->ent);
+	ips_path_map_init(map);
+}
+
+static int64_t
+ips_path_map_slot(const struct ips_path_map *map, uint64_t key)
+{
+	uint32_t mask = map->size - 1;
+	uint32_t idx;
+
+	if (map->size == 0)
+		return -1;
+	for (idx = ips_path_map_home(map, key); map->ent[idx].data;
+	     idx = (idx + 1) & mask)
+		if (map->ent[idx].key == key)
+			return idx;
+	return -1;
+}
+
+void *ips_path_map_find(const struct ips_path_map *map, uint64_t key)
+{
+	int64_t idx = ips_path_map_slot(map, key);
+
+	return idx < 0 ? NULL : map->ent[idx].data;
+}
+
+static void
+ips_path_map_place(struct ips_path_map *map, uint64_t key, void *data)
+{
+	uint32_t mask = map->size - 1;
+	uint32_t idx = ips_path_map_home(map, key);
+
+	while (map->ent[idx].data)
+		idx = (idx + 1) & mask;
+	map->ent[idx].key = key;
+	map->ent[idx].data = data;
+}
+
+psm2_error_t
+ips_path_map_insert(psm2_ep_t ep, struct ips_path_map *map,
+		    uint64_t key, void *data)
+{
+	struct ips_path_map old = *map;
+	uint32_t i;
+
+	psmi_assert(data != NULL);
+	psmi_assert(ips_path_map_find(map, key) == NULL);
+
+	if ((uint64_t) (map->used + 1) * IPS_PATH_MAP_LOAD_DEN >
+	    (uint64_t) map->size * IPS_PATH_MAP_LOAD_NUM) {
+		map->size = old.size ? old.size * 2 : IPS_PATH_MAP_SIZE_MIN;
+		map->ent = (struct ips_path_map_entry *)
+		    psmi_calloc(ep, UNDEFINED, map->size,
+				sizeof(struct ips_path_map_entry));
+		if (map->ent == NULL) {
+			*map = old;
+			return PSM2_NO_MEMORY;
+		}
+		for (i = 0; i < old.size; i++)
+			if (old.ent[i].data)
+				ips_path_map_place(map, old.ent[i].key,
+						   old.ent[i].data);
+		if (old.ent)
+			psmi_free(old.ent);
+	}
+	ips_path_map_place(map, key, data);
+	map->used++;
+	return PSM2_OK;
+}
+
 static psm2_error_t
 ips_none_get_path_rec(struct ips_proto *proto,
 		      uint16_t slid, uint16_t dlid, uint16_t desthfi_type,
@@ -261,27 +353,18 @@ ips_none_get_path_rec(struct ips_proto *proto,
 {
 	psm2_error_t err = PSM2_OK;
 	ips_path_rec_t *path_rec;
-	ENTRY elid, *epath = NULL;
-	char eplid[128];
+	uint64_t key = IPS_PATH_KEY(slid, dlid, 0);
 
 	/* Query the path record cache */
-	snprintf(eplid, sizeof(eplid), "%x_%x", slid, dlid);
-	elid.key = eplid;
-	hsearch_r(elid, FIND, &epath, &proto->ips_path_rec_hash);
+	path_rec = (ips_path_rec_t *)
+	    ips_path_map_find(&proto->ips_path_rec_hash, key);
 
-	if (!epath) {
-		elid.key =
-		    psmi_calloc(proto->ep, UNDEFINED, 1, strlen(eplid) + 1);
+	if (!path_rec) {
 		path_rec = (ips_path_rec_t *)
 		    psmi_calloc(proto->ep, UNDEFINED, 1,
 				sizeof(ips_path_rec_t));
-		if (!elid.key || !path_rec) {
-			if (elid.key)
-				psmi_free(elid.key);
-			if (path_rec)
-				psmi_free(path_rec);
+		if (!path_rec)
 			return PSM2_NO_MEMORY;
-		}
 
 		/* Create path record */
 		path_rec->pr_slid = slid;
@@ -298,7 +381,6 @@ ips_none_get_path_rec(struct ips_proto *proto,
 
 		/* Setup CCA parameters for path */
 		if (path_rec->pr_sl > PSMI_SL_MAX) {
-			psmi_free(elid.key);
 			psmi_free(path_rec);
 			return PSM2_INTERNAL_ERR;
 		}
@@ -337,11 +419,13 @@ ips_none_get_path_rec(struct ips_proto *proto,
 		}
 
 		/* Add path record into cache */
-		strcpy(elid.key, eplid);
-		elid.data = (void *)path_rec;
-		hsearch_r(elid, ENTER, &epath, &proto->ips_path_rec_hash);
-	} else
-		path_rec = (ips_path_rec_t *) epath->data;
+		err = ips_path_map_insert(proto->ep, &proto->ips_path_rec_hash,
+					  key, path_rec);
+		if (err != PSM2_OK) {
+			psmi_free(path_rec);
+			return err;
+		}
+	}
 
 	/* Return IPS path record */
 	*ppath_rec = path_rec;
@@ -359,8 +443,7 @@ ips_none_path_rec(struct ips_proto *proto,
 	uint16_t base_slid, base_dlid;
 	ips_path_rec_t *path;
 	ips_path_grp_t *pathgrp;
-	ENTRY elid, *epath = NULL;
-	char eplid[128];
+	uint64_t key = IPS_PATH_KEY(slid, dlid, 0);
 
 	/* For the "none" path record resolution all paths are assumed to be of equal
 	 * priority however since we want to isolate all control traffic (acks, naks)
@@ -370,12 +453,11 @@ ips_none_path_rec(struct ips_proto *proto,
 	 */
 
 	/* Query the path record cache */
-	snprintf(eplid, sizeof(eplid), "%x_%x", slid, dlid);
-	elid.key = eplid;
-	hsearch_r(elid, FIND, &epath, &proto->ips_path_grp_hash);
+	pathgrp = (ips_path_grp_t *)
+	    ips_path_map_find(&proto->ips_path_grp_hash, key);
 
-	if (epath) {		/* Find path group in cache */
-		*ppathgrp = (ips_path_grp_t *) epath->data;
+	if (pathgrp) {		/* Find path group in cache */
+		*ppathgrp = pathgrp;
 		return err;
 	}
 
@@ -384,16 +466,11 @@ ips_none_path_rec(struct ips_proto *proto,
 		num_path = 1;
 
 	/* Allocate a new pathgroup */
-	elid.key = psmi_calloc(proto->ep, UNDEFINED, 1, strlen(eplid) + 1);
 	pathgrp = (ips_path_grp_t *)
 	    psmi_calloc(proto->ep, UNDEFINED, 1, sizeof(ips_path_grp_t) +
 			num_path * IPS_PATH_MAX_PRIORITY *
 			sizeof(ips_path_rec_t *));
-	if (!elid.key || !pathgrp) {
-		if (elid.key)
-			psmi_free(elid.key);
-		if (pathgrp)
-			psmi_free(pathgrp);
+	if (!pathgrp) {
 		err = PSM2_NO_MEMORY;
 		goto fail;
 	}
@@ -424,7 +501,6 @@ ips_none_path_rec(struct ips_proto *proto,
 		    ips_none_get_path_rec(proto, base_slid, base_dlid,
 					  desthfi_type, timeout, &path);
 		if (err != PSM2_OK) {
-			psmi_free(elid.key);
 			psmi_free(pathgrp);
 			goto fail;
 		}
@@ -459,9 +535,12 @@ ips_none_path_rec(struct ips_proto *proto,
 	}
 
 	/* Add path record into cache */
-	strcpy(elid.key, eplid);
-	elid.data = (void *)pathgrp;
-	hsearch_r(elid, ENTER, &epath, &proto->ips_path_grp_hash);
+	err = ips_path_map_insert(proto->ep, &proto->ips_path_grp_hash,
+				  key, pathgrp);
+	if (err != PSM2_OK) {
+		psmi_free(pathgrp);
+		goto fail;
+	}
 
 	*ppathgrp = pathgrp;
 
@@ -723,8 +802,8 @@ finishcca:
 	srand(getpid());
 
 	/* Initialize path record/group hash table */
-	hcreate_r(DF_PATH_REC_HASH_SIZE, &proto->ips_path_rec_hash);
-	hcreate_r(DF_PATH_GRP_HASH_SIZE, &proto->ips_path_grp_hash);
+	ips_path_map_init(&proto->ips_path_rec_hash);
+	ips_path_map_init(&proto->ips_path_grp_hash);
 
 	/* On startup treat it as a link up/down event to setup state . */
 	if ((err = ips_ibta_link_updown_event(proto)) != PSM2_OK)
@@ -756,13 +835,30 @@ fail:
 psm2_error_t ips_ibta_fini(struct ips_proto *proto)
 {
 	psm2_error_t err = PSM2_OK;
+	uint32_t i;
 
 	if (proto->ibta.fini)
 		err = proto->ibta.fini(proto);
 
-	/* Destroy the path record/group hash */
-	hdestroy_r(&proto->ips_path_rec_hash);
-	hdestroy_r(&proto->ips_path_grp_hash);
+	/* Destroy the path record/group hash, groups only point at records */
+	for (i = 0; i < proto->ips_path_grp_hash.size; i++)
+		if (proto->ips_path_grp_hash.ent[i].data)
+			psmi_free(proto->ips_path_grp_hash.ent[i].data);
+	ips_path_map_fini(&proto->ips_path_grp_hash);
+
+	for (i = 0; i < proto->ips_path_rec_hash.size; i++) {
+		ips_path_rec_t *path_rec = (ips_path_rec_t *)
+		    proto->ips_path_rec_hash.ent[i].data;
+		if (path_rec == NULL)
+			continue;
+		if (path_rec->pr_timer_cca) {
+			psmi_timer_cancel(proto->timerq,
+					  path_rec->pr_timer_cca);
+			psmi_mpool_put(path_rec->pr_timer_cca);
+		}
+		psmi_free(path_rec);
+	}
+	ips_path_map_fini(&proto->ips_path_rec_hash);
 
 	return err;
 }
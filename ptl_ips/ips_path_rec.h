@@ -57,13 +57,8 @@
 #ifndef _IPS_PATH_REC_H_
 #define _IPS_PATH_REC_H_
 
-#include <search.h>
-
-/* Default size of path record hash table */
-#define DF_PATH_REC_HASH_SIZE 2047
-
-/* Default size of path group hash table */
-#define DF_PATH_GRP_HASH_SIZE 255
+/* Initial size of the path record/group maps, they double at 3/4 load */
+#define IPS_PATH_MAP_SIZE_MIN 64
 
 /* Default size of CCT table. Must be multiple of 64 */
 #define DF_CCT_TABLE_SIZE 128
@@ -180,6 +175,31 @@ typedef struct ips_path_rec {
 	struct ips_proto *proto;	/* for global info */
 } ips_path_rec_t;
 
+/*
+ * Path records and path groups are cached in open addressed maps keyed by
+ * the (net order) SLID/DLID pair and, for records, the query class: OPP
+ * resolves the low priority paths against the bulk data service id.
+ */
+#define IPS_PATH_KEY(slid, dlid, cls)					\
+	(((uint64_t)(cls) << 32) | ((uint64_t)(dlid) << 16) | (uint64_t)(slid))
+
+struct ips_path_map_entry {
+	uint64_t key;
+	void *data;		/* NULL for an empty slot */
+};
+
+struct ips_path_map {
+	struct ips_path_map_entry *ent;
+	uint32_t size;		/* power of 2, 0 until the first insert */
+	uint32_t used;
+};
+
+void ips_path_map_init(struct ips_path_map *map);
+void ips_path_map_fini(struct ips_path_map *map);
+void *ips_path_map_find(const struct ips_path_map *map, uint64_t key);
+psm2_error_t ips_path_map_insert(psm2_ep_t ep, struct ips_path_map *map,
+				 uint64_t key, void *data);
+
 psm2_error_t ips_opp_init(struct ips_proto *proto);
 
 #endif
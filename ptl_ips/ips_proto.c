@@ -237,6 +237,21 @@ ips_proto_init(const psmi_context_t *context, const ptl_t *ptl,
 			proto->flags |= IPS_PROTO_FLAG_COALESCE_ACKS;
 	}
 
+	{
+		/* Rail selection policy when PSM2_MULTIRAIL is enabled */
+		union psmi_envvar_val env_rail_policy;
+
+		psmi_getenv("PSM2_MULTIRAIL_POLICY",
+			    "Policy to pick the rail for each message if multiple rails are used. Options are adaptive, round_robin. Default is adaptive.",
+			    PSMI_ENVVAR_LEVEL_USER, PSMI_ENVVAR_TYPE_STR,
+			    (union psmi_envvar_val)"adaptive", &env_rail_policy);
+
+		if (!strcasecmp((const char *)env_rail_policy.e_str, "adaptive"))
+			proto->flags |= IPS_PROTO_FLAG_RAIL_ADAPTIVE;
+		proto->rail_stall_window =
+		    us_2_cycles(IPS_RAIL_STALL_WINDOW_US);
+	}
+
 	{
 		/* Number of credits per flow */
 		union psmi_envvar_val env_flow_credits;
@@ -347,6 +362,11 @@ ips_proto_init(const psmi_context_t *context, const ptl_t *ptl,
 					   &proto->stats.hdr_overflow),
 			PSMI_STATS_DECLU64("rcveager overflows",
 					   &proto->stats.egr_overflow),
+			PSMI_STATS_DECLU64("rcveager held msgs",
+					   &proto->stats.egr_hold_msgs),
+			/* Held too long or eager queue filling up */
+			PSMI_STATS_DECLU64("rcveager held reclaims",
+					   &proto->stats.egr_hold_reclaims),
 			PSMI_STATS_DECLU64("lid zero errs (**)",	/* shouldn't happen */
 					   &proto->stats.lid_zero_errs),
 			PSMI_STATS_DECLU64("unknown packets (**)",	/* shouldn't happen */
@@ -886,7 +906,12 @@ ips_proto_timer_ctrlq_callback(struct psmi_timer *timer, uint64_t t_cyc_expire)
 		}
 
 		if (err == PSM2_OK) {
-			ips_proto_epaddr_stats_set(proto, cqe->message_type);
+			ips_proto_trace_pkt(proto, PSMI_TRACE_IPS_TX,
+					    cqe->msg_scb.flow->ipsaddr,
+					    &cqe->msg_scb.ips_lrh, 0);
+			ips_proto_epaddr_stats_set(proto,
+						   cqe->msg_scb.flow->ipsaddr,
+						   cqe->message_type);
 			*cqe->msg_queue_mask &=
 			    ~message_type2index(proto, cqe->message_type);
 			cqe->msg_queue_mask = NULL;
@@ -899,6 +924,9 @@ ips_proto_timer_ctrlq_callback(struct psmi_timer *timer, uint64_t t_cyc_expire)
 				proto->stats.writev_busy_cnt++;
 			else
 				proto->stats.pio_busy_cnt++;
+			psmi_telemetry_count((psm2_epaddr_t)
+					     cqe->msg_scb.flow->ipsaddr,
+					     PSMI_TELEMETRY_SEND_STALLS, 1);
 			/* re-request a timer expiration */
 			psmi_timer_request(proto->timerq, &ctrlq->ctrlq_timer,
 					   PSMI_TIMER_PRIO_0);
@@ -970,8 +998,11 @@ ips_proto_send_ctrl_message(struct ips_flow *flow, uint8_t message_type,
 		break;
 	}
 
-	if (err == PSM2_OK)
-		ips_proto_epaddr_stats_set(proto, message_type);
+	if (err == PSM2_OK) {
+		ips_proto_trace_pkt(proto, PSMI_TRACE_IPS_TX, ipsaddr,
+				    &ctrlscb->ips_lrh, paylen);
+		ips_proto_epaddr_stats_set(proto, ipsaddr, message_type);
+	}
 
 	_HFI_VDBG("transfer_frame of opcode=0x%x,remote_lid=%d,"
 		  "src=%p,len=%d returns %d\n",
@@ -984,6 +1015,8 @@ ips_proto_send_ctrl_message(struct ips_flow *flow, uint8_t message_type,
 		proto->stats.writev_busy_cnt++;
 	else
 		proto->stats.pio_busy_cnt++;
+	psmi_telemetry_count((psm2_epaddr_t) ipsaddr,
+			     PSMI_TELEMETRY_SEND_STALLS, 1);
 
 	if (proto->ctrl_msg_queue_enqueue & proto->
 	    message_type_to_index[message_type]) {
@@ -1026,6 +1059,11 @@ void ips_proto_flow_enqueue(struct ips_flow *flow, ips_scb_t *scb)
 	ips_epaddr_t *ipsaddr = flow->ipsaddr;
 	struct ips_proto *proto = ((psm2_epaddr_t) ipsaddr)->proto;
 
+	/* A new message on an idle flow may switch to a less congested path */
+	if (flow->protocol == PSM_PROTOCOL_GO_BACK_N &&
+	    STAILQ_EMPTY(&flow->scb_unacked))
+		ips_flow_select_path(proto, flow);
+
 	ips_scb_prepare_flow_inner(proto, ipsaddr, flow, scb);
 	if ((proto->flags & IPS_PROTO_FLAG_CKSUM) &&
 	    (scb->tidctrl == 0) && (scb->nfrag == 1)) {
@@ -1034,10 +1072,12 @@ void ips_proto_flow_enqueue(struct ips_flow *flow, ips_scb_t *scb)
 			     scb->payload, scb->payload_size, &scb->cksum[0]);
 	}
 
-	/* If this is the first scb on flow, pull in both timers. */
+	/* If this is the first scb on flow, pull in both timers.  Go-back-n
+	 * flows retransmit on their peer's timer. */
 	if (flow->timer_ack == NULL) {
 		psmi_assert(flow->timer_send == NULL);
-		flow->timer_ack = scb->timer_ack;
+		flow->timer_ack = flow->protocol == PSM_PROTOCOL_GO_BACK_N ?
+		    &ipsaddr->timer_ack : scb->timer_ack;
 		flow->timer_send = scb->timer_send;
 	}
 	psmi_assert(flow->timer_ack != NULL);
@@ -1050,6 +1090,8 @@ void ips_proto_flow_enqueue(struct ips_flow *flow, ips_scb_t *scb)
 
 	/* Insert scb into flow's unacked queue */
 	STAILQ_INSERT_TAIL(&flow->scb_unacked, scb, nextq);
+	proto->inflight_bytes += scb->nfrag > 1 ?
+	    scb->chunk_size : scb->payload_size;
 
 #ifdef PSM_DEBUG
 	/* update scb counters in flow. */
@@ -1101,12 +1143,15 @@ ips_proto_flow_flush_pio(struct ips_flow *flow, int *nflushed)
 						   flags &
 						   IPS_SEND_FLAG_PKTCKSUM,
 						   scb->cksum[0])) == PSM2_OK) {
+			ips_proto_trace_pkt(proto, PSMI_TRACE_IPS_TX,
+					    flow->ipsaddr, &scb->ips_lrh,
+					    scb->payload_size);
 			t_cyc = get_cycles();
 			scb->flags &= ~IPS_SEND_FLAG_PENDING;
 			scb->ack_timeout = proto->epinfo.ep_timeout_ack;
 			scb->abs_timeout = proto->epinfo.ep_timeout_ack + t_cyc;
-			psmi_timer_request(proto->timerq, flow->timer_ack,
-					   scb->abs_timeout);
+			ips_flow_timer_ack_request(proto, flow,
+						   scb->abs_timeout);
 			num_sent++;
 			flow->credits--;
 			SLIST_REMOVE_HEAD(scb_pend, next);
@@ -1121,6 +1166,8 @@ ips_proto_flow_flush_pio(struct ips_flow *flow, int *nflushed)
 	/* If out of flow credits re-schedule send timer */
 	if (!SLIST_EMPTY(scb_pend)) {
 		proto->stats.pio_busy_cnt++;
+		psmi_telemetry_count((psm2_epaddr_t) flow->ipsaddr,
+				     PSMI_TELEMETRY_SEND_STALLS, 1);
 		psmi_timer_request(proto->timerq, flow->timer_send,
 				   get_cycles() + proto->timeout_send);
 	}
@@ -1191,6 +1238,11 @@ ips_proto_flow_flush_dma(struct ips_flow *flow, int *nflushed)
 		SLIST_FOREACH(scb, scb_pend, next) {
 			if (++i > nsent)
 				break;
+			ips_proto_trace_pkt(proto, PSMI_TRACE_IPS_TX,
+					    flow->ipsaddr, &scb->ips_lrh,
+					    scb->nfrag > 1 ?
+					    scb->chunk_size_remaining :
+					    scb->payload_size);
 			scb->flags &= ~IPS_SEND_FLAG_PENDING;
 			scb->ack_timeout =
 			    scb->nfrag * proto->epinfo.ep_timeout_ack;
@@ -1239,13 +1291,16 @@ ips_proto_flow_flush_dma(struct ips_flow *flow, int *nflushed)
 						   get_cycles() +
 						   (proto->timeout_send << 1));
 				proto->stats.writev_busy_cnt++;
+				psmi_telemetry_count((psm2_epaddr_t)
+						     flow->ipsaddr,
+						     PSMI_TELEMETRY_SEND_STALLS,
+						     1);
 			} else {
 				/* Re-instate ACK timer to reap flow credits */
-				psmi_timer_request(proto->timerq,
-						   flow->timer_ack,
-						   get_cycles() +
-						   (proto->epinfo.
-						    ep_timeout_ack >> 2));
+				ips_flow_timer_ack_request(proto, flow,
+							   get_cycles() +
+							   (proto->epinfo.
+							    ep_timeout_ack >> 2));
 			}
 
 			break;
@@ -1258,21 +1313,25 @@ ips_proto_flow_flush_dma(struct ips_flow *flow, int *nflushed)
 						   get_cycles() +
 						   (proto->timeout_send << 1));
 				proto->stats.writev_busy_cnt++;
+				psmi_telemetry_count((psm2_epaddr_t)
+						     flow->ipsaddr,
+						     PSMI_TELEMETRY_SEND_STALLS,
+						     1);
 			} else {
 				/* Schedule ACK timer to reap flow credits */
-				psmi_timer_request(proto->timerq,
-						   flow->timer_ack,
-						   get_cycles() +
-						   (proto->epinfo.
-						    ep_timeout_ack >> 2));
+				ips_flow_timer_ack_request(proto, flow,
+							   get_cycles() +
+							   (proto->epinfo.
+							    ep_timeout_ack >> 2));
 			}
 			break;
 		}
 	} else {
 		/* Schedule ack timer */
 		psmi_timer_cancel(proto->timerq, flow->timer_send);
-		psmi_timer_request(proto->timerq, flow->timer_ack,
-				   get_cycles() + proto->epinfo.ep_timeout_ack);
+		ips_flow_timer_ack_request(proto, flow,
+					   get_cycles() +
+					   proto->epinfo.ep_timeout_ack);
 	}
 
 	/* We overwrite error with its new meaning for flushing packets */
@@ -1840,20 +1899,19 @@ ips_proto_dma_wait_until(struct ips_proto *proto, ips_scb_t *scb)
 	return err;
 }
 
-psm2_error_t
-ips_proto_timer_ack_callback(struct psmi_timer *current_timer,
-			     uint64_t current)
+/*
+ * Send an error check if the oldest unacked packet of a flow timed out,
+ * returns when the flow needs checking again.
+ */
+static uint64_t
+ips_flow_timer_ack_check(struct ips_proto *proto, struct ips_flow *flow,
+			 uint64_t current)
 {
-	struct ips_flow *flow = ((ips_scb_t *)current_timer->context)->flow;
-	struct ips_proto *proto = ((psm2_epaddr_t) (flow->ipsaddr))->proto;
 	uint64_t t_cyc_next = get_cycles();
 	psmi_seqnum_t err_chk_seq;
 	ips_scb_t *scb, ctrlscb;
 	uint8_t message_type;
 
-	if (STAILQ_EMPTY(&flow->scb_unacked))
-		return PSM2_OK;
-
 	scb = STAILQ_FIRST(&flow->scb_unacked);
 
 	if (current >= scb->abs_timeout) {
@@ -1922,7 +1980,54 @@ ips_proto_timer_ack_callback(struct psmi_timer *current_timer,
 	} else
 		t_cyc_next += (scb->abs_timeout - current);
 
-	psmi_timer_request(proto->timerq, current_timer, t_cyc_next);
+	return t_cyc_next;
+}
+
+psm2_error_t
+ips_proto_timer_ack_callback(struct psmi_timer *current_timer,
+			     uint64_t current)
+{
+	struct ips_flow *flow = ((ips_scb_t *)current_timer->context)->flow;
+	struct ips_proto *proto = ((psm2_epaddr_t) (flow->ipsaddr))->proto;
+
+	if (STAILQ_EMPTY(&flow->scb_unacked))
+		return PSM2_OK;
+
+	psmi_timer_request(proto->timerq, current_timer,
+			   ips_flow_timer_ack_check(proto, flow, current));
+
+	return PSM2_OK;
+}
+
+/*
+ * One timer per peer covers its go-back-n flows, it checks those that have
+ * packets on the wire and expires again for the earliest of them.
+ */
+psm2_error_t
+ips_proto_timer_peer_ack_callback(struct psmi_timer *current_timer,
+				  uint64_t current)
+{
+	ips_epaddr_t *ipsaddr = (ips_epaddr_t *) current_timer->context;
+	struct ips_proto *proto = ((psm2_epaddr_t) ipsaddr)->proto;
+	uint64_t t_cyc_next = TIMEOUT_INFINITE;
+	struct ips_flow *flow;
+	int i;
+
+	for (i = 0; i < EP_FLOW_TIDFLOW; i++) {
+		flow = &ipsaddr->flows[i];
+		/* Flows waiting for pio or dma resources re-arm the timer
+		 * when they send again */
+		if (flow->timer_ack != current_timer ||
+		    STAILQ_EMPTY(&flow->scb_unacked) ||
+		    (STAILQ_FIRST(&flow->scb_unacked)->flags &
+		     IPS_SEND_FLAG_PENDING))
+			continue;
+		t_cyc_next = min(t_cyc_next,
+				 ips_flow_timer_ack_check(proto, flow, current));
+	}
+
+	if (t_cyc_next != TIMEOUT_INFINITE)
+		psmi_timer_request(proto->timerq, current_timer, t_cyc_next);
 
 	return PSM2_OK;
 }
@@ -1943,10 +2048,13 @@ ips_proto_timer_send_callback(struct psmi_timer *current_timer,
 		flow->flags &= ~IPS_FLOW_FLAG_CONGESTED;
 		if ((flow->path->pr_ccti +
 		     proto->cace[flow->path->pr_sl].ccti_increase) <=
-		    proto->ccti_limit)
+		    proto->ccti_limit) {
 			ips_cca_adjust_rate(flow->path,
 					    proto->cace[flow->path->pr_sl].
 					    ccti_increase);
+			psmi_telemetry_count((psm2_epaddr_t) flow->ipsaddr,
+					     PSMI_TELEMETRY_CCA_CHANGES, 1);
+		}
 	}
 
 	if (!SLIST_EMPTY(&flow->scb_pend))
@@ -205,6 +205,8 @@ struct ips_proto_stats {
 	uint64_t scb_exp_unavail_cnt;
 	uint64_t hdr_overflow;
 	uint64_t egr_overflow;
+	uint64_t egr_hold_msgs;
+	uint64_t egr_hold_reclaims;
 	uint64_t lid_zero_errs;
 	uint64_t unknown_packets;
 	uint64_t stray_packets;
@@ -304,6 +306,9 @@ struct ips_proto {
 	uint32_t psn_mask;
 	uint32_t scb_bufsize;
 	uint16_t flow_credits;
+	/* Multi-rail load tracking, see ips_select_rail() */
+	uint64_t inflight_bytes;	/* bytes queued on flows, not yet acked */
+	uint64_t rail_stall_window;	/* cycles a PIO stall weighs on the rail */
 	mpool_t pend_sends_pool;
 	mpool_t timer_pool;
 	struct ips_ibta_compliance_fn ibta;
@@ -369,8 +374,8 @@ struct ips_proto {
 
 	/* Path record support */
 	uint8_t ips_ipd_delay[IBV_RATE_300_GBPS + 1];
-	struct hsearch_data ips_path_rec_hash;
-	struct hsearch_data ips_path_grp_hash;
+	struct ips_path_map ips_path_rec_hash;
+	struct ips_path_map ips_path_grp_hash;
 	void *opp_lib;
 	void *hndl;
 	void *device;
@@ -462,6 +467,11 @@ struct ips_epaddr {
 	uint8_t  context;	/* real context value */
 	uint8_t  subcontext;	/* sub context, 3 bits, 5 bits for future */
 	uint8_t  msg_toggle;	/* only 2 bits used, 6 bits for future */
+	uint8_t  ack_piggyback;	/* peer takes one ACK for both flows */
+
+	/* Retransmission timer shared by the pio and dma flows, it checks
+	 * every flow with unacked packets when it expires */
+	struct psmi_timer timer_ack;
 
 	/* this portion is only for connect/disconnect */
 	uint64_t s_timeout;	/* used as a time in close */
@@ -576,6 +586,8 @@ uint32_t ips_crc_calculate(uint32_t len, uint8_t *data, uint32_t crc);
 /*
  * Matched-Queue processing and sends
  */
+psm2_error_t ips_proto_mq_rts_match_callback(psm2_mq_req_t req,
+					     int was_posted);
 psm2_error_t ips_proto_mq_push_cts_req(struct ips_proto *proto,
 				      psm2_mq_req_t req);
 psm2_error_t ips_proto_mq_push_rts_data(struct ips_proto *proto,
@@ -56,6 +56,7 @@
 #include "psm_user.h"
 #include "psm2_am.h"
 #include "psm_am_internal.h"
+#include "psm_mq_internal.h"
 #include "ips_proto.h"
 #include "ips_proto_internal.h"
 
@@ -87,6 +88,35 @@ static struct {
 
 static mpool_t ips_am_msg_pool;
 
+/*
+ * Long requests ride on the MQ rendezvous.  The origin parks the source
+ * buffer in an internal send request and sends the user's AM request flagged
+ * IPS_SEND_FLAG_AMLONG, with a descriptor of the transfer as payload.  The
+ * target posts an internal receive request on the destination and goes on as
+ * for a matched RTS: expected TIDs above the rendezvous threshold, LONG_DATA
+ * packets below it.  The handler runs once the data has landed, the
+ * completion once the origin's send request completes.
+ */
+struct ips_am_long_desc {
+	uint64_t dest;
+	uint32_t len;
+	uint32_t sreq_idx;
+};
+
+struct ips_am_long {
+	/* origin */
+	psm2_am_completion_fn_t completion_fn;
+	void *completion_ctxt;
+
+	/* target */
+	struct ips_epaddr *ipsaddr;
+	struct ips_proto_am *proto_am;
+	psm2_handler_t handler;
+	uint32_t can_reply;
+	int nargs;
+	psm2_amarg_t args[PSMI_AM_MAX_ARGS];
+};
+
 /* This calculation ensures that the number of reply slots will always be at
  * least twice as large + 1 as the number of request slots. This is optimal: the
  * minimum amount required is actually only twice as many, but it is much
@@ -181,6 +211,7 @@ ips_am_get_parameters(psm2_ep_t ep, struct psm2_am_parameters *parameters)
 	parameters->max_nargs = max_nargs;
 	parameters->max_request_short = max_payload;
 	parameters->max_reply_short = max_payload;
+	parameters->max_request_long = UINT32_MAX;
 
 	return PSM2_OK;
 }
@@ -304,17 +335,18 @@ ips_am_scb_init(ips_scb_t *scb, uint8_t handler, int nargs,
 	return;
 }
 
+static
 psm2_error_t
-ips_am_short_request(psm2_epaddr_t epaddr,
-		     psm2_handler_t handler, psm2_amarg_t *args, int nargs,
-		     void *src, size_t len, int flags,
-		     psm2_am_completion_fn_t completion_fn,
-		     void *completion_ctxt)
+ips_am_request(ips_epaddr_t *ipsaddr,
+	       psm2_handler_t handler, psm2_amarg_t *args, int nargs,
+	       void *src, size_t len, int flags, uint32_t send_flags,
+	       psm2_am_completion_fn_t completion_fn,
+	       void *completion_ctxt)
 {
+	psm2_epaddr_t epaddr = (psm2_epaddr_t) ipsaddr;
 	struct ips_proto_am *proto_am = &epaddr->proto->proto_am;
 	psm2_error_t err;
 	ips_scb_t *scb;
-	ips_epaddr_t *ipsaddr;
 	int pad_bytes = calculate_pad_bytes(len);
 	int payload_sz = (nargs << 3);
 
@@ -344,10 +376,7 @@ ips_am_short_request(psm2_epaddr_t epaddr,
 	psmi_assert_always(scb != NULL);
 	ips_am_scb_init(scb, handler, nargs, pad_bytes,
 			completion_fn, completion_ctxt);
-
-	/* Select the next ipsaddr for multi-rail */
-	ipsaddr = ((ips_epaddr_t *)epaddr)->msgctl->ipsaddr_next;
-	ipsaddr->msgctl->ipsaddr_next = ipsaddr->next;
+	scb->flags |= send_flags;
 
 	return am_short_reqrep(scb, ipsaddr, args,
 			       nargs,
@@ -357,10 +386,185 @@ ips_am_short_request(psm2_epaddr_t epaddr,
 }
 
 psm2_error_t
-ips_am_short_reply(psm2_am_token_t tok,
-		   psm2_handler_t handler, psm2_amarg_t *args, int nargs,
-		   void *src, size_t len, int flags,
-		   psm2_am_completion_fn_t completion_fn, void *completion_ctxt)
+ips_am_short_request(psm2_epaddr_t epaddr,
+		     psm2_handler_t handler, psm2_amarg_t *args, int nargs,
+		     void *src, size_t len, int flags,
+		     psm2_am_completion_fn_t completion_fn,
+		     void *completion_ctxt)
+{
+	/* Select the next ipsaddr for multi-rail */
+	ips_epaddr_t *ipsaddr =
+	    ips_select_rail(((ips_epaddr_t *)epaddr)->msgctl);
+
+	return ips_am_request(ipsaddr, handler, args, nargs, src, len, flags,
+			      0, completion_fn, completion_ctxt);
+}
+
+static
+void
+ips_am_long_send_complete(psm2_mq_req_t req)
+{
+	struct ips_am_long *amlong = (struct ips_am_long *)req->context;
+	psm2_am_completion_fn_t completion_fn = amlong->completion_fn;
+	void *completion_ctxt = amlong->completion_ctxt;
+
+	psmi_mq_req_free(req);
+	psmi_free(amlong);
+
+	if (completion_fn)
+		completion_fn(completion_ctxt);
+}
+
+psm2_error_t
+ips_am_long_request(psm2_epaddr_t epaddr,
+		    psm2_handler_t handler, psm2_amarg_t *args, int nargs,
+		    void *src, size_t len, void *dest, int flags,
+		    psm2_am_completion_fn_t completion_fn,
+		    void *completion_ctxt)
+{
+	struct ips_proto *proto = epaddr->proto;
+	struct ips_am_long_desc desc;
+	struct ips_am_long *amlong;
+	ips_epaddr_t *ipsaddr;
+	psm2_mq_req_t req;
+
+	/* The CTS comes back on the rail the request goes out on */
+	ipsaddr = ips_select_rail(((ips_epaddr_t *)epaddr)->msgctl);
+
+	desc.dest = (uint64_t) (uintptr_t) dest;
+	desc.len = len;
+
+	if (len == 0) {
+		/* Nothing to pull, the request alone carries it */
+		desc.sreq_idx = 0;
+		return ips_am_request(ipsaddr, handler, args, nargs,
+				      &desc, sizeof(desc),
+				      flags & ~PSM2_AM_FLAG_ASYNC,
+				      IPS_SEND_FLAG_AMLONG,
+				      completion_fn, completion_ctxt);
+	}
+
+	amlong = (struct ips_am_long *)
+	    psmi_malloc(proto->ep, UNDEFINED, sizeof(struct ips_am_long));
+	if (amlong == NULL)
+		return PSM2_NO_MEMORY;
+	amlong->completion_fn = completion_fn;
+	amlong->completion_ctxt = completion_ctxt;
+
+	req = psmi_mq_req_alloc(proto->mq, MQE_TYPE_SEND);
+	if_pf(req == NULL) {
+		psmi_free(amlong);
+		return PSM2_NO_MEMORY;
+	}
+
+	req->type |= MQE_TYPE_INTERNAL;
+	req->complete_callback = ips_am_long_send_complete;
+	req->context = amlong;
+	req->buf = src;
+	req->buf_len = len;
+	req->send_msglen = len;
+	req->send_msgoff = 0;
+	req->recv_msgoff = 0;
+	req->rts_peer = (psm2_epaddr_t) ipsaddr;
+
+	desc.sreq_idx = psmi_mpool_get_obj_index(req);
+
+	return ips_am_request(ipsaddr, handler, args, nargs,
+			      &desc, sizeof(desc),
+			      flags & ~PSM2_AM_FLAG_ASYNC,
+			      IPS_SEND_FLAG_AMLONG, NULL, NULL);
+}
+
+static
+void
+ips_am_long_recv_complete(psm2_mq_req_t req)
+{
+	struct ips_am_long *amlong = (struct ips_am_long *)req->context;
+	struct ips_am_token token;
+	psm2_am_handler_fn_t hfn;
+	void *buf = req->buf;
+	uint32_t len = req->recv_msglen;
+
+	psmi_mq_req_free(req);
+
+	token.tok.flags = 0;
+	token.tok.epaddr_from =
+	    (psm2_epaddr_t) &amlong->ipsaddr->msgctl->master_epaddr;
+	token.tok.can_reply = amlong->can_reply;
+	token.epaddr_rail = amlong->ipsaddr;
+	token.proto_am = amlong->proto_am;
+
+	hfn = psm_am_get_handler_function(amlong->proto_am->proto->ep,
+					  amlong->handler);
+	hfn(&token, amlong->args, amlong->nargs, buf, len);
+
+	psmi_free(amlong);
+}
+
+/* Target side of a long request, pull the payload into its destination */
+static
+void
+ips_am_long_recv(struct ips_am_token *token, psm2_handler_t handler,
+		 psm2_amarg_t *args, int nargs, void *payload,
+		 uint32_t paylen)
+{
+	struct ips_proto *proto = token->proto_am->proto;
+	struct ips_am_long_desc desc;
+	struct ips_am_long *amlong;
+	psm2_mq_req_t req;
+	uint32_t recvlen;
+
+	psmi_assert(paylen >= sizeof(desc));
+	memcpy(&desc, payload, sizeof(desc));
+
+	if (desc.len == 0) {
+		psm2_am_handler_fn_t hfn =
+		    psm_am_get_handler_function(proto->ep, handler);
+		hfn(token, args, nargs, (void *)(uintptr_t) desc.dest, 0);
+		return;
+	}
+
+	/* A rejected destination is received as a truncated message, the
+	 * origin's send completes without any data moving */
+	recvlen = psmi_am_long_dest_ok(proto->ep, handler, args, nargs,
+				       (void *)(uintptr_t) desc.dest,
+				       desc.len) ? desc.len : 0;
+
+	amlong = (struct ips_am_long *)
+	    psmi_malloc(proto->ep, UNDEFINED, sizeof(struct ips_am_long));
+	psmi_assert_always(amlong != NULL);
+	amlong->ipsaddr = token->epaddr_rail;
+	amlong->proto_am = token->proto_am;
+	amlong->handler = handler;
+	amlong->can_reply = token->tok.can_reply;
+	amlong->nargs = nargs;
+	memcpy(amlong->args, args, nargs * sizeof(psm2_amarg_t));
+
+	req = psmi_mq_req_alloc(proto->mq, MQE_TYPE_RECV);
+	psmi_assert_always(req != NULL);
+
+	req->type |= MQE_TYPE_INTERNAL;
+	req->complete_callback = ips_am_long_recv_complete;
+	req->context = amlong;
+	req->state = MQ_STATE_MATCHED;
+	req->buf = (void *)(uintptr_t) desc.dest;
+	req->buf_len = recvlen;
+	req->recv_msglen = recvlen;
+	req->send_msglen = desc.len;
+	req->recv_msgoff = 0;
+	req->send_msgoff = 0;
+	req->rts_peer = (psm2_epaddr_t) token->epaddr_rail;
+	req->rts_reqidx_peer = desc.sreq_idx;
+
+	ips_proto_mq_rts_match_callback(req, 1);
+}
+
+static
+psm2_error_t
+ips_am_reply(psm2_am_token_t tok,
+	     psm2_handler_t handler, psm2_amarg_t *args, int nargs,
+	     void *src, size_t len, int flags, uint32_t send_flags,
+	     psm2_am_completion_fn_t completion_fn, void *completion_ctxt)
 {
 	struct ips_am_token *token = (struct ips_am_token *)tok;
 	struct ips_proto_am *proto_am = token->proto_am;
@@ -394,11 +598,86 @@ ips_am_short_reply(psm2_am_token_t tok,
 	psmi_assert_always(scb != NULL);
 	ips_am_scb_init(scb, handler, nargs, pad_bytes,
 			completion_fn, completion_ctxt);
+	scb->flags |= send_flags;
 	am_short_reqrep(scb, ipsaddr, args, nargs, OPCODE_AM_REPLY,
 			src, len, flags, pad_bytes);
 	return PSM2_OK;
 }
 
+psm2_error_t
+ips_am_short_reply(psm2_am_token_t tok,
+		   psm2_handler_t handler, psm2_amarg_t *args, int nargs,
+		   void *src, size_t len, int flags,
+		   psm2_am_completion_fn_t completion_fn, void *completion_ctxt)
+{
+	return ips_am_reply(tok, handler, args, nargs, src, len, flags, 0,
+			    completion_fn, completion_ctxt);
+}
+
+psm2_error_t
+ips_am_long_reply(psm2_am_token_t tok,
+		  psm2_handler_t handler, psm2_amarg_t *args, int nargs,
+		  void *src, size_t len, void *dest, int flags,
+		  psm2_am_completion_fn_t completion_fn, void *completion_ctxt)
+{
+	struct ips_am_token *token = (struct ips_am_token *)tok;
+	struct ips_proto *proto = token->proto_am->proto;
+	struct ips_am_long_desc desc;
+	struct ips_am_long *amlong;
+	psm2_mq_req_t req;
+	psm2_error_t err;
+
+	if (!token->tok.can_reply) {
+		_HFI_ERROR("Invalid AM reply for request!");
+		return PSM2_AM_INVALID_REPLY;
+	}
+
+	desc.dest = (uint64_t) (uintptr_t) dest;
+	desc.len = len;
+
+	if (len == 0) {
+		desc.sreq_idx = 0;
+		return ips_am_reply(tok, handler, args, nargs,
+				    &desc, sizeof(desc), 0,
+				    IPS_SEND_FLAG_AMLONG,
+				    completion_fn, completion_ctxt);
+	}
+
+	amlong = (struct ips_am_long *)
+	    psmi_malloc(proto->ep, UNDEFINED, sizeof(struct ips_am_long));
+	if (amlong == NULL)
+		return PSM2_NO_MEMORY;
+	amlong->completion_fn = completion_fn;
+	amlong->completion_ctxt = completion_ctxt;
+
+	req = psmi_mq_req_alloc(proto->mq, MQE_TYPE_SEND);
+	if_pf(req == NULL) {
+		psmi_free(amlong);
+		return PSM2_NO_MEMORY;
+	}
+
+	/* The requester pulls it from us as for a long request */
+	req->type |= MQE_TYPE_INTERNAL;
+	req->complete_callback = ips_am_long_send_complete;
+	req->context = amlong;
+	req->buf = src;
+	req->buf_len = len;
+	req->send_msglen = len;
+	req->send_msgoff = 0;
+	req->recv_msgoff = 0;
+	req->rts_peer = (psm2_epaddr_t) token->epaddr_rail;
+
+	desc.sreq_idx = psmi_mpool_get_obj_index(req);
+
+	err = ips_am_reply(tok, handler, args, nargs, &desc, sizeof(desc), 0,
+			   IPS_SEND_FLAG_AMLONG, NULL, NULL);
+	if (err != PSM2_OK) {
+		psmi_mq_req_free(req);
+		psmi_free(amlong);
+	}
+	return err;
+}
+
 /* Prepares and runs a handler from a receive event. */
 static int
 ips_am_run_handler(const struct ips_message_header *p_hdr,
@@ -447,6 +726,13 @@ ips_am_run_handler(const struct ips_message_header *p_hdr,
 		paylen -= p_hdr->amhdr_len;
 	}
 
+	if_pf(token.tok.flags & IPS_SEND_FLAG_AMLONG) {
+		/* The handler runs once the payload is in */
+		ips_am_long_recv(&token, p_hdr->amhdr_hidx, args, nargs,
+				 payload, paylen);
+		return 0;
+	}
+
 	hfn = psm_am_get_handler_function(proto_am->proto->ep,
 			p_hdr->amhdr_hidx);
 
@@ -81,6 +81,20 @@ ips_am_short_request(psm2_epaddr_t epaddr,
 		     psm2_am_completion_fn_t completion_fn,
 		     void *completion_ctxt);
 
+psm2_error_t
+ips_am_long_reply(psm2_am_token_t tok,
+		  psm2_handler_t handler, psm2_amarg_t *args, int nargs,
+		  void *src, size_t len, void *dest, int flags,
+		  psm2_am_completion_fn_t completion_fn,
+		  void *completion_ctxt);
+
+psm2_error_t
+ips_am_long_request(psm2_epaddr_t epaddr,
+		    psm2_handler_t handler, psm2_amarg_t *args, int nargs,
+		    void *src, size_t len, void *dest, int flags,
+		    psm2_am_completion_fn_t completion_fn,
+		    void *completion_ctxt);
+
 psm2_error_t 
 ips_proto_am_init(struct ips_proto *proto,
              int num_send_slots,
@@ -77,7 +77,8 @@
  * define connection version. this is the basic version, optimized
  * version will be added later for scability.
  */
-#define IPS_CONNECT_VERNO	  0x0001
+#define IPS_CONNECT_VERNO	  0x0002
+#define IPS_CONNECT_VERNO_ACKS	  0x0002	/* understands piggybacked ACKs */
 
 struct ips_connect_hdr {
 	uint16_t connect_verno;	/* should be ver 1 */
@@ -216,6 +217,7 @@ ips_ipsaddr_set_req_params(struct ips_proto *proto,
 	 */
 	ipsaddr->mtu_size = peer_mtu;
 	ipsaddr->pio_size = piosize;
+	ipsaddr->ack_piggyback = req->connect_verno >= IPS_CONNECT_VERNO_ACKS;
 
 	/*
 	 * For static routes i.e. "none" path resolution update all paths to
@@ -610,6 +612,9 @@ ips_alloc_epaddr(struct ips_proto *proto, int master, psm2_epid_t epid,
 			      ipsaddr, PSM_TRANSFER_DMA, PSM_PROTOCOL_GO_BACK_N,
 			      IPS_PATH_LOW_PRIORITY, EP_FLOW_GO_BACK_N_DMA);
 
+	psmi_timer_entry_init(&ipsaddr->timer_ack,
+			      ips_proto_timer_peer_ack_callback, ipsaddr);
+
 	/* clear connection state. */
 	ipsaddr->cstate_to = CSTATE_NONE;
 	ipsaddr->cstate_from = CSTATE_NONE;
@@ -617,6 +622,7 @@ ips_alloc_epaddr(struct ips_proto *proto, int master, psm2_epid_t epid,
 	/* Add epaddr to PSM's epid table */
 	psmi_epid_add(proto->ep, epaddr->epid, epaddr);
 	psmi_assert_always(psmi_epid_lookup(proto->ep, epaddr->epid) == epaddr);
+	psmi_telemetry_peer_add(proto->ep, epaddr, PSMI_TELEMETRY_HFI);
 
 	return epaddr;
 }
@@ -627,6 +633,7 @@ void ips_free_epaddr(psm2_epaddr_t epaddr)
 	ips_epaddr_t *ipsaddr = (ips_epaddr_t *) epaddr;
 	_HFI_VDBG("epaddr=%p,ipsaddr=%p,connidx_from=%d\n", epaddr, ipsaddr,
 		  ipsaddr->connidx_from);
+	psmi_timer_cancel(epaddr->proto->timerq, &ipsaddr->timer_ack);
 	psmi_epid_remove(epaddr->proto->ep, epaddr->epid);
 	ips_epstate_del(epaddr->proto->epstate, ipsaddr->connidx_from);
 	psmi_free(epaddr);
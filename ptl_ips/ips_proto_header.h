@@ -178,4 +178,8 @@ struct ips_message_header {
 #define OPCODE_FUTURE_FROM		0xD5	/* reserved for expansion */
 #define OPCODE_FUTURE_TO		0xDF	/* reserved for expansion */
 
+/* In the mdata of a go-back-n flow ACK, also acknowledges the other
+ * go-back-n flow up to the sequence number in the low bits */
+#define IPS_ACK_PIGGYBACK		0x80000000U
+
 #endif /* _IPS_PROTO_HEADER_H */
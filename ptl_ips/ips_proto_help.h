@@ -103,6 +103,25 @@ ips_proto_flowid(struct ips_message_header *p_hdr))
 				    HFI_BTH_FLOWID_MASK);
 }
 
+/* One trace record per packet put on or taken off the wire */
+PSMI_ALWAYS_INLINE(
+void
+ips_proto_trace_pkt(struct ips_proto *proto, uint16_t event,
+		    ips_epaddr_t *ipsaddr, struct ips_message_header *p_hdr,
+		    uint32_t paylen))
+{
+	psmi_seqnum_t seq;
+
+	if_pf(psmi_trace_enabled(proto->ep)) {
+		seq.psn_val = __be32_to_cpu(p_hdr->bth[2]);
+		psmi_trace_at(proto->ep, get_cycles(), event,
+			      _get_proto_hfi_opcode(p_hdr),
+			      ipsaddr != NULL ?
+			      ((psm2_epaddr_t) ipsaddr)->epid : 0,
+			      paylen, seq.psn_num, ips_proto_flowid(p_hdr));
+	}
+}
+
 PSMI_ALWAYS_INLINE(
 int
 ips_do_cksum(struct ips_proto *proto, struct ips_message_header *p_hdr,
@@ -369,7 +388,8 @@ ips_scb_prepare_flow_inner(struct ips_proto *proto, struct ips_epaddr *ipsaddr,
 
 PSMI_ALWAYS_INLINE(
 void
-ips_proto_epaddr_stats_set(struct ips_proto *proto, uint8_t msgtype))
+ips_proto_epaddr_stats_set(struct ips_proto *proto, ips_epaddr_t *ipsaddr,
+			   uint8_t msgtype))
 {
 	switch (msgtype) {
 	case OPCODE_ACK:
@@ -380,6 +400,8 @@ ips_proto_epaddr_stats_set(struct ips_proto *proto, uint8_t msgtype))
 		break;
 	case OPCODE_NAK:
 		proto->epaddr_stats.nak_send++;
+		psmi_telemetry_count((psm2_epaddr_t) ipsaddr,
+				     PSMI_TELEMETRY_NAK_SENT, 1);
 		break;
 	case OPCODE_CONNECT_REQUEST:
 		proto->epaddr_stats.connect_req++;
@@ -401,6 +423,34 @@ psm2_error_t ips_proto_send_ctrl_message(struct ips_flow *flow,
 		uint8_t message_type, uint16_t *msg_queue_mask,
 		ips_scb_t *ctrlscb, void *payload, uint32_t paylen);
 
+/*
+ * Go-back-n flows share their peer's ack timer, tidflows use the timer of
+ * their first unacked scb.
+ */
+PSMI_ALWAYS_INLINE(
+void
+ips_flow_timer_ack_request(struct ips_proto *proto, struct ips_flow *flow,
+			   uint64_t t_cyc))
+{
+	if (flow->timer_ack == &flow->ipsaddr->timer_ack)
+		psmi_timer_request_before(proto->timerq, flow->timer_ack, t_cyc);
+	else
+		psmi_timer_request(proto->timerq, flow->timer_ack, t_cyc);
+}
+
+PSMI_ALWAYS_INLINE(
+void
+ips_flow_timer_ack_cancel(struct ips_proto *proto, struct ips_flow *flow))
+{
+	ips_epaddr_t *ipsaddr = flow->ipsaddr;
+
+	/* The other flow still waits for acks */
+	if (flow->timer_ack == &ipsaddr->timer_ack &&
+	    ipsaddr->flows[flow->flowid ^ 1].timer_ack == flow->timer_ack)
+		return;
+	psmi_timer_cancel(proto->timerq, flow->timer_ack);
+}
+
 PSMI_ALWAYS_INLINE(
 void
 ips_proto_send_ack(struct ips_recvhdrq *recvq, struct ips_flow *flow))
@@ -419,6 +469,7 @@ ips_proto_send_ack(struct ips_recvhdrq *recvq, struct ips_flow *flow))
 
 		ctrlscb.flags = 0;
 		ctrlscb.ips_lrh.ack_seq_num = flow->recv_seq_num.psn_num;
+		ctrlscb.ips_lrh.mdata = 0;
 		/* Coalesced ACKs disabled. Send ACK immediately */
 		ips_proto_send_ctrl_message(flow, OPCODE_ACK,
 					    &flow->ipsaddr->ctrl_msg_queued,
@@ -614,6 +665,9 @@ ips_proto_process_packet(const struct ips_recvhdrq_event *rcv_ev))
 			return IPS_RECVHDRQ_CONTINUE;
 	}
 
+	ips_proto_trace_pkt(rcv_ev->proto, PSMI_TRACE_IPS_RX, rcv_ev->ipsaddr,
+			    rcv_ev->p_hdr, ips_recvhdrq_event_paylen(rcv_ev));
+
 	/* see file ips_proto_header.h for details */
 	index = _get_proto_hfi_opcode(rcv_ev->p_hdr) - OPCODE_RESERVED;
 	if (index >= (OPCODE_FUTURE_FROM - OPCODE_RESERVED))
@@ -689,4 +743,85 @@ ips_select_path(struct ips_proto *proto, ips_path_type_t path_type,
 	return pathgrp->pg_path[path_idx][path_type];
 }
 
+/*
+ * With adaptive path selection, move an idle go-back-n flow off a path that
+ * CCA is currently throttling onto the least congested path of the same
+ * priority.  Only idle flows are moved so retransmissions never straddle
+ * two paths.
+ */
+PSMI_ALWAYS_INLINE(
+void
+ips_flow_select_path(struct ips_proto *proto, struct ips_flow *flow))
+{
+	ips_path_grp_t *pathgrp = flow->ipsaddr->pathgrp;
+	ips_path_type_t path_type;
+	ips_path_rec_t *path;
+	int i;
+
+	if (!(proto->flags & IPS_PROTO_FLAG_PPOLICY_ADAPTIVE) ||
+	    flow->path->pr_active_ipd == 0)
+		return;
+
+	/* Matches the path priorities assigned in ips_alloc_epaddr() */
+	path_type = (flow->transfer == PSM_TRANSFER_PIO) ?
+	    IPS_PATH_NORMAL_PRIORITY : IPS_PATH_LOW_PRIORITY;
+
+	for (i = 0; i < pathgrp->pg_num_paths[path_type]; i++) {
+		path = pathgrp->pg_path[i][path_type];
+		if (path->pr_active_ipd < flow->path->pr_active_ipd)
+			flow->path = path;
+	}
+}
+
+/*
+ * Estimated load on the rail behind ipsaddr: bytes queued but not yet acked
+ * on the rail, plus a penalty if the send context recently ran out of PIO
+ * credits, scaled by the CCA inter-packet delay of the message flow's path.
+ */
+PSMI_ALWAYS_INLINE(
+uint64_t
+ips_rail_load(ips_epaddr_t *ipsaddr))
+{
+	struct ips_proto *proto = ((psm2_epaddr_t) ipsaddr)->proto;
+	ips_path_rec_t *path = ipsaddr->flows[proto->msgflowid].path;
+	uint64_t load = proto->inflight_bytes;
+
+	if ((get_cycles() - proto->spioc->spio_last_stall_cyc) <
+	    proto->rail_stall_window)
+		load += IPS_RAIL_STALL_PENALTY;
+
+	return load * (1 + path->pr_active_ipd);
+}
+
+/*
+ * Pick the rail for the next message to a peer.  Round robin unless the
+ * adaptive rail policy is enabled, in which case the least loaded rail wins
+ * and ties keep the round robin order.
+ */
+PSMI_ALWAYS_INLINE(
+ips_epaddr_t *
+ips_select_rail(ips_msgctl_t *msgctl))
+{
+	ips_epaddr_t *ipsaddr = msgctl->ipsaddr_next;
+
+	if (msgctl->ipsaddr_count > 1 &&
+	    (((psm2_epaddr_t) ipsaddr)->proto->flags &
+	     IPS_PROTO_FLAG_RAIL_ADAPTIVE)) {
+		ips_epaddr_t *cur = ipsaddr->next;
+		uint64_t load, min_load = ips_rail_load(ipsaddr);
+
+		while (cur != msgctl->ipsaddr_next) {
+			load = ips_rail_load(cur);
+			if (load < min_load) {
+				min_load = load;
+				ipsaddr = cur;
+			}
+			cur = cur->next;
+		}
+	}
+
+	msgctl->ipsaddr_next = ipsaddr->next;
+	return ipsaddr;
+}
+
 #endif /* _IPS_PROTO_HELP_H */
@@ -75,6 +75,7 @@ int ips_proto_build_connect_message(struct ips_proto *proto,
 				    uint8_t opcode, void *payload);
 
 psm2_error_t ips_proto_timer_ack_callback(struct psmi_timer *, uint64_t);
+psm2_error_t ips_proto_timer_peer_ack_callback(struct psmi_timer *, uint64_t);
 psm2_error_t ips_proto_timer_send_callback(struct psmi_timer *, uint64_t);
 psm2_error_t ips_proto_timer_ctrlq_callback(struct psmi_timer *, uint64_t);
 psm2_error_t ips_proto_timer_pendq_callback(struct psmi_timer *, uint64_t);
@@ -114,9 +114,13 @@ int ips_proto_mq_eager_complete(void *reqp, uint32_t nbytes)
 	 * we may have DW pad in nbytes.
 	 */
 	if (req->send_msgoff >= req->send_msglen) {
+		if_pf(req->type & MQE_TYPE_INTERNAL) {
+			psmi_mq_req_complete_internal(req);
+			return IPS_RECVHDRQ_CONTINUE;
+		}
 		req->state = MQ_STATE_COMPLETE;
 		ips_barrier();
-		mq_qq_append(&req->mq->completed_q, req);
+		psmi_mq_req_completed(req->mq, req);
 	}
 	return IPS_RECVHDRQ_CONTINUE;
 }
@@ -431,8 +435,7 @@ ips_proto_mq_isend(psm2_mq_t mq, psm2_epaddr_t mepaddr, uint32_t flags,
 	if_pf(req == NULL)
 	    return PSM2_NO_MEMORY;
 
-	ipsaddr = ((ips_epaddr_t *) mepaddr)->msgctl->ipsaddr_next;
-	ipsaddr->msgctl->ipsaddr_next = ipsaddr->next;
+	ipsaddr = ips_select_rail(((ips_epaddr_t *) mepaddr)->msgctl);
 	proto = ((psm2_epaddr_t) ipsaddr)->proto;
 
 	req->send_msglen = len;
@@ -460,7 +463,7 @@ ips_proto_mq_isend(psm2_mq_t mq, psm2_epaddr_t mepaddr, uint32_t flags,
 		/* We can mark this op complete since all the data is now copied
 		 * into an SCB that remains live until it is remotely acked */
 		req->state = MQ_STATE_COMPLETE;
-		mq_qq_append(&mq->completed_q, req);
+		psmi_mq_req_completed(mq, req);
 		_HFI_VDBG
 		    ("[itiny][%s->%s][b=%p][m=%d][t=%08x.%08x.%08x][req=%p]\n",
 		     psmi_epaddr_get_name(mq->ep->epid),
@@ -522,12 +525,12 @@ ips_proto_mq_isend(psm2_mq_t mq, psm2_epaddr_t mepaddr, uint32_t flags,
 
 				/* mark the message done */
 				req->state = MQ_STATE_COMPLETE;
-				mq_qq_append(&mq->completed_q, req);
+				psmi_mq_req_completed(mq, req);
 			}
 		} else {
 			/* mark the message done */
 			req->state = MQ_STATE_COMPLETE;
-			mq_qq_append(&mq->completed_q, req);
+			psmi_mq_req_completed(mq, req);
 		}
 		_HFI_VDBG
 		    ("[ishrt][%s->%s][b=%p][m=%d][t=%08x.%08x.%08x][req=%p]\n",
@@ -580,8 +583,7 @@ ips_proto_mq_send(psm2_mq_t mq, psm2_epaddr_t mepaddr, uint32_t flags,
 	ips_epaddr_t *ipsaddr;
 	ips_scb_t *scb;
 
-	ipsaddr = ((ips_epaddr_t *) mepaddr)->msgctl->ipsaddr_next;
-	ipsaddr->msgctl->ipsaddr_next = ipsaddr->next;
+	ipsaddr = ips_select_rail(((ips_epaddr_t *) mepaddr)->msgctl);
 	proto = ((psm2_epaddr_t) ipsaddr)->proto;
 
 	if (flags & PSM2_MQ_FLAG_SENDSYNC) {
@@ -725,7 +727,6 @@ do_rendezvous:
 	return err;
 }
 
-static
 psm2_error_t
 ips_proto_mq_rts_match_callback(psm2_mq_req_t req, int was_posted)
 {
@@ -739,7 +740,8 @@ ips_proto_mq_rts_match_callback(psm2_mq_req_t req, int was_posted)
 	 */
 	PSM2_LOG_MSG("entering");
 	if (req->recv_msglen <= proto->mq->hfi_thresh_rv ||	/* less rv theshold */
-	    proto->protoexp == NULL) {	/* no expected tid recieve */
+	    proto->protoexp == NULL ||	/* no expected tid recieve */
+	    req->stride != NULL) {	/* tids only map a contiguous buffer */
 
 		/* there is no order requirement, try to push CTS request
 		 * directly, if fails, then queue it for later try. */
@@ -1191,7 +1193,8 @@ ips_proto_mq_handle_tiny(struct ips_recvhdrq_event *rcv_ev)
 	int rc = psmi_mq_handle_envelope(mq,
 				(psm2_epaddr_t) &ipsaddr->msgctl->master_epaddr,
 				(psm2_mq_tag_t *) p_hdr->tag, paylen, 0,
-				payload, paylen, msgorder, OPCODE_TINY, &req);
+				payload, paylen, msgorder, OPCODE_TINY, &req,
+				NULL);
 	if (unlikely(rc == MQ_RET_UNEXP_NO_RESOURCES)) {
 		uint32_t psn_mask = ((psm2_epaddr_t)ipsaddr)->proto->psn_mask;
 
@@ -1244,6 +1247,7 @@ ips_proto_mq_handle_short(struct ips_recvhdrq_event *rcv_ev)
 	char *payload;
 	uint32_t paylen;
 	psm2_mq_req_t req;
+	struct psmi_mq_hold *hold = NULL;
 
 	/*
 	 * if PSN does not match, drop the packet.
@@ -1261,6 +1265,13 @@ ips_proto_mq_handle_short(struct ips_recvhdrq_event *rcv_ev)
 	paylen = ips_recvhdrq_event_paylen(rcv_ev);
 	psmi_assert(paylen == 0 || payload);
 
+	/*
+	 * An in-order unexpected message can be left in the eager buffer
+	 * until its receive is posted, out-of-order ones use ptl_req_ptr.
+	 */
+	if (msgorder == IPS_MSG_ORDER_EXPECTED)
+		hold = ips_recvq_egr_hold_get(rcv_ev);
+
 	/*
 	 * We can't have past message sequence here. For eager message,
 	 * it must always have an eager queue matching because even in
@@ -1278,7 +1289,8 @@ ips_proto_mq_handle_short(struct ips_recvhdrq_event *rcv_ev)
 				(psm2_epaddr_t) &ipsaddr->msgctl->master_epaddr,
 				(psm2_mq_tag_t *) p_hdr->tag,
 				p_hdr->hdr_data.u32w1, p_hdr->hdr_data.u32w0,
-				payload, paylen, msgorder, OPCODE_SHORT, &req);
+				payload, paylen, msgorder, OPCODE_SHORT, &req,
+				hold);
 	if (unlikely(rc == MQ_RET_UNEXP_NO_RESOURCES)) {
 		uint32_t psn_mask = ((psm2_epaddr_t)ipsaddr)->proto->psn_mask;
 
@@ -1305,8 +1317,11 @@ ips_proto_mq_handle_short(struct ips_recvhdrq_event *rcv_ev)
 		if (msgctl->outoforder_count)
 			ips_proto_mq_handle_outoforder_queue(mq, msgctl);
 
-		if (rc == MQ_RET_UNEXP_OK)
+		if (rc == MQ_RET_UNEXP_OK) {
+			if (req->type & MQE_TYPE_HELD)
+				ips_recvq_egr_hold_commit(rcv_ev, req);
 			ret = IPS_RECVHDRQ_BREAK;
+		}
 	}
 
 	if ((__be32_to_cpu(p_hdr->bth[2]) & IPS_SEND_FLAG_ACKREQ) ||
@@ -1404,7 +1419,8 @@ ips_proto_mq_handle_eager(struct ips_recvhdrq_event *rcv_ev)
 				(psm2_epaddr_t) &ipsaddr->msgctl->master_epaddr,
 				(psm2_mq_tag_t *) p_hdr->tag,
 				p_hdr->hdr_data.u32w1, p_hdr->hdr_data.u32w0,
-				payload, paylen, msgorder, OPCODE_EAGER, &req);
+				payload, paylen, msgorder, OPCODE_EAGER, &req,
+				NULL);
 	if (unlikely(rc == MQ_RET_UNEXP_NO_RESOURCES)) {
 		uint32_t psn_mask = ((psm2_epaddr_t)ipsaddr)->proto->psn_mask;
 
@@ -1497,9 +1513,8 @@ ips_proto_mq_handle_data(struct ips_recvhdrq_event *rcv_ev)
 	 */
 	if (p_hdr->data[1].u32w0 < 4 && p_hdr->data[1].u32w0 > 0) {
 		psmi_assert(p_hdr->data[1].u32w0 == (req->send_msglen&0x3));
-		mq_copy_tiny((uint32_t *)req->buf,
-				(uint32_t *)&p_hdr->mdata,
-				p_hdr->data[1].u32w0);
+		mq_recv_copy_tiny(req, 0, (uint32_t *)&p_hdr->mdata,
+				  p_hdr->data[1].u32w0);
 		req->send_msgoff += p_hdr->data[1].u32w0;
 	}
 
@@ -149,6 +149,7 @@
 #define IPS_SEND_FLAG_BLOCKING		0x01	/* blocking send */
 #define IPS_SEND_FLAG_PKTCKSUM          0x02	/* Has packet checksum */
 #define IPS_SEND_FLAG_AMISTINY		0x04	/* AM is tiny, exclusive */
+#define IPS_SEND_FLAG_AMLONG		0x08	/* AM starts a long request */
 #define IPS_SEND_FLAG_PROTO_OPTS        0x3f	/* only 6bits wire flags */
 
 /* scb flags */
@@ -202,6 +203,18 @@
 #define IPS_PROTO_FLAG_CCA 0x2000
 #define IPS_PROTO_FLAG_CCA_PRESCAN 0x4000	/* Enable RAPID CCA prescanning */
 
+/* Multi-rail selection policy: pick the least loaded rail for each new
+ * message instead of plain round robin over the rails.
+ */
+#define IPS_PROTO_FLAG_RAIL_ADAPTIVE 0x8000
+
+/* A PIO stall seen within the window counts as this many queued bytes */
+#define IPS_RAIL_STALL_WINDOW_US	100
+#define IPS_RAIL_STALL_PENALTY		(64*1024)
+
+/* Max time an unexpected message is left in the eager queue */
+#define IPS_EGR_HOLD_US			100
+
 #define IPS_PROTOEXP_FLAG_ENABLED	0x01	/* default */
 #define IPS_PROTOEXP_FLAG_HDR_SUPP      0x02	/* Header suppression enabled */
 #define IPS_PROTOEXP_FLAG_TID_DEBUG	0x04	/* *not* default */
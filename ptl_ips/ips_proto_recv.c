@@ -523,44 +523,23 @@ void ips_dmaflow_nak_post_process(struct ips_proto *proto,
 	}
 }
 
-/* process an incoming ack message.  Separate function to allow */
-/* for better optimization by compiler */
-int
-ips_proto_process_ack(struct ips_recvhdrq_event *rcv_ev)
+/* Release the scbs of a flow up to ack_seq_num.  rcv_ev is NULL for an
+ * ACK that came along with the other flow's */
+static void
+ips_flow_process_ack(struct ips_proto *proto, struct ips_flow *flow,
+		     psmi_seqnum_t ack_seq_num,
+		     struct ips_recvhdrq_event *rcv_ev)
 {
-	struct ips_proto *proto = rcv_ev->proto;
-	ips_epaddr_t *ipsaddr = rcv_ev->ipsaddr;
-	struct ips_message_header *p_hdr = rcv_ev->p_hdr;
-	struct ips_flow *flow = NULL;
 	struct ips_scb_unackedq *unackedq;
 	struct ips_scb_pendlist *scb_pend;
-	psmi_seqnum_t ack_seq_num, last_seq_num;
-	ips_epaddr_flow_t flowid;
+	psmi_seqnum_t last_seq_num;
 	ips_scb_t *scb;
-	uint32_t tidctrl;
-
-	ack_seq_num.psn_num = p_hdr->ack_seq_num;
-	tidctrl = GET_HFI_KHDR_TIDCTRL(__le32_to_cpu(p_hdr->khdr.kdeth0));
-	if (!tidctrl && ((flowid = ips_proto_flowid(p_hdr)) < EP_FLOW_TIDFLOW)) {
-		ack_seq_num.psn_num =
-		    (ack_seq_num.psn_num - 1) & proto->psn_mask;
-		psmi_assert(flowid < EP_FLOW_LAST);
-		flow = &ipsaddr->flows[flowid];
-		if (!pio_dma_ack_valid(proto, flow, ack_seq_num))
-			goto ret;
-	} else {
-		ack_seq_num.psn_seq -= 1;
-		flow = get_tidflow(proto, ipsaddr, p_hdr, ack_seq_num);
-		if (!flow)	/* Invalid ack for flow */
-			goto ret;
-	}
-	flow->xmit_ack_num.psn_num = p_hdr->ack_seq_num;
 
 	unackedq = &flow->scb_unacked;
 	scb_pend = &flow->scb_pend;
 
 	if (STAILQ_EMPTY(unackedq))
-		goto ret;
+		return;
 
 	last_seq_num = STAILQ_LAST(unackedq, ips_scb, nextq)->seq_num;
 
@@ -585,6 +564,8 @@ ips_proto_process_ack(struct ips_recvhdrq_event *rcv_ev)
 		flow->scb_num_unacked--;
 		psmi_assert(flow->scb_num_unacked >= flow->scb_num_pending);
 #endif
+		proto->inflight_bytes -= scb->nfrag > 1 ?
+		    scb->chunk_size : scb->payload_size;
 		flow->credits += scb->nfrag;
 
 		if (flow->transfer == PSM_TRANSFER_DMA &&
@@ -601,7 +582,7 @@ ips_proto_process_ack(struct ips_recvhdrq_event *rcv_ev)
 		/* set all index pointer to NULL if all frames have been
 		 * acked */
 		if (STAILQ_EMPTY(unackedq)) {
-			psmi_timer_cancel(proto->timerq, flow->timer_ack);
+			ips_flow_timer_ack_cancel(proto, flow);
 			flow->timer_ack = NULL;
 			psmi_timer_cancel(proto->timerq, flow->timer_send);
 			flow->timer_send = NULL;
@@ -612,8 +593,8 @@ ips_proto_process_ack(struct ips_recvhdrq_event *rcv_ev)
 			flow->credits = flow->cwin = proto->flow_credits;
 			flow->ack_interval = max((flow->credits >> 2) - 1, 1);
 			flow->flags &= ~IPS_FLOW_FLAG_CONGESTED;
-			goto ret;
-		} else if (flow->timer_ack == scb->timer_ack) {
+			return;
+		} else if (flow->timer_send == scb->timer_send) {
 			/*
 			 * Exchange timers with last scb on unackedq.
 			 * timer in scb is used by flow, cancelling current
@@ -641,13 +622,15 @@ ips_proto_process_ack(struct ips_recvhdrq_event *rcv_ev)
 	psmi_assert(!STAILQ_EMPTY(unackedq));	/* sanity for above loop */
 
 	/* CCA: If flow is congested adjust rate */
-	if_pf(rcv_ev->is_congested & IPS_RECV_EVENT_BECN) {
+	if_pf(rcv_ev && (rcv_ev->is_congested & IPS_RECV_EVENT_BECN)) {
 		if ((flow->path->pr_ccti +
 		     proto->cace[flow->path->pr_sl].ccti_increase) <=
 		    proto->ccti_limit) {
 			ips_cca_adjust_rate(flow->path,
 					    proto->cace[flow->path->pr_sl].
 					    ccti_increase);
+			psmi_telemetry_count((psm2_epaddr_t) flow->ipsaddr,
+					     PSMI_TELEMETRY_CCA_CHANGES, 1);
 			/* Clear congestion event */
 			rcv_ev->is_congested &= ~IPS_RECV_EVENT_BECN;
 		}
@@ -673,9 +656,56 @@ ips_proto_process_ack(struct ips_recvhdrq_event *rcv_ev)
 	 * pio bufs
 	 */
 	if (STAILQ_FIRST(unackedq)->abs_timeout == TIMEOUT_INFINITE)
-		psmi_timer_cancel(proto->timerq, flow->timer_ack);
+		ips_flow_timer_ack_cancel(proto, flow);
+}
+
+/* process an incoming ack message.  Separate function to allow */
+/* for better optimization by compiler */
+int
+ips_proto_process_ack(struct ips_recvhdrq_event *rcv_ev)
+{
+	struct ips_proto *proto = rcv_ev->proto;
+	ips_epaddr_t *ipsaddr = rcv_ev->ipsaddr;
+	struct ips_message_header *p_hdr = rcv_ev->p_hdr;
+	struct ips_flow *flow = NULL;
+	psmi_seqnum_t ack_seq_num;
+	ips_epaddr_flow_t flowid;
+	uint32_t tidctrl;
+
+	ack_seq_num.psn_num = p_hdr->ack_seq_num;
+	tidctrl = GET_HFI_KHDR_TIDCTRL(__le32_to_cpu(p_hdr->khdr.kdeth0));
+	if (!tidctrl && ((flowid = ips_proto_flowid(p_hdr)) < EP_FLOW_TIDFLOW)) {
+		ack_seq_num.psn_num =
+		    (ack_seq_num.psn_num - 1) & proto->psn_mask;
+		psmi_assert(flowid < EP_FLOW_LAST);
+		flow = &ipsaddr->flows[flowid];
+		if (pio_dma_ack_valid(proto, flow, ack_seq_num)) {
+			flow->xmit_ack_num.psn_num = p_hdr->ack_seq_num;
+			ips_flow_process_ack(proto, flow, ack_seq_num, rcv_ev);
+		}
+
+		/* The ACK may acknowledge the other flow as well */
+		if (ipsaddr->ack_piggyback &&
+		    (p_hdr->mdata & IPS_ACK_PIGGYBACK)) {
+			flow = &ipsaddr->flows[flowid ^ 1];
+			ack_seq_num.psn_num =
+			    (p_hdr->mdata - 1) & proto->psn_mask;
+			if (pio_dma_ack_valid(proto, flow, ack_seq_num)) {
+				flow->xmit_ack_num.psn_num =
+				    p_hdr->mdata & ~IPS_ACK_PIGGYBACK;
+				ips_flow_process_ack(proto, flow, ack_seq_num,
+						     NULL);
+			}
+		}
+	} else {
+		ack_seq_num.psn_seq -= 1;
+		flow = get_tidflow(proto, ipsaddr, p_hdr, ack_seq_num);
+		if (flow) {	/* else invalid ack for flow */
+			flow->xmit_ack_num.psn_num = p_hdr->ack_seq_num;
+			ips_flow_process_ack(proto, flow, ack_seq_num, rcv_ev);
+		}
+	}
 
-ret:
 	return IPS_RECVHDRQ_CONTINUE;
 }
 
@@ -734,6 +764,8 @@ int ips_proto_process_nak(struct ips_recvhdrq_event *rcv_ev)
 	last_seq_num = STAILQ_LAST(unackedq, ips_scb, nextq)->seq_num;
 
 	proto->epaddr_stats.nak_recv++;
+	psmi_telemetry_count((psm2_epaddr_t) ipsaddr,
+			     PSMI_TELEMETRY_NAK_RECV, 1);
 
 	_HFI_VDBG("got a nack %d on flow %d, "
 		  "first is %d, last is %d\n", ack_seq_num.psn_num,
@@ -762,6 +794,8 @@ int ips_proto_process_nak(struct ips_recvhdrq_event *rcv_ev)
 		flow->scb_num_unacked--;
 		psmi_assert(flow->scb_num_unacked >= flow->scb_num_pending);
 #endif
+		proto->inflight_bytes -= scb->nfrag > 1 ?
+		    scb->chunk_size : scb->payload_size;
 
 		if (flow->transfer == PSM_TRANSFER_DMA &&
 				scb->dma_complete == 0)
@@ -776,7 +810,7 @@ int ips_proto_process_nak(struct ips_recvhdrq_event *rcv_ev)
 
 		/* set all index pointer to NULL if all frames has been acked */
 		if (STAILQ_EMPTY(unackedq)) {
-			psmi_timer_cancel(proto->timerq, flow->timer_ack);
+			ips_flow_timer_ack_cancel(proto, flow);
 			flow->timer_ack = NULL;
 			psmi_timer_cancel(proto->timerq, flow->timer_send);
 			flow->timer_send = NULL;
@@ -788,7 +822,7 @@ int ips_proto_process_nak(struct ips_recvhdrq_event *rcv_ev)
 			flow->ack_interval = max((flow->credits >> 2) - 1, 1);
 			flow->flags &= ~IPS_FLOW_FLAG_CONGESTED;
 			goto ret;
-		} else if (flow->timer_ack == scb->timer_ack) {
+		} else if (flow->timer_send == scb->timer_send) {
 			/*
 			 * Exchange timers with last scb on unackedq.
 			 * timer in scb is used by flow, cancelling current
@@ -821,7 +855,7 @@ int ips_proto_process_nak(struct ips_recvhdrq_event *rcv_ev)
 		ips_dmaflow_nak_post_process(proto, flow);
 
 	/* Always cancel ACK timer as we are going to restart the flow */
-	psmi_timer_cancel(proto->timerq, flow->timer_ack);
+	ips_flow_timer_ack_cancel(proto, flow);
 
 	/* What's now pending is all that was unacked */
 	SLIST_FIRST(scb_pend) = scb;
@@ -883,6 +917,8 @@ int ips_proto_process_nak(struct ips_recvhdrq_event *rcv_ev)
 		flow->flush(flow, &num_resent);
 
 		proto->epaddr_stats.send_rexmit += num_resent;
+		psmi_telemetry_count((psm2_epaddr_t) ipsaddr,
+				     PSMI_TELEMETRY_REXMIT, num_resent);
 	}
 
 ret:
@@ -926,6 +962,7 @@ ips_proto_process_err_chk(struct ips_recvhdrq_event *rcv_ev)
 
 		ctrlscb.flags = 0;
 		ctrlscb.ips_lrh.ack_seq_num = flow->recv_seq_num.psn_num;
+		ctrlscb.ips_lrh.mdata = 0;
 
 		ips_proto_send_ctrl_message(flow, OPCODE_ACK,
 					    &ipsaddr->ctrl_msg_queued,
@@ -1073,6 +1110,8 @@ ips_proto_process_becn(struct ips_recvhdrq_event *rcv_ev)
 	proto->cace[flow->path->pr_sl].ccti_increase) <= proto->ccti_limit) {
 		ips_cca_adjust_rate(flow->path,
 			    proto->cace[flow->path->pr_sl].ccti_increase);
+		psmi_telemetry_count((psm2_epaddr_t) ipsaddr,
+				     PSMI_TELEMETRY_CCA_CHANGES, 1);
 		/* Clear congestion event */
 		rcv_ev->is_congested &= ~IPS_RECV_EVENT_BECN;
 	}
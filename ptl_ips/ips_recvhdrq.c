@@ -57,6 +57,11 @@
 #include "ips_proto_internal.h"
 #include "ips_recvhdrq.h"
 
+static psm2_error_t
+ips_recvq_egr_hold_callback(struct psmi_timer *timer, uint64_t current);
+static void
+ips_recvq_egr_hold_release(struct psmi_mq_hold *hold, psm2_mq_req_t req);
+
 /*
  * Receive header queue initialization.
  */
@@ -133,39 +138,193 @@ ips_recvhdrq_init(const psmi_context_t *context,
 		recvq->state->egrq_update_interval = 1;
 	}
 
+	/*
+	 * Unexpected short messages are left in the eager queue until their
+	 * receive is posted.  Not done for shared contexts, where the eager
+	 * queue is also drained on behalf of the other subcontexts.
+	 */
+	recvq->egr_hold_index_head = NO_EAGER_UPDATE;
+	psmi_timer_entry_init(&recvq->egr_hold_timer,
+			      ips_recvq_egr_hold_callback, recvq);
+	if (context->user_info.subctxt_cnt == 0) {
+		union psmi_envvar_val env_egr_hold, env_egr_hold_us;
+		uint32_t i;
+
+		psmi_getenv("PSM2_EGR_HOLD",
+			    "Max unexpected messages kept in the eager queue (0 to always copy). Default is 1/4 of the eager queue",
+			    PSMI_ENVVAR_LEVEL_HIDDEN, PSMI_ENVVAR_TYPE_UINT,
+			    (union psmi_envvar_val) (recvq->egrq.elemcnt / 4),
+			    &env_egr_hold);
+		psmi_getenv("PSM2_EGR_HOLD_US",
+			    "Max time in usecs an unexpected message is kept in the eager queue",
+			    PSMI_ENVVAR_LEVEL_HIDDEN, PSMI_ENVVAR_TYPE_UINT,
+			    (union psmi_envvar_val) IPS_EGR_HOLD_US,
+			    &env_egr_hold_us);
+
+		recvq->egr_hold_max = env_egr_hold.e_uint;
+		recvq->egr_hold_cycles = us_2_cycles(env_egr_hold_us.e_uint);
+		if (recvq->egr_hold_max) {
+			recvq->egr_hold = (struct ips_recvq_egr_hold *)
+			    psmi_calloc(context->ep, UNDEFINED,
+					recvq->egr_hold_max,
+					sizeof(struct ips_recvq_egr_hold));
+			if (recvq->egr_hold == NULL) {
+				err = psmi_handle_error(proto->ep, PSM2_NO_MEMORY,
+							"Couldn't allocate memory for eager hold table");
+				goto fail;
+			}
+			for (i = 0; i < recvq->egr_hold_max; i++) {
+				recvq->egr_hold[i].hold.release =
+				    ips_recvq_egr_hold_release;
+				recvq->egr_hold[i].recvq = recvq;
+			}
+		}
+	}
+
 fail:
 	return err;
 }
 
 psm2_error_t ips_recvhdrq_fini(struct ips_recvhdrq *recvq)
 {
+	psmi_timer_cancel(recvq->proto->timerq, &recvq->egr_hold_timer);
+	if (recvq->egr_hold != NULL)
+		psmi_free(recvq->egr_hold);
 	ips_recvq_egrbuf_table_free(recvq->egrq_buftable);
 	return PSM2_OK;
 }
 
-/* flush the eager buffers, by setting the eager index head to eager index tail
-   if eager buffer queue is full.
+/*
+ * Drop the oldest hold, moving its payload to a sysbuf if the receive hasn't
+ * been posted yet, along with any already released holds queued behind it.
+ */
+static void ips_recvq_egr_hold_pop(struct ips_recvhdrq *recvq)
+{
+	struct ips_recvq_egr_hold *egr_hold;
+
+	do {
+		egr_hold = &recvq->egr_hold[recvq->egr_hold_first];
+		if (egr_hold->req != NULL) {
+			psmi_mq_reclaim_held(egr_hold->req);
+			egr_hold->req = NULL;
+			recvq->proto->stats.egr_hold_reclaims++;
+		}
+		recvq->egr_hold_first =
+		    (recvq->egr_hold_first + 1) % recvq->egr_hold_max;
+		recvq->egr_hold_count--;
+	} while (recvq->egr_hold_count &&
+		 recvq->egr_hold[recvq->egr_hold_first].req == NULL);
+}
 
-   Called when we had eager buffer overflows (ERR_TID/HFI_RHF_H_TIDERR
-   was set in RHF errors), and no good eager packets were received, so
-   that eager head wasn't advanced.
+/*
+ * Move the eager head to index, or to the oldest held entry if that comes
+ * first.  Holds never pin more than half of the eager queue.
+ */
+static void
+ips_recvq_egr_head_update(struct ips_recvhdrq *recvq, uint32_t index)
+{
+	const uint32_t egr_cnt = recvq->egrq.elemcnt;
+	uint32_t oldest;
+
+	recvq->egr_hold_index_head = index;
+	while (recvq->egr_hold_count) {
+		oldest = recvq->egr_hold[recvq->egr_hold_first].egr_index;
+		if ((index + egr_cnt - oldest) % egr_cnt <= egr_cnt / 2) {
+			index = oldest;
+			break;
+		}
+		ips_recvq_egr_hold_pop(recvq);
+	}
+	ips_recvq_head_update(&recvq->egrq, index);
+}
+
+void ips_recvq_egr_hold_commit(const struct ips_recvhdrq_event *rcv_ev,
+			       psm2_mq_req_t req)
+{
+	struct ips_recvhdrq *recvq = (struct ips_recvhdrq *)rcv_ev->recvq;
+	struct ips_recvq_egr_hold *egr_hold =
+	    (struct ips_recvq_egr_hold *)req->ptl_req_ptr;
+
+	psmi_assert(egr_hold == &recvq->egr_hold[(recvq->egr_hold_first +
+						  recvq->egr_hold_count) %
+						 recvq->egr_hold_max]);
+	egr_hold->req = req;
+	egr_hold->egr_index = hfi_hdrget_egrbfr_index(rcv_ev->rhf);
+	egr_hold->cycles = get_cycles();
+	if (recvq->egr_hold_count++ == 0)
+		psmi_timer_request(recvq->proto->timerq,
+				   &recvq->egr_hold_timer,
+				   egr_hold->cycles + recvq->egr_hold_cycles);
+	recvq->proto->stats.egr_hold_msgs++;
+}
+
+static void
+ips_recvq_egr_hold_release(struct psmi_mq_hold *hold, psm2_mq_req_t req)
+{
+	struct ips_recvq_egr_hold *egr_hold = (struct ips_recvq_egr_hold *)hold;
+	struct ips_recvhdrq *recvq = egr_hold->recvq;
+
+	psmi_assert(egr_hold->req == req);
+	egr_hold->req = NULL;
+	if (egr_hold != &recvq->egr_hold[recvq->egr_hold_first])
+		return;
+
+	ips_recvq_egr_hold_pop(recvq);
+	if (recvq->egr_hold_count == 0)
+		psmi_timer_cancel(recvq->proto->timerq,
+				  &recvq->egr_hold_timer);
+	if (recvq->egr_hold_index_head != NO_EAGER_UPDATE)
+		ips_recvq_egr_head_update(recvq, recvq->egr_hold_index_head);
+}
+
+/*
+ * Bounds how long a payload stays in the eager queue, anything held longer
+ * than egr_hold_cycles is moved to a sysbuf.
+ */
+static psm2_error_t
+ips_recvq_egr_hold_callback(struct psmi_timer *timer, uint64_t current)
+{
+	struct ips_recvhdrq *recvq = (struct ips_recvhdrq *)timer->context;
+	struct ips_recvq_egr_hold *egr_hold;
+
+	while (recvq->egr_hold_count) {
+		egr_hold = &recvq->egr_hold[recvq->egr_hold_first];
+		if (current - egr_hold->cycles < recvq->egr_hold_cycles) {
+			psmi_timer_request(recvq->proto->timerq, timer,
+					   egr_hold->cycles +
+					   recvq->egr_hold_cycles);
+			break;
+		}
+		ips_recvq_egr_hold_pop(recvq);
+	}
+	if (recvq->egr_hold_index_head != NO_EAGER_UPDATE)
+		ips_recvq_egr_head_update(recvq, recvq->egr_hold_index_head);
+
+	return PSM2_OK;
+}
+
+/* Hand every eager entry back to hardware, copying held payloads out to
+   sysbufs first.
+
+   Called when the eager queue is full, since held entries stop the eager
+   head from advancing and would otherwise be overwritten by the overflow
+   flush below.
 */
-#if 0
 static void ips_flush_egrq_if_required(struct ips_recvhdrq *recvq)
 {
-	const uint32_t tail = ips_recvq_tail_get(&recvq->egrq);
-	const uint32_t head = ips_recvq_head_get(&recvq->egrq);
-	uint32_t egr_cnt = recvq->egrq.elemcnt;
-
-	if ((head % egr_cnt) == ((tail + 1) % egr_cnt)) {
-		_HFI_DBG("eager array full after overflow, flushing "
-			 "(head %llx, tail %llx)\n",
-			 (long long)head, (long long)tail);
-		recvq->proto->stats.egr_overflow++;
-	}
+	if (recvq->egr_hold_count == 0)
+		return;
+
+	_HFI_DBG("eager array full with %u held messages, reclaiming\n",
+		 recvq->egr_hold_count);
+	while (recvq->egr_hold_count)
+		ips_recvq_egr_hold_pop(recvq);
+	psmi_timer_cancel(recvq->proto->timerq, &recvq->egr_hold_timer);
+	if (recvq->egr_hold_index_head != NO_EAGER_UPDATE)
+		ips_recvq_head_update(&recvq->egrq,
+				      recvq->egr_hold_index_head);
 	return;
 }
-#endif
 
 /*
  * Helpers for ips_recvhdrq_progress.
@@ -401,6 +560,7 @@ process_pending_acks(struct ips_recvhdrq *recvq))
 
 		ctrlscb.flags = 0;
 		ctrlscb.ips_lrh.ack_seq_num = flow->recv_seq_num.psn_num;
+		ctrlscb.ips_lrh.mdata = 0;
 
 		if (flow->flags & IPS_FLOW_FLAG_PENDING_ACK) {
 			psmi_assert_always((flow->
@@ -408,20 +568,37 @@ process_pending_acks(struct ips_recvhdrq *recvq))
 					   == 0);
 
 			flow->flags &= ~IPS_FLOW_FLAG_PENDING_ACK;
+
+			/* Acknowledge the peer's other flow in the same
+			 * message, it then skips its own turn */
+			if (flow->protocol == PSM_PROTOCOL_GO_BACK_N &&
+			    flow->ipsaddr->ack_piggyback) {
+				struct ips_flow *other =
+				    &flow->ipsaddr->flows[flow->flowid ^ 1];
+
+				if ((other->flags & (IPS_FLOW_FLAG_PENDING_ACK |
+						     IPS_FLOW_FLAG_GEN_BECN)) ==
+				    IPS_FLOW_FLAG_PENDING_ACK) {
+					other->flags &=
+					    ~IPS_FLOW_FLAG_PENDING_ACK;
+					ctrlscb.ips_lrh.mdata =
+					    IPS_ACK_PIGGYBACK |
+					    other->recv_seq_num.psn_num;
+				}
+			}
+
 			ips_proto_send_ctrl_message(flow, OPCODE_ACK,
 						    &flow->ipsaddr->
 						    ctrl_msg_queued,
 						    &ctrlscb, ctrlscb.cksum, 0);
-		} else {
-			psmi_assert_always(flow->
-					   flags & IPS_FLOW_FLAG_PENDING_NAK);
-
+		} else if (flow->flags & IPS_FLOW_FLAG_PENDING_NAK) {
 			flow->flags &= ~IPS_FLOW_FLAG_PENDING_NAK;
 			ips_proto_send_ctrl_message(flow, OPCODE_NAK,
 						    &flow->ipsaddr->
 						    ctrl_msg_queued,
 						    &ctrlscb, ctrlscb.cksum, 0);
 		}
+		/* else the ACK went out with the other flow's */
 	}
 }
 
@@ -568,9 +745,15 @@ psm2_error_t ips_recvhdrq_progress(struct ips_recvhdrq *recvq)
 				uint32_t egr_cnt = recvq->egrq.elemcnt;
 				const uint32_t etail =
 					ips_recvq_tail_get(&recvq->egrq);
-				const uint32_t ehead =
+				uint32_t ehead =
 					ips_recvq_head_get(&recvq->egrq);
 
+				if (ehead == ((etail + 1) % egr_cnt) &&
+				    recvq->egr_hold_count) {
+					ips_flush_egrq_if_required(recvq);
+					ehead = ips_recvq_head_get(&recvq->egrq);
+				}
+
 				if (ehead == ((etail + 1) % egr_cnt)) {
 					/* eager is full,
 					 * trace existing header entries */
@@ -687,9 +870,9 @@ skip_packet_no_egr_update:
 		if (state->num_egrq_done >= state->egrq_update_interval) {
 			/* Lazy update of egrq */
 			if (state->rcv_egr_index_head != NO_EAGER_UPDATE) {
-				ips_recvq_head_update(&recvq->egrq,
-						      state->
-						      rcv_egr_index_head);
+				ips_recvq_egr_head_update(recvq,
+							  state->
+							  rcv_egr_index_head);
 				state->rcv_egr_index_head = NO_EAGER_UPDATE;
 				state->num_egrq_done = 0;
 			}
@@ -707,8 +890,10 @@ skip_packet_no_egr_update:
 
 				/* Checks eager-full again. This is a real false-egr-full */
 				if (head == ((tail + 1) % egr_cnt)) {
-					ips_recvq_head_update(&recvq->egrq,
-							      tail);
+					ips_flush_egrq_if_required(recvq);
+					/* Also moves the hold head, so a later
+					 * release can't step back behind tail */
+					ips_recvq_egr_head_update(recvq, tail);
 					_HFI_DBG
 					    ("eager array full after overflow, flushing "
 					     "(head %llx, tail %llx)\n",
@@ -846,6 +1031,8 @@ psm2_error_t ips_recvhdrq_scan_cca (struct ips_recvhdrq *recvq)
 				     proto->cace[flow->path->pr_sl].ccti_increase) <= proto->ccti_limit) {
 					ips_cca_adjust_rate(flow->path,
 							    proto->cace[flow->path->pr_sl].ccti_increase);
+					psmi_telemetry_count((psm2_epaddr_t) ipsaddr,
+							     PSMI_TELEMETRY_CCA_CHANGES, 1);
 					/* Clear congestion event */
 					rcv_ev.is_congested &= ~IPS_RECV_EVENT_BECN;
 				}
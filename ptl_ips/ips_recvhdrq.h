@@ -54,6 +54,7 @@
 /* Copyright (c) 2003-2015 Intel Corporation. All rights reserved. */
 
 #include "psm_user.h"
+#include "psm_mq_internal.h"
 #include "ips_proto.h"
 #include "ips_proto_header.h"
 #include "ips_proto_params.h"
@@ -145,6 +146,19 @@ struct ips_recvhdrq_state {
 	uint32_t hdrq_cachedlastscan;	/* last element to be prescanned */
 };
 
+/*
+ * Unexpected message payload left in place in the eager queue.  Holds are
+ * kept in a ring in arrival order, which is also eager index order, and the
+ * eager head is never moved past the oldest one.
+ */
+struct ips_recvq_egr_hold {
+	struct psmi_mq_hold hold;	/* must be first */
+	struct ips_recvhdrq *recvq;
+	psm2_mq_req_t req;	/* NULL once released */
+	uint32_t egr_index;
+	uint64_t cycles;	/* when the payload was held */
+};
+
 /*
  * Structure to read from recvhdrq
  */
@@ -167,6 +181,15 @@ struct ips_recvhdrq {
 	void **egrq_buftable;	/* table of eager idx-to-ptr */
 	struct ips_recvq_params egrq;
 
+	/* Eager entries held by unexpected messages */
+	struct ips_recvq_egr_hold *egr_hold;	/* ring of egr_hold_max */
+	uint32_t egr_hold_max;	/* 0 when holding is disabled */
+	uint32_t egr_hold_first;	/* oldest hold */
+	uint32_t egr_hold_count;
+	uint32_t egr_hold_index_head;	/* eager head if nothing was held */
+	uint64_t egr_hold_cycles;	/* max time a payload stays held */
+	struct psmi_timer egr_hold_timer;
+
 	/* Lookup endpoints epid -> ptladdr (rank)) */
 	const struct ips_epstate *epstate;
 
@@ -219,6 +242,29 @@ ips_recvhdrq_event_paylen(const struct ips_recvhdrq_event *rcv_ev))
 	/* PSM does not use bth0].PadCnt, it figures out real datalen other way */
 }
 
+/*
+ * Returns the hold to offer MQ for the payload of rcv_ev, or NULL if the
+ * payload has to be copied out of the eager queue.
+ */
+PSMI_INLINE(
+struct psmi_mq_hold *
+ips_recvq_egr_hold_get(const struct ips_recvhdrq_event *rcv_ev))
+{
+	const struct ips_recvhdrq *recvq = rcv_ev->recvq;
+
+	if (recvq->egr_hold_count == recvq->egr_hold_max ||
+	    !hfi_hdrget_use_egrbfr(rcv_ev->rhf))
+		return NULL;
+
+	return &recvq->egr_hold[(recvq->egr_hold_first +
+				 recvq->egr_hold_count) %
+				recvq->egr_hold_max].hold;
+}
+
+/* Called once MQ has taken the hold returned by ips_recvq_egr_hold_get() */
+void ips_recvq_egr_hold_commit(const struct ips_recvhdrq_event *rcv_ev,
+			       psm2_mq_req_t req);
+
 PSMI_INLINE(int ips_recvhdrq_trylock(struct ips_recvhdrq *recvq))
 {
 	int ret = pthread_spin_trylock(&recvq->hdrq_lock);
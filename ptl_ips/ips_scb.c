@@ -58,6 +58,36 @@
 #include "ips_scb.h"
 #include "ips_proto_internal.h"
 
+/*
+ * Zeroed memory for scbs and send buffers.  Arrays covering a good part of a
+ * huge page come from huge pages when PSM2_MEM_HUGEPAGES is set, in which
+ * case *mapsz is set to the size of the mapping, otherwise it is left 0.
+ */
+static void *
+ips_scbctrl_mem_alloc(psm2_ep_t ep, size_t alloc_sz, size_t *mapsz)
+{
+	void *ptr;
+	int is_huge = 1;
+
+	*mapsz = 0;
+	if (psmi_hugepages_enabled() && alloc_sz >= PSMI_HUGEPAGE_SIZE / 2) {
+		ptr = psmi_hugepage_alloc(NETWORK_BUFFERS, &alloc_sz, &is_huge);
+		if (ptr != NULL) {
+			*mapsz = alloc_sz;
+			return ptr;
+		}
+	}
+	return psmi_calloc(ep, NETWORK_BUFFERS, 1, alloc_sz);
+}
+
+static void ips_scbctrl_mem_free(void *ptr, size_t mapsz)
+{
+	if (mapsz)
+		psmi_hugepage_free(NETWORK_BUFFERS, ptr, mapsz);
+	else
+		psmi_free(ptr);
+}
+
 psm2_error_t
 ips_scbctrl_init(const psmi_context_t *context,
 		 uint32_t numscb, uint32_t numbufs,
@@ -101,7 +131,8 @@ ips_scbctrl_init(const psmi_context_t *context,
 
 		alloc_sz = numbufs * bufsize + redzone + PSMI_PAGESIZE;
 		scbc->sbuf_buf_alloc =
-		    psmi_calloc(ep, NETWORK_BUFFERS, 1, alloc_sz);
+		    ips_scbctrl_mem_alloc(ep, alloc_sz,
+					  &scbc->sbuf_buf_alloc_mapsz);
 		if (scbc->sbuf_buf_alloc == NULL) {
 			err = PSM2_NO_MEMORY;
 			goto fail;
@@ -133,7 +164,8 @@ ips_scbctrl_init(const psmi_context_t *context,
 		scbc->scb_imm_size = PSMI_ALIGNUP(imm_size, 64);
 		alloc_sz = numscb * scbc->scb_imm_size + 64;
 		scbc->scb_imm_buf =
-		    psmi_calloc(ep, NETWORK_BUFFERS, 1, alloc_sz);
+		    ips_scbctrl_mem_alloc(ep, alloc_sz,
+					  &scbc->scb_imm_buf_mapsz);
 		if (scbc->scb_imm_buf == NULL) {
 			err = PSM2_NO_MEMORY;
 			goto fail;
@@ -148,7 +180,7 @@ ips_scbctrl_init(const psmi_context_t *context,
 	scb_size = PSMI_ALIGNUP(scb_size, 64);
 	alloc_sz = numscb * scb_size + PSM_VALGRIND_REDZONE_SZ + 64;
 	scbc->scb_base = (void *)
-	    psmi_calloc(ep, NETWORK_BUFFERS, 1, alloc_sz);
+	    ips_scbctrl_mem_alloc(ep, alloc_sz, &scbc->scb_base_mapsz);
 	if (scbc->scb_base == NULL) {
 		err = PSM2_NO_MEMORY;
 		goto fail;
@@ -210,12 +242,16 @@ fail:
 psm2_error_t ips_scbctrl_fini(struct ips_scbctrl *scbc)
 {
 	if (scbc->scb_base != NULL) {
-		psmi_free(scbc->scb_base);
+		ips_scbctrl_mem_free(scbc->scb_base, scbc->scb_base_mapsz);
 		VALGRIND_DESTROY_MEMPOOL(scbc);
 	}
+	if (scbc->scb_imm_buf != NULL)
+		ips_scbctrl_mem_free(scbc->scb_imm_buf,
+				     scbc->scb_imm_buf_mapsz);
 	if (scbc->sbuf_buf_alloc) {
 		VALGRIND_DESTROY_MEMPOOL(scbc->sbuf_buf_alloc);
-		psmi_free(scbc->sbuf_buf_alloc);
+		ips_scbctrl_mem_free(scbc->sbuf_buf_alloc,
+				     scbc->sbuf_buf_alloc_mapsz);
 	}
 	return PSM2_OK;
 }
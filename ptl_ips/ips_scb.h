@@ -99,12 +99,14 @@ struct ips_scbctrl {
 	uint32_t scb_num_cur;
 	 SLIST_HEAD(scb_free, ips_scb) scb_free;
 	void *scb_base;
+	size_t scb_base_mapsz;	/* non-zero if mapped from huge pages */
 	ips_scbctrl_avail_callback_fn_t scb_avail_callback;
 	void *scb_avail_context;
 
 	/* Immediate data for send buffers */
 	uint32_t scb_imm_size;
 	void *scb_imm_buf;
+	size_t scb_imm_buf_mapsz;
 	psmi_timer *timers;	/* ack/send timers */
 
 	/*
@@ -115,6 +117,7 @@ struct ips_scbctrl {
 	uint32_t sbuf_num_cur;
 	 SLIST_HEAD(sbuf_free, ips_scbbuf) sbuf_free;
 	void *sbuf_buf_alloc;
+	size_t sbuf_buf_alloc_mapsz;
 	uint32_t sbuf_buf_size;
 	void *sbuf_buf_base;
 	void *sbuf_buf_last;
@@ -70,6 +70,13 @@ ips_tid_init(const psmi_context_t *context, struct ips_protoexp *protoexp,
 	struct psmi_stats_entry entries[] = {
 		PSMI_STATS_DECL("tid update count", MPSPAWN_STATS_REDUCTION_ALL,
 				NULL, &tidc->tid_num_total),
+		PSMI_STATS_DECL("tid cache hits", MPSPAWN_STATS_REDUCTION_ALL,
+				NULL, &tidc->tid_cache_hit),
+		PSMI_STATS_DECL("tid cache misses", MPSPAWN_STATS_REDUCTION_ALL,
+				NULL, &tidc->tid_cache_miss),
+		PSMI_STATS_DECL("tid cache evictions",
+				MPSPAWN_STATS_REDUCTION_ALL,
+				NULL, &tidc->tid_cache_evict),
 	};
 
 	tidc->context = context;
@@ -79,6 +86,10 @@ ips_tid_init(const psmi_context_t *context, struct ips_protoexp *protoexp,
 	tidc->tid_avail_cb = cb;
 	tidc->tid_avail_context = cb_context;
 	tidc->tid_array = NULL;
+	tidc->tid_cache_idle_max = 0;
+	tidc->tid_cache_hit = 0;
+	tidc->tid_cache_miss = 0;
+	tidc->tid_cache_evict = 0;
 	tidc->invalidation_event = (uint64_t *)
 		(ptrdiff_t) base_info->events_bufbase;
 
@@ -86,9 +97,16 @@ ips_tid_init(const psmi_context_t *context, struct ips_protoexp *protoexp,
 	 * PSM uses tid registration caching only if driver has enabled it.
 	 */
 	if (!(tidc->context->runtime_flags & HFI1_CAP_TID_UNMAP)) {
+		union psmi_envvar_val env_idle_max;
 		int i;
 		cl_qmap_t *p_map;
 
+		psmi_getenv("PSM2_TID_CACHE_IDLE_MAX",
+			    "Max bytes kept pinned by idle cached tids (0 no limit)",
+			    PSMI_ENVVAR_LEVEL_USER, PSMI_ENVVAR_TYPE_ULONG_ULONG,
+			    (union psmi_envvar_val)0ULL, &env_idle_max);
+		tidc->tid_cache_idle_max = env_idle_max.e_ulonglong;
+
 		tidc->tid_array = (uint32_t *)
 			psmi_calloc(context->ep, UNDEFINED,
 				context->ctrl->__hfi_tidexpcnt,
@@ -123,6 +141,7 @@ ips_tid_init(const psmi_context_t *context, struct ips_protoexp *protoexp,
 
 		NTID = 0;
 		NIDLE = 0;
+		NIDLE_BYTES = 0;
 		IPREV(IHEAD) = INEXT(IHEAD) = IHEAD;
 		for (i = 1; i <= context->ctrl->__hfi_tidexpcnt; i++) {
 			INVALIDATE(i) = 1;
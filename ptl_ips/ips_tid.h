@@ -90,6 +90,10 @@ struct ips_tid {
 	uint64_t tid_num_total;
 	uint32_t tid_num_inuse;
 	uint32_t tid_cachesize;	/* items can be cached */
+	uint64_t tid_cache_idle_max;	/* idle bytes kept pinned, 0 no limit */
+	uint64_t tid_cache_hit;		/* tids reused from the cache */
+	uint64_t tid_cache_miss;	/* registrations with the driver */
+	uint64_t tid_cache_evict;	/* tids freed to make room */
 	cl_qmap_t tid_cachemap; /* RB tree implementation */
 	/*
 	 * tids storage.
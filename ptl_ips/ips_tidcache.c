@@ -102,6 +102,7 @@ ips_tidcache_remove(struct ips_tid *tidc, uint32_t tidcnt)
 		 */
 		IDLE_REMOVE(idx);
 		ips_cl_qmap_remove_item(p_map, &p_map->root[idx]);
+		tidc->tid_cache_evict++;
 	}
 
 	/*
@@ -181,6 +182,7 @@ retry:
 	}
 	psmi_assert(tidcnt > 0);
 	psmi_assert((tidcnt+NTID) <= tidc->tid_cachesize);
+	tidc->tid_cache_miss++;
 
 	/*
 	 * backward processing because we want to return
@@ -410,7 +412,8 @@ retry:
 		err = ips_tidcache_register(tidc, start, nbytes, &idx);
 		if (err)
 			return err;
-	}
+	} else
+		tidc->tid_cache_hit++;
 
 	/*
 	 * sanity check.
@@ -456,7 +459,8 @@ retry:
 			 */
 			psmi_assert(REFCNT(idx) != 0);
 			break;
-		}
+		} else
+			tidc->tid_cache_hit++;
 
 		/*
 		 * sanity check.
@@ -527,6 +531,23 @@ ips_tidcache_release(struct ips_tid *tidc,
 		}
 	}
 
+	/*
+	 * Don't leave invalidated idle tids pinned until the next
+	 * acquire, the buffer behind them is gone.
+	 */
+	if ((*tidc->invalidation_event) & HFI1_EVENT_TID_MMU_NOTIFY) {
+		err = ips_tidcache_invalidation(tidc);
+		if (err)
+			return err;
+	}
+
+	/*
+	 * Trim the idle queue from its least recently used end.
+	 */
+	if (tidc->tid_cache_idle_max && NIDLE_BYTES > tidc->tid_cache_idle_max)
+		ips_tidcache_evict(tidc,
+				   NIDLE_BYTES - tidc->tid_cache_idle_max);
+
 	return PSM2_OK;
 }
 
@@ -94,6 +94,9 @@
  *    its caching system to match tids for a 'new' buffer chunk.
  * 9, when the caching system is full, and a new buffer chunk is asked
  *    to register, PSM picks a victim to remove.
+ * 10. idle tids are kept in LRU order, PSM can also bound the bytes they
+ *    keep pinned (PSM2_TID_CACHE_IDLE_MAX) and evicts the least recently
+ *    released ones beyond that on release.
  */
 
 /*
@@ -118,6 +121,7 @@ typedef struct _cl_qmap {
 	cl_map_item_t		*nil_item;	/* terminator node pointer */
 	uint32_t		ntid;		/* tids are cached */
 	uint32_t		nidle;		/* tids are idle */
+	uint64_t		nidle_bytes;	/* bytes pinned by idle tids */
 } cl_qmap_t;
 
 
@@ -139,6 +143,7 @@ typedef struct _cl_qmap {
  * Macro for idle tid queue management.
  */
 #define NIDLE			p_map->nidle
+#define NIDLE_BYTES		p_map->nidle_bytes
 #define IHEAD			0
 #define INEXT(x)		p_map->root[x].i_next
 #define IPREV(x)		p_map->root[x].i_prev
@@ -147,6 +152,7 @@ typedef struct _cl_qmap {
 					INEXT(IPREV(x)) = INEXT(x);	\
 					IPREV(INEXT(x)) = IPREV(x);	\
 					NIDLE--;			\
+					NIDLE_BYTES -= LENGTH(x) << 12;	\
 				} while (0)
 
 #define	IDLE_INSERT(x)		do {					\
@@ -155,6 +161,7 @@ typedef struct _cl_qmap {
 					IPREV(INEXT(IHEAD)) = x;	\
 					INEXT(IHEAD) = x;		\
 					NIDLE++;			\
+					NIDLE_BYTES += LENGTH(x) << 12;	\
 				} while (0)
 
 
@@ -276,6 +276,8 @@ psm2_error_t ips_ptl_init(const psm2_ep_t ep, ptl_t *ptl, ptl_ctl_t *ctl)
 
 	ctl->am_short_request = ips_am_short_request;
 	ctl->am_short_reply = ips_am_short_reply;
+	ctl->am_long_request = ips_am_long_request;
+	ctl->am_long_reply = ips_am_long_reply;
 
 	ctl->epaddr_stats_num = ips_ptl_epaddr_stats_num;
 	ctl->epaddr_stats_init = ips_ptl_epaddr_stats_init;
@@ -54,6 +54,7 @@
 /* Copyright (c) 2003-2014 Intel Corporation. All rights reserved. */
 
 #include <sys/poll.h>
+#include <sched.h>
 
 #include "ptl_ips.h"
 #include "ips_proto.h"
@@ -65,6 +66,9 @@
 #define RCVTHREAD_TO_MAX_FREQ	    100	/* max of 100 polls per sec */
 #define RCVTHREAD_TO_SHIFT	    1
 
+/* Busy-poll window after progress, in microseconds (0 disables) */
+#define RCVTHREAD_SPIN_US	    0
+
 struct ptl_rcvthread;
 
 static void *ips_ptl_pollintr(void *recvthreadc);
@@ -93,6 +97,14 @@ struct ptl_rcvthread {
 	uint64_t pollok_last;
 	uint64_t pollcnt_last;
 	uint32_t last_timeout;
+
+	/* Hybrid mode: busy-poll for spin_cyc after progress, then sleep */
+	uint64_t spin_cyc;
+	uint64_t spin_until;
+	uint64_t spincnt;
+
+	/* cpu to pin the thread to, -1 to inherit the caller's affinity */
+	int cpu;
 };
 
 /*
@@ -199,6 +211,42 @@ fail:
 	return err;
 }
 
+/*
+ * Returns the first hardware thread sharing a core with cpu, or -1 if there
+ * is none.  thread_siblings_list is a comma separated list of ranges.
+ */
+static
+int rcvthread_sibling_cpu(int cpu)
+{
+	char path[128], buf[256];
+	char *p = buf;
+	int sibling = -1;
+	FILE *fp;
+
+	snprintf(path, sizeof(path),
+		 "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list",
+		 cpu);
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		return -1;
+	if (fgets(buf, sizeof(buf), fp) == NULL)
+		buf[0] = '\0';
+	fclose(fp);
+
+	while (sibling < 0 && *p >= '0' && *p <= '9') {
+		long lo = strtol(p, &p, 10), hi = lo;
+		if (*p == '-')
+			hi = strtol(p + 1, &p, 10);
+		if (lo != cpu)
+			sibling = (int)lo;
+		else if (hi > cpu)
+			sibling = cpu + 1;
+		if (*p == ',')
+			p++;
+	}
+	return sibling;
+}
+
 psm2_error_t rcvthread_initsched(struct ptl_rcvthread *rcvc)
 {
 	union psmi_envvar_val env_to;
@@ -263,6 +311,39 @@ psm2_error_t rcvthread_initsched(struct ptl_rcvthread *rcvc)
 			   rcvc->timeout_period_min, rcvc->timeout_period_max,
 			   rcvc->timeout_shift);
 	}
+
+	psmi_getenv("PSM2_RCVTHREAD_SPIN",
+		    "Thread busy-polls this many usecs after progress before "
+		    "sleeping (0 disables)",
+		    PSMI_ENVVAR_LEVEL_HIDDEN, PSMI_ENVVAR_TYPE_UINT,
+		    (union psmi_envvar_val)RCVTHREAD_SPIN_US, &env_to);
+	rcvc->spin_cyc = nanosecs_to_cycles((uint64_t) env_to.e_uint * 1000);
+
+	rcvc->cpu = -1;
+	if (!psmi_getenv("PSM2_RCVTHREAD_AFFINITY",
+			 "Pin thread to <cpu> or to the SMT sibling of the "
+			 "opening thread's cpu <sibling>",
+			 PSMI_ENVVAR_LEVEL_HIDDEN, PSMI_ENVVAR_TYPE_STR,
+			 (union psmi_envvar_val)"", &env_to)) {
+		if (strcasecmp(env_to.e_str, "sibling") == 0) {
+			int cpu = sched_getcpu();
+			rcvc->cpu = cpu < 0 ? -1 : rcvthread_sibling_cpu(cpu);
+			if (rcvc->cpu < 0)
+				_HFI_INFO("No SMT sibling found for cpu %d, "
+					  "not pinning receive thread\n", cpu);
+		} else if (*env_to.e_str) {
+			char *ep;
+			long cpu = strtol(env_to.e_str, &ep, 0);
+			if (*ep || cpu < 0 || cpu >= CPU_SETSIZE)
+				_HFI_INFO("Ignoring invalid PSM2_RCVTHREAD_AFFINITY "
+					  "of %s\n", env_to.e_str);
+			else
+				rcvc->cpu = (int)cpu;
+		}
+	}
+
+	_HFI_PRDBG("rcvthread spin window %lld cycles, cpu %d\n",
+		   (long long)rcvc->spin_cyc, rcvc->cpu);
 	return PSM2_OK;
 }
 
@@ -290,6 +371,16 @@ int rcvthread_next_timeout(struct ptl_rcvthread *rcvc)
 	return (int)rcvc->last_timeout;
 }
 
+/* Progress was made, keep busy-polling for another spin window */
+PSMI_ALWAYS_INLINE(void rcvthread_spin_arm(struct ptl_rcvthread *rcvc))
+{
+	if (rcvc->spin_cyc) {
+		if (rcvc->spin_until == 0)
+			rcvc->spincnt++;
+		rcvc->spin_until = get_cycles() + rcvc->spin_cyc;
+	}
+}
+
 extern int ips_in_rcvthread;
 
 /*
@@ -302,6 +393,11 @@ extern int ips_in_rcvthread;
  * returns an event, we *try* to make progress on the receive queue but simply
  * go back to sleep if we notice that the main thread is already making
  * progress.
+ *
+ * With PSM2_RCVTHREAD_SPIN set, any progress opens a busy-poll window during
+ * which the thread polls with a zero timeout and services shm as well as hfi,
+ * so rendezvous traffic keeps moving while the main thread computes.  Once a
+ * window passes without progress the thread goes back to sleeping.
  */
 static
 void *ips_ptl_pollintr(void *rcvthreadc)
@@ -314,6 +410,7 @@ void *ips_ptl_pollintr(void *rcvthreadc)
 	psm2_ep_t ep = context->ep;
 	struct pollfd pfd[2];
 	int ret;
+	int spinning;
 	int next_timeout = rcvc->last_timeout;
 	uint64_t t_cyc;
 	psm2_error_t err;
@@ -335,7 +432,29 @@ void *ips_ptl_pollintr(void *rcvthreadc)
 
 	_HFI_PRDBG("Enabled communication thread on URG packets\n");
 
+	if (rcvc->cpu >= 0) {
+		cpu_set_t cpuset;
+		CPU_ZERO(&cpuset);
+		CPU_SET(rcvc->cpu, &cpuset);
+		ret = pthread_setaffinity_np(pthread_self(), sizeof(cpuset),
+					     &cpuset);
+		if (ret)
+			_HFI_INFO("Couldn't pin receive thread to cpu %d: %s\n",
+				  rcvc->cpu, strerror(ret));
+	}
+
 	while (1) {
+		spinning = 0;
+		if (rcvc->spin_until) {
+			if (get_cycles() < rcvc->spin_until) {
+				spinning = 1;
+				next_timeout = 0;
+			} else {
+				rcvc->spin_until = 0;
+				next_timeout = rcvc->last_timeout;
+			}
+		}
+
 		pfd[0].fd = fd_dev;
 		pfd[0].events = POLLIN;
 		pfd[0].revents = 0;
@@ -376,15 +495,16 @@ void *ips_ptl_pollintr(void *rcvthreadc)
 				if (!ips_recvhdrq_trylock(recvq))
 					continue;
 				err = ips_recvhdrq_progress(recvq);
-				if (err == PSM2_OK)
+				if (err == PSM2_OK) {
 					rcvc->pollok++;
-				else
+					rcvthread_spin_arm(rcvc);
+				} else
 					rcvc->pollcyc += get_cycles() - t_cyc;
 				ips_recvhdrq_unlock(recvq);
 			} else if (!PSMI_PLOCK_TRY()) {
-				/* If we time out, we service shm and hfi.  If not, we
-				 * assume to have received an hfi interrupt and service
-				 * only hfi.
+				/* If we time out or are spinning, we service shm and
+				 * hfi.  If not, we assume to have received an hfi
+				 * interrupt and service only hfi.
 				 */
 				if(recvq->proto->flags & IPS_PROTO_FLAG_CCA_PRESCAN ) {
 						ips_recvhdrq_scan_cca(recvq);
@@ -396,6 +516,7 @@ void *ips_ptl_pollintr(void *rcvthreadc)
 
 				if (err == PSM2_OK) {
 					rcvc->pollok++;
+					rcvthread_spin_arm(rcvc);
 					/*
 					   if (rcvc->pollok % 1000 == 0 && rcvc->pollok >= 1000)
 					   _HFI_INFO("pollok = %lld\n", (unsigned long long)rcvc->pollok);
@@ -406,7 +527,8 @@ void *ips_ptl_pollintr(void *rcvthreadc)
 			}
 		}
 
-		if (ret == 0) { /* change timeout only on timed out poll */
+		/* change timeout only on timed out poll, not while spinning */
+		if (ret == 0 && !spinning) {
 			rcvc->pollcnt_to++;
 			next_timeout = rcvthread_next_timeout(rcvc);
 		}
@@ -451,6 +573,10 @@ static psm2_error_t rcvthread_initstats(ptl_t *ptl)
 				MPSPAWN_STATS_REDUCTION_ALL |
 				MPSPAWN_STATS_SKIP_IF_ZERO,
 				NULL, &rcvc->pollcnt_to),
+		PSMI_STATS_DECL("intrthread spin windows",
+				MPSPAWN_STATS_REDUCTION_ALL |
+				MPSPAWN_STATS_SKIP_IF_ZERO,
+				NULL, &rcvc->spincnt),
 		PSMI_STATS_DECL("intrthread wasted time (ms)",
 				MPSPAWN_STATS_REDUCTION_ALL,
 				rcvthread_stats_pollcyc, NULL)
@@ -80,8 +80,8 @@ ptl_handle_rtsmatch(psm2_mq_req_t recv_req, int was_posted)
 		VALGRIND_MAKE_MEM_DEFINED(send_req->buf, send_req->buf_len);
 		VALGRIND_MAKE_MEM_DEFINED(send_req->buf, recv_req->recv_msglen);
 
-		psmi_mq_mtucpy(recv_req->buf, send_req->buf,
-			       recv_req->recv_msglen);
+		mq_recv_copy(recv_req, 0, send_req->buf,
+			     recv_req->recv_msglen);
 	}
 
 	psmi_mq_handle_rts_complete(recv_req);
@@ -194,6 +194,7 @@ self_am_get_parameters(psm2_ep_t ep, struct psm2_am_parameters *parameters)
 	parameters->max_nargs = INT_MAX;
 	parameters->max_request_short = INT_MAX;
 	parameters->max_reply_short = INT_MAX;
+	parameters->max_request_long = INT_MAX;
 
 	return PSM2_OK;
 }
@@ -222,6 +223,36 @@ self_am_short_request(psm2_epaddr_t epaddr,
 	return PSM2_OK;
 }
 
+static
+psm2_error_t
+self_am_long_request(psm2_epaddr_t epaddr,
+		     psm2_handler_t handler, psm2_amarg_t *args, int nargs,
+		     void *src, size_t len, void *dest, int flags,
+		     psm2_am_completion_fn_t completion_fn,
+		     void *completion_ctxt)
+{
+	psm2_am_handler_fn_t hfn;
+	psm2_ep_t ep = epaddr->ptlctl->ptl->ep;
+	struct psmi_am_token tok;
+
+	tok.epaddr_from = epaddr;
+
+	/* A rejected destination gets none of the payload */
+	if (!psmi_am_long_dest_ok(ep, handler, args, nargs, dest, len))
+		len = 0;
+	else if (len > 0 && dest != src)
+		psmi_mq_mtucpy(dest, src, len);
+
+	hfn = psm_am_get_handler_function(ep, handler);
+	hfn(&tok, args, nargs, dest, len);
+
+	if (completion_fn) {
+		completion_fn(completion_ctxt);
+	}
+
+	return PSM2_OK;
+}
+
 static
 psm2_error_t
 self_am_short_reply(psm2_am_token_t token,
@@ -243,6 +274,30 @@ self_am_short_reply(psm2_am_token_t token,
 	return PSM2_OK;
 }
 
+static
+psm2_error_t
+self_am_long_reply(psm2_am_token_t token,
+		   psm2_handler_t handler, psm2_amarg_t *args, int nargs,
+		   void *src, size_t len, void *dest, int flags,
+		   psm2_am_completion_fn_t completion_fn, void *completion_ctxt)
+{
+	psm2_am_handler_fn_t hfn;
+	struct psmi_am_token *tok = token;
+	psm2_ep_t ep = tok->epaddr_from->ptlctl->ptl->ep;
+
+	if (len > 0 && dest != src)
+		psmi_mq_mtucpy(dest, src, len);
+
+	hfn = psm_am_get_handler_function(ep, handler);
+	hfn(token, args, nargs, dest, len);
+
+	if (completion_fn) {
+		completion_fn(completion_ctxt);
+	}
+
+	return PSM2_OK;
+}
+
 static
 psm2_error_t
 self_connect(ptl_t *ptl,
@@ -275,6 +330,8 @@ self_connect(ptl_t *ptl,
 				goto fail;
 			}
 			psmi_epid_add(ptl->ep, ptl->epid, ptl->epaddr);
+			psmi_telemetry_peer_add(ptl->ep, ptl->epaddr,
+						PSMI_TELEMETRY_SELF);
 			array_of_errors[i] = PSM2_OK;
 		} else {
 			array_of_epaddr[i] = NULL;
@@ -327,6 +384,7 @@ psm2_error_t self_ptl_init(const psm2_ep_t ep, ptl_t *ptl, ptl_ctl_t *ctl)
 
 	memset(ctl, 0, sizeof(*ctl));
 	/* Fill in the control structure */
+	ctl->ep = ep;
 	ctl->ptl = ptl;
 	ctl->ep_poll = NULL;
 	ctl->ep_connect = self_connect;
@@ -338,6 +396,8 @@ psm2_error_t self_ptl_init(const psm2_ep_t ep, ptl_t *ptl, ptl_ctl_t *ctl)
 	ctl->am_get_parameters = self_am_get_parameters;
 	ctl->am_short_request = self_am_short_request;
 	ctl->am_short_reply = self_am_short_reply;
+	ctl->am_long_request = self_am_long_request;
+	ctl->am_long_reply = self_am_long_reply;
 
 	/* No stats in self */
 	ctl->epaddr_stats_num = NULL;